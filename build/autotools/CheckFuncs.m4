@@ -20,6 +20,6 @@ AS_IF([test "x$need_librt" = xyes],
 AC_CHECK_FUNCS([sched_getcpu])
 
 # Check for various functions we can take advantage of
-AC_HAVE_FUNCS([fallocate fdatasync ftruncate mmap munmap posix_fadvise \
+AC_HAVE_FUNCS([fallocate fdatasync ftruncate madvise mmap munmap posix_fadvise \
                posix_fallocate pthread_setname_np pthread_yield \
                pthread_yield_np shm_open shm_unlink])
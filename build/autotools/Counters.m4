@@ -1,3 +1,8 @@
 # Enable fast counters with rdtscp
 AS_IF([test "$enable_rdtscp" = "yes"],
       [AC_DEFINE(ENABLE_RDTSCP, [1], [Use rdtscp instruction for faster counters.])])
+
+# Per-call-site allocation counters. Memory.h checks this in every file that
+# allocates, so it goes on the command line rather than in config.h.
+AS_IF([test "$enable_memory_stats" = "yes"],
+      [CPPFLAGS="$CPPFLAGS -DENABLE_MEMORY_STATS"])
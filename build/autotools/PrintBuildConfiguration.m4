@@ -33,5 +33,6 @@ Build configuration:
   Code coverage support                            : ${enable_coverage}
   Cross Compiling                                  : ${enable_crosscompile}
   Fast counters                                    : ${enable_rdtscp}
+  Per-call-site memory statistics                  : ${enable_memory_stats}
   Libbson                                          : ${with_libbson}
 "
@@ -55,6 +55,12 @@ AC_ARG_ENABLE([rdtscp],
               [],
               [enable_rdtscp=no])
 
+AC_ARG_ENABLE([memory-stats],
+              [AS_HELP_STRING([--enable-memory-stats=@<:@no/yes@:>@],
+                              [Track allocations per call site in counters @<:@default=no@:>@])],
+              [],
+              [enable_memory_stats=no])
+
 # use strict compiler flags only on development releases
 m4_define([maintainer_flags_default], [m4_if(m4_eval(congo_minor_version % 2), [1], [yes], [no])])
 AC_ARG_ENABLE([maintainer-flags],
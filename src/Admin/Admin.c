@@ -0,0 +1,793 @@
+/* Admin.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Admin.h>
+#include <Counter.h>
+#include <CString.h>
+#include <Debug.h>
+#include <Log.h>
+#include <Memory.h>
+#include <Mutex.h>
+#include <Socket.h>
+#include <Task.h>
+#include <ThreadOnce.h>
+#include <TimeSpec.h>
+#include <Tunable.h>
+
+
+#undef LOG_DOMAIN
+#define LOG_DOMAIN "Admin"
+
+#define ADMIN_MAX_ACTIONS      64
+#define ADMIN_BACKLOG          8
+#define ADMIN_ACCEPT_PAUSE_MSEC 100
+#define ADMIN_WARNING_USEC     (10 * USEC_PER_SEC)
+
+
+typedef struct
+{
+   char            *name;
+   char            *usage;
+   AdminActionFunc  func;
+   void            *user_data;
+} AdminAction;
+
+
+typedef struct
+{
+   Socket socket;
+   Task   task;
+} AdminTask;
+
+
+static Mutex        gAdminMutex;
+static AdminAction  gAdminActions [ADMIN_MAX_ACTIONS];
+static int          gAdminActionsLen;
+static ThreadOnce   gAdminOnce = THREAD_ONCE_INIT;
+
+
+void
+AdminReply_Init (AdminReply *reply) /* OUT */
+{
+   ASSERT (reply);
+
+   Memory_Zero (reply, sizeof *reply);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * AdminReply_Printf --
+ *
+ *       Appends formatted text to @reply.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       May grow the reply buffer.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+AdminReply_Printf (AdminReply *reply,  /* IN */
+                   const char *format, /* IN */
+                   ...)                /* IN */
+{
+   va_list args;
+   int len;
+
+   ASSERT (reply);
+   ASSERT (format);
+
+   va_start (args, format);
+   len = vsnprintf (NULL, 0, format, args);
+   va_end (args);
+
+   if (len <= 0) {
+      return;
+   }
+
+   if ((reply->len + len + 1) > reply->allocated) {
+      reply->allocated = MAX (256, (reply->len + len + 1) * 2);
+      reply->data = Memory_SafeRealloc (reply->data, reply->allocated);
+   }
+
+   va_start (args, format);
+   vsnprintf (reply->data + reply->len, len + 1, format, args);
+   va_end (args);
+
+   reply->len += len;
+}
+
+
+void
+AdminReply_Destroy (AdminReply *reply) /* IN */
+{
+   ASSERT (reply);
+
+   Memory_Free (reply->data);
+   Memory_Zero (reply, sizeof *reply);
+}
+
+
+static void
+AdminReply_PrintValue (AdminReply *reply,  /* IN */
+                       const Value *value) /* IN */
+{
+   switch (value->type) {
+   case VALUE_TYPE_INT16:
+      AdminReply_Printf (reply, "%d", value->u.i16);
+      break;
+   case VALUE_TYPE_UINT16:
+      AdminReply_Printf (reply, "%u", value->u.u16);
+      break;
+   case VALUE_TYPE_INT32:
+      AdminReply_Printf (reply, "%d", value->u.i32);
+      break;
+   case VALUE_TYPE_UINT32:
+      AdminReply_Printf (reply, "%u", value->u.u32);
+      break;
+   case VALUE_TYPE_INT64:
+      AdminReply_Printf (reply, "%"PRId64, value->u.i64);
+      break;
+   case VALUE_TYPE_UINT64:
+      AdminReply_Printf (reply, "%"PRIu64, value->u.u64);
+      break;
+   case VALUE_TYPE_SIZE:
+   case VALUE_TYPE_SSIZE:
+      AdminReply_Printf (reply, "%zu", value->u.sz);
+      break;
+   case VALUE_TYPE_FLOAT:
+      AdminReply_Printf (reply, "%g", value->u.flt4);
+      break;
+   case VALUE_TYPE_DOUBLE:
+      AdminReply_Printf (reply, "%g", value->u.flt8);
+      break;
+   case VALUE_TYPE_BOOL:
+      AdminReply_Printf (reply, "%s", value->u.bl ? "true" : "false");
+      break;
+   case VALUE_TYPE_STRING:
+      AdminReply_Printf (reply, "%s", value->u.str ? value->u.str : "");
+      break;
+   default:
+      AdminReply_Printf (reply, "(unset)");
+      break;
+   }
+}
+
+
+static bool
+Admin_Help (int argc,          /* IN */
+            char *argv[],      /* IN */
+            AdminReply *reply, /* IN */
+            void *user_data)   /* IN */
+{
+   int i;
+
+   Mutex_Lock (&gAdminMutex);
+   for (i = 0; i < gAdminActionsLen; i++) {
+      AdminReply_Printf (reply, "%s%s%s\n",
+                         gAdminActions [i].name,
+                         gAdminActions [i].usage ? " " : "",
+                         gAdminActions [i].usage ? gAdminActions [i].usage : "");
+   }
+   Mutex_Unlock (&gAdminMutex);
+
+   return true;
+}
+
+
+static void
+Admin_ListCb (Tunable tunable,    /* IN */
+              const char *name,   /* IN */
+              const Value *value, /* IN */
+              void *user_data)    /* IN */
+{
+   void **args = user_data;
+   AdminReply *reply = args [0];
+   const char *prefix = args [1];
+
+   if (!prefix || CString_HasPrefix (name, prefix)) {
+      AdminReply_Printf (reply, "%s = ", name);
+      AdminReply_PrintValue (reply, value);
+      AdminReply_Printf (reply, "\n");
+   }
+}
+
+
+static bool
+Admin_List (int argc,          /* IN */
+            char *argv[],      /* IN */
+            AdminReply *reply, /* IN */
+            void *user_data)   /* IN */
+{
+   void *args [2] = { reply, (argc > 1) ? argv [1] : NULL };
+
+   Tunable_Foreach (Admin_ListCb, args);
+
+   return true;
+}
+
+
+static bool
+Admin_Get (int argc,          /* IN */
+           char *argv[],      /* IN */
+           AdminReply *reply, /* IN */
+           void *user_data)   /* IN */
+{
+   Tunable tunable;
+   Value value;
+
+   if (argc != 2) {
+      AdminReply_Printf (reply, "usage: get NAME\n");
+      return false;
+   }
+
+   if (TUNABLE_INVALID == (tunable = Tunable_Find (argv [1]))) {
+      AdminReply_Printf (reply, "No such tunable \"%s\".\n", argv [1]);
+      return false;
+   }
+
+   Tunable_Get (tunable, &value);
+   AdminReply_PrintValue (reply, &value);
+   AdminReply_Printf (reply, "\n");
+   Value_Destroy (&value);
+
+   return true;
+}
+
+
+static bool
+Admin_Set (int argc,          /* IN */
+           char *argv[],      /* IN */
+           AdminReply *reply, /* IN */
+           void *user_data)   /* IN */
+{
+   Tunable tunable;
+
+   if (argc != 3) {
+      AdminReply_Printf (reply, "usage: set NAME VALUE\n");
+      return false;
+   }
+
+   if (TUNABLE_INVALID == (tunable = Tunable_Find (argv [1]))) {
+      AdminReply_Printf (reply, "No such tunable \"%s\".\n", argv [1]);
+      return false;
+   }
+
+   if (!Tunable_SetString (tunable, argv [2])) {
+      AdminReply_Printf (reply, "Invalid value \"%s\" for \"%s\".\n",
+                         argv [2], argv [1]);
+      return false;
+   }
+
+   LOG_MESSAGE ("Tunable \"%s\" set to \"%s\".", argv [1], argv [2]);
+
+   return true;
+}
+
+
+static void
+Admin_CountersCb (Counter *counter, /* IN */
+                  void *user_data)  /* IN */
+{
+   void **args = user_data;
+   AdminReply *reply = args [0];
+   const char *category = args [1];
+   bool reset = !!args [2];
+
+   if (category && strcmp (category, counter->category)) {
+      return;
+   }
+
+   if (reset) {
+      Counter_Reset (counter);
+   } else {
+      AdminReply_Printf (reply, "%s/%s = %"PRId64"\n",
+                         counter->category, counter->name,
+                         Counter_Get (counter));
+   }
+}
+
+
+static bool
+Admin_Counters (int argc,          /* IN */
+                char *argv[],      /* IN */
+                AdminReply *reply, /* IN */
+                void *user_data)   /* IN */
+{
+   void *args [3] = { reply, (argc > 1) ? argv [1] : NULL, user_data };
+
+   Counters_Foreach (Admin_CountersCb, args);
+
+   return true;
+}
+
+
+static bool
+Admin_Stacks (int argc,          /* IN */
+              char *argv[],      /* IN */
+              AdminReply *reply, /* IN */
+              void *user_data)   /* IN */
+{
+#ifdef TASK_USE_LTHREAD
+   size_t highwater;
+   size_t size;
+   int live;
+
+   if (0 == lthread_stack_stats (&live, &highwater, &size)) {
+      AdminReply_Printf (reply,
+                         "tasks = %d\n"
+                         "stack.size = %zu\n"
+                         "stack.highwater = %zu\n",
+                         live, size, highwater);
+      return true;
+   }
+#endif
+
+   AdminReply_Printf (reply, "Stack usage is only tracked for lthreads.\n");
+
+   return false;
+}
+
+
+static void
+Admin_AddAction (const char *name,     /* IN */
+                 const char *usage,    /* IN */
+                 AdminActionFunc func, /* IN */
+                 void *user_data)      /* IN */
+{
+   AdminAction *action = NULL;
+   int i;
+
+   Mutex_Lock (&gAdminMutex);
+
+   for (i = 0; i < gAdminActionsLen; i++) {
+      if (0 == strcmp (name, gAdminActions [i].name)) {
+         action = &gAdminActions [i];
+         Memory_Free (action->usage);
+         break;
+      }
+   }
+
+   if (!action) {
+      if (gAdminActionsLen == ADMIN_MAX_ACTIONS) {
+         Mutex_Unlock (&gAdminMutex);
+         LOG_WARNING ("Too many admin actions, dropping \"%s\".", name);
+         return;
+      }
+      action = &gAdminActions [gAdminActionsLen++];
+      action->name = CString_Dup (name);
+   }
+
+   action->usage = usage ? CString_Dup (usage) : NULL;
+   action->func = func;
+   action->user_data = user_data;
+
+   Mutex_Unlock (&gAdminMutex);
+}
+
+
+static void
+Admin_Init (void)
+{
+   Mutex_Init (&gAdminMutex, NULL);
+
+   Admin_AddAction ("help", NULL, Admin_Help, NULL);
+   Admin_AddAction ("list", "[PREFIX]", Admin_List, NULL);
+   Admin_AddAction ("get", "NAME", Admin_Get, NULL);
+   Admin_AddAction ("set", "NAME VALUE", Admin_Set, NULL);
+   Admin_AddAction ("counters", "[CATEGORY]", Admin_Counters, NULL);
+   Admin_AddAction ("counters.reset", "[CATEGORY]", Admin_Counters,
+                    (void *)1);
+   Admin_AddAction ("stacks", NULL, Admin_Stacks, NULL);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Admin_RegisterAction --
+ *
+ *       Adds a command named @name to the admin socket. @usage describes
+ *       its arguments for "help", and may be NULL.
+ *
+ *       Registering an existing name replaces it.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+Admin_RegisterAction (const char *name,     /* IN */
+                      const char *usage,    /* IN */
+                      AdminActionFunc func, /* IN */
+                      void *user_data)      /* IN */
+{
+   ASSERT (name);
+   ASSERT (func);
+
+   ThreadOnce_Once (&gAdminOnce, Admin_Init);
+   Admin_AddAction (name, usage, func, user_data);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Admin_Execute --
+ *
+ *       Runs the admin command in @line, as if it had arrived over the
+ *       admin socket.
+ *
+ * Returns:
+ *       true if the command succeeded. Either way its output has been
+ *       appended to @reply.
+ *
+ * Side effects:
+ *       Whatever the command does.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+Admin_Execute (const char *line,  /* IN */
+               AdminReply *reply) /* IN */
+{
+   AdminAction action = { 0 };
+   char buf [ADMIN_MAX_LINE];
+   char *argv [ADMIN_MAX_ARGS + 1];
+   char *saveptr = NULL;
+   char *word;
+   int argc = 0;
+   int i;
+
+   ASSERT (line);
+   ASSERT (reply);
+
+   ThreadOnce_Once (&gAdminOnce, Admin_Init);
+
+   if (!CString_Copy (line, buf, sizeof buf)) {
+      AdminReply_Printf (reply, "Command too long.\n");
+      return false;
+   }
+
+   for (word = strtok_r (buf, " \t\r\n", &saveptr);
+        word;
+        word = strtok_r (NULL, " \t\r\n", &saveptr)) {
+      if (argc == ADMIN_MAX_ARGS) {
+         AdminReply_Printf (reply, "Too many arguments.\n");
+         return false;
+      }
+      argv [argc++] = word;
+   }
+
+   argv [argc] = NULL;
+
+   if (!argc) {
+      AdminReply_Printf (reply, "Empty command, try \"help\".\n");
+      return false;
+   }
+
+   Mutex_Lock (&gAdminMutex);
+   for (i = 0; i < gAdminActionsLen; i++) {
+      if (0 == strcmp (argv [0], gAdminActions [i].name)) {
+         action = gAdminActions [i];
+         break;
+      }
+   }
+   Mutex_Unlock (&gAdminMutex);
+
+   if (!action.func) {
+      AdminReply_Printf (reply, "Unknown command \"%s\", try \"help\".\n",
+                         argv [0]);
+      return false;
+   }
+
+   return action.func (argc, argv, reply, action.user_data);
+}
+
+
+static bool
+Admin_SendAll (Socket *socket,  /* IN */
+               const char *buf, /* IN */
+               size_t len)      /* IN */
+{
+   ssize_t ret;
+
+   while (len) {
+      if ((ret = Socket_Send (socket, buf, len, 0, 0)) <= 0) {
+         return false;
+      }
+      buf += ret;
+      len -= ret;
+   }
+
+   return true;
+}
+
+
+static bool
+Admin_Reply (Socket *socket,    /* IN */
+             bool ok,           /* IN */
+             AdminReply *reply) /* IN */
+{
+   char header [32];
+   int len;
+
+   len = snprintf (header, sizeof header, "%s %zu\n",
+                   ok ? "OK" : "ERROR", reply->len);
+
+   return (Admin_SendAll (socket, header, len) &&
+           (!reply->len || Admin_SendAll (socket, reply->data, reply->len)));
+}
+
+
+static void
+Admin_ClientLoop (void *data) /* IN */
+{
+   AdminTask *task = data;
+   AdminReply reply;
+   char buf [ADMIN_MAX_LINE];
+   size_t len = 0;
+   ssize_t ret;
+   char *eol;
+   bool ok;
+
+   /* Nothing joins client tasks. */
+#ifdef TASK_USE_LTHREAD
+   Task_Detach ();
+#else
+   Task_Detach (Task_Current ());
+#endif
+
+   for (;;) {
+      while ((eol = memchr (buf, '\n', len))) {
+         *eol = '\0';
+
+         AdminReply_Init (&reply);
+         ok = Admin_Execute (buf, &reply);
+         ok = Admin_Reply (&task->socket, ok, &reply);
+         AdminReply_Destroy (&reply);
+
+         if (!ok) {
+            goto done;
+         }
+
+         len -= (eol + 1 - buf);
+         memmove (buf, eol + 1, len);
+      }
+
+      if (len == sizeof buf) {
+         AdminReply_Init (&reply);
+         AdminReply_Printf (&reply, "Command too long.\n");
+         Admin_Reply (&task->socket, false, &reply);
+         AdminReply_Destroy (&reply);
+         goto done;
+      }
+
+      ret = Socket_Recv (&task->socket, buf + len, sizeof buf - len, 0, 0);
+      if (ret <= 0) {
+         goto done;
+      }
+
+      len += ret;
+   }
+
+done:
+   Socket_Close (&task->socket);
+   Memory_Free (task);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Admin_PeerAllowed --
+ *
+ *       Checks that the process on the other end of client runs as our
+ *       effective user. This is the only access control for sockets in
+ *       the abstract namespace, which have no file permissions.
+ *
+ * Returns:
+ *       true if the peer may run admin commands.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+Admin_PeerAllowed (Socket *client) /* IN */
+{
+#if defined(SO_PEERCRED)
+   struct ucred cred;
+   socklen_t len = sizeof cred;
+
+   if (0 != getsockopt (client->sd, SOL_SOCKET, SO_PEERCRED, &cred, &len)) {
+      return false;
+   }
+
+   return (cred.uid == geteuid ());
+#else
+   uid_t uid;
+   gid_t gid;
+
+   if (0 != getpeereid (client->sd, &uid, &gid)) {
+      return false;
+   }
+
+   return (uid == geteuid ());
+#endif
+}
+
+
+static void
+Admin_AcceptLoop (void *data) /* IN */
+{
+   AdminTask *task = data;
+   AdminTask *client;
+   uint64_t last_warning = 0;
+   uint64_t suppressed = 0;
+   uint64_t now;
+   int err;
+
+   for (;;) {
+      client = Memory_SafeMalloc0 (sizeof *client);
+
+      if (!Socket_Accept (&task->socket, &client->socket)) {
+         err = errno;
+         Memory_Free (client);
+
+         /*
+          * Warn at most every ADMIN_WARNING_USEC, so that running out of
+          * descriptors does not also flood the log.
+          */
+         now = TimeSpec_GetMonotonic ();
+         if (!last_warning || ((now - last_warning) >= ADMIN_WARNING_USEC)) {
+            LOG_WARNING ("Failed to accept admin connection: %s "
+                         "(%" PRIu64 " similar suppressed)",
+                         strerror (err), suppressed);
+            last_warning = now;
+            suppressed = 0;
+         } else {
+            suppressed++;
+         }
+
+         switch (err) {
+         case EINTR:
+         case ECONNABORTED:
+         case EPROTO:
+            break;
+         default:
+            Task_Sleep (ADMIN_ACCEPT_PAUSE_MSEC);
+            break;
+         }
+
+         continue;
+      }
+
+      if (!Admin_PeerAllowed (&client->socket)) {
+         LOG_WARNING ("Rejected admin connection from another user.");
+         Socket_Close (&client->socket);
+         Memory_Free (client);
+         continue;
+      }
+
+      Task_Create (&client->task, Admin_ClientLoop, client);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Admin_Start --
+ *
+ *       Serves admin commands on the UNIX-domain socket @path, from a
+ *       task on the current scheduler. A leading '@' puts the socket in
+ *       the abstract namespace.
+ *
+ *       A stale socket file at @path is replaced, but not a socket in
+ *       use or any other file. The socket file is created accessible to
+ *       the owner only, and clients running as other users are
+ *       disconnected, which also covers abstract sockets.
+ *
+ * Returns:
+ *       true if the socket is listening, otherwise false.
+ *
+ * Side effects:
+ *       Creates the socket file.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+Admin_Start (const char *path) /* IN */
+{
+   struct sockaddr_un addr;
+   socklen_t addrlen;
+   AdminTask *task;
+   mode_t mask;
+   int ret;
+
+   ASSERT (path);
+
+   ThreadOnce_Once (&gAdminOnce, Admin_Init);
+
+   if (!Socket_UnixAddr (path, &addr, &addrlen)) {
+      LOG_WARNING ("Invalid admin socket path \"%s\".", path);
+      return false;
+   }
+
+   task = Memory_SafeMalloc0 (sizeof *task);
+
+   if (!Socket_Init (&task->socket, AF_UNIX, SOCK_STREAM, 0)) {
+      LOG_WARNING ("Failed to create admin socket: %s", strerror (errno));
+      Memory_Free (task);
+      return false;
+   }
+
+   if (!Socket_UnlinkStale (path)) {
+      LOG_WARNING ("Not replacing \"%s\" with the admin socket: %s",
+                   path, strerror (errno));
+      Socket_Close (&task->socket);
+      Memory_Free (task);
+      return false;
+   }
+
+   /*
+    * Create the socket file without group or other access, rather than
+    * chmod()ing it after others could have connected.
+    */
+   mask = umask (S_IXUSR | S_IRWXG | S_IRWXO);
+   ret = Socket_Bind (&task->socket, (const struct sockaddr *)&addr, addrlen);
+   umask (mask);
+
+   if ((0 != ret) || (0 != Socket_Listen (&task->socket, ADMIN_BACKLOG))) {
+      LOG_WARNING ("Failed to listen on admin socket \"%s\": %s",
+                   path, strerror (errno));
+      Socket_Close (&task->socket);
+      Memory_Free (task);
+      return false;
+   }
+
+   LOG_INFO ("Listening for admin commands on \"%s\".", path);
+
+   Task_Create (&task->task, Admin_AcceptLoop, task);
+
+   return true;
+}
@@ -0,0 +1,84 @@
+/* Admin.h
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef ADMIN_H
+#define ADMIN_H
+
+
+#include <Macros.h>
+#include <Types.h>
+
+
+BEGIN_DECLS
+
+
+/*
+ * The admin socket lets an operator inspect and change a running process:
+ * list, get and set tunables, and run actions such as resetting counters.
+ * congo-ctl is its client.
+ *
+ * Each request is one line of space separated words, the first naming the
+ * command. Each reply is a status line, "OK <length>" or "ERROR <length>",
+ * followed by that many bytes of text.
+ */
+
+
+#define ADMIN_MAX_LINE 1024
+#define ADMIN_MAX_ARGS 16
+
+
+typedef struct _AdminReply AdminReply;
+
+
+struct _AdminReply
+{
+   char   *data;
+   size_t  len;
+   size_t  allocated;
+};
+
+
+/*
+ * Actions run on the admin task. They should be quick, and report
+ * problems by printing a message to @reply and returning false.
+ */
+typedef bool (*AdminActionFunc) (int argc,
+                                 char *argv[],
+                                 AdminReply *reply,
+                                 void *user_data);
+
+
+void AdminReply_Init      (AdminReply *reply);
+void AdminReply_Printf    (AdminReply *reply,
+                           const char *format,
+                           ...) GNUC_PRINTF (2, 3);
+void AdminReply_Destroy   (AdminReply *reply);
+void Admin_RegisterAction (const char *name,
+                           const char *usage,
+                           AdminActionFunc func,
+                           void *user_data);
+bool Admin_Execute        (const char *line,
+                           AdminReply *reply);
+bool Admin_Start          (const char *path);
+
+
+END_DECLS
+
+
+#endif /* ADMIN_H */
@@ -47,14 +47,21 @@ Array_Grow (Array *array, /* IN */
             uint32_t len) /* IN */
 {
    size_t bytes;
+   void *data;
 
    ASSERT (array);
    ASSERT (len > array->len);
 
    bytes = ((size_t)len) * ((size_t)array->element_size);
 
-   array->data = realloc(array->data, bytes);
-   ASSERT (array->data);
+   if (array->borrowed) {
+      data = Memory_SafeMalloc (bytes);
+      memcpy (data, array->data, array->len * array->element_size);
+      array->data = data;
+      array->borrowed = false;
+   } else {
+      array->data = Memory_SafeRealloc (array->data, bytes);
+   }
 
    array->allocated_len = len;
 
@@ -127,6 +134,7 @@ Array_InitSized (Array *array,          /* OUT */
    array->allocated_len = 0;
    array->element_size = element_size;
    array->zeroed = zeroed;
+   array->borrowed = false;
 
    if (count) {
       Array_Grow (array, count);
@@ -134,6 +142,51 @@ Array_InitSized (Array *array,          /* OUT */
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Array_InitBorrowed --
+ *
+ *       Like Array_InitSized() except that the first @length elements
+ *       are stored in @storage, such as memory from a MemoryArena, rather
+ *       than allocated. Growing past them moves the array to the heap.
+ *
+ *       @storage is never freed by the array, and must outlive it or
+ *       its first Array_Grow().
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+Array_InitBorrowed (Array *array,          /* OUT */
+                    uint32_t element_size, /* IN */
+                    bool zeroed,           /* IN */
+                    void *storage,         /* IN */
+                    uint32_t length)       /* IN */
+{
+   ASSERT (array);
+   ASSERT (storage);
+   ASSERT (length);
+
+   array->len = 0;
+   array->data = storage;
+   array->allocated_len = length;
+   array->element_size = element_size;
+   array->zeroed = zeroed;
+   array->borrowed = true;
+
+   if (zeroed) {
+      memset (storage, 0, (size_t)length * element_size);
+   }
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -157,12 +210,15 @@ Array_Destroy (Array *array) /* IN */
 {
    ASSERT (array);
 
-   Memory_Free (array->data);
+   if (!array->borrowed) {
+      Memory_Free (array->data);
+   }
 
    array->data = NULL;
    array->len = 0;
    array->allocated_len = 0;
    array->zeroed = 0;
+   array->borrowed = false;
 }
 
 
@@ -314,6 +370,12 @@ Array_StealData (Array *array, /* IN */
       ret = array->data;
       retlen = array->len;
 
+      if (array->borrowed) {
+         ret = Memory_SafeMalloc (retlen * array->element_size);
+         memcpy (ret, array->data, retlen * array->element_size);
+         array->borrowed = false;
+      }
+
       array->allocated_len = 0;
       array->data = NULL;
       array->len = 0;
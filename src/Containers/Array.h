@@ -29,7 +29,7 @@
 BEGIN_DECLS
 
 
-#define ARRAY_INITIALIZER(type) { 0, NULL, 0, sizeof(type), false }
+#define ARRAY_INITIALIZER(type) { 0, NULL, 0, sizeof(type), false, false }
 #define Array_Append(array, val) Array_AppendRange(array, 1, &(val))
 #define Array_Index(array, type, index) (((type *)(array)->data)[index])
 
@@ -43,6 +43,7 @@ typedef struct
    uint32_t allocated_len;
    uint32_t element_size;
    bool zeroed;
+   bool borrowed;
 } Array;
 
 
@@ -59,6 +60,11 @@ void        Array_InitSized   (Array *array,
                                uint32_t element_size,
                                bool zeroed,
                                uint32_t length);
+void        Array_InitBorrowed (Array *array,
+                                uint32_t element_size,
+                                bool zeroed,
+                                void *storage,
+                                uint32_t length);
 void        Array_Destroy     (Array *array);
 void        Array_Remove      (Array *array,
                                uint32_t index);
@@ -73,6 +79,114 @@ void        Array_Sort        (Array *array,
                                CompareFunc compare);
 
 
+/*
+ * Array_SortByUInt32() and Array_SortByUInt64() radix sort elements by an
+ * unsigned integer key found key_offset bytes into each element, such as
+ * a cursor id or a disk offset:
+ *
+ *   Array_SortByUInt64 (&locations, offsetof (DiskLoc, offset));
+ *
+ * The radix sorts are stable.
+ *
+ * Array_SortParallel() is Array_Sort() spread over the CPUs for large
+ * arrays. It is not stable.
+ *
+ * All three may replace the element storage.
+ */
+void        Array_SortByUInt32 (Array *array,
+                                uint32_t key_offset);
+void        Array_SortByUInt64 (Array *array,
+                                uint32_t key_offset);
+void        Array_SortParallel (Array *array,
+                                CompareFunc compare);
+
+
+/*
+ * ARRAY_DEFINE generates an Array wrapper specialized for ElementType.
+ * Elements are appended and removed by assignment with the element size
+ * known at compile time, instead of memcpy() of a runtime size. The
+ * result is still an Array, so the generic functions work on it too.
+ *
+ *   ARRAY_DEFINE (UInt64Array, uint64_t)
+ *
+ *   UInt64Array_Append (&array, 42);
+ */
+
+#define ARRAY_DEFINE(Name, ElementType) \
+typedef Array Name; \
+\
+static __inline__ void \
+Name##_Init (Name *self) \
+{ \
+   Array_Init ((Array *)self, sizeof (ElementType), false); \
+} \
+\
+static __inline__ void \
+Name##_InitSized (Name *self, uint32_t count) \
+{ \
+   Array_InitSized ((Array *)self, sizeof (ElementType), false, count); \
+} \
+\
+static __inline__ void \
+Name##_Destroy (Name *self) \
+{ \
+   Array_Destroy ((Array *)self); \
+} \
+\
+static __inline__ uint32_t \
+Name##_Size (Name *self) \
+{ \
+   return ((Array *)self)->len; \
+} \
+\
+static __inline__ ElementType * \
+Name##_Data (Name *self) \
+{ \
+   return (ElementType *)((Array *)self)->data; \
+} \
+\
+static __inline__ ElementType * \
+Name##_Index (Name *self, uint32_t index) \
+{ \
+   return &((ElementType *)((Array *)self)->data) [index]; \
+} \
+\
+static __inline__ void \
+Name##_Append (Name *self, ElementType val) \
+{ \
+   Array *array = (Array *)self; \
+\
+   if (UNLIKELY (array->len == array->allocated_len)) { \
+      Array_Grow (array, MAX (16, array->allocated_len * 2)); \
+   } \
+\
+   ((ElementType *)array->data) [array->len++] = val; \
+} \
+\
+static __inline__ ElementType \
+Name##_Pop (Name *self) \
+{ \
+   Array *array = (Array *)self; \
+\
+   return ((ElementType *)array->data) [--array->len]; \
+} \
+\
+static __inline__ void \
+Name##_RemoveFast (Name *self, uint32_t index) \
+{ \
+   Array *array = (Array *)self; \
+   ElementType *data = (ElementType *)array->data; \
+\
+   data [index] = data [--array->len]; \
+} \
+\
+static __inline__ void \
+Name##_Clear (Name *self) \
+{ \
+   ((Array *)self)->len = 0; \
+}
+
+
 END_DECLS
 
 
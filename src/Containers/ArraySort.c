@@ -0,0 +1,608 @@
+/* ArraySort.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+# include <immintrin.h>
+#endif
+
+#include <Array.h>
+#include <Debug.h>
+#include <Memory.h>
+#include <Platform.h>
+#include <ThreadOnce.h>
+#include <ThreadPool.h>
+
+
+/*
+ * Below ARRAY_SORT_SMALL elements the radix histograms cost more than
+ * they save and we insertion sort by key instead.
+ *
+ * Below ARRAY_SORT_PARALLEL_MIN elements handing chunks to other threads
+ * costs more than it saves and Array_SortParallel() sorts in place.
+ */
+#define ARRAY_SORT_SMALL          64
+#define ARRAY_SORT_SMALL_ELEMENT  64
+#define ARRAY_SORT_PARALLEL_MIN   (1 << 16)
+#define ARRAY_SORT_MAX_CHUNKS     32
+#define ARRAY_SORT_RADIX          256
+
+
+typedef enum
+{
+   ARRAY_SORT_JOB_SORT,
+   ARRAY_SORT_JOB_MERGE,
+} ArraySortJobType;
+
+
+typedef struct
+{
+   ArraySortJobType  type;
+   CompareFunc       compare;
+   size_t            element_size;
+   uint8_t          *src;
+   uint8_t          *dst;
+   size_t            left;
+   size_t            right;
+} ArraySortJob;
+
+
+static ThreadPool gArraySortPool;
+static ThreadOnce gArraySortOnce = THREAD_ONCE_INIT;
+
+
+static __inline__ void
+Array_CopyElement (void *dst,         /* OUT */
+                   const void *src,     /* IN */
+                   size_t element_size) /* IN */
+{
+   /*
+    * Common element sizes get a fixed size copy, which compiles to a
+    * couple of moves.
+    */
+   switch (element_size) {
+   case 4:
+      memcpy (dst, src, 4);
+      break;
+   case 8:
+      memcpy (dst, src, 8);
+      break;
+   case 16:
+      memcpy (dst, src, 16);
+      break;
+   default:
+      memcpy (dst, src, element_size);
+      break;
+   }
+}
+
+
+static __inline__ uint64_t
+Array_GetKey (const uint8_t *element, /* IN */
+              uint32_t key_offset,    /* IN */
+              uint32_t key_size)      /* IN */
+{
+   uint32_t key32;
+   uint64_t key64;
+
+   if (key_size == 4) {
+      memcpy (&key32, element + key_offset, 4);
+      return key32;
+   }
+
+   memcpy (&key64, element + key_offset, 8);
+   return key64;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Array_ReplaceData --
+ *
+ *       Makes @data, which was allocated for array->allocated_len
+ *       elements, the storage of @array, releasing the previous one.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+Array_ReplaceData (Array *array, /* IN */
+                   void *data)   /* IN */
+{
+   if (!array->borrowed) {
+      Memory_Free (array->data);
+   }
+   array->data = data;
+   array->borrowed = false;
+
+   if (array->zeroed) {
+      memset ((uint8_t *)array->data + (array->len * array->element_size), 0,
+              (array->allocated_len - array->len) * array->element_size);
+   }
+}
+
+
+#if defined(__AVX2__)
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Array_SortNetwork8 --
+ *
+ *       Sorts up to 8 uint32_t in a single AVX2 register with a bitonic
+ *       sorting network: six rounds of min/max against a shuffled copy,
+ *       with no branches.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+Array_SortNetwork8 (uint32_t *keys, /* IN/OUT */
+                    uint32_t len)   /* IN */
+{
+   uint32_t buf [8] = {
+      UINT32_MAX, UINT32_MAX, UINT32_MAX, UINT32_MAX,
+      UINT32_MAX, UINT32_MAX, UINT32_MAX, UINT32_MAX,
+   };
+   __m256i v;
+   __m256i s;
+
+   ASSERT (len <= 8);
+
+   memcpy (buf, keys, len * sizeof *keys);
+   v = _mm256_loadu_si256 ((const __m256i *)buf);
+
+#define NETWORK_ROUND(shuffled, mask) \
+   s = (shuffled); \
+   v = _mm256_blend_epi32 (_mm256_min_epu32 (v, s), \
+                           _mm256_max_epu32 (v, s), \
+                           (mask))
+
+   /* Sort pairs, then merge them into sorted groups of four. */
+   NETWORK_ROUND (_mm256_shuffle_epi32 (v, _MM_SHUFFLE (2, 3, 0, 1)), 0xAA);
+   NETWORK_ROUND (_mm256_shuffle_epi32 (v, _MM_SHUFFLE (0, 1, 2, 3)), 0xCC);
+   NETWORK_ROUND (_mm256_shuffle_epi32 (v, _MM_SHUFFLE (2, 3, 0, 1)), 0xAA);
+
+   /* Merge the two groups of four. */
+   NETWORK_ROUND (_mm256_permutevar8x32_epi32 (
+                     v, _mm256_setr_epi32 (7, 6, 5, 4, 3, 2, 1, 0)), 0xF0);
+   NETWORK_ROUND (_mm256_shuffle_epi32 (v, _MM_SHUFFLE (1, 0, 3, 2)), 0xCC);
+   NETWORK_ROUND (_mm256_shuffle_epi32 (v, _MM_SHUFFLE (2, 3, 0, 1)), 0xAA);
+
+#undef NETWORK_ROUND
+
+   _mm256_storeu_si256 ((__m256i *)buf, v);
+   memcpy (keys, buf, len * sizeof *keys);
+}
+#endif
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Array_InsertionSortByKey --
+ *
+ *       Sorts a short array by an unsigned key.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+Array_InsertionSortByKey (Array *array,        /* IN */
+                          uint32_t key_offset, /* IN */
+                          uint32_t key_size)   /* IN */
+{
+   uint8_t tmp [ARRAY_SORT_SMALL_ELEMENT];
+   uint8_t *data = array->data;
+   size_t es = array->element_size;
+   uint64_t key;
+   uint32_t i;
+   uint32_t j;
+
+   ASSERT (es <= sizeof tmp);
+
+   for (i = 1; i < array->len; i++) {
+      key = Array_GetKey (data + (i * es), key_offset, key_size);
+      for (j = i;
+           (j > 0) && (key < Array_GetKey (data + ((j - 1) * es),
+                                           key_offset, key_size));
+           j--) {
+         /* nothing */
+      }
+      if (j != i) {
+         Array_CopyElement (tmp, data + (i * es), es);
+         memmove (data + ((j + 1) * es), data + (j * es), (i - j) * es);
+         Array_CopyElement (data + (j * es), tmp, es);
+      }
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Array_RadixSort --
+ *
+ *       Sorts @array by the unsigned key of @key_size bytes found at
+ *       @key_offset in each element, least significant byte first.
+ *
+ *       All the byte histograms are built in a single pass over the
+ *       keys. Bytes that are the same in every key, such as the high
+ *       bytes of small ids, are skipped.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+Array_RadixSort (Array *array,        /* IN */
+                 uint32_t key_offset, /* IN */
+                 uint32_t key_size)   /* IN */
+{
+   size_t counts [8][ARRAY_SORT_RADIX] = {{ 0 }};
+   size_t offsets [ARRAY_SORT_RADIX];
+   size_t es = array->element_size;
+   size_t n = array->len;
+   size_t total;
+   size_t i;
+   uint64_t key;
+   uint8_t *src;
+   uint8_t *dst;
+   uint8_t *tmp;
+   uint8_t *swap;
+   unsigned digit;
+   unsigned shift;
+   unsigned b;
+
+   ASSERT (key_offset + key_size <= es);
+
+   if (n < 2) {
+      return;
+   }
+
+#if defined(__AVX2__)
+   if ((key_size == 4) && (es == 4) && (n <= 8)) {
+      Array_SortNetwork8 (array->data, n);
+      return;
+   }
+#endif
+
+   if ((n < ARRAY_SORT_SMALL) && (es <= ARRAY_SORT_SMALL_ELEMENT)) {
+      Array_InsertionSortByKey (array, key_offset, key_size);
+      return;
+   }
+
+   src = array->data;
+
+   for (i = 0; i < n; i++) {
+      key = Array_GetKey (src + (i * es), key_offset, key_size);
+      for (digit = 0; digit < key_size; digit++) {
+         counts [digit][(key >> (digit * 8)) & 0xFF]++;
+      }
+   }
+
+   tmp = Memory_SafeMallocN (es, array->allocated_len);
+   dst = tmp;
+
+   key = Array_GetKey (src, key_offset, key_size);
+
+   for (digit = 0; digit < key_size; digit++) {
+      shift = digit * 8;
+
+      if (counts [digit][(key >> shift) & 0xFF] == n) {
+         continue;
+      }
+
+      for (b = 0, total = 0; b < ARRAY_SORT_RADIX; b++) {
+         offsets [b] = total;
+         total += counts [digit][b];
+      }
+
+      for (i = 0; i < n; i++) {
+         b = (Array_GetKey (src + (i * es), key_offset, key_size) >> shift)
+            & 0xFF;
+         Array_CopyElement (dst + (offsets [b]++ * es), src + (i * es), es);
+      }
+
+      swap = src;
+      src = dst;
+      dst = swap;
+   }
+
+   if (src == tmp) {
+      Array_ReplaceData (array, tmp);
+   } else {
+      Memory_Free (tmp);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Array_SortByUInt32 --
+ *
+ *       Sorts @array in ascending order of the uint32_t found at
+ *       @key_offset bytes into each element, using a radix sort.
+ *
+ *       For an array of uint32_t, pass 0 as @key_offset.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The element storage may be replaced.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+Array_SortByUInt32 (Array *array,        /* IN */
+                    uint32_t key_offset) /* IN */
+{
+   ASSERT (array);
+
+   Array_RadixSort (array, key_offset, sizeof (uint32_t));
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Array_SortByUInt64 --
+ *
+ *       Sorts @array in ascending order of the uint64_t found at
+ *       @key_offset bytes into each element, using a radix sort.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The element storage may be replaced.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+Array_SortByUInt64 (Array *array,        /* IN */
+                    uint32_t key_offset) /* IN */
+{
+   ASSERT (array);
+
+   Array_RadixSort (array, key_offset, sizeof (uint64_t));
+}
+
+
+static void
+Array_Merge (ArraySortJob *job) /* IN */
+{
+   size_t es = job->element_size;
+   uint8_t *a = job->src;
+   uint8_t *a_end = a + (job->left * es);
+   uint8_t *b = a_end;
+   uint8_t *b_end = b + (job->right * es);
+   uint8_t *out = job->dst;
+
+   while ((a < a_end) && (b < b_end)) {
+      if (job->compare (b, a) < 0) {
+         Array_CopyElement (out, b, es);
+         b += es;
+      } else {
+         Array_CopyElement (out, a, es);
+         a += es;
+      }
+      out += es;
+   }
+
+   memcpy (out, a, a_end - a);
+   out += a_end - a;
+   memcpy (out, b, b_end - b);
+}
+
+
+static void
+Array_RunSortJob (ArraySortJob *job) /* IN */
+{
+   switch (job->type) {
+   case ARRAY_SORT_JOB_SORT:
+      qsort (job->src, job->left, job->element_size, job->compare);
+      break;
+   case ARRAY_SORT_JOB_MERGE:
+      Array_Merge (job);
+      break;
+   default:
+      ASSERT (false);
+      break;
+   }
+}
+
+
+static void
+Array_SortRange (size_t begin, /* IN */
+                 size_t end,   /* IN */
+                 void *data)   /* IN */
+{
+   ArraySortJob *jobs = data;
+   size_t i;
+
+   for (i = begin; i < end; i++) {
+      Array_RunSortJob (&jobs [i]);
+   }
+}
+
+
+static void
+Array_SortInitPool (void)
+{
+   ThreadPool_Init (&gArraySortPool,
+                    MIN (Platform_GetCpuCount (), ARRAY_SORT_MAX_CHUNKS),
+                    ARRAY_SORT_MAX_CHUNKS, NULL, NULL);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Array_RunSortJobs --
+ *
+ *       Runs @jobs on the calling thread and the sort thread pool, and
+ *       waits for all of them to complete.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+Array_RunSortJobs (ArraySortJob *jobs, /* IN */
+                   unsigned n_jobs)    /* IN */
+{
+   ThreadPool_ParallelFor (&gArraySortPool, 0, n_jobs, 1, Array_SortRange,
+                           jobs);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Array_SortParallel --
+ *
+ *       Sorts @array like Array_Sort(), spreading large arrays over the
+ *       CPUs. The array is cut into a power of two number of chunks which
+ *       are sorted concurrently, then merged pairwise, each round of
+ *       merges also running concurrently.
+ *
+ *       Small arrays, and any array on a single CPU machine, are sorted
+ *       with Array_Sort().
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The element storage may be replaced. Starts the sort thread pool
+ *       on first use.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+Array_SortParallel (Array *array,        /* IN */
+                    CompareFunc compare) /* IN */
+{
+   ArraySortJob jobs [ARRAY_SORT_MAX_CHUNKS];
+   size_t bounds [ARRAY_SORT_MAX_CHUNKS + 1];
+   size_t es;
+   unsigned n_chunks;
+   unsigned n_jobs;
+   unsigned width;
+   unsigned i;
+   uint8_t *src;
+   uint8_t *dst;
+   uint8_t *tmp;
+   uint8_t *swap;
+
+   ASSERT (array);
+   ASSERT (compare);
+
+   n_chunks = MIN (Platform_GetCpuCount (), ARRAY_SORT_MAX_CHUNKS);
+
+   if ((array->len < ARRAY_SORT_PARALLEL_MIN) || (n_chunks < 2)) {
+      Array_Sort (array, compare);
+      return;
+   }
+
+   ThreadOnce_Once (&gArraySortOnce, Array_SortInitPool);
+
+   while (n_chunks & (n_chunks - 1)) {
+      n_chunks &= n_chunks - 1;
+   }
+
+   es = array->element_size;
+
+   for (i = 0; i <= n_chunks; i++) {
+      bounds [i] = ((size_t)array->len * i) / n_chunks;
+   }
+
+   for (i = 0; i < n_chunks; i++) {
+      jobs [i].type = ARRAY_SORT_JOB_SORT;
+      jobs [i].compare = compare;
+      jobs [i].element_size = es;
+      jobs [i].src = (uint8_t *)array->data + (bounds [i] * es);
+      jobs [i].dst = NULL;
+      jobs [i].left = bounds [i + 1] - bounds [i];
+      jobs [i].right = 0;
+   }
+
+   Array_RunSortJobs (jobs, n_chunks);
+
+   tmp = Memory_SafeMallocN (es, array->allocated_len);
+   src = array->data;
+   dst = tmp;
+
+   for (width = 1; width < n_chunks; width *= 2) {
+      for (i = 0, n_jobs = 0; i < n_chunks; i += 2 * width, n_jobs++) {
+         jobs [n_jobs].type = ARRAY_SORT_JOB_MERGE;
+         jobs [n_jobs].src = src + (bounds [i] * es);
+         jobs [n_jobs].dst = dst + (bounds [i] * es);
+         jobs [n_jobs].left = bounds [i + width] - bounds [i];
+         jobs [n_jobs].right = bounds [i + (2 * width)] - bounds [i + width];
+      }
+
+      Array_RunSortJobs (jobs, n_jobs);
+
+      swap = src;
+      src = dst;
+      dst = swap;
+   }
+
+   if (src == tmp) {
+      Array_ReplaceData (array, tmp);
+   } else {
+      Memory_Free (tmp);
+   }
+}
@@ -0,0 +1,269 @@
+/* HashMap.h
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HASHMAP_H
+#define HASHMAP_H
+
+
+#include <Macros.h>
+#include <Math.h>
+#include <Memory.h>
+#include <Types.h>
+
+
+BEGIN_DECLS
+
+
+/*
+ * HASHMAP_DEFINE generates a hash map specialized for KeyType and
+ * ValueType. Keys and values are stored inline in the table rather than
+ * behind pointers, and Hash and Equal are called directly, so they may be
+ * macros or inline functions:
+ *
+ *   #define UInt64_HashKey(k)    ((uint32_t)Hash_Mix64 (k))
+ *   #define UInt64_EqualKey(a,b) ((a) == (b))
+ *   HASHMAP_DEFINE (UInt64Map, uint64_t, void *, UInt64_HashKey,
+ *                   UInt64_EqualKey)
+ *
+ * Hash takes a KeyType and returns a well distributed uint32_t; the low
+ * bits pick the bucket. Equal takes two KeyTypes.
+ *
+ * The table uses Robin Hood linear probing with backward shift deletion,
+ * so there are no tombstones and lookups stop as soon as they pass the
+ * position the key would have been displaced to. It grows by doubling at
+ * 7/8 load. Unlike HashTable, the map does not own its keys or values;
+ * walk it with Name_Next() to release them before Name_Destroy().
+ */
+
+#define _HASHMAP_MIN_SIZE 16
+
+
+#define HASHMAP_DEFINE(Name, KeyType, ValueType, Hash, Equal) \
+\
+typedef struct \
+{ \
+   uint32_t  hash; \
+   KeyType   key; \
+   ValueType value; \
+} Name##Entry; \
+\
+typedef struct \
+{ \
+   Name##Entry *entries; \
+   uint32_t     mask; \
+   uint32_t     len; \
+} Name; \
+\
+static __inline__ uint32_t \
+Name##_HashKey (KeyType key) \
+{ \
+   uint32_t hash = Hash (key); \
+\
+   /* 0 marks an empty entry. */ \
+   return hash ? hash : 1; \
+} \
+\
+static __inline__ void \
+Name##_Init (Name *self, uint32_t size) \
+{ \
+   uint32_t capacity; \
+\
+   capacity = UInt32_NextPowerOf2 (MAX (_HASHMAP_MIN_SIZE, \
+                                        size + (size / 7) + 1)); \
+\
+   self->entries = Memory_SafeMalloc0 (capacity * sizeof (Name##Entry)); \
+   self->mask = capacity - 1; \
+   self->len = 0; \
+} \
+\
+static __inline__ void \
+Name##_Destroy (Name *self) \
+{ \
+   Memory_Free (self->entries); \
+   self->entries = NULL; \
+   self->mask = 0; \
+   self->len = 0; \
+} \
+\
+static __inline__ uint32_t \
+Name##_Size (Name *self) \
+{ \
+   return self->len; \
+} \
+\
+static __inline__ Name##Entry * \
+Name##_Find (Name *self, KeyType key) \
+{ \
+   Name##Entry *entry; \
+   uint32_t hash; \
+   uint32_t pos; \
+   uint32_t dist; \
+\
+   hash = Name##_HashKey (key); \
+   pos = hash & self->mask; \
+\
+   for (dist = 0;; dist++) { \
+      entry = &self->entries [pos]; \
+      if (!entry->hash || \
+          (((pos - entry->hash) & self->mask) < dist)) { \
+         return NULL; \
+      } \
+      if ((entry->hash == hash) && Equal (entry->key, key)) { \
+         return entry; \
+      } \
+      pos = (pos + 1) & self->mask; \
+   } \
+} \
+\
+static __inline__ ValueType * \
+Name##_Lookup (Name *self, KeyType key) \
+{ \
+   Name##Entry *entry = Name##_Find (self, key); \
+\
+   return entry ? &entry->value : NULL; \
+} \
+\
+static __inline__ bool \
+Name##_Contains (Name *self, KeyType key) \
+{ \
+   return !!Name##_Find (self, key); \
+} \
+\
+static __inline__ void \
+Name##_Place (Name *self, Name##Entry entry) \
+{ \
+   Name##Entry *cur; \
+   Name##Entry tmp; \
+   uint32_t pos; \
+   uint32_t dist; \
+   uint32_t cur_dist; \
+\
+   pos = entry.hash & self->mask; \
+\
+   for (dist = 0;; dist++) { \
+      cur = &self->entries [pos]; \
+      if (!cur->hash) { \
+         *cur = entry; \
+         return; \
+      } \
+      cur_dist = (pos - cur->hash) & self->mask; \
+      if (cur_dist < dist) { \
+         tmp = *cur; \
+         *cur = entry; \
+         entry = tmp; \
+         dist = cur_dist; \
+      } \
+      pos = (pos + 1) & self->mask; \
+   } \
+} \
+\
+static void \
+Name##_Resize (Name *self) \
+{ \
+   Name##Entry *old = self->entries; \
+   uint32_t capacity = self->mask + 1; \
+   uint32_t i; \
+\
+   self->entries = Memory_SafeMalloc0 (2 * capacity * sizeof (Name##Entry)); \
+   self->mask = (2 * capacity) - 1; \
+\
+   for (i = 0; i < capacity; i++) { \
+      if (old [i].hash) { \
+         Name##_Place (self, old [i]); \
+      } \
+   } \
+\
+   Memory_Free (old); \
+} \
+\
+static __inline__ void \
+Name##_Insert (Name *self, KeyType key, ValueType value) \
+{ \
+   Name##Entry *existing; \
+   Name##Entry entry; \
+   uint32_t capacity; \
+\
+   if ((existing = Name##_Find (self, key))) { \
+      existing->value = value; \
+      return; \
+   } \
+\
+   capacity = self->mask + 1; \
+   if (UNLIKELY ((self->len + 1) > (capacity - (capacity / 8)))) { \
+      Name##_Resize (self); \
+   } \
+\
+   entry.hash = Name##_HashKey (key); \
+   entry.key = key; \
+   entry.value = value; \
+   Name##_Place (self, entry); \
+   self->len++; \
+} \
+\
+static __inline__ bool \
+Name##_Remove (Name *self, KeyType key) \
+{ \
+   Name##Entry *entry; \
+   Name##Entry *next; \
+   uint32_t pos; \
+\
+   if (!(entry = Name##_Find (self, key))) { \
+      return false; \
+   } \
+\
+   /* \
+    * Shift the following entries of the cluster back by one until one \
+    * is in its home bucket, so that no tombstone is needed. \
+    */ \
+   pos = entry - self->entries; \
+\
+   for (;;) { \
+      next = &self->entries [(pos + 1) & self->mask]; \
+      if (!next->hash || \
+          !((((pos + 1) & self->mask) - next->hash) & self->mask)) { \
+         break; \
+      } \
+      self->entries [pos] = *next; \
+      pos = (pos + 1) & self->mask; \
+   } \
+\
+   self->entries [pos].hash = 0; \
+   self->len--; \
+\
+   return true; \
+} \
+\
+static __inline__ bool \
+Name##_Next (Name *self, uint32_t *iter, Name##Entry **entry) \
+{ \
+   while (*iter <= self->mask) { \
+      if (self->entries [(*iter)++].hash) { \
+         *entry = &self->entries [*iter - 1]; \
+         return true; \
+      } \
+   } \
+\
+   return false; \
+}
+
+
+END_DECLS
+
+
+#endif /* HASHMAP_H */
@@ -17,34 +17,497 @@
  */
 
 
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
 #include <Debug.h>
+#include <Hash.h>
 #include <HashTable.h>
+#include <Math.h>
 #include <Memory.h>
 
 
-typedef struct _HashTableItem HashTableItem;
+/*
+ * HashTable is an open addressing table in the style of SwissTable.
+ *
+ * Next to the array of slots we keep one control byte per slot. A full
+ * slot's control byte holds the low 7 bits of its hash, so a lookup can
+ * compare the control bytes of a whole group of slots at once (with SSE2
+ * where available) and only calls equal_func on slots whose 7 bits match
+ * and whose stored hash is equal. Empty and deleted slots have the high
+ * bit set.
+ *
+ * Groups are probed in triangular order over a power-of-two capacity,
+ * which visits every group exactly once. The first group's control bytes
+ * are cloned past the end so that a group can be loaded at any offset.
+ *
+ * When the table needs to grow we allocate the new buckets at once but
+ * move entries over incrementally, a few slots on each insert and remove,
+ * so that no single operation pays for rehashing the whole table. Until
+ * that finishes, lookups consult both sets of buckets.
+ */
+
+
+#define GROUP_WIDTH   16
+#define MIGRATE_STEP  16
+#define MIN_CAPACITY  GROUP_WIDTH
 
+#define CTRL_EMPTY    ((int8_t)-128) /* 0x80 */
+#define CTRL_DELETED  ((int8_t)-2)   /* 0xFE */
 
-struct _HashTableItem
+#define H1(h)         ((h) >> 7)
+#define H2(h)         ((int8_t)((h) & 0x7F))
+
+#define IS_FULL(c)    ((c) >= 0)
+
+
+typedef struct
 {
-   HashTableItem *next;
-   void *key;
-   void *value;
-};
+   uint32_t  hash;
+   void     *key;
+   void     *value;
+} HashTableSlot;
+
+
+typedef struct
+{
+   int8_t        *ctrl;
+   HashTableSlot *slots;
+   uint32_t       capacity;
+   uint32_t       size;
+   uint32_t       growth_left;
+} HashTableBuckets;
 
 
 struct _HashTable
 {
-   uint32_t len;
-   uint32_t key_count;
-   HashFunc hash_func;
-   EqualFunc equal_func;
-   FreeFunc key_free_func;
-   FreeFunc value_free_func;
-   HashTableItem *table[0];
+   HashTableBuckets buckets;
+   HashTableBuckets old;
+   uint32_t         migrate_pos;
+   HashFunc         hash_func;
+   EqualFunc        equal_func;
+   FreeFunc         key_free_func;
+   FreeFunc         value_free_func;
 };
 
 
+/*
+ * Group matching. Each returns a bitmask with bit i set if the i'th
+ * control byte of the group matches.
+ */
+
+#if defined(__SSE2__)
+
+static __inline__ uint32_t
+Group_Match (const int8_t *ctrl, /* IN */
+             int8_t h2)          /* IN */
+{
+   __m128i group = _mm_loadu_si128 ((const __m128i *)ctrl);
+
+   return _mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_set1_epi8 (h2), group));
+}
+
+
+static __inline__ uint32_t
+Group_MatchEmpty (const int8_t *ctrl) /* IN */
+{
+   return Group_Match (ctrl, CTRL_EMPTY);
+}
+
+
+static __inline__ uint32_t
+Group_MatchEmptyOrDeleted (const int8_t *ctrl) /* IN */
+{
+   /*
+    * Empty and deleted are the only negative control bytes.
+    */
+   return _mm_movemask_epi8 (_mm_loadu_si128 ((const __m128i *)ctrl));
+}
+
+#else
+
+static __inline__ uint32_t
+Group_Match (const int8_t *ctrl, /* IN */
+             int8_t h2)          /* IN */
+{
+   uint32_t mask = 0;
+   int i;
+
+   for (i = 0; i < GROUP_WIDTH; i++) {
+      mask |= (uint32_t)(ctrl [i] == h2) << i;
+   }
+
+   return mask;
+}
+
+
+static __inline__ uint32_t
+Group_MatchEmpty (const int8_t *ctrl) /* IN */
+{
+   return Group_Match (ctrl, CTRL_EMPTY);
+}
+
+
+static __inline__ uint32_t
+Group_MatchEmptyOrDeleted (const int8_t *ctrl) /* IN */
+{
+   uint32_t mask = 0;
+   int i;
+
+   for (i = 0; i < GROUP_WIDTH; i++) {
+      mask |= (uint32_t)(ctrl [i] < 0) << i;
+   }
+
+   return mask;
+}
+
+#endif
+
+
+/*
+ * Finalizer from MurmurHash3. We take both the control byte and the
+ * starting group from the low bits of the hash, so guard against
+ * caller-supplied hash functions that distribute those poorly.
+ */
+static __inline__ uint32_t
+HashTable_Mix (uint32_t h) /* IN */
+{
+   h ^= h >> 16;
+   h *= 0x85EBCA6B;
+   h ^= h >> 13;
+   h *= 0xC2B2AE35;
+   h ^= h >> 16;
+
+   return h;
+}
+
+
+static __inline__ uint32_t
+HashTable_GrowthLimit (uint32_t capacity) /* IN */
+{
+   return capacity - (capacity / 8);
+}
+
+
+static void
+HashTableBuckets_Init (HashTableBuckets *buckets, /* OUT */
+                       uint32_t capacity)         /* IN */
+{
+   size_t ctrl_size;
+
+   ASSERT (capacity >= MIN_CAPACITY);
+   ASSERT (capacity == UInt32_NextPowerOf2 (capacity));
+
+   /*
+    * One allocation holds the slots followed by the control bytes.
+    */
+   ctrl_size = capacity + GROUP_WIDTH;
+
+   buckets->slots = Memory_SafeMalloc ((sizeof (HashTableSlot) * capacity) +
+                                       ctrl_size);
+   buckets->ctrl = (int8_t *)(buckets->slots + capacity);
+   buckets->capacity = capacity;
+   buckets->size = 0;
+   buckets->growth_left = HashTable_GrowthLimit (capacity);
+
+   memset (buckets->ctrl, CTRL_EMPTY, ctrl_size);
+}
+
+
+static void
+HashTableBuckets_Destroy (HashTableBuckets *buckets) /* IN */
+{
+   Memory_Free (buckets->slots);
+   Memory_Zero (buckets, sizeof *buckets);
+}
+
+
+static __inline__ void
+HashTableBuckets_SetCtrl (HashTableBuckets *buckets, /* IN */
+                          uint32_t i,                /* IN */
+                          int8_t ctrl)               /* IN */
+{
+   buckets->ctrl [i] = ctrl;
+
+   if (i < GROUP_WIDTH) {
+      buckets->ctrl [buckets->capacity + i] = ctrl;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * HashTableBuckets_Find --
+ *
+ *       Looks up key in buckets.
+ *
+ * Returns:
+ *       The index of the slot holding key, or -1 if not found.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static int64_t
+HashTableBuckets_Find (HashTable *hash_table,       /* IN */
+                       HashTableBuckets *buckets,   /* IN */
+                       const void *key,             /* IN */
+                       uint32_t hash)               /* IN */
+{
+   const uint32_t mask = buckets->capacity - 1;
+   HashTableSlot *slot;
+   uint32_t match;
+   uint32_t pos;
+   uint32_t i;
+   uint32_t step = 0;
+
+   if (!buckets->size) {
+      return -1;
+   }
+
+   pos = H1 (hash) & mask;
+
+   for (;;) {
+      match = Group_Match (&buckets->ctrl [pos], H2 (hash));
+
+      while (match) {
+         i = (pos + __builtin_ctz (match)) & mask;
+         slot = &buckets->slots [i];
+         if ((slot->hash == hash) &&
+             hash_table->equal_func (key, slot->key)) {
+            return i;
+         }
+         match &= match - 1;
+      }
+
+      if (Group_MatchEmpty (&buckets->ctrl [pos])) {
+         return -1;
+      }
+
+      step += GROUP_WIDTH;
+      pos = (pos + step) & mask;
+
+      ASSERT (step <= buckets->capacity);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * HashTableBuckets_FindFree --
+ *
+ *       Finds the first empty or deleted slot in the probe sequence for
+ *       hash. There is always one since we never fill the table.
+ *
+ * Returns:
+ *       The index of the slot.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static uint32_t
+HashTableBuckets_FindFree (HashTableBuckets *buckets, /* IN */
+                           uint32_t hash)             /* IN */
+{
+   const uint32_t mask = buckets->capacity - 1;
+   uint32_t match;
+   uint32_t pos;
+   uint32_t step = 0;
+
+   pos = H1 (hash) & mask;
+
+   for (;;) {
+      if ((match = Group_MatchEmptyOrDeleted (&buckets->ctrl [pos]))) {
+         return (pos + __builtin_ctz (match)) & mask;
+      }
+
+      step += GROUP_WIDTH;
+      pos = (pos + step) & mask;
+
+      ASSERT (step <= buckets->capacity);
+   }
+}
+
+
+static void
+HashTableBuckets_Put (HashTableBuckets *buckets, /* IN */
+                      uint32_t i,                /* IN */
+                      uint32_t hash,             /* IN */
+                      void *key,                 /* IN */
+                      void *value)               /* IN */
+{
+   HashTableSlot *slot = &buckets->slots [i];
+
+   ASSERT (!IS_FULL (buckets->ctrl [i]));
+
+   if (buckets->ctrl [i] == CTRL_EMPTY) {
+      ASSERT (buckets->growth_left);
+      buckets->growth_left--;
+   }
+
+   HashTableBuckets_SetCtrl (buckets, i, H2 (hash));
+   slot->hash = hash;
+   slot->key = key;
+   slot->value = value;
+   buckets->size++;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * HashTableBuckets_Erase --
+ *
+ *       Frees slot i. If no probe sequence can have passed over the slot
+ *       while it was full, it becomes empty again; otherwise it is marked
+ *       deleted so that those lookups keep going.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+HashTableBuckets_Erase (HashTableBuckets *buckets, /* IN */
+                        uint32_t i)                /* IN */
+{
+   const uint32_t mask = buckets->capacity - 1;
+   uint32_t empty_before;
+   uint32_t empty_after;
+
+   ASSERT (IS_FULL (buckets->ctrl [i]));
+
+   /*
+    * If the run of full slots around i is shorter than a group, every
+    * group load that sees slot i also sees an empty slot, so lookups
+    * through here would have stopped anyway.
+    */
+   empty_before = Group_MatchEmpty (&buckets->ctrl [(i - GROUP_WIDTH) & mask]);
+   empty_after = Group_MatchEmpty (&buckets->ctrl [i]);
+
+   if (empty_before && empty_after &&
+       ((__builtin_ctz (empty_after) +
+         (__builtin_clz (empty_before) - (32 - GROUP_WIDTH))) < GROUP_WIDTH)) {
+      HashTableBuckets_SetCtrl (buckets, i, CTRL_EMPTY);
+      buckets->growth_left++;
+   } else {
+      HashTableBuckets_SetCtrl (buckets, i, CTRL_DELETED);
+   }
+
+   buckets->size--;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * HashTable_Migrate --
+ *
+ *       Moves up to max_slots slots worth of entries from the old buckets
+ *       into the current ones. The old buckets are released once empty.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+HashTable_Migrate (HashTable *hash_table, /* IN */
+                   uint32_t max_slots)    /* IN */
+{
+   HashTableBuckets *old = &hash_table->old;
+   HashTableSlot *slot;
+   uint32_t i;
+
+   if (!old->capacity) {
+      return;
+   }
+
+   for (; max_slots && (hash_table->migrate_pos < old->capacity); max_slots--) {
+      i = hash_table->migrate_pos++;
+
+      if (IS_FULL (old->ctrl [i])) {
+         slot = &old->slots [i];
+         HashTableBuckets_Put (&hash_table->buckets,
+                               HashTableBuckets_FindFree (&hash_table->buckets,
+                                                          slot->hash),
+                               slot->hash, slot->key, slot->value);
+         /*
+          * Keep the probe sequences of the remaining old entries intact.
+          */
+         HashTableBuckets_SetCtrl (old, i, CTRL_DELETED);
+         old->size--;
+      }
+   }
+
+   if (hash_table->migrate_pos == old->capacity) {
+      ASSERT (!old->size);
+      HashTableBuckets_Destroy (old);
+      hash_table->migrate_pos = 0;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * HashTable_Resize --
+ *
+ *       Called when the buckets have run out of empty slots. Starts
+ *       moving everything into new buckets, twice as large unless most of
+ *       the used slots are tombstones.
+ *
+ *       Entries move at MIGRATE_STEP slots per insert or remove. Even if
+ *       every one of those is an insert, the migration finishes before
+ *       the new buckets could fill up, so resizes never overlap.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+HashTable_Resize (HashTable *hash_table) /* IN */
+{
+   uint32_t capacity;
+
+   ASSERT (!hash_table->old.capacity);
+
+   capacity = hash_table->buckets.capacity;
+
+   if (hash_table->buckets.size > (HashTable_GrowthLimit (capacity) / 2)) {
+      ASSERT (capacity < (1U << 31));
+      capacity *= 2;
+   }
+
+   hash_table->old = hash_table->buckets;
+   hash_table->migrate_pos = 0;
+
+   HashTableBuckets_Init (&hash_table->buckets, capacity);
+   HashTable_Migrate (hash_table, MIGRATE_STEP);
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -52,6 +515,9 @@ struct _HashTable
  *
  *       Creates a new instance of HashTable.
  *
+ *       size is the number of entries expected. The table grows as
+ *       needed, so this only saves resizing.
+ *
  * Returns:
  *       HashTable that should be freed with HashTable_Free().
  *
@@ -69,15 +535,18 @@ HashTable_Create (uint32_t size,            /* IN */
                   FreeFunc value_free_func) /* IN */
 {
    HashTable *hash_table;
-   uint32_t n_bytes;
+   uint32_t capacity;
 
    ASSERT(size > 0);
+   ASSERT(size < (1U << 30));
    ASSERT(hash_func);
    ASSERT(equal_func);
 
-   n_bytes = sizeof *hash_table + (size * sizeof (HashTableItem *));
-   hash_table = Memory_SafeMalloc0 (n_bytes);
-   hash_table->len = size;
+   capacity = UInt32_NextPowerOf2 (size + (size / 7) + 1);
+   capacity = MAX (capacity, MIN_CAPACITY);
+
+   hash_table = Memory_SafeMalloc0 (sizeof *hash_table);
+   HashTableBuckets_Init (&hash_table->buckets, capacity);
    hash_table->hash_func = hash_func;
    hash_table->equal_func = equal_func;
    hash_table->key_free_func = key_free_func;
@@ -92,7 +561,7 @@ HashTable_Create (uint32_t size,            /* IN */
  *
  * HashTable_Lookup --
  *
- *       Attempts to find the first item in the hash table matching key.
+ *       Attempts to find the item in the hash table matching key.
  *
  * Returns:
  *       The value stored in the hash table if successful; otherwise NULL.
@@ -107,17 +576,22 @@ void *
 HashTable_Lookup (HashTable *hash_table, /* IN */
                   const void *key)       /* IN */
 {
-   HashTableItem *item;
-   uint32_t pos;
+   uint32_t hash;
+   int64_t i;
 
    ASSERT(hash_table);
 
-   pos = hash_table->hash_func(key) % hash_table->len;
+   hash = HashTable_Mix (hash_table->hash_func (key));
 
-   for (item = hash_table->table[pos]; item; item = item->next) {
-      if (hash_table->equal_func(key, item->key)) {
-         return item->value;
-      }
+   if ((i = HashTableBuckets_Find (hash_table, &hash_table->buckets,
+                                   key, hash)) >= 0) {
+      return hash_table->buckets.slots [i].value;
+   }
+
+   if (UNLIKELY (hash_table->old.capacity) &&
+       (i = HashTableBuckets_Find (hash_table, &hash_table->old,
+                                   key, hash)) >= 0) {
+      return hash_table->old.slots [i].value;
    }
 
    return NULL;
@@ -129,13 +603,13 @@ HashTable_Lookup (HashTable *hash_table, /* IN */
  *
  * HashTable_Remove --
  *
- *       Removes the first item matching key from the hash table.
+ *       Removes the item matching key from the hash table.
  *
  * Returns:
  *       None.
  *
  * Side effects:
- *       None.
+ *       The key and value are freed with the free functions, if any.
  *
  *--------------------------------------------------------------------------
  */
@@ -144,32 +618,32 @@ void
 HashTable_Remove(HashTable *hash_table, /* IN */
                  const void *key)       /* IN */
 {
-   HashTableItem *item;
-   HashTableItem *last = NULL;
-   uint32_t pos;
+   HashTableBuckets *buckets = &hash_table->buckets;
+   HashTableSlot slot;
+   uint32_t hash;
+   int64_t i;
 
    ASSERT(hash_table);
 
-   pos = hash_table->hash_func(key) % hash_table->len;
+   hash = HashTable_Mix (hash_table->hash_func (key));
 
-   for (item = hash_table->table[pos]; item; item = item->next) {
-      if (hash_table->equal_func(key, item->key)) {
-         if (last) {
-            last->next = item->next;
-         } else {
-            hash_table->table[pos] = item->next;
-         }
-         hash_table->key_count--;
-         if (hash_table->value_free_func) {
-            hash_table->value_free_func(item->value);
-         }
-         if (hash_table->key_free_func) {
-            hash_table->key_free_func(item->key);
-         }
-         Memory_Free (item);
-         break;
+   if ((i = HashTableBuckets_Find (hash_table, buckets, key, hash)) < 0) {
+      buckets = &hash_table->old;
+      if (!buckets->capacity ||
+          (i = HashTableBuckets_Find (hash_table, buckets, key, hash)) < 0) {
+         return;
       }
-      last = item;
+   }
+
+   slot = buckets->slots [i];
+   HashTableBuckets_Erase (buckets, i);
+   HashTable_Migrate (hash_table, MIGRATE_STEP);
+
+   if (hash_table->value_free_func) {
+      hash_table->value_free_func(slot.value);
+   }
+   if (hash_table->key_free_func) {
+      hash_table->key_free_func(slot.key);
    }
 }
 
@@ -179,8 +653,7 @@ HashTable_Remove(HashTable *hash_table, /* IN */
  *
  * HashTable_CountKeys --
  *
- *       Returns the number of keys stored in the hash table. This does
- *       include duplicated entries.
+ *       Returns the number of keys stored in the hash table.
  *
  * Returns:
  *       The number of items in the HashTable.
@@ -195,7 +668,7 @@ uint32_t
 HashTable_CountKeys(HashTable *hash_table) /* IN */
 {
    ASSERT(hash_table);
-   return hash_table->key_count;
+   return hash_table->buckets.size + hash_table->old.size;
 }
 
 
@@ -217,22 +690,19 @@ HashTable_CountKeys(HashTable *hash_table) /* IN */
 
 bool
 HashTable_Contains(HashTable *hash_table, /* IN */
-                        const void *key)            /* IN */
+                   const void *key)       /* IN */
 {
-   HashTableItem *item;
-   uint32_t pos;
+   uint32_t hash;
 
    ASSERT(hash_table);
 
-   pos = hash_table->hash_func(key) % hash_table->len;
-
-   for (item = hash_table->table[pos]; item; item = item->next) {
-      if (hash_table->equal_func(key, item->key)) {
-         return true;
-      }
-   }
+   hash = HashTable_Mix (hash_table->hash_func (key));
 
-   return false;
+   return ((HashTableBuckets_Find (hash_table, &hash_table->buckets,
+                                   key, hash) >= 0) ||
+           (hash_table->old.capacity &&
+            (HashTableBuckets_Find (hash_table, &hash_table->old,
+                                    key, hash) >= 0)));
 }
 
 
@@ -243,34 +713,88 @@ HashTable_Contains(HashTable *hash_table, /* IN */
  *
  *       Inserts a new item into the hash table.
  *
+ *       If an item matching key already exists its value is replaced.
+ *       The old value and the new key are freed with the free functions,
+ *       if any; the existing key is kept. Nothing is freed that is also
+ *       the stored key or the new value, so re-inserting the same pointers
+ *       is harmless.
+ *
  * Returns:
  *       None.
  *
  * Side effects:
- *       None.
+ *       May start growing the table.
  *
  *--------------------------------------------------------------------------
  */
 
 void
 HashTable_Insert(HashTable *hash_table, /* IN */
-                      void *key,                  /* IN */
-                      void *data)                 /* IN */
+                 void *key,             /* IN */
+                 void *data)            /* IN */
 {
-   HashTableItem *item;
-   uint32_t pos;
+   HashTableBuckets *buckets = &hash_table->buckets;
+   HashTableSlot *slot;
+   uint32_t hash;
+   uint32_t i;
+   int64_t found;
 
    ASSERT(hash_table);
 
-   pos = hash_table->hash_func(key) % hash_table->len;
+   hash = HashTable_Mix (hash_table->hash_func (key));
+
+   if (((found = HashTableBuckets_Find (hash_table, buckets,
+                                        key, hash)) >= 0) ||
+       (hash_table->old.capacity &&
+        ((found = HashTableBuckets_Find (hash_table, (buckets = &hash_table->old),
+                                         key, hash)) >= 0))) {
+      slot = &buckets->slots [found];
+      if (hash_table->value_free_func && (slot->value != data)) {
+         hash_table->value_free_func(slot->value);
+      }
+      if (hash_table->key_free_func && (slot->key != key)) {
+         hash_table->key_free_func(key);
+      }
+      slot->value = data;
+      return;
+   }
+
+   buckets = &hash_table->buckets;
+   i = HashTableBuckets_FindFree (buckets, hash);
+
+   /*
+    * Reusing a tombstone never needs room; taking an empty slot does.
+    */
+   if (UNLIKELY (!buckets->growth_left) && (buckets->ctrl [i] == CTRL_EMPTY)) {
+      HashTable_Resize (hash_table);
+      i = HashTableBuckets_FindFree (buckets, hash);
+   }
+
+   HashTableBuckets_Put (buckets, i, hash, key, data);
+   HashTable_Migrate (hash_table, MIGRATE_STEP);
+}
+
+
+static void
+HashTableBuckets_FreeAll (HashTable *hash_table,     /* IN */
+                          HashTableBuckets *buckets) /* IN */
+{
+   HashTableSlot *slot;
+   uint32_t i;
 
-   item = Memory_SafeMalloc0 (sizeof *item);
-   item->key = key;
-   item->value = data;
-   item->next = hash_table->table[pos];
+   for (i = 0; i < buckets->capacity; i++) {
+      if (IS_FULL (buckets->ctrl [i])) {
+         slot = &buckets->slots [i];
+         if (hash_table->key_free_func) {
+            hash_table->key_free_func(slot->key);
+         }
+         if (hash_table->value_free_func) {
+            hash_table->value_free_func(slot->value);
+         }
+      }
+   }
 
-   hash_table->table[pos] = item;
-   hash_table->key_count++;
+   HashTableBuckets_Destroy (buckets);
 }
 
 
@@ -293,25 +817,11 @@ HashTable_Insert(HashTable *hash_table, /* IN */
 void
 HashTable_Free(HashTable *hash_table) /* IN */
 {
-   HashTableItem *item;
-   HashTableItem *removed;
-   int32_t i;
-
    ASSERT(hash_table);
 
-   for (i = 0; i < hash_table->len; i++) {
-      item = hash_table->table[i];
-      while (item) {
-         removed = item;
-         item = item->next;
-         if (hash_table->key_free_func) {
-            hash_table->key_free_func(removed->key);
-         }
-         if (hash_table->value_free_func) {
-            hash_table->value_free_func(removed->value);
-         }
-         Memory_Free(removed);
-      }
+   HashTableBuckets_FreeAll (hash_table, &hash_table->buckets);
+   if (hash_table->old.capacity) {
+      HashTableBuckets_FreeAll (hash_table, &hash_table->old);
    }
 
    Memory_Free(hash_table);
@@ -323,7 +833,7 @@ UInt32_Hash (const void *data) /* IN */
 {
    ASSERT(data);
 
-   return *(uint32_t *)data;
+   return (uint32_t)Hash_Mix64 (*(uint32_t *)data);
 }
 
 
@@ -343,7 +853,8 @@ UInt32_Equal (const void *data1, /* IN */
  *
  * Pointer_Hash --
  *
- *       Hash function for a pointer to a pointer.
+ *       Hash function for a pointer. All bits of the address are mixed
+ *       in, since heap addresses share their low and high bits.
  *
  * Returns:
  *       A uint32_t containing the hash.
@@ -357,7 +868,7 @@ UInt32_Equal (const void *data1, /* IN */
 uint32_t
 Pointer_Hash (const void *data) /* IN */
 {
-   return (uint32_t)(size_t)data;
+   return (uint32_t)Hash_Mix64 ((uintptr_t)data);
 }
 
 
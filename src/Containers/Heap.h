@@ -23,132 +23,505 @@
 
 #include <string.h>
 
-#include <Array.h>
 #include <Macros.h>
+#include <Memory.h>
+#include <MemoryPool.h>
+#include <Types.h>
 
 
 BEGIN_DECLS
 
 
-#define _HEAP_PARENT(npos)   (((npos)-1)/2)
-#define _HEAP_LEFT(npos)     (((npos)*2)+1)
-#define _HEAP_RIGHT(npos)    (((npos)*2)+2)
-#define _HEAP_ELEMENT(self, ElementType, i) \
-   (((ElementType *)((Array *)self)->data)[i])
-#define _HEAP_SWAP(self, ElementType, a, b) \
-   do { \
-      ElementType tmp; \
-      memcpy (&tmp, \
-              &_HEAP_ELEMENT(self, ElementType, a), \
-              sizeof tmp); \
-      memcpy (&_HEAP_ELEMENT(self, ElementType, a), \
-              &_HEAP_ELEMENT(self, ElementType, b), \
-              sizeof tmp); \
-      memcpy (&_HEAP_ELEMENT(self, ElementType, b), \
-              &tmp, \
-              sizeof tmp); \
-   } while (0)
+/*
+ * Heaps are generated for a specific element type. Compare is called with
+ * two ElementType pointers and the element comparing greatest is at the
+ * top of the heap, so a min-heap simply reverses its comparison.
+ *
+ * Two implementations are available behind the same API:
+ *
+ *   DARY_HEAP_DEFINE (Name, ElementType, Compare, Arity)
+ *
+ *     An implicit heap in an array where each node has Arity children.
+ *     The storage is offset so that every group of siblings starts on a
+ *     cache line; with Arity * sizeof (ElementType) equal to the cache
+ *     line size, finding the best child touches a single line. HEAP_DEFINE
+ *     is a 4-ary heap.
+ *
+ *   PAIRING_HEAP_DEFINE (Name, ElementType, Compare)
+ *
+ *     A pairing heap of nodes from a MemoryPool. Insert and DecreaseKey
+ *     are O(1), which suits large sets of timers that are mostly
+ *     rescheduled or cancelled rather than expired.
+ *
+ * Both generate:
+ *
+ *   void         Name_Init        (Name *self);
+ *   void         Name_Destroy     (Name *self);
+ *   unsigned     Name_Size        (Name *self);
+ *   Name##Handle Name_Insert      (Name *self, ElementType *val);
+ *   ElementType *Name_Peek        (Name *self);
+ *   bool         Name_Extract     (Name *self, ElementType *val);
+ *   ElementType *Name_Get         (Name *self, Name##Handle handle);
+ *   void         Name_DecreaseKey (Name *self, Name##Handle handle,
+ *                                  ElementType *val);
+ *   void         Name_Remove      (Name *self, Name##Handle handle,
+ *                                  ElementType *val);
+ *
+ * A handle stays valid until its element is extracted or removed.
+ * DecreaseKey replaces the element with one that compares greater or
+ * equal, moving it towards the top (an earlier deadline, for a timer).
+ * Remove may be passed a NULL val.
+ */
+
+#define _HEAP_CACHE_LINE 64
+#define _HEAP_MIN_SIZE   16
 
 
 #define HEAP_DEFINE(Name, ElementType, Compare) \
-typedef Array Name; \
+   DARY_HEAP_DEFINE (Name, ElementType, Compare, 4)
+
+
+#define DARY_HEAP_DEFINE(Name, ElementType, Compare, Arity) \
+\
+typedef uint32_t Name##Handle; \
+\
+typedef struct \
+{ \
+   ElementType *base; \
+   ElementType *data; \
+   uint32_t    *handles; \
+   uint32_t    *positions; \
+   uint32_t     len; \
+   uint32_t     allocated_len; \
+   uint32_t     free_handle; \
+} Name; \
 \
 static __inline__ unsigned \
 Name##_Size (Name *self) \
 { \
-   return ((Array *)self)->len; \
+   return self->len; \
 } \
 \
-static void \
+static __inline__ void \
 Name##_Init (Name *self) \
 { \
-   Array_Init ((Array *)self, sizeof(ElementType), false); \
+   memset (self, 0, sizeof *self); \
+   self->free_handle = UINT32_MAX; \
 } \
 \
-static void \
+static __inline__ void \
 Name##_Destroy (Name *self) \
 { \
-   Array_Destroy ((Array *)self); \
+   Memory_Free (self->base); \
+   Memory_Free (self->handles); \
+   Memory_Free (self->positions); \
+   memset (self, 0, sizeof *self); \
 } \
 \
 static void \
+Name##_Grow (Name *self) \
+{ \
+   ElementType *base; \
+   uint32_t len; \
+\
+   len = MAX (_HEAP_MIN_SIZE, self->allocated_len * 2); \
+\
+   /* \
+    * Element i lives at base [i + Arity - 1], so the children of i, \
+    * (Arity * i) + 1 through (Arity * i) + Arity, start at a multiple of \
+    * Arity. \
+    */ \
+   base = Memory_Memalign ((len + Arity - 1) * sizeof (ElementType), \
+                           _HEAP_CACHE_LINE); \
+   if (self->len) { \
+      memcpy (base + Arity - 1, self->data, \
+              self->len * sizeof (ElementType)); \
+   } \
+   Memory_Free (self->base); \
+\
+   self->base = base; \
+   self->data = base + Arity - 1; \
+   self->handles = Memory_SafeRealloc (self->handles, \
+                                       len * sizeof (uint32_t)); \
+   self->positions = Memory_SafeRealloc (self->positions, \
+                                         len * sizeof (uint32_t)); \
+   self->allocated_len = len; \
+} \
+\
+static __inline__ void \
+Name##_Place (Name *self, uint32_t pos, ElementType *val, uint32_t handle) \
+{ \
+   self->data [pos] = *val; \
+   self->handles [pos] = handle; \
+   self->positions [handle] = pos; \
+} \
+\
+static void \
+Name##_SiftUp (Name *self, uint32_t pos) \
+{ \
+   ElementType val = self->data [pos]; \
+   uint32_t handle = self->handles [pos]; \
+   uint32_t parent; \
+\
+   while (pos > 0) { \
+      parent = (pos - 1) / Arity; \
+      if (Compare (&self->data [parent], &val) >= 0) { \
+         break; \
+      } \
+      Name##_Place (self, pos, &self->data [parent], self->handles [parent]); \
+      pos = parent; \
+   } \
+\
+   Name##_Place (self, pos, &val, handle); \
+} \
+\
+static void \
+Name##_SiftDown (Name *self, uint32_t pos) \
+{ \
+   ElementType val = self->data [pos]; \
+   uint32_t handle = self->handles [pos]; \
+   uint32_t child; \
+   uint32_t last; \
+   uint32_t best; \
+\
+   for (;;) { \
+      child = (pos * Arity) + 1; \
+      if (child >= self->len) { \
+         break; \
+      } \
+\
+      last = MIN (child + Arity, self->len); \
+      for (best = child++; child < last; child++) { \
+         if (Compare (&self->data [child], &self->data [best]) > 0) { \
+            best = child; \
+         } \
+      } \
+\
+      if (Compare (&self->data [best], &val) <= 0) { \
+         break; \
+      } \
+\
+      Name##_Place (self, pos, &self->data [best], self->handles [best]); \
+      pos = best; \
+   } \
+\
+   Name##_Place (self, pos, &val, handle); \
+} \
+\
+static __inline__ Name##Handle \
 Name##_Insert (Name *self, ElementType *val) \
 { \
-   int ipos; \
-   int ppos; \
+   uint32_t handle; \
+\
+   if (UNLIKELY (self->len == self->allocated_len)) { \
+      Name##_Grow (self); \
+   } \
+\
+   /* \
+    * With no free handles, every handle handed out is live, so the next \
+    * one is len. \
+    */ \
+   if (self->free_handle != UINT32_MAX) { \
+      handle = self->free_handle; \
+      self->free_handle = self->positions [handle]; \
+   } else { \
+      handle = self->len; \
+   } \
+\
+   Name##_Place (self, self->len, val, handle); \
+   Name##_SiftUp (self, self->len++); \
+\
+   return handle; \
+} \
+\
+static __inline__ ElementType * \
+Name##_Peek (Name *self) \
+{ \
+   return self->len ? &self->data [0] : NULL; \
+} \
+\
+static __inline__ ElementType * \
+Name##_Get (Name *self, Name##Handle handle) \
+{ \
+   return &self->data [self->positions [handle]]; \
+} \
+\
+static void \
+Name##_Remove (Name *self, Name##Handle handle, ElementType *val) \
+{ \
+   uint32_t pos = self->positions [handle]; \
+   uint32_t parent; \
 \
-   ipos = Name##_Size(self); \
-   ppos = _HEAP_PARENT (ipos); \
+   if (val) { \
+      *val = self->data [pos]; \
+   } \
 \
-   Array_AppendRange ((Array *)self, 1, val); \
+   self->positions [handle] = self->free_handle; \
+   self->free_handle = handle; \
+\
+   if (pos == --self->len) { \
+      return; \
+   } \
 \
-   while ((ipos > 0) && \
-          (Compare (&_HEAP_ELEMENT (self, ElementType, ppos), \
-                    &_HEAP_ELEMENT (self, ElementType, ipos)) < 0)) { \
-      _HEAP_SWAP (self, ElementType, ppos, ipos); \
+   Name##_Place (self, pos, &self->data [self->len], \
+                 self->handles [self->len]); \
 \
-      ipos = ppos; \
-      ppos = _HEAP_PARENT (ipos); \
+   parent = (pos - 1) / Arity; \
+   if ((pos > 0) && \
+       (Compare (&self->data [parent], &self->data [pos]) < 0)) { \
+      Name##_SiftUp (self, pos); \
+   } else { \
+      Name##_SiftDown (self, pos); \
    } \
 } \
 \
-static bool \
+static __inline__ bool \
 Name##_Extract (Name *self, ElementType *val) \
 { \
-   int ipos; \
-   int lpos; \
-   int rpos; \
-   int mpos; \
+   if (!self->len) { \
+      return false; \
+   } \
+\
+   Name##_Remove (self, self->handles [0], val); \
 \
-   if (Name##_Size (self)) { \
-      memcpy (val, &_HEAP_ELEMENT (self, ElementType, 0), sizeof *val); \
-      memmove (&_HEAP_ELEMENT (self, ElementType, 0), \
-               &_HEAP_ELEMENT (self, ElementType, Name##_Size(self) - 1), \
-               sizeof(ElementType)); \
+   return true; \
+} \
+\
+static __inline__ void \
+Name##_DecreaseKey (Name *self, Name##Handle handle, ElementType *val) \
+{ \
+   uint32_t pos = self->positions [handle]; \
+\
+   self->data [pos] = *val; \
+   Name##_SiftUp (self, pos); \
+}
+
+
+#define PAIRING_HEAP_DEFINE(Name, ElementType, Compare) \
 \
-      ((Array *)self)->len--; \
+typedef struct _##Name##Node Name##Node; \
+typedef Name##Node *Name##Handle; \
 \
-      if (!Name##_Size (self)) { \
-         return true; \
+/* \
+ * Children form a list through next. prev is the left sibling, or the \
+ * parent for the first child. \
+ */ \
+struct _##Name##Node \
+{ \
+   ElementType  value; \
+   Name##Node  *child; \
+   Name##Node  *next; \
+   Name##Node  *prev; \
+}; \
+\
+typedef struct \
+{ \
+   Name##Node *root; \
+   unsigned    len; \
+} Name; \
+\
+MEMORY_POOL (Name##NodePool, Name##Node, #Name "Node") \
+\
+static __inline__ unsigned \
+Name##_Size (Name *self) \
+{ \
+   return self->len; \
+} \
+\
+static __inline__ void \
+Name##_Init (Name *self) \
+{ \
+   self->root = NULL; \
+   self->len = 0; \
+} \
+\
+static void \
+Name##_Destroy (Name *self) \
+{ \
+   Name##Node *node = self->root; \
+   Name##Node *tmp; \
+\
+   /* \
+    * Rotate children up into the sibling chain so that the tree is \
+    * freed iteratively. \
+    */ \
+   while (node) { \
+      if (node->child) { \
+         tmp = node->child; \
+         node->child = tmp->next; \
+         tmp->next = node; \
+         node = tmp; \
+      } else { \
+         tmp = node->next; \
+         Name##NodePool_Free (node); \
+         node = tmp; \
       } \
+   } \
 \
-      ipos = 0; \
+   self->root = NULL; \
+   self->len = 0; \
+} \
 \
-      for (;;) { \
-         lpos = _HEAP_LEFT (ipos); \
-         rpos = _HEAP_RIGHT (ipos); \
+static __inline__ Name##Node * \
+Name##_Meld (Name##Node *a, Name##Node *b) \
+{ \
+   Name##Node *tmp; \
 \
-         if ((lpos < Name##_Size (self)) && \
-             (Compare (&_HEAP_ELEMENT (self, ElementType, lpos), \
-                       &_HEAP_ELEMENT (self, ElementType, ipos)) > 0)) { \
-            mpos = lpos; \
-         } else { \
-            mpos = ipos; \
-         } \
+   if (Compare (&a->value, &b->value) < 0) { \
+      tmp = a; \
+      a = b; \
+      b = tmp; \
+   } \
 \
-         if ((rpos < Name##_Size (self)) && \
-             (Compare (&_HEAP_ELEMENT(self, ElementType, rpos), \
-                       &_HEAP_ELEMENT(self, ElementType, mpos)) > 0)) { \
-            mpos = rpos; \
-         } \
+   b->prev = a; \
+   b->next = a->child; \
+   if (a->child) { \
+      a->child->prev = b; \
+   } \
+   a->child = b; \
 \
-         if (mpos == ipos) { \
-            break; \
-         } \
+   return a; \
+} \
+\
+static Name##Node * \
+Name##_MergePairs (Name##Node *first) \
+{ \
+   Name##Node *merged = NULL; \
+   Name##Node *root; \
+   Name##Node *a; \
+   Name##Node *b; \
+   Name##Node *next; \
+\
+   if (!first) { \
+      return NULL; \
+   } \
+\
+   /* \
+    * Meld siblings pairwise from left to right, then meld the results \
+    * from right to left. \
+    */ \
+   while (first) { \
+      a = first; \
+      b = a->next; \
+      if (b) { \
+         first = b->next; \
+         a = Name##_Meld (a, b); \
+      } else { \
+         first = NULL; \
+      } \
+      a->next = merged; \
+      merged = a; \
+   } \
+\
+   root = merged; \
+   merged = merged->next; \
+\
+   while (merged) { \
+      next = merged->next; \
+      root = Name##_Meld (root, merged); \
+      merged = next; \
+   } \
+\
+   root->next = NULL; \
+   root->prev = NULL; \
 \
-         _HEAP_SWAP (self, ElementType, mpos, ipos); \
+   return root; \
+} \
+\
+static __inline__ Name##Handle \
+Name##_Insert (Name *self, ElementType *val) \
+{ \
+   Name##Node *node; \
+\
+   node = Name##NodePool_Alloc0 (); \
+   node->value = *val; \
+\
+   self->root = self->root ? Name##_Meld (self->root, node) : node; \
+   self->root->prev = NULL; \
+   self->root->next = NULL; \
+   self->len++; \
+\
+   return node; \
+} \
+\
+static __inline__ ElementType * \
+Name##_Peek (Name *self) \
+{ \
+   return self->root ? &self->root->value : NULL; \
+} \
+\
+static __inline__ ElementType * \
+Name##_Get (Name *self, Name##Handle handle) \
+{ \
+   return &handle->value; \
+} \
+\
+static __inline__ void \
+Name##_Cut (Name##Node *node) \
+{ \
+   if (node->prev->child == node) { \
+      node->prev->child = node->next; \
+   } else { \
+      node->prev->next = node->next; \
+   } \
+\
+   if (node->next) { \
+      node->next->prev = node->prev; \
+   } \
 \
-         ipos = mpos; \
+   node->next = NULL; \
+   node->prev = NULL; \
+} \
+\
+static void \
+Name##_Remove (Name *self, Name##Handle handle, ElementType *val) \
+{ \
+   Name##Node *children; \
+\
+   if (val) { \
+      *val = handle->value; \
+   } \
+\
+   children = Name##_MergePairs (handle->child); \
+\
+   if (handle == self->root) { \
+      self->root = children; \
+   } else { \
+      Name##_Cut (handle); \
+      if (children) { \
+         self->root = Name##_Meld (self->root, children); \
       } \
+   } \
 \
-      return true; \
+   Name##NodePool_Free (handle); \
+   self->len--; \
+} \
+\
+static __inline__ bool \
+Name##_Extract (Name *self, ElementType *val) \
+{ \
+   if (!self->root) { \
+      return false; \
    } \
 \
-   return false; \
+   Name##_Remove (self, self->root, val); \
+\
+   return true; \
+} \
+\
+static __inline__ void \
+Name##_DecreaseKey (Name *self, Name##Handle handle, ElementType *val) \
+{ \
+   handle->value = *val; \
+\
+   if (handle != self->root) { \
+      Name##_Cut (handle); \
+      self->root = Name##_Meld (self->root, handle); \
+   } \
 }
 
 
 END_DECLS
 
 
-#endif /* _HEAP_H */
+#endif /* HEAP_H */
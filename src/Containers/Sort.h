@@ -22,6 +22,7 @@
 
 
 #include <Macros.h>
+#include <Types.h>
 
 
 BEGIN_DECLS
@@ -34,6 +35,183 @@ typedef int (*CompareDataFunc) (const void *a,
                                 void *user_data);
 
 
+/*
+ * SORT_DEFINE generates a sort and binary search specialized for
+ * ElementType. Compare is called with two ElementType pointers like a
+ * CompareFunc, but as it is known at compile time it can be a macro or
+ * an inline function, and elements are moved by assignment rather than
+ * by a memcpy() of runtime size.
+ *
+ *   #define UInt64_Compare(a,b) ((*(a) > *(b)) - (*(a) < *(b)))
+ *   SORT_DEFINE (UInt64, uint64_t, UInt64_Compare)
+ *
+ *   UInt64_Sort (values, n_values);
+ *
+ * The sort is an introsort: quicksort with a median-of-three pivot,
+ * falling back to heapsort if partitioning goes badly, and insertion sort
+ * for short ranges. Like qsort() it is not stable.
+ */
+
+#define _SORT_INSERTION_THRESHOLD 16
+
+
+#define SORT_DEFINE(Name, ElementType, Compare) \
+\
+static __inline__ void \
+Name##_InsertionSort (ElementType *base, size_t n) \
+{ \
+   ElementType tmp; \
+   size_t i; \
+   size_t j; \
+\
+   for (i = 1; i < n; i++) { \
+      tmp = base [i]; \
+      for (j = i; (j > 0) && (Compare (&tmp, &base [j - 1]) < 0); j--) { \
+         base [j] = base [j - 1]; \
+      } \
+      base [j] = tmp; \
+   } \
+} \
+\
+static __inline__ void \
+Name##_SiftDown (ElementType *base, size_t root, size_t n) \
+{ \
+   ElementType tmp; \
+   size_t child; \
+\
+   tmp = base [root]; \
+\
+   while ((child = (root * 2) + 1) < n) { \
+      if (((child + 1) < n) && \
+          (Compare (&base [child], &base [child + 1]) < 0)) { \
+         child++; \
+      } \
+      if (Compare (&tmp, &base [child]) >= 0) { \
+         break; \
+      } \
+      base [root] = base [child]; \
+      root = child; \
+   } \
+\
+   base [root] = tmp; \
+} \
+\
+static __inline__ void \
+Name##_HeapSort (ElementType *base, size_t n) \
+{ \
+   ElementType tmp; \
+   size_t i; \
+\
+   for (i = n / 2; i > 0; i--) { \
+      Name##_SiftDown (base, i - 1, n); \
+   } \
+\
+   for (i = n - 1; i > 0; i--) { \
+      tmp = base [0]; \
+      base [0] = base [i]; \
+      base [i] = tmp; \
+      Name##_SiftDown (base, 0, i); \
+   } \
+} \
+\
+static void \
+Name##_IntroSort (ElementType *base, size_t n, unsigned depth) \
+{ \
+   ElementType pivot; \
+   ElementType tmp; \
+   size_t mid; \
+   size_t i; \
+   size_t j; \
+\
+   while (n > _SORT_INSERTION_THRESHOLD) { \
+      if (!depth--) { \
+         Name##_HeapSort (base, n); \
+         return; \
+      } \
+\
+      mid = (n - 1) / 2; \
+\
+      if (Compare (&base [mid], &base [0]) < 0) { \
+         tmp = base [mid]; base [mid] = base [0]; base [0] = tmp; \
+      } \
+      if (Compare (&base [n - 1], &base [mid]) < 0) { \
+         tmp = base [mid]; base [mid] = base [n - 1]; base [n - 1] = tmp; \
+         if (Compare (&base [mid], &base [0]) < 0) { \
+            tmp = base [mid]; base [mid] = base [0]; base [0] = tmp; \
+         } \
+      } \
+\
+      /* \
+       * Hoare partition. base [0] <= pivot <= base [n - 1] act as \
+       * sentinels for the scans. \
+       */ \
+      pivot = base [mid]; \
+      i = 0; \
+      j = n - 1; \
+\
+      for (;;) { \
+         do { i++; } while (Compare (&base [i], &pivot) < 0); \
+         do { j--; } while (Compare (&pivot, &base [j]) < 0); \
+         if (i >= j) { \
+            break; \
+         } \
+         tmp = base [i]; base [i] = base [j]; base [j] = tmp; \
+      } \
+\
+      /* \
+       * Recurse into the smaller half, loop on the larger. \
+       */ \
+      j++; \
+      if (j < (n - j)) { \
+         Name##_IntroSort (base, j, depth); \
+         base += j; \
+         n -= j; \
+      } else { \
+         Name##_IntroSort (base + j, n - j, depth); \
+         n = j; \
+      } \
+   } \
+\
+   Name##_InsertionSort (base, n); \
+} \
+\
+static __inline__ void \
+Name##_Sort (ElementType *base, size_t n) \
+{ \
+   unsigned depth = 0; \
+   size_t m; \
+\
+   for (m = n; m > 1; m >>= 1) { \
+      depth += 2; \
+   } \
+\
+   Name##_IntroSort (base, n, depth); \
+} \
+\
+static __inline__ ElementType * \
+Name##_Search (ElementType *base, size_t n, const ElementType *key) \
+{ \
+   size_t lo = 0; \
+   size_t hi = n; \
+   size_t mid; \
+   int cmp; \
+\
+   while (lo < hi) { \
+      mid = lo + ((hi - lo) / 2); \
+      cmp = Compare (key, &base [mid]); \
+      if (cmp == 0) { \
+         return &base [mid]; \
+      } else if (cmp < 0) { \
+         hi = mid; \
+      } else { \
+         lo = mid + 1; \
+      } \
+   } \
+\
+   return NULL; \
+}
+
+
 END_DECLS
 
 
@@ -45,6 +45,16 @@ BEGIN_DECLS
 # define AtomicInt64_Sub(p, v)             (__sync_sub_and_fetch_8(p, v))
 # define AtomicInt64_SubAndTest(p, v)      (__sync_sub_and_fetch_8(p, v) == 0)
 # define AtomicInt64_CompareAndSwap        AtomicInt_CompareAndSwap
+# define AtomicInt_GetAcquire(p)           (__atomic_load_n(p, __ATOMIC_ACQUIRE))
+# define AtomicInt_GetSeqCst(p)            (__atomic_load_n(p, __ATOMIC_SEQ_CST))
+# define AtomicInt_SetRelease(p, v)        (__atomic_store_n(p, v, __ATOMIC_RELEASE))
+# define AtomicInt_SetSeqCst(p, v)         (__atomic_store_n(p, v, __ATOMIC_SEQ_CST))
+# define AtomicInt64_GetAcquire(p)         (__atomic_load_n(p, __ATOMIC_ACQUIRE))
+# define AtomicInt64_SetRelease(p, v)      (__atomic_store_n(p, v, __ATOMIC_RELEASE))
+# define AtomicPtr_GetAcquire(p)           (__atomic_load_n(p, __ATOMIC_ACQUIRE))
+# define AtomicPtr_SetRelease(p, v)        (__atomic_store_n(p, v, __ATOMIC_RELEASE))
+# define Atomic_FenceAcquire()             (__atomic_thread_fence(__ATOMIC_ACQUIRE))
+# define Atomic_CompilerBarrier()          (__atomic_signal_fence(__ATOMIC_SEQ_CST))
 #elif defined(_MSC_VER)
 # define AtomicInt_Add(p, v)               (InterlockedAdd(p, v))
 # define AtomicInt_Increment(p)            (InterlockedIncrement(p))
@@ -60,6 +70,16 @@ BEGIN_DECLS
 # define AtomicInt64_Sub(p, v)             (InterlockedAdd64(p, -(v)))
 # define AtomicInt64_SubAndTest(p, v)      (InterlockedAdd64(p, -(v)) == 0)
 # define AtomicInt64_CompareAndSwap(p,o,n) (InterlockedCompareExchange64(p,n,o))
+# define AtomicInt_GetAcquire(p)           (AtomicInt_Get(p))
+# define AtomicInt_GetSeqCst(p)            (AtomicInt_Get(p))
+# define AtomicInt_SetRelease(p, v)        (AtomicInt_Set(p, v))
+# define AtomicInt_SetSeqCst(p, v)         (AtomicInt_Set(p, v))
+# define AtomicInt64_GetAcquire(p)         (AtomicInt64_Get(p))
+# define AtomicInt64_SetRelease(p, v)      (AtomicInt64_Set(p, v))
+# define AtomicPtr_GetAcquire(p)           (AtomicPtr_Get(p))
+# define AtomicPtr_SetRelease(p, v)        (AtomicPtr_Set((void **)(p), v))
+# define Atomic_FenceAcquire()             (Memory_Barrier())
+# define Atomic_CompilerBarrier()          (_ReadWriteBarrier())
 #else
 # error "Unknown compiler, teach me how to do atomics!"
 #endif
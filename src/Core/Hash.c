@@ -0,0 +1,472 @@
+/* Hash.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+# include <nmmintrin.h>
+# define HASH_CRC32C_SSE42 1
+#endif
+
+#include <Endian.h>
+#include <Hash.h>
+#include <Platform.h>
+
+
+/*
+ * Constants and structure follow wyhash by Wang Yi, which is released
+ * into the public domain.
+ */
+static const uint64_t gHashSecret [4] = {
+   0x2D358DCCAA6C78A5ULL,
+   0x8BB84B93962EACC9ULL,
+   0x4B33A62ED433D4A3ULL,
+   0x4D5A2DA51DE1AA47ULL,
+};
+
+
+static uint64_t gHashSeed;
+
+
+/*
+ * CRC-32C (Castagnoli), reflected, as used by iSCSI, ext4 and the MongoDB
+ * OP_MSG checksum. The tables are for the slicing-by-8 fallback when the
+ * CPU lacks the SSE4.2 crc32 instruction.
+ */
+#define HASH_CRC32C_POLY 0x82F63B78U
+
+typedef uint32_t (*HashCrc32cFunc) (uint32_t crc,
+                                    const uint8_t *p,
+                                    size_t len);
+
+static uint32_t       gCrc32cTable [8][256];
+static HashCrc32cFunc gCrc32cFunc;
+
+
+/*
+ * 64x64 -> 128 bit multiply, returning the low half in *a and the high
+ * half in *b.
+ */
+static __inline__ void
+Hash_Mum (uint64_t *a, /* IN/OUT */
+          uint64_t *b) /* IN/OUT */
+{
+#if defined(__SIZEOF_INT128__)
+   __uint128_t r = *a;
+
+   r *= *b;
+   *a = (uint64_t)r;
+   *b = (uint64_t)(r >> 64);
+#else
+   uint64_t ha = *a >> 32;
+   uint64_t hb = *b >> 32;
+   uint64_t la = (uint32_t)*a;
+   uint64_t lb = (uint32_t)*b;
+   uint64_t rh = ha * hb;
+   uint64_t rm0 = ha * lb;
+   uint64_t rm1 = hb * la;
+   uint64_t rl = la * lb;
+   uint64_t t = rl + (rm0 << 32);
+   uint64_t lo;
+   uint64_t c = t < rl;
+
+   lo = t + (rm1 << 32);
+   c += lo < t;
+   *a = lo;
+   *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+
+static __inline__ uint64_t
+Hash_Mix (uint64_t a, /* IN */
+          uint64_t b) /* IN */
+{
+   Hash_Mum (&a, &b);
+   return a ^ b;
+}
+
+
+static __inline__ uint64_t
+Hash_Read64 (const uint8_t *p) /* IN */
+{
+   uint64_t v;
+
+   memcpy (&v, p, sizeof v);
+   return UINT64_FROM_LE (v);
+}
+
+
+static __inline__ uint64_t
+Hash_Read32 (const uint8_t *p) /* IN */
+{
+   uint32_t v;
+
+   memcpy (&v, p, sizeof v);
+   return UINT32_FROM_LE (v);
+}
+
+
+/*
+ * Reads 1 to 3 bytes.
+ */
+static __inline__ uint64_t
+Hash_Read3 (const uint8_t *p, /* IN */
+            size_t len)       /* IN */
+{
+   return (((uint64_t)p [0]) << 16) |
+          (((uint64_t)p [len >> 1]) << 8) |
+          p [len - 1];
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Hash_Bytes --
+ *
+ *       Hashes len bytes of data.
+ *
+ *       Keys of up to 16 bytes are read as two possibly overlapping
+ *       words; longer keys are consumed 48 bytes at a time in three
+ *       independent lanes.
+ *
+ * Returns:
+ *       A 64-bit hash of data, which is the same for equal data and seed
+ *       on every platform.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+uint64_t
+Hash_Bytes (const void *data, /* IN */
+            size_t len,       /* IN */
+            uint64_t seed)    /* IN */
+{
+   const uint8_t *p = data;
+   uint64_t see1;
+   uint64_t see2;
+   uint64_t a;
+   uint64_t b;
+   size_t i;
+
+   seed ^= Hash_Mix (seed ^ gHashSecret [0], gHashSecret [1]);
+
+   if (LIKELY (len <= 16)) {
+      if (LIKELY (len >= 4)) {
+         a = (Hash_Read32 (p) << 32) | Hash_Read32 (p + ((len >> 3) << 2));
+         b = (Hash_Read32 (p + len - 4) << 32) |
+             Hash_Read32 (p + len - 4 - ((len >> 3) << 2));
+      } else if (LIKELY (len > 0)) {
+         a = Hash_Read3 (p, len);
+         b = 0;
+      } else {
+         a = b = 0;
+      }
+   } else {
+      i = len;
+
+      if (UNLIKELY (i >= 48)) {
+         see1 = seed;
+         see2 = seed;
+         do {
+            seed = Hash_Mix (Hash_Read64 (p) ^ gHashSecret [1],
+                             Hash_Read64 (p + 8) ^ seed);
+            see1 = Hash_Mix (Hash_Read64 (p + 16) ^ gHashSecret [2],
+                             Hash_Read64 (p + 24) ^ see1);
+            see2 = Hash_Mix (Hash_Read64 (p + 32) ^ gHashSecret [3],
+                             Hash_Read64 (p + 40) ^ see2);
+            p += 48;
+            i -= 48;
+         } while (LIKELY (i >= 48));
+         seed ^= see1 ^ see2;
+      }
+
+      while (UNLIKELY (i > 16)) {
+         seed = Hash_Mix (Hash_Read64 (p) ^ gHashSecret [1],
+                          Hash_Read64 (p + 8) ^ seed);
+         i -= 16;
+         p += 16;
+      }
+
+      a = Hash_Read64 (p + i - 16);
+      b = Hash_Read64 (p + i - 8);
+   }
+
+   a ^= gHashSecret [1];
+   b ^= seed;
+   Hash_Mum (&a, &b);
+
+   return Hash_Mix (a ^ gHashSecret [0] ^ len, b ^ gHashSecret [1]);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Hash_InitSeed --
+ *
+ *       Picks the process-wide seed returned by Hash_GetSeed(). This runs
+ *       before main() so that the seed never changes once tables exist.
+ *
+ *       If /dev/urandom is unavailable we fall back to the time, pid and
+ *       address-space layout, which is weaker but still unpredictable to
+ *       a remote client.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Sets gHashSeed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+Hash_InitSeed (void) __attribute__((constructor));
+
+static void
+Hash_InitSeed (void)
+{
+   uint64_t seed = 0;
+#if defined(PLATFORM_POSIX)
+   int fd;
+
+   if (-1 != (fd = open ("/dev/urandom", O_RDONLY))) {
+      if (sizeof seed != read (fd, &seed, sizeof seed)) {
+         seed = 0;
+      }
+      close (fd);
+   }
+
+   seed ^= Hash_Mix64 (getpid ());
+#endif
+
+   seed ^= Hash_Mix64 (time (NULL));
+   seed ^= Hash_Mix64 ((uintptr_t)&seed);
+
+   gHashSeed = seed;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Hash_GetSeed --
+ *
+ *       Gets the random seed for hashing keys that may be chosen by an
+ *       attacker.
+ *
+ * Returns:
+ *       A seed for Hash_Bytes(), fixed for the life of the process.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+uint64_t
+Hash_GetSeed (void)
+{
+   return gHashSeed;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Hash_Crc32cSoft --
+ *
+ *       Slicing-by-8 CRC-32C, eight table lookups per eight bytes.
+ *
+ * Returns:
+ *       The updated, uninverted crc.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static uint32_t
+Hash_Crc32cSoft (uint32_t crc,      /* IN */
+                 const uint8_t *p,  /* IN */
+                 size_t len)        /* IN */
+{
+   uint32_t lo;
+   uint32_t hi;
+
+   for (; len >= 8; len -= 8, p += 8) {
+      memcpy (&lo, p, 4);
+      memcpy (&hi, p + 4, 4);
+      lo = UINT32_FROM_LE (lo) ^ crc;
+      hi = UINT32_FROM_LE (hi);
+      crc = gCrc32cTable [7][lo & 0xFF] ^
+            gCrc32cTable [6][(lo >> 8) & 0xFF] ^
+            gCrc32cTable [5][(lo >> 16) & 0xFF] ^
+            gCrc32cTable [4][lo >> 24] ^
+            gCrc32cTable [3][hi & 0xFF] ^
+            gCrc32cTable [2][(hi >> 8) & 0xFF] ^
+            gCrc32cTable [1][(hi >> 16) & 0xFF] ^
+            gCrc32cTable [0][hi >> 24];
+   }
+
+   for (; len; len--, p++) {
+      crc = gCrc32cTable [0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+   }
+
+   return crc;
+}
+
+
+#ifdef HASH_CRC32C_SSE42
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Hash_Crc32cSse42 --
+ *
+ *       CRC-32C with the SSE4.2 crc32 instruction, eight bytes at a time.
+ *       Only called once the CPU is known to support it.
+ *
+ * Returns:
+ *       The updated, uninverted crc.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+__attribute__((target ("sse4.2")))
+static uint32_t
+Hash_Crc32cSse42 (uint32_t crc,      /* IN */
+                  const uint8_t *p,  /* IN */
+                  size_t len)        /* IN */
+{
+   uint64_t crc64 = crc;
+   uint64_t v;
+
+   for (; len >= 8; len -= 8, p += 8) {
+      memcpy (&v, p, 8);
+      crc64 = _mm_crc32_u64 (crc64, v);
+   }
+
+   crc = (uint32_t)crc64;
+
+   for (; len; len--, p++) {
+      crc = _mm_crc32_u8 (crc, *p);
+   }
+
+   return crc;
+}
+
+
+#endif /* HASH_CRC32C_SSE42 */
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Hash_InitCrc32c --
+ *
+ *       Builds the fallback tables and picks the fastest implementation
+ *       this CPU supports.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Sets gCrc32cTable and gCrc32cFunc.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+Hash_InitCrc32c (void) __attribute__((constructor));
+
+static void
+Hash_InitCrc32c (void)
+{
+   uint32_t crc;
+   int i;
+   int j;
+
+   for (i = 0; i < 256; i++) {
+      crc = i;
+      for (j = 0; j < 8; j++) {
+         crc = (crc >> 1) ^ (HASH_CRC32C_POLY & -(crc & 1));
+      }
+      gCrc32cTable [0][i] = crc;
+   }
+
+   for (i = 0; i < 256; i++) {
+      for (j = 1; j < 8; j++) {
+         gCrc32cTable [j][i] = (gCrc32cTable [j - 1][i] >> 8) ^
+                               gCrc32cTable [0][gCrc32cTable [j - 1][i] & 0xFF];
+      }
+   }
+
+   gCrc32cFunc = Hash_Crc32cSoft;
+
+#ifdef HASH_CRC32C_SSE42
+   __builtin_cpu_init ();
+   if (__builtin_cpu_supports ("sse4.2")) {
+      gCrc32cFunc = Hash_Crc32cSse42;
+   }
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Hash_Crc32c --
+ *
+ *       Computes the CRC-32C of data. To checksum data in pieces, pass
+ *       the result for the previous pieces as crc, or 0 to start.
+ *
+ * Returns:
+ *       The crc.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+uint32_t
+Hash_Crc32c (const void *data, /* IN */
+             size_t len,       /* IN */
+             uint32_t crc)     /* IN */
+{
+   return ~gCrc32cFunc (~crc, data, len);
+}
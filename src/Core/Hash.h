@@ -0,0 +1,90 @@
+/* Hash.h
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HASH_H
+#define HASH_H
+
+
+#include <Macros.h>
+#include <Types.h>
+
+
+BEGIN_DECLS
+
+
+/*
+ * Hash_Bytes() is a wyhash-style hash for arbitrary data. It handles
+ * short keys such as collection names in a couple of multiplies and
+ * longer ones at several bytes per cycle.
+ *
+ * Hash tables whose keys may come from clients should hash with
+ * Hash_GetSeed(), which is randomized per process so that colliding keys
+ * cannot be precomputed.
+ *
+ * Hash_Mix64() scrambles integers and pointers, whose low bits are often
+ * constant (aligned addresses) or sequential (ids).
+ *
+ * Hash_Crc32c() is the CRC-32C checksum, not a hash for tables. It uses
+ * the SSE4.2 crc32 instruction where the CPU has it.
+ */
+
+
+uint64_t Hash_Bytes   (const void *data,
+                       size_t len,
+                       uint64_t seed);
+uint32_t Hash_Crc32c  (const void *data,
+                       size_t len,
+                       uint32_t crc);
+uint64_t Hash_GetSeed (void);
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Hash_Mix64 --
+ *
+ *       The 64-bit finalizer from MurmurHash3. Every input bit affects
+ *       every output bit, and distinct inputs give distinct outputs.
+ *
+ * Returns:
+ *       The mixed value.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static __inline__ uint64_t
+Hash_Mix64 (uint64_t v) /* IN */
+{
+   v ^= v >> 33;
+   v *= 0xFF51AFD7ED558CCDULL;
+   v ^= v >> 33;
+   v *= 0xC4CEB9FE1A85EC53ULL;
+   v ^= v >> 33;
+
+   return v;
+}
+
+
+END_DECLS
+
+
+#endif /* HASH_H */
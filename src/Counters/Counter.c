@@ -37,7 +37,7 @@
 
 
 #define COUNTERS_MAGIC     11552277
-#define COUNTERS_MAX_PAGES 100
+#define COUNTERS_MAX_PAGES 4096
 
 
 typedef struct
@@ -104,7 +104,19 @@ Counters_Destroy (void)
 #if defined(PLATFORM_POSIX)
    char name [32];
    int pid;
+#endif
+   unsigned i;
+
+   /*
+    * Detach every counter from the shared memory before it goes away so
+    * that anything counted from later atexit() handlers is dropped rather
+    * than written into an unmapped page.
+    */
+   for (i = 0; i < gCounters.len; i++) {
+      gCounters.counters [i]->values = NULL;
+   }
 
+#if defined(PLATFORM_POSIX)
    pid = getpid ();
 
    snprintf (name, sizeof name, "/Counters-%u", pid);
@@ -238,7 +250,7 @@ Counters_LayoutInAlloc (Counters *counters) /* IN */
    ctr_off = off + (sizeof (CounterInfo) * counters->len);
    memset (counters->mem + ctr_off, 0, counters->memsize - ctr_off);
 
-   for (i = 0, j = 0; i < counters->len; i++, j++) {
+   for (i = 0, j = 0; i < counters->len; i++) {
       strncpy (info.category,
                counters->counters [i]->category,
                sizeof (info.category));
@@ -252,7 +264,7 @@ Counters_LayoutInAlloc (Counters *counters) /* IN */
       info.category [sizeof info.category - 1] = '\0';
       info.name [sizeof info.name - 1] = '\0';
       info.description [sizeof info.description - 1] = '\0';
-      info.offset = ctr_off + (j * 8);
+      info.offset = ctr_off + (j++ * 8);
 
       /*
        * The following requires an alignment of a pointer (so 8 on 64-bit).
@@ -263,6 +275,9 @@ Counters_LayoutInAlloc (Counters *counters) /* IN */
       counters->counters [i]->values =
          (CounterValue *)(void *)(counters->mem + info.offset);
 
+      /*
+       * Each group of 8 counters shares a cacheline per CPU.
+       */
       if (j == 8) {
          ctr_off += cpucount * sizeof (CounterValue);
          j = 0;
@@ -50,7 +50,7 @@ BEGIN_DECLS
 
 #ifdef HAVE_PLATFORM_GETCURRENTCPU
 # define COUNTER_ADD(c,v) \
-   c.values [Platform_GetCurrentCpu()].value += value
+   c.values [Platform_GetCurrentCpu()].value += (v)
 #else
 # warning "Platform_GetCurrentCpu() is not supported on your platform. " \
           "Counters will use atomics which has performance implications."
@@ -129,6 +129,36 @@ typedef void (*CounterForeachFunc) (Counter *counter,
  */
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Counter_Add --
+ *
+ *       Adds value to a counter that is not known at compile time, such
+ *       as one embedded in another structure.
+ *
+ *       This is safe to call before Counters_Init(), in which case the
+ *       update is dropped.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static __inline__ void
+Counter_Add (Counter *counter, /* IN */
+             int64_t value)    /* IN */
+{
+   if (LIKELY (counter->values)) {
+      COUNTER_ADD ((*counter), value);
+   }
+}
+
+
 void    Counters_Init       (void);
 void    Counters_InitRemote (pid_t pid);
 void    Counters_Foreach    (CounterForeachFunc func,
@@ -19,10 +19,26 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <strings.h>
 #include <sys/time.h>
 #include <time.h>
 
+#include <Atomic.h>
+#include <CString.h>
+#include <Debug.h>
 #include <Log.h>
+#include <LogBinary.h>
+#include <Memory.h>
+#include <ThreadOnce.h>
+#include <TimeSpec.h>
+#include <Tunable.h>
+
+
+#define LOG_TUNABLE_LEVEL           "log.level"
+#define LOG_TUNABLE_RATELIMIT       "log.ratelimit"
+#define LOG_TUNABLE_RATELIMIT_BURST "log.ratelimit.burst"
+#define LOG_DEFAULT_RATELIMIT       0
+#define LOG_DEFAULT_RATELIMIT_BURST 200
 
 
 static void Log_DefaultLogFunc (LogLevel    level,
@@ -36,6 +52,48 @@ static void    *gLogFuncData;
 static int      gLogCorked;
 
 
+static ThreadOnce gLogTunableOnce = THREAD_ONCE_INIT;
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_LogV --
+ *
+ *       Format and log a message with a va_list.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+Log_LogV (LogLevel level,     /* IN */
+          const char *domain, /* IN */
+          const char *format, /* IN */
+          va_list args)       /* IN */
+{
+   char msgbuf [1024];
+   int ret;
+
+   ret = vsnprintf (msgbuf, sizeof msgbuf, format, args);
+
+   if (ret == -1) {
+      fprintf (stderr, "Failed to vsnprintf() \"%s\"", format);
+      return;
+   } else if (ret == sizeof msgbuf) {
+      msgbuf [sizeof msgbuf - 2] = '\n';
+      msgbuf [sizeof msgbuf - 1] = '\0';
+   }
+
+   gLogFunc (level, domain, msgbuf, gLogFuncData);
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -59,32 +117,374 @@ Log_Log (LogLevel level,     /* IN */
          ...)                /* IN */
 {
    va_list args;
-   char msgbuf [1024];
-   int ret;
 
    if (gLogCorked) {
       return;
    }
 
    va_start (args, format);
+   Log_LogV (level, domain, format, args);
+   va_end (args);
+}
 
-   ret = vsnprintf (msgbuf, sizeof msgbuf, format, args);
 
-   if (ret == -1) {
-      fprintf (stderr, "Failed to vsnprintf() \"%s\"", format);
-      va_end (args);
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_Site --
+ *
+ *       Logs a message for @site. In binary mode only the argument values
+ *       are captured, the message is formatted later by congo-logdump.
+ *
+ *       If messages from @site were suppressed by rate limiting, a
+ *       summary is logged first, so that the count reads in order.
+ *
+ *       This is normally called from the LOG_*() macros once
+ *       Log_SiteEnabled() has passed.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+Log_Site (LogSite *site,      /* IN */
+          const char *format, /* IN */
+          ...)                /* IN */
+{
+   va_list args;
+   int32_t suppressed;
+
+   ASSERT (site);
+   ASSERT (format);
+
+   if (gLogCorked) {
       return;
-   } else if (ret == sizeof msgbuf) {
-      msgbuf [sizeof msgbuf - 2] = '\n';
-      msgbuf [sizeof msgbuf - 1] = '\0';
    }
 
-   gLogFunc (level, domain, msgbuf, gLogFuncData);
+   if (UNLIKELY (site->suppressed)) {
+      do {
+         suppressed = site->suppressed;
+      } while (suppressed !=
+               AtomicInt_CompareAndSwap (&site->suppressed, suppressed, 0));
 
+      if (suppressed) {
+         Log_Log (site->level, site->domain,
+                  "Suppressed %d similar messages from %s:%d.",
+                  suppressed, site->file, site->line);
+      }
+   }
+
+   va_start (args, format);
+   if (UNLIKELY (gLogBinary)) {
+      LogBinary_Encode (site, format, args);
+   } else {
+      Log_LogV (site->level, site->domain, format, args);
+   }
    va_end (args);
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * LogLevel_FromString --
+ *
+ *       Parses a log level name such as "warning".
+ *
+ * Returns:
+ *       The LogLevel, or -1 if @str is not a log level.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static int
+LogLevel_FromString (const char *str) /* IN */
+{
+   int i;
+
+   for (i = LOG_LEVEL_TRACE; i <= LOG_LEVEL_ERROR; i++) {
+      if (0 == strcasecmp (str, LogLevel_ToString (i))) {
+         return i;
+      }
+   }
+
+   return -1;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_InitTunables --
+ *
+ *       Registers the tunables that control log filtering.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+Log_InitTunables (void)
+{
+   Value value;
+
+   Value_InitInt32 (&value, LOG_LEVEL_TRACE);
+   Tunable_Register (LOG_TUNABLE_LEVEL, &value);
+
+   Value_InitInt32 (&value, LOG_DEFAULT_RATELIMIT);
+   Tunable_Register (LOG_TUNABLE_RATELIMIT, &value);
+
+   Value_InitInt32 (&value, LOG_DEFAULT_RATELIMIT_BURST);
+   Tunable_Register (LOG_TUNABLE_RATELIMIT_BURST, &value);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_GetTunable --
+ *
+ *       Fetches the integer value of the tunable named @key. Log levels
+ *       may also be set by name, such as "warning".
+ *
+ * Returns:
+ *       The value of the tunable, or @default_value if it doesn't exist.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static int
+Log_GetTunable (const char *key,   /* IN */
+                int default_value) /* IN */
+{
+   Tunable tunable;
+   Value value;
+   int ret = default_value;
+
+   ThreadOnce_Once (&gLogTunableOnce, Log_InitTunables);
+
+   if (TUNABLE_INVALID == (tunable = Tunable_Find (key))) {
+      return default_value;
+   }
+
+   Tunable_Get (tunable, &value);
+
+   switch (value.type) {
+   case VALUE_TYPE_INT32:
+      ret = Value_GetInt32 (&value);
+      break;
+   case VALUE_TYPE_INT64:
+      ret = (int)Value_GetInt64 (&value);
+      break;
+   case VALUE_TYPE_STRING:
+      if (-1 == (ret = LogLevel_FromString (Value_GetString (&value)))) {
+         ret = default_value;
+      }
+      break;
+   default:
+      break;
+   }
+
+   Value_Destroy (&value);
+
+   return ret;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_GetLevel --
+ *
+ *       Fetches the minimum level of messages logged for @domain. This is
+ *       the "log.level.<domain>" tunable, or "log.level" if the domain
+ *       has no level of its own.
+ *
+ * Returns:
+ *       A LogLevel.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+LogLevel
+Log_GetLevel (const char *domain) /* IN */
+{
+   char key [128];
+   int level;
+
+   level = Log_GetTunable (LOG_TUNABLE_LEVEL, LOG_LEVEL_TRACE);
+
+   if (domain) {
+      snprintf (key, sizeof key, LOG_TUNABLE_LEVEL".%s", domain);
+      key [sizeof key - 1] = '\0';
+      level = Log_GetTunable (key, level);
+   }
+
+   return level;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_SetLevel --
+ *
+ *       Sets the minimum level of messages logged for @domain, or for all
+ *       domains without their own level if @domain is NULL.
+ *
+ *       This is a convenience wrapper around the "log.level" tunables.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Every LOG_*() call site refreshes its level.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+Log_SetLevel (const char *domain, /* IN */
+              LogLevel level)     /* IN */
+{
+   Tunable tunable;
+   Value value;
+   char key [128];
+
+   ThreadOnce_Once (&gLogTunableOnce, Log_InitTunables);
+
+   if (domain) {
+      snprintf (key, sizeof key, LOG_TUNABLE_LEVEL".%s", domain);
+      key [sizeof key - 1] = '\0';
+   } else {
+      CString_Copy (LOG_TUNABLE_LEVEL, key, sizeof key);
+   }
+
+   Value_InitInt32 (&value, level);
+
+   if (TUNABLE_INVALID == (tunable = Tunable_Find (key))) {
+      Tunable_Register (key, &value);
+   } else {
+      Tunable_Set (tunable, &value);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_SiteRefresh --
+ *
+ *       Recomputes the cached level and rate limit of @site after a
+ *       tunable has changed. Sites above LOG_LEVEL_WARNING are never
+ *       rate limited.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The token bucket of @site is refilled.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+Log_SiteRefresh (LogSite *site) /* IN */
+{
+   int32_t serial;
+
+   ASSERT (site);
+
+   ThreadOnce_Once (&gLogTunableOnce, Log_InitTunables);
+
+   serial = AtomicInt_Get (&gTunableSerial);
+
+   site->enabled = (site->level >= Log_GetLevel (site->domain));
+   if (site->level > LOG_LEVEL_WARNING) {
+      site->rate = 0;
+   } else {
+      site->rate = MAX (0, Log_GetTunable (LOG_TUNABLE_RATELIMIT, 0));
+   }
+   site->burst = MAX (1, Log_GetTunable (LOG_TUNABLE_RATELIMIT_BURST, 1));
+   site->tokens = site->burst * USEC_PER_SEC;
+   site->refilled = TimeSpec_GetMonotonic ();
+
+   Memory_Barrier ();
+
+   site->serial = serial;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_SiteAcquire --
+ *
+ *       Takes a token from the token bucket of @site. The bucket holds
+ *       up to "log.ratelimit.burst" tokens and is refilled with
+ *       "log.ratelimit" tokens per second.
+ *
+ *       Tokens are kept in millionths so that the bucket can be refilled
+ *       by the elapsed microseconds. Concurrent callers from different
+ *       threads can race, which only makes the limit approximate.
+ *
+ * Returns:
+ *       true if the message should be logged; false if it is suppressed.
+ *
+ * Side effects:
+ *       The suppressed count of @site is incremented on failure.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+Log_SiteAcquire (LogSite *site) /* IN */
+{
+   uint64_t now;
+   int64_t tokens;
+
+   ASSERT (site);
+
+   now = TimeSpec_GetMonotonic ();
+
+   tokens = site->tokens;
+   if (now > site->refilled) {
+      tokens += (now - site->refilled) * site->rate;
+      tokens = MIN (tokens, site->burst * (int64_t)USEC_PER_SEC);
+   }
+   site->refilled = now;
+
+   if (tokens >= USEC_PER_SEC) {
+      site->tokens = tokens - USEC_PER_SEC;
+      return true;
+   }
+
+   site->tokens = tokens;
+   AtomicInt_Increment (&site->suppressed);
+
+   return false;
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -101,7 +501,7 @@ Log_Log (LogLevel level,     /* IN */
  *--------------------------------------------------------------------------
  */
 
-static const char *
+const char *
 LogLevel_ToString (LogLevel level) /* IN */
 {
    switch (level) {
@@ -167,6 +567,39 @@ Log_DefaultLogFunc (LogLevel level,      /* IN */
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_SetLogFunc --
+ *
+ *       Sets the function that receives formatted log messages. Passing
+ *       NULL for @func restores the default function which writes to
+ *       stderr.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+Log_SetLogFunc (LogFunc func,    /* IN */
+                void *user_data) /* IN */
+{
+   if (!func) {
+      func = Log_DefaultLogFunc;
+      user_data = NULL;
+   }
+
+   gLogFuncData = user_data;
+   Memory_Barrier ();
+   gLogFunc = func;
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -22,6 +22,8 @@
 
 
 #include <Macros.h>
+#include <Tunable.h>
+#include <Types.h>
 
 
 BEGIN_DECLS
@@ -32,17 +34,50 @@ BEGIN_DECLS
 #endif
 
 
-#define LOG_ERROR(...)    Log_Log(LOG_LEVEL_ERROR,    LOG_DOMAIN, __VA_ARGS__)
-#define LOG_CRITICAL(...) Log_Log(LOG_LEVEL_CRITICAL, LOG_DOMAIN, __VA_ARGS__)
-#define LOG_WARNING(...)  Log_Log(LOG_LEVEL_WARNING,  LOG_DOMAIN, __VA_ARGS__)
-#define LOG_MESSAGE(...)  Log_Log(LOG_LEVEL_MESSAGE,  LOG_DOMAIN, __VA_ARGS__)
-#define LOG_INFO(...)     Log_Log(LOG_LEVEL_INFO,     LOG_DOMAIN, __VA_ARGS__)
+#define LOG_SITE_MAX_ARGS 16
+
+
+/*
+ * Each LOG_*() call site gets a static LogSite.
+ *
+ * The site caches whether its level is enabled for its domain (see
+ * Log_SetLevel()), so filtered messages cost a compare and a branch and
+ * their arguments are never evaluated. The cache is refreshed whenever a
+ * tunable changes.
+ *
+ * Sites up to LOG_LEVEL_WARNING can also be rate limited with a token
+ * bucket, configured with the "log.ratelimit" (messages per second, 0
+ * to disable, the default) and "log.ratelimit.burst" tunables. The
+ * number of suppressed messages is logged just before the next message
+ * that gets through. Critical messages and errors are never suppressed.
+ *
+ * In binary mode (see Log_StartBinary()) the site is used to record the
+ * format string once, and each message only records the site, a
+ * timestamp and the raw argument values. Formatting is deferred to
+ * congo-logdump.
+ */
+#define LOG_LOG(level, ...) \
+   do { \
+      static LogSite log_site_ = { level, LOG_DOMAIN, __FILE__, __LINE__ }; \
+      if (Log_SiteEnabled (&log_site_)) { \
+         Log_Site (&log_site_, __VA_ARGS__); \
+      } \
+   } while (0)
+
+
+#define LOG_ERROR(...)    LOG_LOG(LOG_LEVEL_ERROR,    __VA_ARGS__)
+#define LOG_CRITICAL(...) LOG_LOG(LOG_LEVEL_CRITICAL, __VA_ARGS__)
+#define LOG_WARNING(...)  LOG_LOG(LOG_LEVEL_WARNING,  __VA_ARGS__)
+#define LOG_MESSAGE(...)  LOG_LOG(LOG_LEVEL_MESSAGE,  __VA_ARGS__)
+#define LOG_INFO(...)     LOG_LOG(LOG_LEVEL_INFO,     __VA_ARGS__)
 
 
 #if !defined(DISABLE_DEBUG)
-# define LOG_DEBUG(...)   Log_Log(LOG_LEVEL_DEBUG,    LOG_DOMAIN, __VA_ARGS__)
+# define LOG_DEBUG(...)   LOG_LOG(LOG_LEVEL_DEBUG,    __VA_ARGS__)
+# define LOG_TRACE(...)   LOG_LOG(LOG_LEVEL_TRACE,    __VA_ARGS__)
 #else
 # define LOG_DEBUG(...)
+# define LOG_TRACE(...)
 #endif
 
 
@@ -58,21 +93,88 @@ typedef enum
 } LogLevel;
 
 
+typedef enum
+{
+   LOG_OVERFLOW_DROP,
+   LOG_OVERFLOW_BLOCK,
+} LogOverflow;
+
+
+typedef struct
+{
+   LogLevel          level;
+   const char       *domain;
+   const char       *file;
+   int               line;
+
+   /*< private >*/
+   volatile int32_t  serial;
+   volatile int32_t  enabled;
+   volatile int32_t  suppressed;
+   int32_t           rate;
+   int64_t           burst;
+   int64_t           tokens;
+   uint64_t          refilled;
+   volatile int32_t  id;
+   volatile int32_t  generation;
+   volatile int32_t  parsed;
+   int32_t           nargs;
+   uint8_t           types [LOG_SITE_MAX_ARGS];
+} LogSite;
+
+
 typedef void (*LogFunc) (LogLevel    level,
                          const char *domain,
                          const char *message,
                          void       *user_data);
 
 
-void Log_Log    (LogLevel level,
-                 const char *domain,
-                 const char *format,
-                 ...) GNUC_PRINTF (3, 4);
-void Log_Trace  (const char *domain,
-                 const char *format,
-                 ...) GNUC_PRINTF (2, 3);
-void Log_Cork   (void);
-void Log_Uncork (void);
+void        Log_Log           (LogLevel level,
+                               const char *domain,
+                               const char *format,
+                               ...) GNUC_PRINTF (3, 4);
+void        Log_Trace         (const char *domain,
+                               const char *format,
+                               ...) GNUC_PRINTF (2, 3);
+void        Log_Site          (LogSite *site,
+                               const char *format,
+                               ...) GNUC_PRINTF (2, 3);
+void        Log_SiteRefresh   (LogSite *site);
+bool        Log_SiteAcquire   (LogSite *site);
+void        Log_SetLevel      (const char *domain,
+                               LogLevel level);
+LogLevel    Log_GetLevel      (const char *domain);
+void        Log_Cork          (void);
+void        Log_Uncork        (void);
+void        Log_SetLogFunc    (LogFunc func,
+                               void *user_data);
+bool        Log_StartAsync    (int fd,
+                               LogOverflow overflow);
+bool        Log_StartBinary   (int fd,
+                               LogOverflow overflow);
+void        Log_StopAsync     (void);
+void       *Log_AsyncReserve  (size_t size);
+void        Log_AsyncCommit   (void *data,
+                               size_t len);
+const char *LogLevel_ToString (LogLevel level);
+
+
+extern int gLogBinary;
+
+
+static __inline__ bool
+Log_SiteEnabled (LogSite *site) /* IN */
+{
+   if (UNLIKELY (site->serial != gTunableSerial)) {
+      Log_SiteRefresh (site);
+   }
+
+   if (!site->enabled) {
+      return false;
+   }
+
+   return site->rate ? Log_SiteAcquire (site) : true;
+}
 
 
 END_DECLS
@@ -0,0 +1,968 @@
+/* LogAsync.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <Atomic.h>
+#include <Cond.h>
+#include <Counter.h>
+#include <Debug.h>
+#include <Log.h>
+#include <LogBinary.h>
+#include <Memory.h>
+#include <Mutex.h>
+#include <Task.h>
+#include <Thread.h>
+#include <ThreadOnce.h>
+
+
+/*
+ * The asynchronous log sink moves the write(2) to stderr off of the
+ * calling thread. Each thread that logs gets its own single-producer,
+ * single-consumer byte ring of variable length records. Since lthreads
+ * do not preempt one another, every lthread on a scheduler thread can
+ * share that thread's ring.
+ *
+ * Records are reserved with Log_AsyncReserve(), filled in place and then
+ * published with Log_AsyncCommit(). Text mode records are formatted log
+ * lines; binary mode (see LogBinary.c) records are encoded directly into
+ * the ring. A record never wraps around the end of the ring, instead a
+ * padding record with no payload is inserted.
+ *
+ * A single writer thread drains all of the rings in batches with
+ * writev(). When a ring is full the record is either dropped (and the
+ * Log/Dropped counter incremented) or the caller waits for the writer to
+ * catch up, depending on the LogOverflow policy. An lthread waits by
+ * sleeping so the other lthreads on its thread keep running; any other
+ * thread waits on a condition the writer signals as it frees space.
+ *
+ * Producers are counted from Log_AsyncReserve() until Log_AsyncCommit(),
+ * so that Log_StopAsync() can switch logging back to synchronous and
+ * wait for records in flight before the final drain.
+ */
+
+
+#define LOG_ASYNC_BUFFER_SIZE 65536
+#define LOG_ASYNC_LINE_MAX    1152
+#define LOG_ASYNC_IOV_MAX     64
+#define LOG_ASYNC_IDLE_MSEC   100
+#define LOG_ASYNC_FULL_MSEC   1
+#define LOG_ASYNC_ALIGN(n)    (((n) + 7) & ~(size_t)7)
+
+
+COUNTER (LogDropped, "Log", "Dropped", "Number of log records dropped.")
+COUNTER (LogWritten, "Log", "Written", "Number of log records written.")
+
+
+typedef struct
+{
+   uint32_t size;
+   uint32_t len;
+} LogEntry;
+
+
+typedef struct _LogBuffer LogBuffer;
+
+
+struct _LogBuffer
+{
+   LogBuffer        *next;
+   volatile int32_t  dead;
+   time_t            cached_sec;
+   char              cached_str [32];
+   int64_t           reserved;
+   volatile int64_t  head GNUC_ALIGNED (64);
+   volatile int64_t  tail GNUC_ALIGNED (64);
+   uint8_t           data [LOG_ASYNC_BUFFER_SIZE] GNUC_ALIGNED (64);
+};
+
+
+static struct
+{
+   LogBuffer        *buffers;
+   pthread_key_t     key;
+   Thread            thread;
+   Mutex             mutex;
+   Cond              cond;
+   Cond              space;
+   int               fd;
+   LogOverflow       overflow;
+   volatile int32_t  running;
+   volatile int32_t  sleeping;
+   volatile int32_t  shutdown;
+   volatile int32_t  producers;
+   volatile int32_t  waiters;
+   bool              atexit_done;
+} gLogAsync = { 0 };
+
+
+static ThreadOnce gLogAsyncOnce = THREAD_ONCE_INIT;
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_AsyncBufferRelease --
+ *
+ *       Thread destructor for a thread's log buffer. The buffer still
+ *       contains records that have not been written, so we just mark it
+ *       as dead and let the writer thread free it once it is empty.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+Log_AsyncBufferRelease (void *data) /* IN */
+{
+   LogBuffer *buffer = data;
+
+   AtomicInt_Set (&buffer->dead, 1);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_AsyncDoInit --
+ *
+ *       Initializes the state shared by all of the async log buffers.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+Log_AsyncDoInit (void)
+{
+   pthread_key_create (&gLogAsync.key, Log_AsyncBufferRelease);
+   Mutex_Init (&gLogAsync.mutex, NULL);
+   Cond_Init (&gLogAsync.cond, NULL);
+   Cond_Init (&gLogAsync.space, NULL);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_AsyncGetBuffer --
+ *
+ *       Fetches the log buffer for the current thread, creating it and
+ *       publishing it to the writer thread if necessary.
+ *
+ * Returns:
+ *       A LogBuffer owned by the current thread.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static LogBuffer *
+Log_AsyncGetBuffer (void)
+{
+   LogBuffer *buffer;
+   LogBuffer *head;
+
+   if (LIKELY ((buffer = pthread_getspecific (gLogAsync.key)))) {
+      return buffer;
+   }
+
+   buffer = Memory_Memalign (sizeof *buffer, 64);
+   Memory_Zero (buffer, sizeof *buffer);
+   buffer->cached_sec = -1;
+
+   do {
+      head = AtomicPtr_Get (&gLogAsync.buffers);
+      buffer->next = head;
+   } while (head != AtomicInt_CompareAndSwap (&gLogAsync.buffers,
+                                              head,
+                                              buffer));
+
+   pthread_setspecific (gLogAsync.key, buffer);
+
+   return buffer;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_AsyncWakeup --
+ *
+ *       Wakes up the writer thread if it is waiting for records.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+Log_AsyncWakeup (void)
+{
+   if (AtomicInt_Get (&gLogAsync.sleeping)) {
+      Mutex_Lock (&gLogAsync.mutex);
+      Cond_Signal (&gLogAsync.cond);
+      Mutex_Unlock (&gLogAsync.mutex);
+   }
+}
+
+
+static __inline__ bool
+Log_AsyncHasSpace (LogBuffer *buffer, /* IN */
+                   int64_t head,      /* IN */
+                   size_t need)       /* IN */
+{
+   return ((head + need - AtomicInt64_Get (&buffer->tail)) <=
+           LOG_ASYNC_BUFFER_SIZE);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_AsyncWaitForSpace --
+ *
+ *       Waits for the writer to free up @need bytes from @head in
+ *       @buffer.
+ *
+ * Returns:
+ *       true if the space is available, false if the async sink stopped
+ *       or the caller is the writer thread itself.
+ *
+ * Side effects:
+ *       Yields to other lthreads if called from one, otherwise blocks the
+ *       calling thread.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+Log_AsyncWaitForSpace (LogBuffer *buffer, /* IN */
+                       int64_t head,      /* IN */
+                       size_t need)       /* IN */
+{
+   struct timespec ts;
+
+   if (pthread_equal (pthread_self (), gLogAsync.thread)) {
+      return false;
+   }
+
+#ifdef TASK_USE_LTHREAD
+   if (Task_Current ()) {
+      while (!Log_AsyncHasSpace (buffer, head, need)) {
+         if (!AtomicInt_Get (&gLogAsync.running)) {
+            return false;
+         }
+         Log_AsyncWakeup ();
+         Task_Sleep (LOG_ASYNC_FULL_MSEC);
+      }
+      return true;
+   }
+#endif
+
+   Mutex_Lock (&gLogAsync.mutex);
+   AtomicInt_Increment (&gLogAsync.waiters);
+   while (!Log_AsyncHasSpace (buffer, head, need) && AtomicInt_Get (&gLogAsync.running)) {
+      Cond_Signal (&gLogAsync.cond);
+
+      /* The timeout only guards against a writer that went away. */
+      clock_gettime (CLOCK_REALTIME, &ts);
+      ts.tv_sec += 1;
+      Cond_TimedWait (&gLogAsync.space, &gLogAsync.mutex, &ts);
+   }
+   AtomicInt_Decrement (&gLogAsync.waiters);
+   Mutex_Unlock (&gLogAsync.mutex);
+
+   return Log_AsyncHasSpace (buffer, head, need);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_AsyncReserve --
+ *
+ *       Reserves @size contiguous bytes in the current thread's ring. The
+ *       record must be published with Log_AsyncCommit() before the thread
+ *       logs again.
+ *
+ * Returns:
+ *       A pointer to @size writable bytes, or NULL if the async sink is not
+ *       running or the ring is full and the overflow policy is to drop.
+ *
+ * Side effects:
+ *       The caller waits if the ring is full and the policy is to block.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void *
+Log_AsyncReserve (size_t size) /* IN */
+{
+   LogBuffer *buffer;
+   LogEntry *entry;
+   int64_t head;
+   size_t offset;
+   size_t need;
+   size_t pad;
+
+   ASSERT (size <= (LOG_ASYNC_BUFFER_SIZE / 4));
+
+   for (;;) {
+      /*
+       * Count ourselves before checking running, Log_StopAsync() clears
+       * running before waiting for producers to leave. Waiting for space
+       * happens uncounted, since another lthread on this thread may be
+       * the one stopping.
+       */
+      AtomicInt_Increment (&gLogAsync.producers);
+
+      if (!AtomicInt_GetSeqCst (&gLogAsync.running)) {
+         AtomicInt_Decrement (&gLogAsync.producers);
+         return NULL;
+      }
+
+      buffer = Log_AsyncGetBuffer ();
+
+      head = buffer->head;
+      need = LOG_ASYNC_ALIGN (sizeof *entry + size);
+      offset = head & (LOG_ASYNC_BUFFER_SIZE - 1);
+      pad = 0;
+
+      if ((offset + need) > LOG_ASYNC_BUFFER_SIZE) {
+         pad = LOG_ASYNC_BUFFER_SIZE - offset;
+      }
+
+      if ((head + pad + need - AtomicInt64_Get (&buffer->tail)) <=
+          LOG_ASYNC_BUFFER_SIZE) {
+         break;
+      }
+
+      AtomicInt_Decrement (&gLogAsync.producers);
+
+      /*
+       * Other lthreads may log while we wait, so start over rather than
+       * trust head afterwards.
+       */
+      if ((gLogAsync.overflow == LOG_OVERFLOW_DROP) ||
+          !Log_AsyncWaitForSpace (buffer, head, pad + need)) {
+         LogDropped_Increment ();
+         return NULL;
+      }
+   }
+
+   if (pad) {
+      entry = (LogEntry *)(void *)&buffer->data [offset];
+      entry->size = pad;
+      entry->len = 0;
+   }
+
+   buffer->reserved = head + pad;
+   entry = (LogEntry *)(void *)
+      &buffer->data [buffer->reserved & (LOG_ASYNC_BUFFER_SIZE - 1)];
+
+   return entry + 1;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_AsyncCommit --
+ *
+ *       Publishes the first @len bytes of the record returned from the
+ *       last call to Log_AsyncReserve() to the writer thread. A @len of
+ *       0 abandons the record.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+Log_AsyncCommit (void *data, /* IN */
+                 size_t len) /* IN */
+{
+   LogBuffer *buffer;
+   LogEntry *entry = (LogEntry *)data - 1;
+
+   buffer = pthread_getspecific (gLogAsync.key);
+
+   ASSERT (buffer);
+   ASSERT ((void *)entry ==
+           &buffer->data [buffer->reserved & (LOG_ASYNC_BUFFER_SIZE - 1)]);
+
+   entry->size = LOG_ASYNC_ALIGN (sizeof *entry + len);
+   entry->len = len;
+
+   AtomicInt64_Set (&buffer->head, buffer->reserved + entry->size);
+   AtomicInt_Decrement (&gLogAsync.producers);
+
+   Log_AsyncWakeup ();
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_AsyncFormatTime --
+ *
+ *       Formats the date portion of a log line for @sec. The string is
+ *       cached in the thread's buffer, so the localtime_r() and
+ *       strftime() only happen once per second.
+ *
+ * Returns:
+ *       A string owned by the current thread.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static const char *
+Log_AsyncFormatTime (time_t sec) /* IN */
+{
+   LogBuffer *buffer;
+   struct tm tt;
+
+   buffer = Log_AsyncGetBuffer ();
+
+   if (sec != buffer->cached_sec) {
+      buffer->cached_sec = sec;
+      localtime_r (&buffer->cached_sec, &tt);
+      strftime (buffer->cached_str, sizeof buffer->cached_str,
+                "%Y/%m/%d %H:%M:%S", &tt);
+   }
+
+   return buffer->cached_str;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_AsyncLogFunc --
+ *
+ *       LogFunc that formats the log line into the current thread's ring
+ *       buffer. The line matches the one written by the default LogFunc,
+ *       but the date string is only regenerated once per second.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Record is dropped or the caller waits if the ring is full.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+Log_AsyncLogFunc (LogLevel level,      /* IN */
+                  const char *domain,  /* IN */
+                  const char *message, /* IN */
+                  void *user_data)     /* IN */
+{
+   struct timeval tv;
+   const char *nowstr;
+   char *line;
+   int ret;
+
+   gettimeofday (&tv, NULL);
+   nowstr = Log_AsyncFormatTime (tv.tv_sec);
+
+   if (!(line = Log_AsyncReserve (LOG_ASYNC_LINE_MAX))) {
+      return;
+   }
+
+   ret = snprintf (line, LOG_ASYNC_LINE_MAX,
+                   "%s.%04ld: %8s: %12s: %s\n",
+                   nowstr,
+                   (long)(tv.tv_usec / 1000L),
+                   LogLevel_ToString (level),
+                   domain,
+                   message);
+
+   if (ret < 0) {
+      LogDropped_Increment ();
+      Log_AsyncCommit (line, 0);
+      return;
+   } else if (ret >= LOG_ASYNC_LINE_MAX) {
+      line [LOG_ASYNC_LINE_MAX - 2] = '\n';
+      ret = LOG_ASYNC_LINE_MAX - 1;
+   }
+
+   Log_AsyncCommit (line, ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_AsyncWritev --
+ *
+ *       Writes all of @iov to @fd, handling short writes.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @iov is modified.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+Log_AsyncWritev (int fd,            /* IN */
+                 struct iovec *iov, /* IN */
+                 int iovcnt)        /* IN */
+{
+   ssize_t ret;
+
+   while (iovcnt) {
+      ret = writev (fd, iov, iovcnt);
+
+      if (ret < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         return;
+      }
+
+      while (iovcnt && (ret >= iov->iov_len)) {
+         ret -= iov->iov_len;
+         iov++;
+         iovcnt--;
+      }
+
+      if (iovcnt) {
+         iov->iov_base = (char *)iov->iov_base + ret;
+         iov->iov_len -= ret;
+      }
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_AsyncDrainBuffer --
+ *
+ *       Writes all of the records pending in @buffer.
+ *
+ * Returns:
+ *       The number of records written.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static int64_t
+Log_AsyncDrainBuffer (LogBuffer *buffer) /* IN */
+{
+   struct iovec iov [LOG_ASYNC_IOV_MAX];
+   LogEntry *entry;
+   int64_t count = 0;
+   int64_t head;
+   int64_t tail;
+   int iovcnt;
+
+   head = AtomicInt64_Get (&buffer->head);
+   tail = buffer->tail;
+
+   while (tail < head) {
+      for (iovcnt = 0; (iovcnt < LOG_ASYNC_IOV_MAX) && (tail < head);) {
+         entry = (LogEntry *)(void *)
+            &buffer->data [tail & (LOG_ASYNC_BUFFER_SIZE - 1)];
+         if (entry->len) {
+            iov [iovcnt].iov_base = entry + 1;
+            iov [iovcnt].iov_len = entry->len;
+            iovcnt++;
+         }
+         tail += entry->size;
+      }
+
+      Log_AsyncWritev (gLogAsync.fd, iov, iovcnt);
+
+      count += iovcnt;
+
+      AtomicInt64_Set (&buffer->tail, tail);
+
+      if (AtomicInt_Get (&gLogAsync.waiters)) {
+         Mutex_Lock (&gLogAsync.mutex);
+         Cond_Broadcast (&gLogAsync.space);
+         Mutex_Unlock (&gLogAsync.mutex);
+      }
+   }
+
+   return count;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_AsyncDrain --
+ *
+ *       Drains all of the thread buffers and frees those belonging to
+ *       threads that have exited.
+ *
+ * Returns:
+ *       The number of records written.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static int64_t
+Log_AsyncDrain (void)
+{
+   LogBuffer *buffer;
+   LogBuffer *prev = NULL;
+   LogBuffer *next;
+   int64_t count = 0;
+
+   for (buffer = AtomicPtr_Get (&gLogAsync.buffers); buffer; buffer = next) {
+      next = buffer->next;
+
+      if (AtomicInt_Get (&buffer->dead)) {
+         count += Log_AsyncDrainBuffer (buffer);
+
+         /*
+          * Only the writer thread unlinks buffers, so the only race is
+          * with a new thread pushing onto the head of the list.
+          */
+         if (prev) {
+            prev->next = next;
+            Memory_Free (buffer);
+            continue;
+         } else if (buffer == AtomicInt_CompareAndSwap (&gLogAsync.buffers,
+                                                        buffer,
+                                                        next)) {
+            Memory_Free (buffer);
+            continue;
+         }
+      } else {
+         count += Log_AsyncDrainBuffer (buffer);
+      }
+
+      prev = buffer;
+   }
+
+   if (count) {
+      LogWritten_Add (count);
+   }
+
+   return count;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_AsyncHasPending --
+ *
+ *       Checks to see if any of the thread buffers contain records.
+ *
+ * Returns:
+ *       true if there are records waiting to be written.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+Log_AsyncHasPending (void)
+{
+   LogBuffer *buffer;
+
+   for (buffer = AtomicPtr_Get (&gLogAsync.buffers);
+        buffer;
+        buffer = buffer->next) {
+      if (AtomicInt64_Get (&buffer->head) != buffer->tail) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_AsyncWorker --
+ *
+ *       Writer thread. Drains the thread buffers until Log_StopAsync()
+ *       is called, sleeping while there is nothing to write.
+ *
+ * Returns:
+ *       NULL.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void *
+Log_AsyncWorker (void *data) /* IN */
+{
+   struct timespec ts;
+
+   for (;;) {
+      if (Log_AsyncDrain ()) {
+         continue;
+      }
+
+      if (AtomicInt_Get (&gLogAsync.shutdown)) {
+         break;
+      }
+
+      clock_gettime (CLOCK_REALTIME, &ts);
+      ts.tv_nsec += LOG_ASYNC_IDLE_MSEC * 1000000L;
+      if (ts.tv_nsec >= 1000000000L) {
+         ts.tv_sec++;
+         ts.tv_nsec -= 1000000000L;
+      }
+
+      Mutex_Lock (&gLogAsync.mutex);
+      AtomicInt_Set (&gLogAsync.sleeping, 1);
+      if (!Log_AsyncHasPending () && !AtomicInt_Get (&gLogAsync.shutdown)) {
+         Cond_TimedWait (&gLogAsync.cond, &gLogAsync.mutex, &ts);
+      }
+      AtomicInt_Set (&gLogAsync.sleeping, 0);
+      Mutex_Unlock (&gLogAsync.mutex);
+   }
+
+   return NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_AsyncStart --
+ *
+ *       Starts the writer thread for @fd and installs @func as the
+ *       LogFunc.
+ *
+ * Returns:
+ *       true if the writer thread was started.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+Log_AsyncStart (int fd,               /* IN */
+                LogOverflow overflow, /* IN */
+                LogFunc func)         /* IN */
+{
+   gLogAsync.fd = fd;
+   gLogAsync.overflow = overflow;
+   AtomicInt_Set (&gLogAsync.shutdown, 0);
+
+   if (!Thread_Init (&gLogAsync.thread, "LogWriter", Log_AsyncWorker, NULL)) {
+      return false;
+   }
+
+   AtomicInt_Set (&gLogAsync.running, 1);
+
+   if (!gLogAsync.atexit_done) {
+      gLogAsync.atexit_done = true;
+      atexit (Log_StopAsync);
+   }
+
+   Log_SetLogFunc (func, NULL);
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_StartAsync --
+ *
+ *       Routes log messages through per-thread ring buffers that are
+ *       written to @fd by a background thread, so that logging never
+ *       blocks the caller on I/O.
+ *
+ *       @overflow determines what happens when a thread logs faster
+ *       than the writer can keep up.
+ *
+ *       Log_StopAsync() is registered with atexit() so that pending
+ *       records are flushed when the process exits.
+ *
+ * Returns:
+ *       true if the writer thread was started.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+Log_StartAsync (int fd,               /* IN */
+                LogOverflow overflow) /* IN */
+{
+   ThreadOnce_Once (&gLogAsyncOnce, Log_AsyncDoInit);
+
+   if (AtomicInt_Get (&gLogAsync.running)) {
+      return false;
+   }
+
+   return Log_AsyncStart (fd, overflow, Log_AsyncLogFunc);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_StartBinary --
+ *
+ *       Like Log_StartAsync(), but writes a binary log to @fd. Messages
+ *       from the LOG_*() macros are recorded without being formatted;
+ *       use congo-logdump to render the log as text.
+ *
+ * Returns:
+ *       true if the writer thread was started.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+Log_StartBinary (int fd,               /* IN */
+                 LogOverflow overflow) /* IN */
+{
+   LogBinaryHeader header = { LOG_BINARY_MAGIC, LOG_BINARY_VERSION };
+   struct iovec iov = { &header, sizeof header };
+
+   ThreadOnce_Once (&gLogAsyncOnce, Log_AsyncDoInit);
+
+   if (AtomicInt_Get (&gLogAsync.running)) {
+      return false;
+   }
+
+   Log_AsyncWritev (fd, &iov, 1);
+
+   if (!Log_AsyncStart (fd, overflow, LogBinary_LogFunc)) {
+      return false;
+   }
+
+   LogBinary_Begin ();
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Log_StopAsync --
+ *
+ *       Restores the synchronous log function, waits for records being
+ *       logged to be committed, writes all pending records and stops
+ *       the writer thread.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+Log_StopAsync (void)
+{
+   if (!AtomicInt_Get (&gLogAsync.running)) {
+      return;
+   }
+
+   LogBinary_End ();
+
+   /*
+    * New messages go to the synchronous LogFunc. Wait for producers that
+    * already got past the running check to commit, or give up waiting
+    * for space, so the final drain sees every record.
+    */
+   Log_SetLogFunc (NULL, NULL);
+   AtomicInt_SetSeqCst (&gLogAsync.running, 0);
+
+   Mutex_Lock (&gLogAsync.mutex);
+   Cond_Broadcast (&gLogAsync.space);
+   Mutex_Unlock (&gLogAsync.mutex);
+
+   while (AtomicInt_GetSeqCst (&gLogAsync.producers)) {
+      sched_yield ();
+   }
+
+   Mutex_Lock (&gLogAsync.mutex);
+   AtomicInt_Set (&gLogAsync.shutdown, 1);
+   Cond_Signal (&gLogAsync.cond);
+   Mutex_Unlock (&gLogAsync.mutex);
+
+   Thread_Join (gLogAsync.thread);
+}
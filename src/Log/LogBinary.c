@@ -0,0 +1,1016 @@
+/* LogBinary.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <ctype.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <Atomic.h>
+#include <Debug.h>
+#include <Log.h>
+#include <LogBinary.h>
+#include <TimeSpec.h>
+
+
+#define LOG_BINARY_ARG_MAX   16
+#define LOG_BINARY_FIELD_MAX (LOG_BINARY_RECORD_MAX * 16)
+
+
+#define LOG_BINARY_PUT(type, value) \
+   do { \
+      type __v = (value); \
+      memcpy (ptr, &__v, sizeof __v); \
+      ptr += sizeof __v; \
+   } while (0)
+
+
+#define LOG_BINARY_GET(type, value) \
+   do { \
+      if ((size_t)(end - ptr) < sizeof (type)) { \
+         return false; \
+      } \
+      memcpy (&(value), ptr, sizeof (type)); \
+      ptr += sizeof (type); \
+   } while (0)
+
+
+STATIC_ASSERT (sizeof (long double) <= LOG_BINARY_ARG_MAX);
+
+
+int gLogBinary;
+
+
+static volatile int32_t gLogBinarySiteSeq;
+static volatile int32_t gLogBinaryGeneration;
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * LogBinary_GetTimestamp --
+ *
+ *       Fetches the current wall clock time in nanoseconds.
+ *
+ * Returns:
+ *       Nanoseconds since the UNIX epoch.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static uint64_t
+LogBinary_GetTimestamp (void)
+{
+   struct timespec ts;
+
+   clock_gettime (CLOCK_REALTIME, &ts);
+
+   return (ts.tv_sec * (uint64_t)NANOSEC_PER_SEC) + ts.tv_nsec;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * LogBinary_AppendStrings --
+ *
+ *       Appends a record whose payload is two NUL terminated strings.
+ *       @str2 is truncated if the record would be too large.
+ *
+ * Returns:
+ *       true if the record was appended; false if it was dropped.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+LogBinary_AppendStrings (LogBinaryType type, /* IN */
+                         LogLevel level,     /* IN */
+                         uint32_t site,      /* IN */
+                         const char *str1,   /* IN */
+                         const char *str2)   /* IN */
+{
+   LogBinaryRecord *record;
+   size_t len1;
+   size_t len2;
+   char *ptr;
+
+   len1 = MIN (strlen (str1), 255UL) + 1;
+   len2 = MIN (strlen (str2) + 1,
+               LOG_BINARY_RECORD_MAX - sizeof *record - len1);
+
+   if (!(record = Log_AsyncReserve (sizeof *record + len1 + len2))) {
+      return false;
+   }
+
+   record->len = sizeof *record + len1 + len2;
+   record->type = type;
+   record->level = level;
+   record->site = site;
+   record->padding = 0;
+   record->timestamp = LogBinary_GetTimestamp ();
+
+   ptr = (char *)(record + 1);
+   memcpy (ptr, str1, len1 - 1);
+   ptr [len1 - 1] = '\0';
+   ptr += len1;
+   memcpy (ptr, str2, len2 - 1);
+   ptr [len2 - 1] = '\0';
+
+   Log_AsyncCommit (record, record->len);
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * LogBinary_LogFunc --
+ *
+ *       LogFunc used while in binary mode. Messages logged with Log_Log()
+ *       directly rather than through a LOG_*() call site are already
+ *       formatted, so they are recorded as text.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+LogBinary_LogFunc (LogLevel level,      /* IN */
+                   const char *domain,  /* IN */
+                   const char *message, /* IN */
+                   void *user_data)     /* IN */
+{
+   LogBinary_AppendStrings (LOG_BINARY_TEXT, level, 0, domain, message);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * LogBinary_Begin --
+ *
+ *       Switches the LOG_*() macros into binary mode. Every call site
+ *       records its format string again in the new log.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+LogBinary_Begin (void)
+{
+   AtomicInt_Increment (&gLogBinaryGeneration);
+   gLogBinary = 1;
+   Memory_Barrier ();
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * LogBinary_End --
+ *
+ *       Switches the LOG_*() macros back to formatting messages.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+LogBinary_End (void)
+{
+   gLogBinary = 0;
+   Memory_Barrier ();
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * LogBinary_Encode --
+ *
+ *       Encodes a LOG_BINARY_EVENT for @site into the current thread's
+ *       log ring. The format string of a site is parsed the first time
+ *       it is used, after that recording a message is a copy of each of
+ *       the arguments.
+ *
+ *       Formats that can't be deferred (%n, %m, wide strings or too many
+ *       arguments) are formatted immediately and recorded as text.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+LogBinary_Encode (LogSite *site,      /* IN */
+                  const char *format, /* IN */
+                  va_list args)       /* IN */
+{
+   LogBinaryRecord *record;
+   const char *str;
+   int32_t generation;
+   int32_t id;
+   uint8_t *ptr;
+   uint8_t *end;
+   size_t avail;
+   size_t len;
+   char msgbuf [1024];
+   int i;
+
+   ASSERT (site);
+   ASSERT (format);
+
+   if (UNLIKELY (!AtomicInt_Get (&site->parsed))) {
+      site->nargs = LogFormat_Parse (format, site->types, LOG_SITE_MAX_ARGS);
+      AtomicInt_Set (&site->parsed, 1);
+   }
+
+   if (UNLIKELY (site->nargs < 0)) {
+      vsnprintf (msgbuf, sizeof msgbuf, format, args);
+      LogBinary_AppendStrings (LOG_BINARY_TEXT, site->level, 0,
+                               site->domain, msgbuf);
+      return;
+   }
+
+   if (UNLIKELY (!(id = site->id))) {
+      id = AtomicInt_Increment (&gLogBinarySiteSeq);
+      if (0 != AtomicInt_CompareAndSwap (&site->id, 0, id)) {
+         id = site->id;
+      }
+   }
+
+   generation = AtomicInt_Get (&gLogBinaryGeneration);
+
+   if (UNLIKELY (site->generation != generation)) {
+      if (!LogBinary_AppendStrings (LOG_BINARY_SITE, site->level, id,
+                                    site->domain, format)) {
+         return;
+      }
+      site->generation = generation;
+   }
+
+   if (!(record = Log_AsyncReserve (LOG_BINARY_RECORD_MAX))) {
+      return;
+   }
+
+   ptr = (uint8_t *)(record + 1);
+   end = (uint8_t *)record + LOG_BINARY_RECORD_MAX;
+
+   for (i = 0; i < site->nargs; i++) {
+      switch (site->types [i]) {
+      case LOG_ARG_INT:
+         LOG_BINARY_PUT (int64_t, va_arg (args, int));
+         break;
+      case LOG_ARG_LONG:
+         LOG_BINARY_PUT (int64_t, va_arg (args, long));
+         break;
+      case LOG_ARG_LLONG:
+         LOG_BINARY_PUT (int64_t, va_arg (args, long long));
+         break;
+      case LOG_ARG_INTMAX:
+         LOG_BINARY_PUT (int64_t, va_arg (args, intmax_t));
+         break;
+      case LOG_ARG_SIZE:
+         LOG_BINARY_PUT (uint64_t, va_arg (args, size_t));
+         break;
+      case LOG_ARG_PTRDIFF:
+         LOG_BINARY_PUT (int64_t, va_arg (args, ptrdiff_t));
+         break;
+      case LOG_ARG_DOUBLE:
+         LOG_BINARY_PUT (double, va_arg (args, double));
+         break;
+      case LOG_ARG_LDOUBLE:
+         LOG_BINARY_PUT (long double, va_arg (args, long double));
+         break;
+      case LOG_ARG_POINTER:
+         LOG_BINARY_PUT (uint64_t, (size_t)va_arg (args, void *));
+         break;
+      case LOG_ARG_STRING:
+         /*
+          * Leave room for the remaining arguments in the record.
+          */
+         avail = (end - ptr) - sizeof (uint16_t) -
+                 ((site->nargs - i - 1) * LOG_BINARY_ARG_MAX);
+         if (!(str = va_arg (args, const char *))) {
+            LOG_BINARY_PUT (uint16_t, LOG_BINARY_NULL_STRING);
+         } else {
+            len = MIN (strlen (str), avail);
+            LOG_BINARY_PUT (uint16_t, len);
+            memcpy (ptr, str, len);
+            ptr += len;
+         }
+         break;
+      default:
+         ASSERT (false);
+         break;
+      }
+   }
+
+   record->len = ptr - (uint8_t *)record;
+   record->type = LOG_BINARY_EVENT;
+   record->level = site->level;
+   record->site = id;
+   record->padding = 0;
+   record->timestamp = LogBinary_GetTimestamp ();
+
+   Log_AsyncCommit (record, record->len);
+}
+
+
+static int
+LogFormat_ParseInt (const char **ptr) /* IN/OUT */
+{
+   int value = 0;
+
+   for (; (**ptr >= '0') && (**ptr <= '9'); (*ptr)++) {
+      if (value < LOG_BINARY_FIELD_MAX) {
+         value = (value * 10) + (**ptr - '0');
+      }
+   }
+
+   return value;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * LogFormat_ParseSpec --
+ *
+ *       Parses the printf() conversion specification starting at
+ *       @format, which must point at a '%'.
+ *
+ *       @spec->type is set to the type of argument consumed by the
+ *       conversion, LOG_ARG_NONE for "%%", or LOG_ARG_INVALID for
+ *       conversions that can't be deferred. @spec->nstars is the number
+ *       of int arguments consumed for '*' width and precision.
+ *
+ * Returns:
+ *       A pointer to the character after the conversion.
+ *
+ * Side effects:
+ *       @spec is initialized.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+const char *
+LogFormat_ParseSpec (const char *format, /* IN */
+                     LogFormatSpec *spec) /* OUT */
+{
+   const char *ptr = format + 1;
+   int longs = 0;
+   char length = '\0';
+
+   ASSERT (format);
+   ASSERT (*format == '%');
+   ASSERT (spec);
+
+   spec->begin = format;
+   spec->nstars = 0;
+   spec->type = LOG_ARG_INVALID;
+   spec->flags = 0;
+   spec->width = -1;
+   spec->precision = -1;
+   spec->shorts = 0;
+   spec->conversion = '\0';
+
+   if (*ptr == '%') {
+      spec->type = LOG_ARG_NONE;
+      spec->conversion = '%';
+      spec->len = 2;
+      return ptr + 1;
+   }
+
+   for (; *ptr && strchr ("-+ #0'I", *ptr); ptr++) {
+      switch (*ptr) {
+      case '-':
+         spec->flags |= LOG_FORMAT_LEFT;
+         break;
+      case '+':
+         spec->flags |= LOG_FORMAT_PLUS;
+         break;
+      case ' ':
+         spec->flags |= LOG_FORMAT_SPACE;
+         break;
+      case '#':
+         spec->flags |= LOG_FORMAT_ALT;
+         break;
+      case '0':
+         spec->flags |= LOG_FORMAT_ZERO;
+         break;
+      default:
+         break;
+      }
+   }
+
+   if (*ptr == '*') {
+      spec->flags |= LOG_FORMAT_WIDTH_ARG;
+      spec->nstars++;
+      ptr++;
+   } else if ((*ptr >= '0') && (*ptr <= '9')) {
+      spec->width = LogFormat_ParseInt (&ptr);
+   }
+
+   if (*ptr == '.') {
+      ptr++;
+      if (*ptr == '*') {
+         spec->flags |= LOG_FORMAT_PRECISION_ARG;
+         spec->nstars++;
+         ptr++;
+      } else {
+         spec->precision = LogFormat_ParseInt (&ptr);
+      }
+   }
+
+   for (; *ptr && strchr ("hlLqjzZt", *ptr); ptr++) {
+      if (*ptr == 'l') {
+         longs++;
+      } else if (*ptr == 'h') {
+         spec->shorts++;
+      }
+      length = *ptr;
+   }
+
+   spec->conversion = *ptr;
+
+   switch (*ptr) {
+   case 'd':
+   case 'i':
+   case 'o':
+   case 'u':
+   case 'x':
+   case 'X':
+      if ((longs >= 2) || (length == 'q') || (length == 'L')) {
+         spec->type = LOG_ARG_LLONG;
+      } else if (longs == 1) {
+         spec->type = LOG_ARG_LONG;
+      } else if (length == 'j') {
+         spec->type = LOG_ARG_INTMAX;
+      } else if ((length == 'z') || (length == 'Z')) {
+         spec->type = LOG_ARG_SIZE;
+      } else if (length == 't') {
+         spec->type = LOG_ARG_PTRDIFF;
+      } else {
+         spec->type = LOG_ARG_INT;
+      }
+      break;
+   case 'c':
+      spec->type = LOG_ARG_INT;
+      break;
+   case 'e':
+   case 'E':
+   case 'f':
+   case 'F':
+   case 'g':
+   case 'G':
+   case 'a':
+   case 'A':
+      spec->type = (length == 'L') ? LOG_ARG_LDOUBLE : LOG_ARG_DOUBLE;
+      break;
+   case 's':
+      spec->type = longs ? LOG_ARG_INVALID : LOG_ARG_STRING;
+      break;
+   case 'p':
+      spec->type = LOG_ARG_POINTER;
+      break;
+   case '\0':
+      spec->len = ptr - format;
+      return ptr;
+   default:
+      break;
+   }
+
+   ptr++;
+   spec->len = ptr - format;
+
+   return ptr;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * LogFormat_Parse --
+ *
+ *       Parses the argument types consumed by @format into @types.
+ *
+ * Returns:
+ *       The number of arguments, or -1 if the format contains a
+ *       conversion that can't be deferred or more than @max_types
+ *       arguments.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+int
+LogFormat_Parse (const char *format, /* IN */
+                 uint8_t *types,     /* OUT */
+                 int max_types)      /* IN */
+{
+   LogFormatSpec spec;
+   int count = 0;
+   int i;
+
+   ASSERT (format);
+   ASSERT (types);
+
+   while (*format) {
+      if (*format != '%') {
+         format++;
+         continue;
+      }
+
+      format = LogFormat_ParseSpec (format, &spec);
+
+      if (spec.type == LOG_ARG_NONE) {
+         continue;
+      } else if (spec.type == LOG_ARG_INVALID) {
+         return -1;
+      } else if ((count + spec.nstars + 1) > max_types) {
+         return -1;
+      }
+
+      for (i = 0; i < spec.nstars; i++) {
+         types [count++] = LOG_ARG_INT;
+      }
+
+      types [count++] = spec.type;
+   }
+
+   return count;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * LogBinary_Emit --
+ *
+ *       Appends @n bytes of @data to @str, or @n copies of @fill if @data
+ *       is NULL, stopping short of the end of the buffer.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @str and @len are advanced; *@str is NUL terminated.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+LogBinary_Emit (char **str,       /* IN/OUT */
+                size_t *len,      /* IN/OUT */
+                const char *data, /* IN */
+                char fill,        /* IN */
+                size_t n)         /* IN */
+{
+   n = MIN (n, *len - 1);
+
+   if (data) {
+      memcpy (*str, data, n);
+   } else {
+      memset (*str, fill, n);
+   }
+
+   *str += n;
+   *len -= n;
+   **str = '\0';
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * LogBinary_EmitField --
+ *
+ *       Appends a converted argument, @prefix (its sign or radix prefix)
+ *       followed by @body, padded out to @width as printf() would.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @str and @len are advanced.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+LogBinary_EmitField (char **str,           /* IN/OUT */
+                     size_t *len,          /* IN/OUT */
+                     LogFormatFlags flags, /* IN */
+                     int width,            /* IN */
+                     const char *prefix,   /* IN */
+                     const char *body,     /* IN */
+                     size_t bodylen,       /* IN */
+                     bool zero_pad)        /* IN */
+{
+   size_t prefixlen = strlen (prefix);
+   size_t pad = 0;
+
+   if ((width > 0) && ((size_t)width > (prefixlen + bodylen))) {
+      pad = width - prefixlen - bodylen;
+   }
+
+   if (flags & LOG_FORMAT_LEFT) {
+      LogBinary_Emit (str, len, prefix, 0, prefixlen);
+      LogBinary_Emit (str, len, body, 0, bodylen);
+      LogBinary_Emit (str, len, NULL, ' ', pad);
+   } else if (zero_pad && (flags & LOG_FORMAT_ZERO)) {
+      LogBinary_Emit (str, len, prefix, 0, prefixlen);
+      LogBinary_Emit (str, len, NULL, '0', pad);
+      LogBinary_Emit (str, len, body, 0, bodylen);
+   } else {
+      LogBinary_Emit (str, len, NULL, ' ', pad);
+      LogBinary_Emit (str, len, prefix, 0, prefixlen);
+      LogBinary_Emit (str, len, body, 0, bodylen);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * LogBinary_FormatInteger --
+ *
+ *       Renders the digits of an integer conversion into @body after
+ *       narrowing @value to the type the conversion names. The sign or
+ *       "0x" prefix goes to @prefix so that zero padding can follow it.
+ *
+ * Returns:
+ *       What snprintf() returned for @body.
+ *
+ * Side effects:
+ *       @prefix and @body are filled in.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static int
+LogBinary_FormatInteger (const LogFormatSpec *spec, /* IN */
+                         LogFormatFlags flags,      /* IN */
+                         int precision,             /* IN */
+                         int64_t value,             /* IN */
+                         char *prefix,              /* OUT */
+                         char *body,                /* OUT */
+                         size_t len)                /* IN */
+{
+   uint64_t u;
+
+   *prefix = '\0';
+
+   switch (spec->conversion) {
+   case 'c':
+      return snprintf (body, len, "%c", (int)(unsigned char)value);
+   case 'd':
+   case 'i':
+      if (spec->type == LOG_ARG_INT) {
+         value = (spec->shorts > 1) ? (signed char)value :
+                 spec->shorts ? (short)value : (int)value;
+      } else if (spec->type == LOG_ARG_LONG) {
+         value = (long)value;
+      }
+      if (value < 0) {
+         strcpy (prefix, "-");
+         u = -(uint64_t)value;
+      } else {
+         if (flags & LOG_FORMAT_PLUS) {
+            strcpy (prefix, "+");
+         } else if (flags & LOG_FORMAT_SPACE) {
+            strcpy (prefix, " ");
+         }
+         u = value;
+      }
+      return snprintf (body, len, "%.*llu", precision, (unsigned long long)u);
+   default:
+      break;
+   }
+
+   if (spec->type == LOG_ARG_INT) {
+      u = (spec->shorts > 1) ? (unsigned char)value :
+          spec->shorts ? (unsigned short)value : (unsigned int)value;
+   } else if (spec->type == LOG_ARG_LONG) {
+      u = (unsigned long)value;
+   } else if (spec->type == LOG_ARG_SIZE) {
+      u = (size_t)value;
+   } else {
+      u = value;
+   }
+
+   switch (spec->conversion) {
+   case 'o':
+      return snprintf (body, len,
+                       (flags & LOG_FORMAT_ALT) ? "%#.*llo" : "%.*llo",
+                       precision, (unsigned long long)u);
+   case 'x':
+      if ((flags & LOG_FORMAT_ALT) && u) {
+         strcpy (prefix, "0x");
+      }
+      return snprintf (body, len, "%.*llx", precision, (unsigned long long)u);
+   case 'X':
+      if ((flags & LOG_FORMAT_ALT) && u) {
+         strcpy (prefix, "0X");
+      }
+      return snprintf (body, len, "%.*llX", precision, (unsigned long long)u);
+   default:
+      return snprintf (body, len, "%.*llu", precision, (unsigned long long)u);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * LogBinary_FormatDouble --
+ *
+ *       Renders the magnitude of a floating point conversion into @body
+ *       and its sign into @prefix. @value is formatted as a double
+ *       unless @is_long, so "%a" shows the same digits it would have.
+ *
+ * Returns:
+ *       What snprintf() returned for @body.
+ *
+ * Side effects:
+ *       @prefix and @body are filled in.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static int
+LogBinary_FormatDouble (const LogFormatSpec *spec, /* IN */
+                        LogFormatFlags flags,      /* IN */
+                        int precision,             /* IN */
+                        long double value,         /* IN */
+                        bool is_long,              /* IN */
+                        char *prefix,              /* OUT */
+                        char *body,                /* OUT */
+                        size_t len)                /* IN */
+{
+   bool alt = !!(flags & LOG_FORMAT_ALT);
+   double d;
+   int ret;
+   int i;
+
+   *prefix = '\0';
+
+   if (signbit (value)) {
+      strcpy (prefix, "-");
+      value = -value;
+   } else if (flags & LOG_FORMAT_PLUS) {
+      strcpy (prefix, "+");
+   } else if (flags & LOG_FORMAT_SPACE) {
+      strcpy (prefix, " ");
+   }
+
+   d = (double)value;
+
+   switch (tolower (spec->conversion)) {
+   case 'e':
+      ret = is_long ?
+         snprintf (body, len, alt ? "%#.*Le" : "%.*Le", precision, value) :
+         snprintf (body, len, alt ? "%#.*e" : "%.*e", precision, d);
+      break;
+   case 'f':
+      ret = is_long ?
+         snprintf (body, len, alt ? "%#.*Lf" : "%.*Lf", precision, value) :
+         snprintf (body, len, alt ? "%#.*f" : "%.*f", precision, d);
+      break;
+   case 'g':
+      ret = is_long ?
+         snprintf (body, len, alt ? "%#.*Lg" : "%.*Lg", precision, value) :
+         snprintf (body, len, alt ? "%#.*g" : "%.*g", precision, d);
+      break;
+   case 'a':
+   default:
+      ret = is_long ?
+         snprintf (body, len, alt ? "%#.*La" : "%.*La", precision, value) :
+         snprintf (body, len, alt ? "%#.*a" : "%.*a", precision, d);
+      break;
+   }
+
+   if (isupper (spec->conversion)) {
+      for (i = 0; body [i]; i++) {
+         body [i] = toupper (body [i]);
+      }
+   }
+
+   return ret;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * LogBinary_Format --
+ *
+ *       Renders @format using the encoded arguments of a
+ *       LOG_BINARY_EVENT into @str. This is the deferred half of
+ *       LogBinary_Encode() and is used by congo-logdump.
+ *
+ *       @format comes from the log file, so it is never handed to
+ *       printf(). Each conversion is rendered with a fixed format and
+ *       its flags, width and precision are applied here.
+ *
+ * Returns:
+ *       true if successful; false if @args does not match @format.
+ *
+ * Side effects:
+ *       @str is always NUL terminated, possibly truncated.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+LogBinary_Format (const char *format, /* IN */
+                  const uint8_t *args, /* IN */
+                  size_t argslen,      /* IN */
+                  char *str,           /* OUT */
+                  size_t len)          /* IN */
+{
+   const uint8_t *ptr = args;
+   const uint8_t *end = args + argslen;
+   const char *next;
+   const char *body;
+   LogFormatFlags flags;
+   LogFormatSpec spec;
+   long double ld;
+   uint16_t slen;
+   int64_t i64;
+   double d;
+   char bodybuf [LOG_BINARY_RECORD_MAX];
+   char strbuf [LOG_BINARY_RECORD_MAX];
+   char prefix [4];
+   size_t bodylen;
+   bool zero_pad;
+   int precision;
+   int width;
+   int ret;
+
+   ASSERT (format);
+   ASSERT (str);
+   ASSERT (len);
+
+   *str = '\0';
+
+   while (*format && (len > 1)) {
+      if (*format != '%') {
+         *str++ = *format++;
+         *str = '\0';
+         len--;
+         continue;
+      }
+
+      next = LogFormat_ParseSpec (format, &spec);
+
+      if (spec.type == LOG_ARG_INVALID) {
+         return false;
+      } else if (spec.type == LOG_ARG_NONE) {
+         LogBinary_Emit (&str, &len, "%", 0, 1);
+         format = next;
+         continue;
+      }
+
+      format = next;
+      flags = spec.flags;
+      width = spec.width;
+      precision = spec.precision;
+
+      if (flags & LOG_FORMAT_WIDTH_ARG) {
+         LOG_BINARY_GET (int64_t, i64);
+         i64 = MAX (i64, -LOG_BINARY_FIELD_MAX);
+         i64 = MIN (i64, LOG_BINARY_FIELD_MAX);
+         if (i64 < 0) {
+            flags |= LOG_FORMAT_LEFT;
+            i64 = -i64;
+         }
+         width = (int)i64;
+      }
+
+      if (flags & LOG_FORMAT_PRECISION_ARG) {
+         LOG_BINARY_GET (int64_t, i64);
+         precision = (i64 < 0) ? -1 : (int)MIN (i64, LOG_BINARY_FIELD_MAX);
+      }
+
+      body = bodybuf;
+      zero_pad = false;
+      *prefix = '\0';
+
+      switch (spec.type) {
+      case LOG_ARG_INT:
+      case LOG_ARG_LONG:
+      case LOG_ARG_LLONG:
+      case LOG_ARG_INTMAX:
+      case LOG_ARG_SIZE:
+      case LOG_ARG_PTRDIFF:
+         LOG_BINARY_GET (int64_t, i64);
+         ret = LogBinary_FormatInteger (&spec, flags, precision, i64,
+                                        prefix, bodybuf, sizeof bodybuf);
+         zero_pad = (precision < 0) && (spec.conversion != 'c');
+         break;
+      case LOG_ARG_DOUBLE:
+         LOG_BINARY_GET (double, d);
+         ret = LogBinary_FormatDouble (&spec, flags, precision, d, false,
+                                       prefix, bodybuf, sizeof bodybuf);
+         zero_pad = isfinite (d);
+         break;
+      case LOG_ARG_LDOUBLE:
+         LOG_BINARY_GET (long double, ld);
+         ret = LogBinary_FormatDouble (&spec, flags, precision, ld, true,
+                                       prefix, bodybuf, sizeof bodybuf);
+         zero_pad = isfinite (ld);
+         break;
+      case LOG_ARG_POINTER:
+         LOG_BINARY_GET (int64_t, i64);
+         ret = snprintf (bodybuf, sizeof bodybuf, "%p",
+                         (void *)(size_t)i64);
+         break;
+      case LOG_ARG_STRING:
+         LOG_BINARY_GET (uint16_t, slen);
+         if (slen == LOG_BINARY_NULL_STRING) {
+            body = "(null)";
+         } else if (((size_t)(end - ptr) < slen) || (slen >= sizeof strbuf)) {
+            return false;
+         } else {
+            memcpy (strbuf, ptr, slen);
+            strbuf [slen] = '\0';
+            ptr += slen;
+            body = strbuf;
+         }
+         ret = (precision < 0) ? strlen (body) : strnlen (body, precision);
+         break;
+      case LOG_ARG_NONE:
+      case LOG_ARG_INVALID:
+      default:
+         return false;
+      }
+
+      if (ret < 0) {
+         return false;
+      }
+
+      bodylen = MIN ((size_t)ret, sizeof bodybuf - 1);
+      LogBinary_EmitField (&str, &len, flags, width, prefix, body, bodylen,
+                           zero_pad);
+   }
+
+   /*
+    * If @str was truncated, the remaining arguments were not consumed.
+    */
+   return (*format || (ptr == end));
+}
@@ -0,0 +1,160 @@
+/* LogBinary.h
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LOG_BINARY_H
+#define LOG_BINARY_H
+
+
+#include <stdarg.h>
+
+#include <Log.h>
+#include <Macros.h>
+#include <Types.h>
+
+
+/*
+ * A binary log is a LogBinaryHeader followed by a stream of records.
+ * Every record starts with a LogBinaryRecord whose len includes the
+ * record header.
+ *
+ *   LOG_BINARY_SITE   payload is "domain\0format\0" for the site.
+ *   LOG_BINARY_EVENT  payload is the encoded arguments for site.
+ *   LOG_BINARY_TEXT   payload is "domain\0message\0" for messages that
+ *                     did not come through a LOG_*() call site.
+ *
+ * Arguments are encoded in the order they appear in the format string.
+ * Integers, pointers and doubles take 8 bytes, long doubles take
+ * sizeof (long double). Strings are a 16-bit length followed by the bytes,
+ * with a length of LOG_BINARY_NULL_STRING for NULL.
+ *
+ * Records are in host byte order; logs are meant to be decoded on the
+ * machine (or architecture) that wrote them.
+ */
+
+
+BEGIN_DECLS
+
+
+#define LOG_BINARY_MAGIC       "CONGOLOG"
+#define LOG_BINARY_VERSION     1
+#define LOG_BINARY_RECORD_MAX  1024
+#define LOG_BINARY_NULL_STRING 0xFFFF
+
+
+typedef enum
+{
+   LOG_BINARY_SITE  = 1,
+   LOG_BINARY_EVENT = 2,
+   LOG_BINARY_TEXT  = 3,
+} LogBinaryType;
+
+
+typedef enum
+{
+   LOG_ARG_NONE,
+   LOG_ARG_INVALID,
+   LOG_ARG_INT,
+   LOG_ARG_LONG,
+   LOG_ARG_LLONG,
+   LOG_ARG_INTMAX,
+   LOG_ARG_SIZE,
+   LOG_ARG_PTRDIFF,
+   LOG_ARG_DOUBLE,
+   LOG_ARG_LDOUBLE,
+   LOG_ARG_STRING,
+   LOG_ARG_POINTER,
+} LogArgType;
+
+
+#pragma pack(push, 1)
+typedef struct
+{
+   char     magic [8];
+   uint32_t version;
+   uint32_t flags;
+} LogBinaryHeader;
+
+
+typedef struct
+{
+   uint32_t len;
+   uint16_t type;
+   uint16_t level;
+   uint32_t site;
+   uint32_t padding;
+   uint64_t timestamp;
+} LogBinaryRecord;
+#pragma pack(pop)
+
+
+typedef enum
+{
+   LOG_FORMAT_LEFT          = 1 << 0,
+   LOG_FORMAT_PLUS          = 1 << 1,
+   LOG_FORMAT_SPACE         = 1 << 2,
+   LOG_FORMAT_ALT           = 1 << 3,
+   LOG_FORMAT_ZERO          = 1 << 4,
+   LOG_FORMAT_WIDTH_ARG     = 1 << 5,
+   LOG_FORMAT_PRECISION_ARG = 1 << 6,
+} LogFormatFlags;
+
+
+/*
+ * width and precision are -1 when absent or taken from an argument.
+ * shorts counts 'h' length modifiers.
+ */
+typedef struct
+{
+   const char     *begin;
+   size_t          len;
+   int             nstars;
+   LogArgType      type;
+   LogFormatFlags  flags;
+   int             width;
+   int             precision;
+   int             shorts;
+   char            conversion;
+} LogFormatSpec;
+
+
+const char *LogFormat_ParseSpec (const char *format,
+                                 LogFormatSpec *spec);
+int         LogFormat_Parse     (const char *format,
+                                 uint8_t *types,
+                                 int max_types);
+bool        LogBinary_Format    (const char *format,
+                                 const uint8_t *args,
+                                 size_t argslen,
+                                 char *str,
+                                 size_t len);
+void        LogBinary_Encode    (LogSite *site,
+                                 const char *format,
+                                 va_list args);
+void        LogBinary_LogFunc   (LogLevel level,
+                                 const char *domain,
+                                 const char *message,
+                                 void *user_data);
+void        LogBinary_Begin     (void);
+void        LogBinary_End       (void);
+
+
+END_DECLS
+
+
+#endif /* LOG_BINARY_H */
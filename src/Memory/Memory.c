@@ -25,6 +25,22 @@
 #include <Memory.h>
 
 
+#if defined(ENABLE_MEMORY_STATS)
+/*
+ * Memory.h replaces these with macros that record the call site; this
+ * file provides the untracked implementations they build upon.
+ */
+# undef Memory_Malloc
+# undef Memory_Malloc0
+# undef Memory_Malloc0N
+# undef Memory_Memalign
+# undef Memory_SafeMalloc
+# undef Memory_SafeMallocN
+# undef Memory_SafeMalloc0
+# undef Memory_SafeRealloc
+#endif
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -127,6 +143,35 @@ Memory_Malloc0N (size_t elem_size, /* IN */
 
 void
 Memory_Free (void *mem) /* IN */
+{
+#if defined(ENABLE_MEMORY_STATS)
+   MemorySite_Release (mem);
+#else
+   free (mem);
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Memory_FreeUntracked --
+ *
+ *       Free memory that came straight from the C library or from another
+ *       library rather than from this module, such as the result of
+ *       strdup().
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @mem is freed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+Memory_FreeUntracked (void *mem) /* IN */
 {
    free (mem);
 }
@@ -153,6 +198,9 @@ void *
 Memory_SafeRealloc (void *mem,   /* IN */
                     size_t size) /* IN */
 {
+#if defined(ENABLE_MEMORY_STATS)
+   return Memory_SafeReallocAt (mem, size, NULL);
+#else
    mem = realloc (mem, size);
 
    if (!mem && size) {
@@ -162,6 +210,7 @@ Memory_SafeRealloc (void *mem,   /* IN */
    }
 
    return mem;
+#endif
 }
 
 
@@ -45,21 +45,137 @@ BEGIN_DECLS
 #define Memory_Zero(Mem,Size) memset((Mem), 0, (Size))
 
 
-void  Memory_Free        (void *mem);
-void *Memory_Malloc      (size_t size);
-void *Memory_Malloc0     (size_t size);
-void *Memory_Malloc0N    (size_t elemsize,
-                          size_t count);
-void *Memory_Memalign    (size_t size,
-                          size_t alignment);
-void *Memory_SafeMalloc  (size_t size);
-void *Memory_SafeMallocN (size_t elemsize,
-                          size_t count);
-void *Memory_SafeMalloc0 (size_t size);
-void *Memory_SafeRealloc (void *mem,
+void  Memory_Free          (void *mem);
+void  Memory_FreeUntracked (void *mem);
+void *Memory_Malloc        (size_t size);
+void *Memory_Malloc0       (size_t size);
+void *Memory_Malloc0N      (size_t elemsize,
+                            size_t count);
+void *Memory_Memalign      (size_t size,
+                            size_t alignment);
+void *Memory_SafeMalloc    (size_t size);
+void *Memory_SafeMallocN   (size_t elemsize,
+                            size_t count);
+void *Memory_SafeMalloc0   (size_t size);
+void *Memory_SafeRealloc   (void *mem,
+                            size_t size);
+
+
+/*
+ * Memory_AllocLarge() maps big, long-lived buffers directly from the
+ * kernel. Requests of at least MEMORY_HUGE_PAGE_SIZE may be backed by
+ * huge pages to cut down on TLB misses, and may be placed on the calling
+ * thread's NUMA node. Each of these is a hint: when the system cannot
+ * honor it we quietly fall back to regular pages.
+ *
+ * The memory is zeroed and page aligned, and must be released with
+ * Memory_FreeLarge() passing the same size.
+ */
+
+#define MEMORY_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+
+typedef enum
+{
+   MEMORY_LARGE_NONE       = 0,
+   MEMORY_LARGE_HUGEPAGES  = 1 << 0,
+   MEMORY_LARGE_HUGETLB    = 1 << 1,
+   MEMORY_LARGE_NUMA_LOCAL = 1 << 2,
+} MemoryLargeFlags;
+
+
+void *Memory_AllocLarge  (size_t size,
+                          MemoryLargeFlags flags);
+void  Memory_FreeLarge   (void *mem,
                           size_t size);
 
 
+#if defined(ENABLE_MEMORY_STATS)
+/*
+ * With --enable-memory-stats, each Memory_*() call site gets a static
+ * MemorySite and the allocation is prefixed with a small header that
+ * remembers the site and size. Every site registers a set of counters
+ * (category "Memory/...", named after file:line) tracking live bytes,
+ * allocations, frees and a histogram of request sizes, which congo-stat
+ * can read from a running process.
+ *
+ * The header ends in a magic value that Memory_Free() and
+ * Memory_SafeRealloc() check before trusting it; a mismatch aborts.
+ * Memory that did not come from Memory_*() (strdup(), another library)
+ * must be released with Memory_FreeUntracked(), and Memory_AllocLarge()
+ * memory with Memory_FreeLarge(), neither of which looks for a header.
+ */
+
+typedef struct _MemorySite MemorySite;
+
+
+typedef enum
+{
+   MEMORY_SITE_LIVE_BYTES,
+   MEMORY_SITE_ALLOCS,
+   MEMORY_SITE_FREES,
+   MEMORY_SITE_SIZE_64,
+   MEMORY_SITE_SIZE_256,
+   MEMORY_SITE_SIZE_1K,
+   MEMORY_SITE_SIZE_4K,
+   MEMORY_SITE_SIZE_LARGE,
+   MEMORY_SITE_LAST
+} MemorySiteCounter;
+
+
+struct _MemorySite
+{
+   const char      *file;
+   int              line;
+   int              registered;
+   struct _Counter *counters;
+};
+
+
+# define MEMORY_SITE \
+   ({ \
+      static MemorySite __memory_site = { __FILE__, __LINE__ }; \
+      static MemorySite *__memory_site_ptr \
+         __attribute__((section ("congo_memory_sites"), used)) = \
+            &__memory_site; \
+      &__memory_site; \
+   })
+
+
+# define Memory_Malloc(s)        Memory_MallocAt ((s), MEMORY_SITE)
+# define Memory_Malloc0(s)       Memory_Malloc0At ((s), MEMORY_SITE)
+# define Memory_Malloc0N(e,c)    Memory_Malloc0NAt ((e), (c), MEMORY_SITE)
+# define Memory_Memalign(s,a)    Memory_MemalignAt ((s), (a), MEMORY_SITE)
+# define Memory_SafeMalloc(s)    Memory_SafeMallocAt ((s), MEMORY_SITE)
+# define Memory_SafeMallocN(e,c) Memory_SafeMallocNAt ((e), (c), MEMORY_SITE)
+# define Memory_SafeMalloc0(s)   Memory_SafeMalloc0At ((s), MEMORY_SITE)
+# define Memory_SafeRealloc(m,s) Memory_SafeReallocAt ((m), (s), MEMORY_SITE)
+
+
+void *Memory_MallocAt        (size_t size,
+                              MemorySite *site);
+void *Memory_Malloc0At       (size_t size,
+                              MemorySite *site);
+void *Memory_Malloc0NAt      (size_t elemsize,
+                              size_t count,
+                              MemorySite *site);
+void *Memory_MemalignAt      (size_t size,
+                              size_t alignment,
+                              MemorySite *site);
+void *Memory_SafeMallocAt    (size_t size,
+                              MemorySite *site);
+void *Memory_SafeMallocNAt   (size_t elemsize,
+                              size_t count,
+                              MemorySite *site);
+void *Memory_SafeMalloc0At   (size_t size,
+                              MemorySite *site);
+void *Memory_SafeReallocAt   (void *mem,
+                              size_t size,
+                              MemorySite *site);
+void  MemorySite_Release     (void *mem);
+#endif /* ENABLE_MEMORY_STATS */
+
+
 END_DECLS
 
 
@@ -0,0 +1,357 @@
+/* MemoryArena.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+
+#include <Debug.h>
+#include <Memory.h>
+#include <MemoryArena.h>
+
+
+struct _MemoryArenaChunk
+{
+   MemoryArenaChunk *next;
+   size_t            size;
+};
+
+
+#define CHUNK_HEADER_SIZE \
+   ((sizeof (MemoryArenaChunk) + MEMORY_ARENA_ALIGNMENT - 1) & \
+    ~(MEMORY_ARENA_ALIGNMENT - 1))
+#define CHUNK_DATA(c) (((uint8_t *)(c)) + CHUNK_HEADER_SIZE)
+
+
+static MemoryArenaChunk *
+MemoryArenaChunk_New (MemoryArena *arena, /* IN */
+                      size_t size)        /* IN */
+{
+   MemoryArenaChunk *chunk;
+
+   ASSERT (size <= (SIZE_MAX - CHUNK_HEADER_SIZE));
+
+   chunk = Memory_Memalign (CHUNK_HEADER_SIZE + size, MEMORY_ARENA_ALIGNMENT);
+   chunk->next = NULL;
+   chunk->size = size;
+
+   arena->allocated += size;
+
+   return chunk;
+}
+
+
+static void
+MemoryArenaChunk_FreeList (MemoryArena *arena,      /* IN */
+                           MemoryArenaChunk *chunk) /* IN */
+{
+   MemoryArenaChunk *next;
+
+   for (; chunk; chunk = next) {
+      next = chunk->next;
+      arena->allocated -= chunk->size;
+      Memory_Free (chunk);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemoryArena_Init --
+ *
+ *       Initializes a MemoryArena. No memory is allocated until the first
+ *       call to MemoryArena_Alloc().
+ *
+ *       If chunk_size is 0, MEMORY_ARENA_DEFAULT_CHUNK_SIZE is used.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+MemoryArena_Init (MemoryArena *arena,     /* OUT */
+                  size_t chunk_size,      /* IN */
+                  MemoryArenaFlags flags) /* IN */
+{
+   ASSERT (arena);
+
+   Memory_Zero (arena, sizeof *arena);
+
+   arena->chunk_size = chunk_size;
+   arena->flags = flags;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemoryArena_Destroy --
+ *
+ *       Releases all memory owned by arena. The arena may be reused after
+ *       calling MemoryArena_Init() again.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       All memory allocated from arena is invalid.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+MemoryArena_Destroy (MemoryArena *arena) /* IN */
+{
+   ASSERT (arena);
+
+   MemoryArenaChunk_FreeList (arena, arena->chunks);
+   MemoryArenaChunk_FreeList (arena, arena->large);
+
+   arena->pos = NULL;
+   arena->end = NULL;
+   arena->current = NULL;
+   arena->chunks = NULL;
+   arena->large = NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemoryArena_Reset --
+ *
+ *       Releases every allocation made from arena in one step.
+ *
+ *       With MEMORY_ARENA_RECYCLE this only rewinds to the first chunk;
+ *       chunks are reused in order as the arena fills up again.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       All memory allocated from arena is invalid.
+ *       Oversized allocations are freed, as are the chunks after the
+ *       first unless MEMORY_ARENA_RECYCLE is set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+MemoryArena_Reset (MemoryArena *arena) /* IN */
+{
+   ASSERT (arena);
+
+   if (UNLIKELY (arena->large)) {
+      MemoryArenaChunk_FreeList (arena, arena->large);
+      arena->large = NULL;
+   }
+
+   if (!arena->chunks) {
+      return;
+   }
+
+   if (!(arena->flags & MEMORY_ARENA_RECYCLE) && arena->chunks->next) {
+      MemoryArenaChunk_FreeList (arena, arena->chunks->next);
+      arena->chunks->next = NULL;
+   }
+
+   arena->current = arena->chunks;
+   arena->pos = CHUNK_DATA (arena->current);
+   arena->end = arena->pos + arena->current->size;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemoryArena_AllocSlow --
+ *
+ *       Slow path for MemoryArena_Alloc() when the current chunk cannot
+ *       satisfy the request. size must already be rounded up to
+ *       MEMORY_ARENA_ALIGNMENT.
+ *
+ *       Oversized requests get a dedicated chunk. Otherwise we move on to
+ *       the next recycled chunk, or allocate a new one.
+ *
+ * Returns:
+ *       Uninitialized memory of at least size bytes.
+ *
+ * Side effects:
+ *       May allocate a new chunk. The remainder of the current chunk is
+ *       wasted until the next reset.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void *
+MemoryArena_AllocSlow (MemoryArena *arena, /* IN */
+                       size_t size)        /* IN */
+{
+   MemoryArenaChunk *chunk;
+   uint8_t *ret;
+
+   ASSERT (arena);
+
+   if (!arena->chunk_size) {
+      arena->chunk_size = MEMORY_ARENA_DEFAULT_CHUNK_SIZE;
+   }
+
+   if (size > (arena->chunk_size / 4)) {
+      chunk = MemoryArenaChunk_New (arena, size);
+      chunk->next = arena->large;
+      arena->large = chunk;
+      return CHUNK_DATA (chunk);
+   }
+
+   if (arena->current && arena->current->next) {
+      chunk = arena->current->next;
+   } else {
+      chunk = MemoryArenaChunk_New (arena, arena->chunk_size);
+      if (arena->current) {
+         arena->current->next = chunk;
+      } else {
+         arena->chunks = chunk;
+      }
+   }
+
+   arena->current = chunk;
+
+   ret = CHUNK_DATA (chunk);
+   arena->pos = ret + size;
+   arena->end = ret + chunk->size;
+
+   return ret;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemoryArena_Alloc0 --
+ *
+ *       Like MemoryArena_Alloc() but the memory is zeroed.
+ *
+ * Returns:
+ *       Zeroed memory valid until the next reset.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void *
+MemoryArena_Alloc0 (MemoryArena *arena, /* IN */
+                    size_t size)        /* IN */
+{
+   void *ret;
+
+   ret = MemoryArena_Alloc (arena, size);
+   Memory_Zero (ret, size);
+
+   return ret;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemoryArena_MemDup --
+ *
+ *       Copies size bytes of mem into arena.
+ *
+ * Returns:
+ *       A copy of mem valid until the next reset.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void *
+MemoryArena_MemDup (MemoryArena *arena, /* IN */
+                    const void *mem,    /* IN */
+                    size_t size)        /* IN */
+{
+   void *ret;
+
+   ret = MemoryArena_Alloc (arena, size);
+   memcpy (ret, mem, size);
+
+   return ret;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemoryArena_StrDup --
+ *
+ *       Copies str into arena.
+ *
+ * Returns:
+ *       A copy of str valid until the next reset, or NULL if str is NULL.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+char *
+MemoryArena_StrDup (MemoryArena *arena, /* IN */
+                    const char *str)    /* IN */
+{
+   if (!str) {
+      return NULL;
+   }
+
+   return MemoryArena_MemDup (arena, str, strlen (str) + 1);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemoryArena_GetSize --
+ *
+ *       Gets the number of bytes currently held by arena, whether or not
+ *       they have been handed out since the last reset.
+ *
+ * Returns:
+ *       The size of all chunks in bytes.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+size_t
+MemoryArena_GetSize (MemoryArena *arena) /* IN */
+{
+   ASSERT (arena);
+
+   return arena->allocated;
+}
@@ -0,0 +1,132 @@
+/* MemoryArena.h
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MEMORY_ARENA_H
+#define MEMORY_ARENA_H
+
+
+#include <Macros.h>
+#include <Types.h>
+
+
+BEGIN_DECLS
+
+
+/*
+ * A MemoryArena hands out memory by bumping a pointer through large
+ * chunks. Individual allocations are never freed; instead the whole arena
+ * is reset at once, typically after each request has been handled.
+ *
+ * Allocations larger than a quarter of the chunk size get a chunk of
+ * their own, which is released on reset.
+ *
+ * With MEMORY_ARENA_RECYCLE, chunks are kept across resets so that an
+ * arena in steady state never calls into malloc. Without it, every chunk
+ * but the first is freed on reset.
+ *
+ * A zeroed MemoryArena is valid and uses the default chunk size.
+ */
+
+
+#define MEMORY_ARENA_DEFAULT_CHUNK_SIZE (64 * 1024)
+#define MEMORY_ARENA_ALIGNMENT          16
+
+
+typedef enum
+{
+   MEMORY_ARENA_NONE    = 0,
+   MEMORY_ARENA_RECYCLE = 1 << 0,
+} MemoryArenaFlags;
+
+
+typedef struct _MemoryArenaChunk MemoryArenaChunk;
+
+
+typedef struct
+{
+   uint8_t          *pos;
+   uint8_t          *end;
+   MemoryArenaChunk *current;
+   MemoryArenaChunk *chunks;
+   MemoryArenaChunk *large;
+   size_t            chunk_size;
+   size_t            allocated;
+   MemoryArenaFlags  flags;
+} MemoryArena;
+
+
+void   MemoryArena_Init      (MemoryArena *arena,
+                              size_t chunk_size,
+                              MemoryArenaFlags flags);
+void   MemoryArena_Destroy   (MemoryArena *arena);
+void   MemoryArena_Reset     (MemoryArena *arena);
+void  *MemoryArena_AllocSlow (MemoryArena *arena,
+                              size_t size);
+void  *MemoryArena_Alloc0    (MemoryArena *arena,
+                              size_t size);
+char  *MemoryArena_StrDup    (MemoryArena *arena,
+                              const char *str);
+void  *MemoryArena_MemDup    (MemoryArena *arena,
+                              const void *mem,
+                              size_t size);
+size_t MemoryArena_GetSize   (MemoryArena *arena);
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemoryArena_Alloc --
+ *
+ *       Allocates size bytes from arena, aligned to
+ *       MEMORY_ARENA_ALIGNMENT.
+ *
+ *       The fast path is a compare and a pointer bump; only when the
+ *       current chunk is exhausted do we call MemoryArena_AllocSlow().
+ *
+ * Returns:
+ *       Uninitialized memory that is valid until the next call to
+ *       MemoryArena_Reset() or MemoryArena_Destroy().
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static __inline__ void *
+MemoryArena_Alloc (MemoryArena *arena, /* IN */
+                   size_t size)        /* IN */
+{
+   uint8_t *ret = arena->pos;
+
+   size = (size + MEMORY_ARENA_ALIGNMENT - 1) & ~(MEMORY_ARENA_ALIGNMENT - 1);
+
+   if (LIKELY (size <= (size_t)(arena->end - ret))) {
+      arena->pos = ret + size;
+      return ret;
+   }
+
+   return MemoryArena_AllocSlow (arena, size);
+}
+
+
+END_DECLS
+
+
+#endif /* MEMORY_ARENA_H */
@@ -0,0 +1,302 @@
+/* MemoryLarge.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <Counter.h>
+#include <Debug.h>
+#include <Memory.h>
+#include <Platform.h>
+
+#if defined(HAVE_MMAP)
+# include <sys/mman.h>
+#endif
+
+#if defined(PLATFORM_LINUX)
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif
+
+
+#if defined(HAVE_MMAP) && !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+# define MAP_ANONYMOUS MAP_ANON
+#endif
+
+
+/*
+ * From <numaif.h>; we talk to the kernel directly rather than depend on
+ * libnuma. MPOL_PREFERRED, unlike MPOL_BIND, falls back to other nodes
+ * when the local one is out of memory.
+ */
+#define MEMORY_MPOL_PREFERRED 1
+#define MEMORY_MAX_NUMA_NODES 1024
+
+
+COUNTER (LargeAllocs, "Memory", "LargeAllocs",
+         "Number of large allocations.")
+COUNTER (LargeHugeTLB, "Memory", "LargeHugeTLB",
+         "Large allocations backed by explicit huge pages.")
+COUNTER (LargeFallbacks, "Memory", "LargeFallbacks",
+         "Explicit huge page requests that fell back.")
+
+
+static size_t
+Memory_GetLargeSize (size_t size) /* IN */
+{
+   size_t align;
+
+   if (size >= MEMORY_HUGE_PAGE_SIZE) {
+      align = MEMORY_HUGE_PAGE_SIZE;
+   } else {
+      align = Platform_GetPageSize ();
+   }
+
+   if (size > (SIZE_MAX - align)) {
+      fprintf (stderr, "Malloc overflow detected!");
+      abort ();
+   }
+
+   return (size + align - 1) & ~(align - 1);
+}
+
+
+#if defined(HAVE_MMAP)
+static void *
+Memory_Map (size_t len, /* IN */
+            int flags)  /* IN */
+{
+   return mmap (NULL, len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Memory_MapHugeAligned --
+ *
+ *       Maps len bytes aligned to MEMORY_HUGE_PAGE_SIZE, so that the
+ *       kernel may back the whole range with transparent huge pages.
+ *
+ *       We over-map by one huge page and unmap the slop at either end.
+ *
+ * Returns:
+ *       The mapping, or MAP_FAILED.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void *
+Memory_MapHugeAligned (size_t len) /* IN */
+{
+   uint8_t *mem;
+   uint8_t *aligned;
+   size_t head;
+   size_t tail;
+
+   mem = Memory_Map (len + MEMORY_HUGE_PAGE_SIZE, 0);
+   if (mem == MAP_FAILED) {
+      return MAP_FAILED;
+   }
+
+   aligned = (uint8_t *)(((uintptr_t)mem + MEMORY_HUGE_PAGE_SIZE - 1) &
+                         ~((uintptr_t)MEMORY_HUGE_PAGE_SIZE - 1));
+   head = aligned - mem;
+   tail = MEMORY_HUGE_PAGE_SIZE - head;
+
+   if (head) {
+      munmap (mem, head);
+   }
+
+   if (tail) {
+      munmap (aligned + len, tail);
+   }
+
+   return aligned;
+}
+
+
+static void
+Memory_BindLocal (void *mem,  /* IN */
+                  size_t len) /* IN */
+{
+#if defined(PLATFORM_LINUX) && defined(SYS_mbind) && defined(SYS_getcpu)
+   unsigned long nodemask [MEMORY_MAX_NUMA_NODES / (8 * sizeof (long))] = { 0 };
+   const size_t bits = 8 * sizeof (long);
+   unsigned cpu;
+   unsigned node;
+
+   if ((0 != syscall (SYS_getcpu, &cpu, &node, NULL)) ||
+       (node >= MEMORY_MAX_NUMA_NODES)) {
+      return;
+   }
+
+   nodemask [node / bits] |= (1UL << (node % bits));
+
+   /*
+    * Failure is fine; the kernel's default policy will apply. This is
+    * common in containers, where mbind() is often filtered.
+    */
+   (void)syscall (SYS_mbind, mem, len, MEMORY_MPOL_PREFERRED, nodemask,
+                  MEMORY_MAX_NUMA_NODES + 1, 0);
+#endif
+}
+#endif /* HAVE_MMAP */
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Memory_AllocLarge --
+ *
+ *       Allocates a large buffer directly from the kernel.
+ *
+ *       If size is at least MEMORY_HUGE_PAGE_SIZE:
+ *
+ *         MEMORY_LARGE_HUGETLB tries explicit huge pages (MAP_HUGETLB),
+ *         which must have been reserved by the administrator. If none
+ *         are available it behaves like MEMORY_LARGE_HUGEPAGES.
+ *
+ *         MEMORY_LARGE_HUGEPAGES aligns the buffer to a huge page and
+ *         asks for transparent huge pages with MADV_HUGEPAGE.
+ *
+ *       MEMORY_LARGE_NUMA_LOCAL prefers the NUMA node of the calling
+ *       thread for the pages of the buffer.
+ *
+ *       Platforms without mmap() get page aligned heap memory.
+ *
+ * Returns:
+ *       Zeroed memory of at least size bytes, which must be released
+ *       with Memory_FreeLarge().
+ *
+ * Side effects:
+ *       Aborts if the memory could not be allocated.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void *
+Memory_AllocLarge (size_t size,            /* IN */
+                   MemoryLargeFlags flags) /* IN */
+{
+#if defined(HAVE_MMAP)
+   bool huge;
+   void *mem = MAP_FAILED;
+   size_t len;
+
+   ASSERT (size);
+
+   len = Memory_GetLargeSize (size);
+   huge = (len >= MEMORY_HUGE_PAGE_SIZE);
+
+   Counter_Add (&__LargeAllocs, 1);
+
+#if defined(MAP_HUGETLB)
+   if (huge && (flags & MEMORY_LARGE_HUGETLB)) {
+# if defined(MAP_HUGE_2MB)
+      mem = Memory_Map (len, MAP_HUGETLB | MAP_HUGE_2MB);
+# else
+      mem = Memory_Map (len, MAP_HUGETLB);
+# endif
+      if (mem == MAP_FAILED) {
+         Counter_Add (&__LargeFallbacks, 1);
+      } else {
+         Counter_Add (&__LargeHugeTLB, 1);
+      }
+   }
+#endif
+
+   if (mem == MAP_FAILED) {
+      if (huge && (flags & (MEMORY_LARGE_HUGEPAGES | MEMORY_LARGE_HUGETLB))) {
+         mem = Memory_MapHugeAligned (len);
+#if defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+         if (mem != MAP_FAILED) {
+            (void)madvise (mem, len, MADV_HUGEPAGE);
+         }
+#endif
+      } else {
+         mem = Memory_Map (len, 0);
+      }
+   }
+
+   if (mem == MAP_FAILED) {
+      fprintf (stderr, "Failed to mmap() %llu bytes.\n",
+               (unsigned long long)len);
+      abort ();
+   }
+
+   if (flags & MEMORY_LARGE_NUMA_LOCAL) {
+      Memory_BindLocal (mem, len);
+   }
+
+   return mem;
+#else
+   void *mem;
+
+   ASSERT (size);
+
+   Counter_Add (&__LargeAllocs, 1);
+
+   mem = Memory_Memalign (size, Platform_GetPageSize ());
+   Memory_Zero (mem, size);
+
+   return mem;
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Memory_FreeLarge --
+ *
+ *       Releases a buffer allocated with Memory_AllocLarge(). size must
+ *       be the size that was requested.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+Memory_FreeLarge (void *mem,   /* IN */
+                  size_t size) /* IN */
+{
+   if (!mem) {
+      return;
+   }
+
+#if defined(HAVE_MMAP)
+   munmap (mem, Memory_GetLargeSize (size));
+#else
+   Memory_Free (mem);
+#endif
+}
@@ -0,0 +1,553 @@
+/* MemoryPool.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+
+#include <Atomic.h>
+#include <Debug.h>
+#include <Memory.h>
+#include <MemoryPool.h>
+
+
+#define MEMORY_POOL_ALIGNMENT 16
+#define SLAB_HEADER_SIZE      MEMORY_POOL_ALIGNMENT
+
+
+struct _MemoryPoolMagazine
+{
+   unsigned  count;
+   void     *objects [MEMORY_POOL_MAGAZINE_SIZE];
+};
+
+
+typedef struct
+{
+   MemoryPool         *pool;
+   MemoryPoolMagazine *loaded;
+   MemoryPoolMagazine *previous;
+} MemoryPoolCache;
+
+
+static __inline__ void
+MemoryPool_Count (Counter *counter, /* IN */
+                  int64_t value)    /* IN */
+{
+   if (counter) {
+      Counter_Add (counter, value);
+   }
+}
+
+
+static MemoryPoolMagazine *
+MemoryPoolMagazine_New (void)
+{
+   MemoryPoolMagazine *magazine;
+
+   magazine = Memory_SafeMalloc (sizeof *magazine);
+   magazine->count = 0;
+
+   return magazine;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemoryPool_DepotPut --
+ *
+ *       Stores magazine in the first free slot of the depot.
+ *
+ *       Slots only ever go from NULL to a magazine and back, and whoever
+ *       swaps a magazine out of a slot owns it, so there is no ABA
+ *       problem to worry about.
+ *
+ * Returns:
+ *       true if the magazine was stored, false if the depot is full.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+MemoryPool_DepotPut (MemoryPoolMagazine *volatile *slots, /* IN */
+                     MemoryPoolMagazine *magazine)        /* IN */
+{
+   int i;
+
+   for (i = 0; i < MEMORY_POOL_DEPOT_SIZE; i++) {
+      if (!slots [i] &&
+          !AtomicInt_CompareAndSwap (&slots [i], NULL, magazine)) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemoryPool_DepotTake --
+ *
+ *       Takes any magazine out of the depot.
+ *
+ * Returns:
+ *       A magazine owned by the caller, or NULL if the depot is empty.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static MemoryPoolMagazine *
+MemoryPool_DepotTake (MemoryPoolMagazine *volatile *slots) /* IN */
+{
+   MemoryPoolMagazine *magazine;
+   int i;
+
+   for (i = 0; i < MEMORY_POOL_DEPOT_SIZE; i++) {
+      if ((magazine = slots [i]) &&
+          (magazine == AtomicInt_CompareAndSwap (&slots [i], magazine, NULL))) {
+         return magazine;
+      }
+   }
+
+   return NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemoryPool_SlabFill --
+ *
+ *       Fills an empty magazine with objects from the pool's free list,
+ *       carving new objects out of slabs as needed.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Takes the pool mutex. May allocate a new slab.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+MemoryPool_SlabFill (MemoryPool *pool,             /* IN */
+                     MemoryPoolMagazine *magazine) /* IN */
+{
+   uint8_t *slab;
+   size_t slab_size;
+   void *object;
+
+   ASSERT (!magazine->count);
+
+   Mutex_Lock (&pool->mutex);
+
+   while (magazine->count < MEMORY_POOL_MAGAZINE_SIZE) {
+      if ((object = pool->free_list)) {
+         pool->free_list = *(void **)object;
+      } else {
+         if ((size_t)(pool->end - pool->pos) < pool->size) {
+            slab_size = MAX (MEMORY_POOL_SLAB_SIZE,
+                             SLAB_HEADER_SIZE +
+                             (pool->size * MEMORY_POOL_MAGAZINE_SIZE));
+            slab = Memory_Memalign (slab_size, MEMORY_POOL_ALIGNMENT);
+            *(void **)slab = pool->slabs;
+            pool->slabs = slab;
+            pool->pos = slab + SLAB_HEADER_SIZE;
+            pool->end = slab + slab_size;
+         }
+         object = pool->pos;
+         pool->pos += pool->size;
+      }
+      magazine->objects [magazine->count++] = object;
+   }
+
+   Mutex_Unlock (&pool->mutex);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemoryPool_SlabRelease --
+ *
+ *       Returns the objects in magazine to the pool's free list.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Takes the pool mutex. magazine is left empty.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+MemoryPool_SlabRelease (MemoryPool *pool,             /* IN */
+                        MemoryPoolMagazine *magazine) /* IN */
+{
+   void *object;
+
+   Mutex_Lock (&pool->mutex);
+
+   while (magazine->count) {
+      object = magazine->objects [--magazine->count];
+      *(void **)object = pool->free_list;
+      pool->free_list = object;
+   }
+
+   Mutex_Unlock (&pool->mutex);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemoryPool_Retire --
+ *
+ *       Hands a magazine that is no longer cached by a thread back to the
+ *       depot, or to the slab free list if the depot is full.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       magazine may be freed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+MemoryPool_Retire (MemoryPool *pool,             /* IN */
+                   MemoryPoolMagazine *magazine) /* IN */
+{
+   if ((magazine->count == MEMORY_POOL_MAGAZINE_SIZE) &&
+       MemoryPool_DepotPut (pool->full, magazine)) {
+      return;
+   }
+
+   MemoryPool_SlabRelease (pool, magazine);
+
+   if (!MemoryPool_DepotPut (pool->empty, magazine)) {
+      Memory_Free (magazine);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemoryPool_CacheRelease --
+ *
+ *       Thread exit handler for a pool's per-thread cache.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The cached objects are made available to other threads.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+MemoryPool_CacheRelease (void *data) /* IN */
+{
+   MemoryPoolCache *cache = data;
+   MemoryPool *pool = cache->pool;
+
+   MemoryPool_Retire (pool, cache->loaded);
+   MemoryPool_Retire (pool, cache->previous);
+   Memory_Free (cache);
+}
+
+
+static __inline__ MemoryPoolCache *
+MemoryPool_GetCache (MemoryPool *pool) /* IN */
+{
+   MemoryPoolCache *cache;
+
+   if (UNLIKELY (!(cache = pthread_getspecific (pool->key)))) {
+      cache = Memory_SafeMalloc (sizeof *cache);
+      cache->pool = pool;
+      cache->loaded = MemoryPoolMagazine_New ();
+      cache->previous = MemoryPoolMagazine_New ();
+      pthread_setspecific (pool->key, cache);
+   }
+
+   return cache;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemoryPool_Init --
+ *
+ *       Initializes a pool of objects of size bytes. Objects are aligned
+ *       to 16 bytes.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+MemoryPool_Init (MemoryPool *pool, /* OUT */
+                 const char *name, /* IN */
+                 size_t size)      /* IN */
+{
+   ASSERT (pool);
+   ASSERT (size);
+
+   Memory_Zero (pool, sizeof *pool);
+
+   pool->name = name;
+   pool->size = (size + MEMORY_POOL_ALIGNMENT - 1) &
+                ~(MEMORY_POOL_ALIGNMENT - 1);
+
+   Mutex_Init (&pool->mutex, NULL);
+   pthread_key_create (&pool->key, MemoryPool_CacheRelease);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemoryPool_Destroy --
+ *
+ *       Releases all memory held by pool, including objects that are
+ *       still allocated.
+ *
+ *       Only the calling thread's cache is released; other threads must
+ *       have exited, or at least stopped using the pool.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       All objects allocated from pool are invalid.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+MemoryPool_Destroy (MemoryPool *pool) /* IN */
+{
+   MemoryPoolMagazine *magazine;
+   MemoryPoolCache *cache;
+   void *slab;
+
+   ASSERT (pool);
+
+   if ((cache = pthread_getspecific (pool->key))) {
+      pthread_setspecific (pool->key, NULL);
+      Memory_Free (cache->loaded);
+      Memory_Free (cache->previous);
+      Memory_Free (cache);
+   }
+
+   pthread_key_delete (pool->key);
+
+   while ((magazine = MemoryPool_DepotTake (pool->full))) {
+      Memory_Free (magazine);
+   }
+
+   while ((magazine = MemoryPool_DepotTake (pool->empty))) {
+      Memory_Free (magazine);
+   }
+
+   while ((slab = pool->slabs)) {
+      pool->slabs = *(void **)slab;
+      Memory_Free (slab);
+   }
+
+   Mutex_Destroy (&pool->mutex);
+
+   Memory_Zero (pool, sizeof *pool);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemoryPool_Alloc --
+ *
+ *       Allocates an object from pool.
+ *
+ * Returns:
+ *       An uninitialized object that should be freed with
+ *       MemoryPool_Free().
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void *
+MemoryPool_Alloc (MemoryPool *pool) /* IN */
+{
+   MemoryPoolMagazine *magazine;
+   MemoryPoolCache *cache;
+
+   ASSERT (pool);
+
+   cache = MemoryPool_GetCache (pool);
+
+   MemoryPool_Count (pool->allocs, 1);
+   MemoryPool_Count (pool->in_use, 1);
+
+   if (LIKELY (cache->loaded->count)) {
+      goto pop;
+   }
+
+   if (cache->previous->count) {
+      magazine = cache->previous;
+      cache->previous = cache->loaded;
+      cache->loaded = magazine;
+      goto pop;
+   }
+
+   MemoryPool_Count (pool->misses, 1);
+
+   /*
+    * Both magazines are empty. Swap the loaded one for a full magazine
+    * from the depot, or failing that, fill it from the slabs.
+    */
+   if ((magazine = MemoryPool_DepotTake (pool->full))) {
+      if (!MemoryPool_DepotPut (pool->empty, cache->loaded)) {
+         Memory_Free (cache->loaded);
+      }
+      cache->loaded = magazine;
+   } else {
+      MemoryPool_SlabFill (pool, cache->loaded);
+   }
+
+pop:
+   magazine = cache->loaded;
+   return magazine->objects [--magazine->count];
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemoryPool_Alloc0 --
+ *
+ *       Like MemoryPool_Alloc() but the object is zeroed.
+ *
+ * Returns:
+ *       A zeroed object that should be freed with MemoryPool_Free().
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void *
+MemoryPool_Alloc0 (MemoryPool *pool) /* IN */
+{
+   void *object;
+
+   object = MemoryPool_Alloc (pool);
+   Memory_Zero (object, pool->size);
+
+   return object;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemoryPool_Free --
+ *
+ *       Returns object to pool. object may have been allocated by another
+ *       thread.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+MemoryPool_Free (MemoryPool *pool, /* IN */
+                 void *object)     /* IN */
+{
+   MemoryPoolMagazine *magazine;
+   MemoryPoolCache *cache;
+
+   ASSERT (pool);
+
+   if (!object) {
+      return;
+   }
+
+   cache = MemoryPool_GetCache (pool);
+
+   MemoryPool_Count (pool->in_use, -1);
+
+   if (LIKELY (cache->loaded->count < MEMORY_POOL_MAGAZINE_SIZE)) {
+      goto push;
+   }
+
+   if (!cache->previous->count) {
+      magazine = cache->previous;
+      cache->previous = cache->loaded;
+      cache->loaded = magazine;
+      goto push;
+   }
+
+   /*
+    * Both magazines are full. Move one to the depot and continue with an
+    * empty one, or give its objects back to the slabs if the depot is
+    * full too.
+    */
+   if (MemoryPool_DepotPut (pool->full, cache->previous)) {
+      cache->previous = cache->loaded;
+      if (!(cache->loaded = MemoryPool_DepotTake (pool->empty))) {
+         cache->loaded = MemoryPoolMagazine_New ();
+      }
+   } else {
+      MemoryPool_SlabRelease (pool, cache->previous);
+      magazine = cache->previous;
+      cache->previous = cache->loaded;
+      cache->loaded = magazine;
+   }
+
+push:
+   magazine = cache->loaded;
+   magazine->objects [magazine->count++] = object;
+}
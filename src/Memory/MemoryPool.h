@@ -0,0 +1,138 @@
+/* MemoryPool.h
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MEMORY_POOL_H
+#define MEMORY_POOL_H
+
+
+#include <pthread.h>
+
+#include <Counter.h>
+#include <Macros.h>
+#include <Mutex.h>
+#include <Types.h>
+
+
+BEGIN_DECLS
+
+
+/*
+ * A MemoryPool hands out fixed-size objects.
+ *
+ * Each thread keeps two magazines (small stacks of free objects) per
+ * pool, so the common case for both alloc and free touches no shared
+ * state. When both magazines are empty (or full) the thread exchanges a
+ * whole magazine with the depot, a lock-free array of magazine slots
+ * shared by all threads. Only when the depot is empty do we take the pool
+ * mutex and carve objects out of a slab.
+ *
+ * Memory is never returned to the system until MemoryPool_Destroy().
+ *
+ * Pools are usually declared at file scope with MEMORY_POOL(), which
+ * also registers counters for the number of allocations, thread cache
+ * misses and objects in use:
+ *
+ *   MEMORY_POOL (RecvTaskPool, RecvTask, "RecvTask")
+ *
+ *   task = RecvTaskPool_Alloc0 ();
+ *   RecvTaskPool_Free (task);
+ */
+
+
+#define MEMORY_POOL_MAGAZINE_SIZE 32
+#define MEMORY_POOL_DEPOT_SIZE    64
+#define MEMORY_POOL_SLAB_SIZE     (64 * 1024)
+
+
+typedef struct _MemoryPoolMagazine MemoryPoolMagazine;
+
+
+typedef struct
+{
+   const char                  *name;
+   size_t                       size;
+   Counter                     *allocs;
+   Counter                     *misses;
+   Counter                     *in_use;
+   pthread_key_t                key;
+   Mutex                        mutex;
+   void                        *free_list;
+   uint8_t                     *pos;
+   uint8_t                     *end;
+   void                        *slabs;
+   MemoryPoolMagazine *volatile full [MEMORY_POOL_DEPOT_SIZE];
+   MemoryPoolMagazine *volatile empty [MEMORY_POOL_DEPOT_SIZE];
+} MemoryPool;
+
+
+#define MEMORY_POOL(Identifier, Type, Name) \
+   COUNTER (Identifier##Allocs, "MemoryPool", Name "Allocs", \
+            "Number of " Name " allocations.") \
+   COUNTER (Identifier##Misses, "MemoryPool", Name "Misses", \
+            "Number of " Name " thread cache misses.") \
+   COUNTER (Identifier##InUse, "MemoryPool", Name "InUse", \
+            "Number of " Name " objects in use.") \
+   \
+   static MemoryPool __##Identifier; \
+   \
+   static void \
+   Identifier##_Init (void) __attribute__((constructor)); \
+   \
+   static void \
+   Identifier##_Init (void) \
+   { \
+      MemoryPool_Init (&__##Identifier, Name, sizeof (Type)); \
+      __##Identifier.allocs = &__##Identifier##Allocs; \
+      __##Identifier.misses = &__##Identifier##Misses; \
+      __##Identifier.in_use = &__##Identifier##InUse; \
+   } \
+   \
+   static __inline__ Type * \
+   Identifier##_Alloc (void) \
+   { \
+      return MemoryPool_Alloc (&__##Identifier); \
+   } \
+   \
+   static __inline__ Type * \
+   Identifier##_Alloc0 (void) \
+   { \
+      return MemoryPool_Alloc0 (&__##Identifier); \
+   } \
+   \
+   static __inline__ void \
+   Identifier##_Free (Type *object) \
+   { \
+      MemoryPool_Free (&__##Identifier, object); \
+   }
+
+
+void  MemoryPool_Init    (MemoryPool *pool,
+                          const char *name,
+                          size_t size);
+void  MemoryPool_Destroy (MemoryPool *pool);
+void *MemoryPool_Alloc   (MemoryPool *pool);
+void *MemoryPool_Alloc0  (MemoryPool *pool);
+void  MemoryPool_Free    (MemoryPool *pool,
+                          void *object);
+
+
+END_DECLS
+
+
+#endif /* MEMORY_POOL_H */
@@ -0,0 +1,473 @@
+/* MemoryStats.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <Counter.h>
+#include <Debug.h>
+#include <Memory.h>
+
+
+#if defined(ENABLE_MEMORY_STATS)
+
+
+# undef Memory_Malloc
+# undef Memory_Malloc0
+# undef Memory_Memalign
+# undef Memory_SafeMalloc
+# undef Memory_SafeMalloc0
+
+
+/*
+ * Every tracked allocation is preceded by a MemoryHeader. offset is the
+ * distance from the start of the underlying allocation to the caller's
+ * pointer, which is larger than the header for Memory_Memalign().
+ *
+ * The magic sits immediately before the caller's pointer and is cleared
+ * on free. Every pointer handed to Memory_Free() or Memory_SafeRealloc()
+ * must carry it, so a mismatch means a foreign pointer, a double free or
+ * an underrun, and we abort rather than guess.
+ */
+typedef struct
+{
+   MemorySite *site;
+   size_t      size;
+   size_t      offset;
+   uint64_t    magic;
+} MemoryHeader;
+
+
+#define MEMORY_HEADER_MAGIC 0x434F4E474F4D4D29ULL
+#define MEMORY_HEADER_SIZE  sizeof (MemoryHeader)
+
+
+STATIC_ASSERT ((sizeof (MemoryHeader) % 16) == 0);
+
+
+/*
+ * Sites live in a dedicated section so that all of them can be registered
+ * before Counters_Init(). The library is linked statically into each
+ * program, so the section covers the program's sites as well.
+ */
+extern MemorySite *__start_congo_memory_sites [] __attribute__((weak));
+extern MemorySite *__stop_congo_memory_sites [] __attribute__((weak));
+
+
+static const char *gMemorySiteCategories [MEMORY_SITE_LAST] = {
+   "Memory/LiveBytes",
+   "Memory/Allocs",
+   "Memory/Frees",
+   "Memory/Size64",
+   "Memory/Size256",
+   "Memory/Size1K",
+   "Memory/Size4K",
+   "Memory/SizeLarge",
+};
+
+
+static const char *gMemorySiteDescriptions [MEMORY_SITE_LAST] = {
+   "Bytes allocated here that are still live.",
+   "Number of allocations made here.",
+   "Number of allocations made here that were freed.",
+   "Allocations of up to 64 bytes.",
+   "Allocations of 65 to 256 bytes.",
+   "Allocations of 257 bytes to 1KB.",
+   "Allocations of 1KB to 4KB.",
+   "Allocations larger than 4KB.",
+};
+
+
+static __inline__ MemorySiteCounter
+MemorySite_SizeClass (size_t size) /* IN */
+{
+   if (size <= 64) {
+      return MEMORY_SITE_SIZE_64;
+   } else if (size <= 256) {
+      return MEMORY_SITE_SIZE_256;
+   } else if (size <= 1024) {
+      return MEMORY_SITE_SIZE_1K;
+   } else if (size <= 4096) {
+      return MEMORY_SITE_SIZE_4K;
+   }
+
+   return MEMORY_SITE_SIZE_LARGE;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemorySite_Track --
+ *
+ *       Fills in the header for a new allocation and accounts for it in
+ *       site.
+ *
+ * Returns:
+ *       The pointer to hand to the caller, or NULL if base is NULL.
+ *
+ * Side effects:
+ *       Updates the site's counters.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void *
+MemorySite_Track (void *base,         /* IN */
+                  size_t offset,      /* IN */
+                  size_t size,        /* IN */
+                  MemorySite *site)   /* IN */
+{
+   MemoryHeader *header;
+   uint8_t *mem;
+
+   if (!base) {
+      return NULL;
+   }
+
+   mem = (uint8_t *)base + offset;
+
+   header = (MemoryHeader *)(void *)(mem - MEMORY_HEADER_SIZE);
+   header->site = site;
+   header->size = size;
+   header->offset = offset;
+   header->magic = MEMORY_HEADER_MAGIC;
+
+   if (site && site->counters) {
+      Counter_Add (&site->counters [MEMORY_SITE_LIVE_BYTES], size);
+      Counter_Add (&site->counters [MEMORY_SITE_ALLOCS], 1);
+      Counter_Add (&site->counters [MemorySite_SizeClass (size)], 1);
+   }
+
+   return mem;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemorySite_GetHeader --
+ *
+ *       Finds the header of a tracked allocation.
+ *
+ * Returns:
+ *       The header preceding mem.
+ *
+ * Side effects:
+ *       Aborts if mem was not allocated by Memory_*() or was already
+ *       freed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static MemoryHeader *
+MemorySite_GetHeader (void *mem) /* IN */
+{
+   MemoryHeader *header;
+
+   header = (MemoryHeader *)(void *)((uint8_t *)mem - MEMORY_HEADER_SIZE);
+
+   if (header->magic != MEMORY_HEADER_MAGIC) {
+      fprintf (stderr, "Memory %p was not allocated by Memory_*() or was "
+                       "already freed.\n", mem);
+      abort ();
+   }
+
+   return header;
+}
+
+
+static void
+MemorySite_Untrack (MemoryHeader *header) /* IN */
+{
+   MemorySite *site = header->site;
+
+   if (site && site->counters) {
+      Counter_Add (&site->counters [MEMORY_SITE_LIVE_BYTES],
+                   -(int64_t)header->size);
+      Counter_Add (&site->counters [MEMORY_SITE_FREES], 1);
+   }
+
+   header->magic = 0;
+}
+
+
+static __inline__ size_t
+MemorySite_AddHeader (size_t size) /* IN */
+{
+   if (size > (SIZE_MAX - MEMORY_HEADER_SIZE)) {
+      fprintf (stderr, "Malloc overflow detected!");
+      abort ();
+   }
+
+   return MEMORY_HEADER_SIZE + size;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemorySite_Release --
+ *
+ *       Frees mem, which must have come from one of the tracking
+ *       allocators, or be NULL.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Updates the counters of the site that allocated mem.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+MemorySite_Release (void *mem) /* IN */
+{
+   MemoryHeader *header;
+
+   if (!mem) {
+      return;
+   }
+
+   header = MemorySite_GetHeader (mem);
+   MemorySite_Untrack (header);
+   free ((uint8_t *)mem - header->offset);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MemorySite_RegisterAll --
+ *
+ *       Registers counters for each call site in the program. Runs as a
+ *       constructor so that it happens before Counters_Init().
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Registers MEMORY_SITE_LAST counters per site.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+MemorySite_RegisterAll (void) __attribute__((constructor));
+
+
+static void
+MemorySite_RegisterAll (void)
+{
+   MemorySite **iter;
+   MemorySite *site;
+   const char *file;
+   Counter *counters;
+   char *name;
+   int i;
+
+   for (iter = __start_congo_memory_sites;
+        iter && (iter < __stop_congo_memory_sites);
+        iter++) {
+      site = *iter;
+
+      if (site->registered) {
+         continue;
+      }
+
+      site->registered = true;
+
+      if ((file = strrchr (site->file, '/'))) {
+         file++;
+      } else {
+         file = site->file;
+      }
+
+      name = Memory_SafeMalloc (32);
+      snprintf (name, 32, "%s:%d", file, site->line);
+      name [31] = '\0';
+
+      counters = Memory_SafeMalloc0 (MEMORY_SITE_LAST * sizeof *counters);
+
+      for (i = 0; i < MEMORY_SITE_LAST; i++) {
+         counters [i].category = gMemorySiteCategories [i];
+         counters [i].name = name;
+         counters [i].description = gMemorySiteDescriptions [i];
+         Counter_Register (&counters [i]);
+      }
+
+      site->counters = counters;
+   }
+}
+
+
+void *
+Memory_MallocAt (size_t size,      /* IN */
+                 MemorySite *site) /* IN */
+{
+   return MemorySite_Track (Memory_Malloc (MemorySite_AddHeader (size)),
+                            MEMORY_HEADER_SIZE, size, site);
+}
+
+
+void *
+Memory_Malloc0At (size_t size,      /* IN */
+                  MemorySite *site) /* IN */
+{
+   return MemorySite_Track (Memory_Malloc0 (MemorySite_AddHeader (size)),
+                            MEMORY_HEADER_SIZE, size, site);
+}
+
+
+void *
+Memory_Malloc0NAt (size_t elem_size, /* IN */
+                   size_t count,     /* IN */
+                   MemorySite *site) /* IN */
+{
+   ASSERT (elem_size);
+
+   if (!count || (count > (SIZE_MAX / elem_size))) {
+      return NULL;
+   }
+
+   return Memory_Malloc0At (elem_size * count, site);
+}
+
+
+void *
+Memory_MemalignAt (size_t size,      /* IN */
+                   size_t alignment, /* IN */
+                   MemorySite *site) /* IN */
+{
+   size_t offset;
+
+   /*
+    * alignment is a power of two, so rounding the header up to it keeps
+    * the caller's pointer aligned.
+    */
+   offset = MAX (MEMORY_HEADER_SIZE, alignment);
+
+   if (size > (SIZE_MAX - offset)) {
+      fprintf (stderr, "Malloc overflow detected!");
+      abort ();
+   }
+
+   return MemorySite_Track (Memory_Memalign (offset + size, alignment),
+                            offset, size, site);
+}
+
+
+void *
+Memory_SafeMallocAt (size_t size,      /* IN */
+                     MemorySite *site) /* IN */
+{
+   return MemorySite_Track (Memory_SafeMalloc (MemorySite_AddHeader (size)),
+                            MEMORY_HEADER_SIZE, size, site);
+}
+
+
+void *
+Memory_SafeMallocNAt (size_t elem_size, /* IN */
+                      size_t count,     /* IN */
+                      MemorySite *site) /* IN */
+{
+   ASSERT (elem_size);
+
+   if (!count || (count > (SIZE_MAX / elem_size))) {
+      fprintf (stderr, "Malloc overflow detected!");
+      abort ();
+   }
+
+   return Memory_SafeMallocAt (elem_size * count, site);
+}
+
+
+void *
+Memory_SafeMalloc0At (size_t size,      /* IN */
+                      MemorySite *site) /* IN */
+{
+   return MemorySite_Track (Memory_SafeMalloc0 (MemorySite_AddHeader (size)),
+                            MEMORY_HEADER_SIZE, size, site);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Memory_SafeReallocAt --
+ *
+ *       Tracking version of Memory_SafeRealloc(). The allocation is
+ *       attributed to site from now on, or to its previous site if site
+ *       is NULL.
+ *
+ * Returns:
+ *       A buffer of at least size bytes.
+ *
+ * Side effects:
+ *       Updates the counters of the old and new sites.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void *
+Memory_SafeReallocAt (void *mem,        /* IN */
+                      size_t size,      /* IN */
+                      MemorySite *site) /* IN */
+{
+   MemoryHeader *header;
+   uint8_t *base;
+   void *ret;
+
+   if (!mem) {
+      return Memory_SafeMallocAt (size, site);
+   }
+
+   header = MemorySite_GetHeader (mem);
+
+   if (!site) {
+      site = header->site;
+   }
+
+   /*
+    * realloc() would not preserve the alignment of Memory_Memalign()
+    * allocations, so move those by hand.
+    */
+   if (header->offset != MEMORY_HEADER_SIZE) {
+      ret = Memory_SafeMallocAt (size, site);
+      memcpy (ret, mem, MIN (size, header->size));
+      MemorySite_Release (mem);
+      return ret;
+   }
+
+   MemorySite_Untrack (header);
+
+   base = (uint8_t *)mem - MEMORY_HEADER_SIZE;
+   if (!(base = realloc (base, MemorySite_AddHeader (size)))) {
+      fprintf (stderr, "Failed to alloc %llu bytes.\n",
+               (unsigned long long)size);
+      abort ();
+   }
+
+   return MemorySite_Track (base, MEMORY_HEADER_SIZE, size, site);
+}
+
+
+#endif /* ENABLE_MEMORY_STATS */
@@ -40,17 +40,38 @@ Connection_InitFromHost (Connection *connection, /* OUT */
 {
    struct addrinfo hints = { 0 };
    struct addrinfo *results = NULL, *rp;
+   struct sockaddr_storage addr;
+   socklen_t addrlen;
    char portstr [16];
    bool success = false;
    int ret;
 
    ASSERT (connection);
    ASSERT (host);
-   ASSERT (port);
 
    Memory_Zero (connection, sizeof *connection);
 
    connection->socket = &connection->inline_socket;
+   MemoryArena_Init (&connection->arena, 0, MEMORY_ARENA_RECYCLE);
+
+   /*
+    * UNIX socket paths, such as mongod's /tmp/mongodb-27017.sock, skip
+    * the resolver.
+    */
+   if ((*host == '/') || (*host == '@')) {
+      if (!Socket_ParseAddr (host, port, &addr, &addrlen) ||
+          !Socket_Init (connection->socket, AF_UNIX, SOCK_STREAM, 0)) {
+         return false;
+      }
+      if (0 != Socket_Connect (connection->socket,
+                               (struct sockaddr *)&addr, addrlen, 0)) {
+         Socket_Close (connection->socket);
+         return false;
+      }
+      WireProtocolReader_Init (&connection->reader, connection->socket);
+      WireProtocolWriter_Init (&connection->writer, connection->socket);
+      return true;
+   }
 
    hints.ai_family = AF_UNSPEC;
    hints.ai_socktype = SOCK_STREAM;
@@ -78,6 +99,7 @@ Connection_InitFromHost (Connection *connection, /* OUT */
                             (socklen_t)rp->ai_addrlen,
                             0);
       if (ret != 0) {
+         Socket_Close (connection->socket);
          continue;
       }
 
@@ -104,6 +126,7 @@ Connection_Init (Connection *connection, /* OUT */
    WireProtocolReader_Init (&connection->reader, socket);
    WireProtocolWriter_Init (&connection->writer, socket);
    connection->last_request_id = Random_Int32 ();
+   MemoryArena_Init (&connection->arena, 0, MEMORY_ARENA_RECYCLE);
 }
 
 
@@ -114,6 +137,8 @@ Connection_Destroy (Connection *connection) /* IN */
 
    Socket_Close (connection->socket);
    connection->socket = NULL;
+   WireProtocolReader_Destroy (&connection->reader);
+   MemoryArena_Destroy (&connection->arena);
 }
 
 
@@ -25,6 +25,7 @@
 
 #include <Error.h>
 #include <Macros.h>
+#include <MemoryArena.h>
 #include <Socket.h>
 #include <Types.h>
 #include <WireProtocol.h>
@@ -35,6 +36,12 @@
 BEGIN_DECLS
 
 
+/*
+ * arena is request-scoped scratch for handlers and is reset after each
+ * message. On server connections the writer gathers replies into it, and
+ * pipelined requests copy their message and buffer their replies in it.
+ * Decoding and bson building still use the heap.
+ */
 typedef struct
 {
    Socket             *socket;
@@ -48,6 +55,7 @@ typedef struct
    int64_t             bytes_recv;
    int64_t             msg_sent;
    int64_t             msg_recv;
+   MemoryArena         arena;
 } Connection;
 
 
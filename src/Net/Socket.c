@@ -20,6 +20,8 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <Debug.h>
@@ -29,6 +31,70 @@
 #include <TimeSpec.h>
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Socket_SetName --
+ *
+ *       Formats the address of @sd for log messages. Accepted UNIX-domain
+ *       sockets are usually unnamed, so they are named after the listener
+ *       with @fd appended.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @sd->name is set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+Socket_SetName (Socket *sd, /* IN */
+                int fd)     /* IN */
+{
+   const struct sockaddr_un *un;
+   const struct sockaddr_in6 *in6;
+   const struct sockaddr_in *in;
+   char host [INET6_ADDRSTRLEN];
+   size_t len;
+
+   switch (sd->addr.ss_family) {
+   case AF_INET:
+      in = (const struct sockaddr_in *)&sd->addr;
+      inet_ntop (AF_INET, &in->sin_addr, host, sizeof host);
+      snprintf (sd->name, sizeof sd->name, "%s:%hu",
+                host, ntohs (in->sin_port));
+      break;
+   case AF_INET6:
+      in6 = (const struct sockaddr_in6 *)&sd->addr;
+      inet_ntop (AF_INET6, &in6->sin6_addr, host, sizeof host);
+      snprintf (sd->name, sizeof sd->name, "[%s]:%hu",
+                host, ntohs (in6->sin6_port));
+      break;
+   case AF_UNIX:
+      un = (const struct sockaddr_un *)&sd->addr;
+      len = sd->addrlen - offsetof (struct sockaddr_un, sun_path);
+      if ((sd->addrlen <= offsetof (struct sockaddr_un, sun_path)) ||
+          (len > sizeof un->sun_path)) {
+         snprintf (sd->name, sizeof sd->name, "unix:%d", fd);
+      } else if (un->sun_path [0] == '\0') {
+         snprintf (sd->name, sizeof sd->name, "@%.*s:%d",
+                   (int)(len - 1), un->sun_path + 1, fd);
+      } else {
+         snprintf (sd->name, sizeof sd->name, "%.*s:%d",
+                   (int)strnlen (un->sun_path, len), un->sun_path, fd);
+      }
+      break;
+   default:
+      snprintf (sd->name, sizeof sd->name, "fd:%d", fd);
+      break;
+   }
+
+   sd->name [sizeof sd->name - 1] = '\0';
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -151,7 +217,7 @@ Socket_Connect (Socket *sd,            /* IN */
  *       0 on success, otherwise -1 and errno is set.
  *
  * Side effects:
- *       None.
+ *       @addr is saved in @sd, to name connections accepted on it.
  *
  *--------------------------------------------------------------------------
  */
@@ -164,8 +230,124 @@ Socket_Bind (Socket *sd,                  /* IN */
    ASSERT (sd);
    ASSERT (addr);
    ASSERT (addrlen);
+   ASSERT (addrlen <= sizeof sd->addr);
+
+   if (0 != bind (sd->sd, addr, addrlen)) {
+      return -1;
+   }
+
+   memcpy (&sd->addr, addr, addrlen);
+   sd->addrlen = addrlen;
+   Socket_SetName (sd, sd->sd);
+
+   return 0;
+}
+
+
+/*
+ * Accepted sockets are non-blocking when they will be driven by lthreads,
+ * like those from Task_Socket().
+ */
+#if defined(TASK_USE_LTHREAD)
+# define SOCKET_ACCEPT_FLAGS (SOCK_NONBLOCK | SOCK_CLOEXEC)
+#else
+# define SOCKET_ACCEPT_FLAGS SOCK_CLOEXEC
+#endif
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Socket_AcceptBatch --
+ *
+ *       Accepts up to @max client sockets from the listening socket @sd
+ *       into @clients.
+ *
+ *       If no connection is pending, the current task is suspended until
+ *       one arrives. Then the accept queue is drained without waiting
+ *       again, so a burst of connections costs one wakeup.
+ *
+ * Returns:
+ *       The number of sockets accepted, or -1 if none could be and errno
+ *       is set. EMFILE and ENFILE are returned rather than waited on, as
+ *       the listener stays readable until descriptors are freed.
+ *
+ * Side effects:
+ *       The returned number of @clients are initialized.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+int
+Socket_AcceptBatch (Socket *sd,      /* IN */
+                    Socket *clients, /* OUT */
+                    int max)         /* IN */
+{
+   Socket *client;
+   int n = 0;
+   int fd;
 
-   return bind (sd->sd, addr, addrlen);
+   ASSERT (sd);
+   ASSERT (clients);
+   ASSERT (max > 0);
+
+   while (n < max) {
+      client = &clients [n];
+      client->addrlen = sizeof client->addr;
+
+#if defined(SOCK_CLOEXEC)
+      fd = accept4 (sd->sd, (struct sockaddr *)&client->addr,
+                    &client->addrlen, SOCKET_ACCEPT_FLAGS);
+#else
+      fd = accept (sd->sd, (struct sockaddr *)&client->addr,
+                   &client->addrlen);
+      if (fd != -1) {
+         fcntl (fd, F_SETFD, FD_CLOEXEC);
+#if defined(TASK_USE_LTHREAD)
+         fcntl (fd, F_SETFL, O_NONBLOCK);
+#endif
+      }
+#endif
+
+      if (fd != -1) {
+         client->domain = sd->domain;
+         client->type = sd->type;
+         client->protocol = sd->protocol;
+         client->sd = fd;
+
+         if ((sd->domain == AF_UNIX) &&
+             (client->addrlen <= offsetof (struct sockaddr_un, sun_path) + 1)) {
+            /* Unbound peer, name it after the listener. */
+            memcpy (&client->addr, &sd->addr, sd->addrlen);
+            client->addrlen = sd->addrlen;
+         }
+
+         Socket_SetName (client, fd);
+         n++;
+         continue;
+      }
+
+      switch (errno) {
+      case EINTR:
+      case ECONNABORTED:
+         continue;
+      case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+      case EWOULDBLOCK:
+#endif
+         if (n) {
+            return n;
+         }
+         if (0 != Task_WaitReadable (sd->sd, 0)) {
+            return -1;
+         }
+         continue;
+      default:
+         return n ? n : -1;
+      }
+   }
+
+   return n;
 }
 
 
@@ -176,8 +358,7 @@ Socket_Bind (Socket *sd,                  /* IN */
  *
  *       Accept a new client socket using @sd.
  *
- *       This calls accept() in a non-blocking fashion. However, the
- *       coroutine will be suspended until the operation may complete.
+ *       The coroutine will be suspended until a connection arrives.
  *
  * Returns:
  *       true on success and client is initialized.
@@ -193,31 +374,21 @@ bool
 Socket_Accept (Socket *sd,     /* IN */
                Socket *client) /* IN */
 {
-   char name [INET_ADDRSTRLEN + 32];
-
    ASSERT (sd);
    ASSERT (client);
 
    Memory_Zero (client, sizeof *client);
 
-   client->domain = sd->domain;
-   client->type = sd->type;
-   client->protocol = sd->protocol;
-   client->addrlen = sizeof client->addr;
-   client->sd = Task_Accept (sd->sd, &client->addr, &client->addrlen);
-
-   inet_ntop (AF_INET, &((struct sockaddr_in *)&client->addr)->sin_addr,
-              name, sizeof name);
-
-   snprintf (client->name, sizeof client->name, "%s:%hu", name,
-             ((struct sockaddr_in *)&client->addr)->sin_port);
-   client->name [sizeof client->name - 1] = '\0';
-
+   if (1 != Socket_AcceptBatch (sd, client, 1)) {
 #if defined(_WIN32)
-   return (client->sd != INVALID_SOCKET);
+      client->sd = INVALID_SOCKET;
 #else
-   return (client->sd != -1);
+      client->sd = -1;
 #endif
+      return false;
+   }
+
+   return true;
 }
 
 
@@ -322,11 +493,231 @@ Socket_SetSockOpt (Socket *sd,         /* IN */
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Socket_Listen --
+ *
+ *       Marks @sd as listening with room for @backlog pending
+ *       connections. The kernel may cap @backlog at net.core.somaxconn.
+ *
+ * Returns:
+ *       0 on success, otherwise -1 and errno is set.
+ *
+ * Side effects:
+ *       @sd is made non-blocking, for Socket_AcceptBatch().
+ *
+ *--------------------------------------------------------------------------
+ */
+
 int
 Socket_Listen (Socket *sd,  /* IN */
                int backlog) /* IN */
 {
+   int flags;
+
    ASSERT (sd);
 
+   if ((-1 == (flags = fcntl (sd->sd, F_GETFL))) ||
+       (-1 == fcntl (sd->sd, F_SETFL, flags | O_NONBLOCK))) {
+      return -1;
+   }
+
    return listen (sd->sd, backlog);
 }
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Socket_UnixAddr --
+ *
+ *       Fills @addr with the UNIX-domain address for @path. A leading '@'
+ *       names a socket in the Linux abstract namespace, which has no file
+ *       and disappears with the last descriptor.
+ *
+ * Returns:
+ *       true on success, false if @path does not fit in sun_path.
+ *
+ * Side effects:
+ *       @addr and @addrlen are initialized if true is returned.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+Socket_UnixAddr (const char *path,         /* IN */
+                 struct sockaddr_un *addr, /* OUT */
+                 socklen_t *addrlen)       /* OUT */
+{
+   size_t len;
+
+   ASSERT (path);
+   ASSERT (addr);
+   ASSERT (addrlen);
+
+   len = strlen (path);
+
+   if (!len || (len >= sizeof addr->sun_path)) {
+      errno = ENAMETOOLONG;
+      return false;
+   }
+
+   Memory_Zero (addr, sizeof *addr);
+   addr->sun_family = AF_UNIX;
+   memcpy (addr->sun_path, path, len);
+
+   if (*path == '@') {
+      addr->sun_path [0] = '\0';
+      *addrlen = offsetof (struct sockaddr_un, sun_path) + len;
+   } else {
+      *addrlen = offsetof (struct sockaddr_un, sun_path) + len + 1;
+   }
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Socket_UnlinkStale --
+ *
+ *       Clears the way to bind a UNIX-domain socket at @path by removing
+ *       a socket file left behind by a process that is gone. Anything
+ *       else at @path is left alone: other files, and sockets that
+ *       still accept connections.
+ *
+ * Returns:
+ *       true if nothing is at @path any more. false with errno set to
+ *       EEXIST for a file that is not a socket, EADDRINUSE for a socket
+ *       in use, or the error that prevented checking.
+ *
+ * Side effects:
+ *       May unlink @path.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+Socket_UnlinkStale (const char *path) /* IN */
+{
+   struct sockaddr_un addr;
+   socklen_t addrlen;
+   struct stat st;
+   int err;
+   int sd;
+
+   ASSERT (path);
+
+   if (*path == '@') {
+      return true;
+   }
+
+   if (0 != lstat (path, &st)) {
+      return (errno == ENOENT);
+   }
+
+   if (!S_ISSOCK (st.st_mode)) {
+      errno = EEXIST;
+      return false;
+   }
+
+   if (!Socket_UnixAddr (path, &addr, &addrlen)) {
+      return false;
+   }
+
+   /*
+    * Non-blocking so that a live listener with a full backlog is
+    * reported as in use rather than blocking us.
+    */
+   if (-1 == (sd = socket (AF_UNIX, SOCK_STREAM, 0))) {
+      return false;
+   }
+
+   fcntl (sd, F_SETFL, fcntl (sd, F_GETFL) | O_NONBLOCK);
+
+   err = (0 == connect (sd, (struct sockaddr *)&addr, addrlen)) ? 0 : errno;
+   close (sd);
+
+   if (err != ECONNREFUSED) {
+      errno = (!err || (err == EAGAIN)) ? EADDRINUSE : err;
+      return false;
+   }
+
+   return ((0 == unlink (path)) || (errno == ENOENT));
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Socket_ParseAddr --
+ *
+ *       Parses a listener address. @host may be an IPv4 address, an IPv6
+ *       address with or without brackets, such as "[::1]", or a UNIX
+ *       socket path, which starts with '/' or, for the abstract namespace,
+ *       '@'. @port is ignored for UNIX sockets.
+ *
+ * Returns:
+ *       true on success, otherwise false and errno is set.
+ *
+ * Side effects:
+ *       @addr and @addrlen are initialized if true is returned.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+Socket_ParseAddr (const char *host,              /* IN */
+                  uint16_t port,                 /* IN */
+                  struct sockaddr_storage *addr, /* OUT */
+                  socklen_t *addrlen)            /* OUT */
+{
+   struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)addr;
+   struct sockaddr_in *in = (struct sockaddr_in *)addr;
+   char ip6 [INET6_ADDRSTRLEN];
+   size_t len;
+
+   ASSERT (host);
+   ASSERT (addr);
+   ASSERT (addrlen);
+
+   Memory_Zero (addr, sizeof *addr);
+
+   if ((*host == '/') || (*host == '@')) {
+      return Socket_UnixAddr (host, (struct sockaddr_un *)addr, addrlen);
+   }
+
+   if (*host == '[') {
+      len = strlen (host);
+      if ((len < 3) || (host [len - 1] != ']') ||
+          ((len - 2) >= sizeof ip6)) {
+         errno = EINVAL;
+         return false;
+      }
+      memcpy (ip6, host + 1, len - 2);
+      ip6 [len - 2] = '\0';
+      host = ip6;
+   }
+
+   if (strchr (host, ':')) {
+      if (1 != inet_pton (AF_INET6, host, &in6->sin6_addr)) {
+         errno = EINVAL;
+         return false;
+      }
+      in6->sin6_family = AF_INET6;
+      in6->sin6_port = htons (port);
+      *addrlen = sizeof *in6;
+   } else {
+      if (1 != inet_pton (AF_INET, host, &in->sin_addr)) {
+         errno = EINVAL;
+         return false;
+      }
+      in->sin_family = AF_INET;
+      in->sin_port = htons (port);
+      *addrlen = sizeof *in;
+   }
+
+   return true;
+}
@@ -26,6 +26,7 @@
 #include <netinet/in.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 
 #include <Macros.h>
 #include <Types.h>
@@ -37,6 +38,13 @@ BEGIN_DECLS
 typedef struct _Socket Socket;
 
 
+/*
+ * Long enough for "[IPv6]:port" and for a UNIX socket path with the
+ * descriptor appended.
+ */
+#define SOCKET_NAME_MAX 128
+
+
 struct _Socket
 {
    int domain;
@@ -47,46 +55,57 @@ struct _Socket
 #else
    int sd;
 #endif
-   struct sockaddr addr;
+   struct sockaddr_storage addr;
    socklen_t addrlen;
-   char name [INET_ADDRSTRLEN];
+   char name [SOCKET_NAME_MAX];
 };
 
 
-bool    Socket_Init       (Socket *socket,
-                           int domain,
-                           int type,
-                           int protocol);
-int     Socket_Bind       (Socket *sd,
-                           const struct sockaddr *addr,
-                           socklen_t addrlen);
-bool    Socket_Accept     (Socket *sd,
-                           Socket *client);
-int     Socket_Connect    (Socket *sd,
-                           struct sockaddr *addr,
-                           socklen_t addrlen,
-                           uint64_t timeout);
-void    Socket_Close      (Socket *sd);
-ssize_t Socket_Recv       (Socket *sd,
-                           void *buf,
-                           size_t len,
-                           int flags,
-                           uint64_t timeout_msec);
-ssize_t Socket_Send       (Socket *sd,
-                           const void *buf,
-                           size_t len,
-                           int flags,
-                           uint64_t timeout);
-ssize_t Socket_SendMsg    (Socket *sd,
-                           const struct msghdr *msg,
-                           int flags);
-int     Socket_Listen     (Socket *sd,
-                           int backlog);
-int     Socket_SetSockOpt (Socket *sd,
-                           int level,
-                           int optname,
-                           const void *optval,
-                           socklen_t optlen);
+bool    Socket_Init        (Socket *socket,
+                            int domain,
+                            int type,
+                            int protocol);
+int     Socket_Bind        (Socket *sd,
+                            const struct sockaddr *addr,
+                            socklen_t addrlen);
+bool    Socket_Accept      (Socket *sd,
+                            Socket *client);
+int     Socket_AcceptBatch (Socket *sd,
+                            Socket *clients,
+                            int max);
+int     Socket_Connect     (Socket *sd,
+                            struct sockaddr *addr,
+                            socklen_t addrlen,
+                            uint64_t timeout);
+void    Socket_Close       (Socket *sd);
+ssize_t Socket_Recv        (Socket *sd,
+                            void *buf,
+                            size_t len,
+                            int flags,
+                            uint64_t timeout_msec);
+ssize_t Socket_Send        (Socket *sd,
+                            const void *buf,
+                            size_t len,
+                            int flags,
+                            uint64_t timeout);
+ssize_t Socket_SendMsg     (Socket *sd,
+                            const struct msghdr *msg,
+                            int flags);
+int     Socket_Listen      (Socket *sd,
+                            int backlog);
+int     Socket_SetSockOpt  (Socket *sd,
+                            int level,
+                            int optname,
+                            const void *optval,
+                            socklen_t optlen);
+bool    Socket_UnixAddr    (const char *path,
+                            struct sockaddr_un *addr,
+                            socklen_t *addrlen);
+bool    Socket_UnlinkStale (const char *path);
+bool    Socket_ParseAddr   (const char *host,
+                            uint16_t port,
+                            struct sockaddr_storage *addr,
+                            socklen_t *addrlen);
 
 
 END_DECLS
@@ -23,14 +23,28 @@
 
 #include <bson.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
 
+#include <Platform.h>
+
+#if defined(TASK_USE_LTHREAD) && defined(PLATFORM_LINUX)
+# include <sys/epoll.h>
+#endif
+
+#include <Array.h>
 #include <Counter.h>
+#include <Endian.h>
 #include <Log.h>
 #include <Memory.h>
+#include <MemoryPool.h>
 #include <QueryCommand.h>
 #include <Socket.h>
 #include <SocketManager.h>
 #include <Task.h>
+#include <TimeSpec.h>
+#include <Trace.h>
+#include <Tunable.h>
 #include <WireProtocol.h>
 #include <WireProtocolReader.h>
 
@@ -38,7 +52,96 @@
 #undef LOG_DOMAIN
 #define LOG_DOMAIN "Sockets"
 
-#define DEFAULT_BACKLOG 128
+/*
+ * Connections accepted per wakeup of a listener are capped by
+ * "net.accept.batch" and by ACCEPT_BATCH_MAX, which sizes the array.
+ *
+ * At "net.max_connections" (0 for no limit) new connections are either
+ * accepted and closed straight away, so clients fail fast and can retry
+ * elsewhere, or with "net.overload.reject" off, left queued in the
+ * backlog until connections close. The listener then polls every
+ * ACCEPT_PAUSE_MSEC, as it does when out of descriptors.
+ */
+#define ACCEPT_BATCH_MAX  128
+#define ACCEPT_PAUSE_MSEC 10
+
+
+TUNABLE_INT (gListenBacklog, "net.listen.backlog", 1024)
+TUNABLE_INT (gAcceptBatch, "net.accept.batch", 64)
+TUNABLE_INT (gMaxConnections, "net.max_connections", 0)
+TUNABLE_BOOL (gOverloadReject, "net.overload.reject", true)
+
+
+COUNTER (NetAccepted, "Net", "Accepted", "Connections accepted.")
+COUNTER (NetAcceptWakeups, "Net", "AcceptWakeups",
+         "Accept batches, one per listener wakeup.")
+COUNTER (NetAcceptErrors, "Net", "AcceptErrors", "Failed accept() calls.")
+COUNTER (NetRejected, "Net", "Rejected",
+         "Connections closed at net.max_connections.")
+COUNTER (NetConnections, "Net", "Connections", "Open client connections.")
+
+
+/*
+ * Every known opcode gets one counter in each of these categories, named
+ * for the opcode. Unknown opcodes fail to parse before reaching a
+ * handler. The latency counters are a histogram of handler time in
+ * decades, and Usecs over Requests gives the mean.
+ */
+typedef enum
+{
+   OPCODE_STAT_REQUESTS,
+   OPCODE_STAT_FAILURES,
+   OPCODE_STAT_USECS,
+   OPCODE_STAT_LATENCY_10US,
+   OPCODE_STAT_LATENCY_100US,
+   OPCODE_STAT_LATENCY_1MS,
+   OPCODE_STAT_LATENCY_10MS,
+   OPCODE_STAT_LATENCY_100MS,
+   OPCODE_STAT_LATENCY_SLOW,
+   OPCODE_STAT_LAST
+} OpcodeStat;
+
+
+static const char *gOpcodeNames [WIRE_PROTOCOL_SLOT_UNKNOWN] = {
+   "reply",
+   "msg",
+   "update",
+   "insert",
+   "query",
+   "getmore",
+   "delete",
+   "killcursors",
+   "opmsg",
+};
+
+
+static const char *gOpcodeStatCategories [OPCODE_STAT_LAST] = {
+   "Net/Requests",
+   "Net/Failures",
+   "Net/Usecs",
+   "Net/Latency10us",
+   "Net/Latency100us",
+   "Net/Latency1ms",
+   "Net/Latency10ms",
+   "Net/Latency100ms",
+   "Net/LatencySlow",
+};
+
+
+static const char *gOpcodeStatDescriptions [OPCODE_STAT_LAST] = {
+   "Messages handled with this opcode.",
+   "Messages whose handler closed the connection.",
+   "Microseconds spent in handlers for this opcode.",
+   "Messages handled in up to 10us.",
+   "Messages handled in 10us to 100us.",
+   "Messages handled in 100us to 1ms.",
+   "Messages handled in 1ms to 10ms.",
+   "Messages handled in 10ms to 100ms.",
+   "Messages handled in more than 100ms.",
+};
+
+
+static Counter gOpcodeCounters [WIRE_PROTOCOL_SLOT_UNKNOWN][OPCODE_STAT_LAST];
 
 
 typedef struct
@@ -49,37 +152,218 @@ typedef struct
 } ListenTask;
 
 
+/*
+ * The connection lives with its task rather than on the task's stack so
+ * it survives the connection being parked.
+ */
 typedef struct
 {
    SocketManager *socket_manager;
    Socket socket;
+   Connection connection;
+   bool parked;
    Task task;
 } RecvTask;
 
 
+MEMORY_POOL (RecvTaskPool, RecvTask, "RecvTask")
+
+
+static void
+SocketManager_RegisterCounters (void) __attribute__((constructor));
+
+
+static void
+SocketManager_RegisterCounters (void)
+{
+   Counter *counter;
+   int i;
+   int j;
+
+   for (i = 0; i < WIRE_PROTOCOL_SLOT_UNKNOWN; i++) {
+      for (j = 0; j < OPCODE_STAT_LAST; j++) {
+         counter = &gOpcodeCounters [i][j];
+         counter->category = gOpcodeStatCategories [j];
+         counter->name = gOpcodeNames [i];
+         counter->description = gOpcodeStatDescriptions [j];
+         Counter_Register (counter);
+      }
+   }
+}
+
+
+static __inline__ OpcodeStat
+OpcodeStat_LatencyClass (uint64_t usec) /* IN */
+{
+   if (usec <= 10) {
+      return OPCODE_STAT_LATENCY_10US;
+   } else if (usec <= 100) {
+      return OPCODE_STAT_LATENCY_100US;
+   } else if (usec <= 1000) {
+      return OPCODE_STAT_LATENCY_1MS;
+   } else if (usec <= 10000) {
+      return OPCODE_STAT_LATENCY_10MS;
+   } else if (usec <= 100000) {
+      return OPCODE_STAT_LATENCY_100MS;
+   }
+
+   return OPCODE_STAT_LATENCY_SLOW;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * SocketManager_RecordMessage --
+ *
+ *       Accounts for a message with opcode whose handler took usec and
+ *       returned ret.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Updates the opcode's counters.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+SocketManager_RecordMessage (int32_t opcode, /* IN */
+                             uint64_t usec,  /* IN */
+                             bool ret)       /* IN */
+{
+   WireProtocolSlot slot;
+   Counter *counters;
+
+   slot = WireProtocol_OpcodeSlot (opcode);
+   if (slot == WIRE_PROTOCOL_SLOT_UNKNOWN) {
+      return;
+   }
+
+   counters = gOpcodeCounters [slot];
+
+   Counter_Add (&counters [OPCODE_STAT_REQUESTS], 1);
+   Counter_Add (&counters [OPCODE_STAT_USECS], usec);
+   Counter_Add (&counters [OpcodeStat_LatencyClass (usec)], 1);
+
+   if (!ret) {
+      Counter_Add (&counters [OPCODE_STAT_FAILURES], 1);
+   }
+}
+
+
+/*
+ * Adapters from the dispatch table to the typed handlers. The message
+ * union members all start at the message, so each just passes the
+ * member for its opcode.
+ */
+#define SOCKET_MANAGER_DISPATCH(Name, field) \
+   static bool \
+   SocketManager_Dispatch##Name (SocketManager *socket_manager, \
+                                 Connection *connection, \
+                                 WireProtocolMessage *message, \
+                                 void *handlers_data) \
+   { \
+      return socket_manager->handlers.Handle##Name ( \
+         socket_manager, connection, &message->field, handlers_data); \
+   }
+
+
+SOCKET_MANAGER_DISPATCH (Reply, reply)
+SOCKET_MANAGER_DISPATCH (Msg, msg)
+SOCKET_MANAGER_DISPATCH (Update, update)
+SOCKET_MANAGER_DISPATCH (Insert, insert)
+SOCKET_MANAGER_DISPATCH (Query, query)
+SOCKET_MANAGER_DISPATCH (Getmore, getmore)
+SOCKET_MANAGER_DISPATCH (Delete, delete)
+SOCKET_MANAGER_DISPATCH (KillCursors, kill_cursors)
+SOCKET_MANAGER_DISPATCH (OpMsg, op_msg)
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * SocketManager_BuildDispatch --
+ *
+ *       Fills the dispatch table from the typed handlers, leaving a NULL
+ *       entry for each opcode without one.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Replaces socket_manager->dispatch.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+SocketManager_BuildDispatch (SocketManager *socket_manager) /* IN */
+{
+   const SocketManagerHandlers *handlers = &socket_manager->handlers;
+   SocketManagerDispatchFunc *dispatch = socket_manager->dispatch;
+
+   Memory_Zero (socket_manager->dispatch, sizeof socket_manager->dispatch);
+
+#define SET_DISPATCH(Slot, Name) \
+   if (handlers->Handle##Name) { \
+      dispatch [WIRE_PROTOCOL_SLOT_##Slot] = SocketManager_Dispatch##Name; \
+   }
+
+   SET_DISPATCH (REPLY, Reply)
+   SET_DISPATCH (MSG, Msg)
+   SET_DISPATCH (UPDATE, Update)
+   SET_DISPATCH (INSERT, Insert)
+   SET_DISPATCH (QUERY, Query)
+   SET_DISPATCH (GETMORE, Getmore)
+   SET_DISPATCH (DELETE, Delete)
+   SET_DISPATCH (KILL_CURSORS, KillCursors)
+   SET_DISPATCH (OP_MSG, OpMsg)
+
+#undef SET_DISPATCH
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * SocketManager_HandleMessage --
+ *
+ *       The default message handler, which dispatches to the typed
+ *       handler for the message's opcode.
+ *
+ * Returns:
+ *       The handler's result, or false if the opcode has no handler.
+ *
+ * Side effects:
+ *       Whatever the handler does.
+ *
+ *--------------------------------------------------------------------------
+ */
+
 static bool
-SocketManager_HandleMessage (SocketManager *socket_manager,
-                             Connection *connection,
-                             WireProtocolMessage *message,
-                             void *handlers_data)
+SocketManager_HandleMessage (SocketManager *socket_manager,  /* IN */
+                             Connection *connection,         /* IN */
+                             WireProtocolMessage *message,   /* IN */
+                             void *handlers_data)            /* IN */
 {
-   bool ret = false;
+   SocketManagerDispatchFunc dispatch;
+   int32_t opcode;
 
    ASSERT (socket_manager);
    ASSERT (connection);
    ASSERT (message);
 
-   switch (message->header.opcode) {
-   case WIRE_PROTOCOL_QUERY:
-      if (socket_manager->handlers.HandleQuery) {
-         ret = socket_manager->handlers.HandleQuery (
-            socket_manager, connection, &message->query, handlers_data);
-      }
-   default:
-      break;
+   opcode = message->header.opcode;
+   dispatch = socket_manager->dispatch [WireProtocol_OpcodeSlot (opcode)];
+
+   if (!dispatch) {
+      LOG_DEBUG ("No handler for opcode %d.", opcode);
+      return false;
    }
 
-   return ret;
+   return dispatch (socket_manager, connection, message, handlers_data);
 }
 
 
@@ -91,6 +375,7 @@ SocketManager_Init (SocketManager *socket_manager)
    Memory_Zero (socket_manager, sizeof *socket_manager);
 
    socket_manager->handlers.HandleMessage = SocketManager_HandleMessage;
+   socket_manager->park_fd = -1;
 }
 
 
@@ -120,78 +405,900 @@ SocketManager_SetHandlers (SocketManager *socket_manager,
    if (!socket_manager->handlers.HandleMessage) {
       socket_manager->handlers.HandleMessage = SocketManager_HandleMessage;
    }
+
+   SocketManager_BuildDispatch (socket_manager);
 }
 
 
+/*
+ * A connection that has had nothing to read for "net.idle.timeout"
+ * milliseconds (0 to never reclaim) drops its reader buffer back to the
+ * default size, frees its arena and releases its task's stack pages.
+ *
+ * With "net.idle.park" it then also gives up its task. The socket is
+ * watched by a single parker task per SocketManager, which starts a new
+ * task for it when it becomes readable. Parking needs lthread tasks and
+ * epoll, and is otherwise ignored.
+ */
+#if defined(TASK_USE_LTHREAD) && defined(PLATFORM_LINUX)
+# define SOCKET_MANAGER_PARK 1
+# define PARK_EVENTS_MAX     64
+#endif
+
+
+TUNABLE_INT (gIdleTimeout, "net.idle.timeout", 5000)
+TUNABLE_BOOL (gIdlePark, "net.idle.park", false)
+
+
+COUNTER (NetIdleReclaims, "Net", "IdleReclaims",
+         "Times an idle connection released its buffers.")
+COUNTER (NetIdleReclaimedBytes, "Net", "IdleReclaimedBytes",
+         "Reader buffer bytes released by idle connections.")
+COUNTER (NetParked, "Net", "Parked", "Idle connections without a task.")
+COUNTER (NetUnparked, "Net", "Unparked",
+         "Parked connections restarted by incoming data.")
+
+
+static void SocketManager_RecvLoop (void *data);
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * SocketManager_Reclaim --
+ *
+ *       Releases the memory an idle connection holds for requests.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Shrinks the reader buffer, frees the arena and has the current
+ *       task release its unused stack at its next yield.
+ *
+ *--------------------------------------------------------------------------
+ */
+
 static void
-SocketManager_RecvLoop (void *data) /* IN */
+SocketManager_Reclaim (Connection *connection) /* IN */
+{
+   NetIdleReclaimedBytes_Add (WireProtocolReader_Shrink (&connection->reader));
+   NetIdleReclaims_Increment ();
+
+   MemoryArena_Destroy (&connection->arena);
+   MemoryArena_Init (&connection->arena, 0, MEMORY_ARENA_RECYCLE);
+
+   Task_ReleaseStack ();
+}
+
+
+#ifdef SOCKET_MANAGER_PARK
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * SocketManager_ParkLoop --
+ *
+ *       Waits for parked sockets to become readable and starts a task
+ *       for each.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Runs for the life of the process.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+SocketManager_ParkLoop (void *data) /* IN */
+{
+   struct epoll_event events [PARK_EVENTS_MAX];
+   SocketManager *socket_manager = data;
+   RecvTask *task;
+   int n;
+   int i;
+
+   Task_Detach ();
+
+   for (;;) {
+      n = epoll_wait (socket_manager->park_fd, events, PARK_EVENTS_MAX, 0);
+
+      if (n == -1) {
+         if (errno != EINTR) {
+            LOG_WARNING ("Failed to wait for parked connections: %s",
+                         strerror (errno));
+            Task_Sleep (ACCEPT_PAUSE_MSEC);
+         }
+         continue;
+      }
+
+      if (n == 0) {
+         Task_WaitReadable (socket_manager->park_fd, 0);
+         continue;
+      }
+
+      for (i = 0; i < n; i++) {
+         task = events [i].data.ptr;
+         epoll_ctl (socket_manager->park_fd, EPOLL_CTL_DEL, task->socket.sd,
+                    &events [i]);
+         NetParked_Decrement ();
+         NetUnparked_Increment ();
+         Task_Create (&task->task, SocketManager_RecvLoop, task);
+      }
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * SocketManager_Park --
+ *
+ *       Hands an idle connection to the parker, starting the parker if
+ *       needed.
+ *
+ * Returns:
+ *       true if the connection was parked and its task must exit
+ *       without touching it.
+ *
+ * Side effects:
+ *       Frees the connection's reader buffer.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+SocketManager_Park (RecvTask *task) /* IN */
+{
+   SocketManager *socket_manager = task->socket_manager;
+   struct epoll_event event;
+   Task parker;
+
+   if (socket_manager->park_fd == -1) {
+      if (-1 == (socket_manager->park_fd = epoll_create1 (EPOLL_CLOEXEC))) {
+         LOG_WARNING ("Failed to create parking epoll: %s", strerror (errno));
+         return false;
+      }
+      Task_Create (&parker, SocketManager_ParkLoop, socket_manager);
+   }
+
+   event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+   event.data.ptr = task;
+
+   task->parked = true;
+   WireProtocolReader_Destroy (&task->connection.reader);
+
+   if (-1 == epoll_ctl (socket_manager->park_fd, EPOLL_CTL_ADD,
+                        task->socket.sd, &event)) {
+      task->parked = false;
+      WireProtocolReader_Init (&task->connection.reader, &task->socket);
+      return false;
+   }
+
+   NetParked_Increment ();
+
+   return true;
+}
+
+
+#else
+
+
+static bool
+SocketManager_Park (RecvTask *task) /* IN */
 {
+   return false;
+}
+
+
+#endif /* SOCKET_MANAGER_PARK */
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * SocketManager_SerialLoop --
+ *
+ *       Receives messages on the task's connection and runs the handler
+ *       for each to completion before receiving the next, reclaiming
+ *       memory when the connection goes idle.
+ *
+ * Returns:
+ *       true if the connection was parked, false once the peer
+ *       disconnects or a handler fails.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+SocketManager_SerialLoop (RecvTask *task) /* IN */
+{
+   SocketManager *socket_manager = task->socket_manager;
+   Connection *connection = &task->connection;
    WireProtocolMessage msg;
-   Connection connection;
-   RecvTask *task = data;
-   Socket *client = data;
+   uint64_t timeout;
+   uint64_t begin;
+   int32_t opcode;
+   bool idle = false;
    bool ret = true;
 
-   ASSERT (client);
+   timeout = MAX (0, TunableInt_Get (gIdleTimeout));
+
+   while (ret) {
+      /*
+       * Wait here rather than in the read so an idle connection is
+       * noticed between messages and never mid-message. Only wait once
+       * a non-blocking read finds nothing; what it does read saves the
+       * next read a trip to the socket.
+       */
+      if (timeout &&
+          !WireProtocolReader_HasPending (&connection->reader) &&
+          (-1 == WireProtocolReader_Poll (&connection->reader)) &&
+          ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+         switch (Task_WaitReadable (task->socket.sd, idle ? 0 : timeout)) {
+         case -2:
+            SocketManager_Reclaim (connection);
+            if (TunableBool_Get (gIdlePark) && SocketManager_Park (task)) {
+               return true;
+            }
+            idle = true;
+            continue;
+         case -1:
+            return false;
+         default:
+            idle = false;
+            break;
+         }
+      }
 
-   Connection_Init (&connection, &task->socket);
+      if (!Connection_Recv (connection, &msg)) {
+         break;
+      }
 
-   if (!task->socket_manager->handlers.Accept
-         (task->socket_manager,
-          &connection,
-          task->socket_manager->handlers_data)) {
-      goto fail;
+      opcode = msg.header.opcode;
+      TRACE_BEGIN (TRACE_HANDLER, opcode);
+      begin = TimeSpec_GetMonotonic ();
+      ret = socket_manager->handlers.HandleMessage (
+         socket_manager, connection, &msg, socket_manager->handlers_data);
+      SocketManager_RecordMessage (opcode, TimeSpec_GetMonotonic () - begin,
+                                   ret);
+      TRACE_END (TRACE_HANDLER, opcode);
+
+      /*
+       * Anything the handler allocated from the connection arena was
+       * scoped to this request.
+       */
+      MemoryArena_Reset (&connection->arena);
    }
 
-   while (ret && Connection_Recv (&connection, &msg)) {
-      ret = task->socket_manager->handlers.HandleMessage (
-         task->socket_manager, &connection, &msg,
-         task->socket_manager->handlers_data);
+   return false;
+}
+
+
+#ifdef TASK_USE_LTHREAD
+
+
+/*
+ * Pipelined connections run each request's handler in its own task
+ * while the connection's task keeps reading, and a writer task sends
+ * the replies in the order the requests arrived.
+ *
+ * A handler gets a copy of the connection whose writer appends to the
+ * request's replies rather than the socket, and whose arena and
+ * message buffer belong to the request. The replies start out in the
+ * arena too. The writer assigns request ids
+ * as it sends, so they stay unique and increasing.
+ *
+ * Everything runs on the connection's scheduler, so the shared state
+ * needs no locking. Only the reader and writer ever wait, each on its
+ * own condition.
+ */
+typedef struct _PipelineRequest PipelineRequest;
+
+
+typedef struct
+{
+   SocketManager   *socket_manager;
+   Connection      *connection;
+   PipelineRequest *head;
+   PipelineRequest *tail;
+   int64_t          depth;
+   int64_t          in_flight;
+   bool             closing;
+   bool             discard;
+   bool             writer_exited;
+   lthread_cond_t  *reader_cond;
+   lthread_cond_t  *writer_cond;
+} Pipeline;
+
+
+struct _PipelineRequest
+{
+   Pipeline            *pipeline;
+   PipelineRequest     *next;
+   Connection           connection;
+   WireProtocolMessage  message;
+   Array                replies;
+   bool                 done;
+   bool                 ret;
+   Task                 task;
+};
+
+
+#define PIPELINE_DEPTH_MAX  1024
+#define PIPELINE_IOV_MAX    64
+#define PIPELINE_REPLY_SIZE 4096
+
+
+MEMORY_POOL (PipelineRequestPool, PipelineRequest, "PipelineRequest")
+
+
+TUNABLE_INT (gPipelineDepth, "net.pipeline.depth", 0)
+
+
+COUNTER (NetPipelined, "Net", "Pipelined",
+         "Requests that arrived while earlier ones were in flight.")
+COUNTER (NetPipelineInFlight, "Net", "PipelineInFlight",
+         "Pipelined requests not yet replied to.")
+COUNTER (NetPipelineStalls, "Net", "PipelineStalls",
+         "Times a reader waited at net.pipeline.depth.")
+COUNTER (NetPipelineWrites, "Net", "PipelineWrites",
+         "Reply batches written by pipeline writers.")
+COUNTER (NetPipelineDiscarded, "Net", "PipelineDiscarded",
+         "Pipelined requests whose replies were dropped.")
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Pipeline_Close --
+ *
+ *       Stops the pipeline reading more requests, waking the reader if
+ *       it is blocked on the socket.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Shuts down the read side of the connection's socket.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+Pipeline_Close (Pipeline *pipeline) /* IN */
+{
+   if (!pipeline->closing) {
+      pipeline->closing = true;
+      shutdown (pipeline->connection->socket->sd, SHUT_RD);
+      lthread_cond_signal (pipeline->reader_cond);
+   }
+}
+
+
+static void
+PipelineRequest_Free (PipelineRequest *request) /* IN */
+{
+   MemoryArena_Destroy (&request->connection.arena);
+   Array_Destroy (&request->replies);
+   PipelineRequestPool_Free (request);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * PipelineRequest_Finish --
+ *
+ *       Folds a completed request's statistics into the connection and
+ *       assigns request ids to its replies.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Rewrites the request_id of each reply unless the handler set
+ *       no_header_mutate.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+PipelineRequest_Finish (PipelineRequest *request) /* IN */
+{
+   Connection *connection = request->pipeline->connection;
+   uint8_t *data = request->replies.data;
+   uint32_t offset = 0;
+   int32_t msg_len;
+   int32_t request_id;
+
+   connection->bytes_sent += request->connection.bytes_sent;
+   connection->msg_sent += request->connection.msg_sent;
+
+   if (request->connection.no_header_mutate) {
+      connection->no_header_mutate = true;
+      return;
+   }
+
+   while ((offset + sizeof (WireProtocolHeader)) <= request->replies.len) {
+      memcpy (&msg_len, data + offset, sizeof msg_len);
+      msg_len = (int32_t)UINT32_FROM_LE (msg_len);
+      request_id = (int32_t)UINT32_TO_LE (++connection->last_request_id);
+      memcpy (data + offset + offsetof (WireProtocolHeader, request_id),
+              &request_id, sizeof request_id);
+      if ((msg_len < (int32_t)sizeof (WireProtocolHeader)) ||
+          ((uint32_t)msg_len > (request->replies.len - offset))) {
+         break;
+      }
+      WireProtocol_SetChecksum (data + offset, msg_len);
+      offset += msg_len;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Pipeline_SendAll --
+ *
+ *       Writes all of iov, resuming after short writes.
+ *
+ * Returns:
+ *       true if everything was sent.
+ *
+ * Side effects:
+ *       Modifies iov.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+Pipeline_SendAll (int fd,             /* IN */
+                  struct iovec *iov,  /* IN */
+                  int iovcnt)         /* IN */
+{
+   struct msghdr msg;
+   ssize_t ret;
+
+   Memory_Zero (&msg, sizeof msg);
+   msg.msg_iov = iov;
+   msg.msg_iovlen = iovcnt;
+
+   while (msg.msg_iovlen) {
+      if ((ret = Task_SendMsg (fd, &msg, 0)) <= 0) {
+         return false;
+      }
+
+      while (msg.msg_iovlen && (ret >= (ssize_t)msg.msg_iov->iov_len)) {
+         ret -= msg.msg_iov->iov_len;
+         msg.msg_iov++;
+         msg.msg_iovlen--;
+      }
+
+      if (msg.msg_iovlen) {
+         msg.msg_iov->iov_base = (uint8_t *)msg.msg_iov->iov_base + ret;
+         msg.msg_iov->iov_len -= ret;
+      }
+   }
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Pipeline_WriterLoop --
+ *
+ *       Sends the replies of completed requests from the head of the
+ *       pipeline, gathering as many as are ready into each write.
+ *
+ *       After a handler fails or a write fails, the remaining requests
+ *       are still waited for but their replies are dropped, as the
+ *       serial loop would have closed the connection.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Exits once the pipeline is closing and empty.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+Pipeline_WriterLoop (void *data) /* IN */
+{
+   PipelineRequest *ready [PIPELINE_IOV_MAX];
+   struct iovec iov [PIPELINE_IOV_MAX];
+   PipelineRequest *request;
+   Pipeline *pipeline = data;
+   int iovcnt;
+   int fd;
+   int n;
+   int i;
+
+   Task_Detach ();
+
+   /*
+    * The scheduler tracks one poller registration per descriptor, so
+    * blocking on a write to the reader's descriptor would drop its
+    * interest in reads. The writer gets a descriptor of its own.
+    */
+   if (-1 == (fd = dup (pipeline->connection->socket->sd))) {
+      pipeline->discard = true;
+   }
+
+   for (;;) {
+      for (n = 0, iovcnt = 0;
+           (n < PIPELINE_IOV_MAX) && pipeline->head && pipeline->head->done;
+           n++) {
+         request = ready [n] = pipeline->head;
+         if (!(pipeline->head = request->next)) {
+            pipeline->tail = NULL;
+         }
+
+         PipelineRequest_Finish (request);
+
+         if (pipeline->discard) {
+            NetPipelineDiscarded_Increment ();
+         } else if (request->replies.len) {
+            iov [iovcnt].iov_base = request->replies.data;
+            iov [iovcnt].iov_len = request->replies.len;
+            iovcnt++;
+         }
+
+         if (!request->ret) {
+            pipeline->discard = true;
+         }
+      }
+
+      if (iovcnt) {
+         NetPipelineWrites_Increment ();
+         if (!Pipeline_SendAll (fd, iov, iovcnt)) {
+            pipeline->discard = true;
+         }
+      }
+
+      if (pipeline->discard) {
+         Pipeline_Close (pipeline);
+      }
+
+      for (i = 0; i < n; i++) {
+         PipelineRequest_Free (ready [i]);
+      }
+
+      if (n) {
+         pipeline->in_flight -= n;
+         NetPipelineInFlight_Add (-n);
+         lthread_cond_signal (pipeline->reader_cond);
+      } else if (pipeline->closing && !pipeline->head) {
+         break;
+      } else {
+         lthread_cond_wait (pipeline->writer_cond, 0);
+      }
+   }
+
+   if (fd != -1) {
+      Task_Close (fd);
+   }
+
+   pipeline->writer_exited = true;
+   lthread_cond_signal (pipeline->reader_cond);
+}
+
+
+static void
+Pipeline_HandlerLoop (void *data) /* IN */
+{
+   PipelineRequest *request = data;
+   SocketManager *socket_manager = request->pipeline->socket_manager;
+   uint64_t begin;
+   int32_t opcode;
+
+   Task_Detach ();
+
+   opcode = request->message.header.opcode;
+   TRACE_BEGIN (TRACE_HANDLER, opcode);
+   begin = TimeSpec_GetMonotonic ();
+   request->ret = socket_manager->handlers.HandleMessage (
+      socket_manager, &request->connection, &request->message,
+      socket_manager->handlers_data);
+   SocketManager_RecordMessage (opcode, TimeSpec_GetMonotonic () - begin,
+                                request->ret);
+   TRACE_END (TRACE_HANDLER, opcode);
+
+   /*
+    * The writer may free the request as soon as it runs.
+    */
+   request->done = true;
+   lthread_cond_signal (request->pipeline->writer_cond);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * SocketManager_PipelineLoop --
+ *
+ *       Receives messages on connection and starts a handler task for
+ *       each, keeping up to depth requests in flight.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Returns once the peer disconnects or a handler fails, and every
+ *       request has finished.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+SocketManager_PipelineLoop (SocketManager *socket_manager, /* IN */
+                            Connection *connection,        /* IN */
+                            int64_t depth)                 /* IN */
+{
+   PipelineRequest *request;
+   WireProtocolMessage msg;
+   Pipeline pipeline;
+   Task writer;
+   void *buf;
+
+   Memory_Zero (&pipeline, sizeof pipeline);
+   pipeline.socket_manager = socket_manager;
+   pipeline.connection = connection;
+   pipeline.depth = MIN (depth, PIPELINE_DEPTH_MAX);
+
+   if ((0 != lthread_cond_create (&pipeline.reader_cond)) ||
+       (0 != lthread_cond_create (&pipeline.writer_cond))) {
+      free (pipeline.reader_cond);
+      return;
+   }
+
+   Task_Create (&writer, Pipeline_WriterLoop, &pipeline);
+
+   while (!pipeline.closing && Connection_Recv (connection, &msg)) {
+      request = PipelineRequestPool_Alloc0 ();
+      request->pipeline = &pipeline;
+
+      memcpy (&request->connection, connection, sizeof *connection);
+      MemoryArena_Init (&request->connection.arena, 0, MEMORY_ARENA_RECYCLE);
+      Array_InitBorrowed (&request->replies, sizeof (uint8_t), false,
+                          MemoryArena_Alloc (&request->connection.arena,
+                                             PIPELINE_REPLY_SIZE),
+                          PIPELINE_REPLY_SIZE);
+      request->connection.writer.buffer = &request->replies;
+      request->connection.writer.arena = &request->connection.arena;
+      request->connection.bytes_sent = 0;
+      request->connection.msg_sent = 0;
+
+      /*
+       * msg points into the reader's buffer, which the next read
+       * reuses, so the request parses its own copy.
+       */
+      buf = MemoryArena_MemDup (&request->connection.arena,
+                                connection->reader.buf,
+                                connection->reader.msglen);
+      if (!WireProtocolMessage_Scatter (&request->message, buf,
+                                        connection->reader.msglen)) {
+         PipelineRequest_Free (request);
+         break;
+      }
+
+      if (pipeline.tail) {
+         pipeline.tail->next = request;
+         NetPipelined_Increment ();
+      } else {
+         pipeline.head = request;
+      }
+
+      pipeline.tail = request;
+      pipeline.in_flight++;
+      NetPipelineInFlight_Increment ();
+
+      Task_Create (&request->task, Pipeline_HandlerLoop, request);
+
+      if (pipeline.in_flight >= pipeline.depth) {
+         NetPipelineStalls_Increment ();
+         while (!pipeline.closing && (pipeline.in_flight >= pipeline.depth)) {
+            lthread_cond_wait (pipeline.reader_cond, 0);
+         }
+      }
+   }
+
+   pipeline.closing = true;
+   lthread_cond_signal (pipeline.writer_cond);
+
+   while (!pipeline.writer_exited) {
+      lthread_cond_wait (pipeline.reader_cond, 0);
+   }
+
+   free (pipeline.reader_cond);
+   free (pipeline.writer_cond);
+}
+
+
+#endif /* TASK_USE_LTHREAD */
+
+
+static void
+SocketManager_RecvLoop (void *data) /* IN */
+{
+   SocketManager *socket_manager;
+   Connection *connection;
+   RecvTask *task = data;
+#ifdef TASK_USE_LTHREAD
+   int64_t depth;
+#endif
+
+   ASSERT (task);
+
+   socket_manager = task->socket_manager;
+   connection = &task->connection;
+
+   /* Nothing joins connection tasks. */
+#ifdef TASK_USE_LTHREAD
+   Task_Detach ();
+#else
+   Task_Detach (Task_Current ());
+#endif
+
+   if (task->parked) {
+      task->parked = false;
+      WireProtocolReader_Init (&connection->reader, &task->socket);
+   } else {
+      Connection_Init (connection, &task->socket);
+
+      /* Reset after each request by the loops below. */
+      connection->writer.arena = &connection->arena;
+
+      if (!socket_manager->handlers.Accept (socket_manager, connection,
+                                            socket_manager->handlers_data)) {
+         goto fail;
+      }
+   }
+
+#ifdef TASK_USE_LTHREAD
+   depth = TunableInt_Get (gPipelineDepth);
+   if (depth > 1) {
+      SocketManager_PipelineLoop (socket_manager, connection, depth);
+   } else if (SocketManager_SerialLoop (task)) {
+      return;
+   }
+#else
+   if (SocketManager_SerialLoop (task)) {
+      return;
    }
+#endif
 
 fail:
-   LOG_MESSAGE ("[%s]: Closing connection.", task->socket.name);
+   LOG_DEBUG ("[%s]: Closing connection.", task->socket.name);
 
-   if (task->socket_manager->handlers.Closed) {
-      task->socket_manager->handlers.Closed (
-         task->socket_manager, &connection,
-         task->socket_manager->handlers_data);
+   if (socket_manager->handlers.Closed) {
+      socket_manager->handlers.Closed (socket_manager, connection,
+                                       socket_manager->handlers_data);
    }
 
-   Connection_Destroy (&connection);
+   Connection_Destroy (connection);
    Socket_Close (&task->socket);
-   Memory_Free (task);
+   AtomicInt_Decrement (&socket_manager->connections);
+   NetConnections_Decrement ();
+   RecvTaskPool_Free (task);
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * SocketManager_AcceptLoop --
+ *
+ *       Accepts connections on a listener and starts a task for each,
+ *       draining the accept queue on every wakeup and applying the
+ *       "net.max_connections" limit.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Closes the listener if it fails.
+ *
+ *--------------------------------------------------------------------------
+ */
+
 static void
 SocketManager_AcceptLoop (void *data) /* IN */
 {
+   SocketManager *socket_manager;
    ListenTask *task = data;
    RecvTask *recv_task;
-   Socket csd;
-
-   if (0 != Socket_Listen (&task->socket, DEFAULT_BACKLOG)) {
+   Socket *clients = NULL;
+   int64_t backlog;
+   int64_t batch;
+   int64_t max;
+   int32_t nopen;
+   int n;
+   int i;
+
+   socket_manager = task->socket_manager;
+   backlog = MAX (TunableInt_Get (gListenBacklog), 1);
+   backlog = MIN (backlog, INT32_MAX);
+
+   if (0 != Socket_Listen (&task->socket, (int)backlog)) {
+      LOG_WARNING ("Failed to listen on %s: %s",
+                   task->socket.name, strerror (errno));
       goto fail;
    }
 
+   clients = Memory_SafeMalloc (ACCEPT_BATCH_MAX * sizeof *clients);
+
    for (;;) {
-      if (!Socket_Accept (&task->socket, &csd)) {
-         LOG_WARNING ("Failed to accept connection: %s: sd=%d",
-                      strerror (errno), task->socket.sd);
-         continue;
+      batch = MAX (TunableInt_Get (gAcceptBatch), 1);
+      batch = MIN (batch, ACCEPT_BATCH_MAX);
+      max = TunableInt_Get (gMaxConnections);
+
+      if ((max > 0) && !TunableBool_Get (gOverloadReject)) {
+         nopen = AtomicInt_GetAcquire (&socket_manager->connections);
+         if (nopen >= max) {
+            Task_Sleep (ACCEPT_PAUSE_MSEC);
+            continue;
+         }
+         batch = MIN (batch, max - nopen);
       }
 
-      LOG_MESSAGE ("[%s]: Connection established.", csd.name);
+      if (-1 == (n = Socket_AcceptBatch (&task->socket, clients, batch))) {
+         NetAcceptErrors_Increment ();
+         switch (errno) {
+         case EMFILE:
+         case ENFILE:
+         case ENOBUFS:
+         case ENOMEM:
+            LOG_WARNING ("Failed to accept connection: %s",
+                         strerror (errno));
+            Task_Sleep (ACCEPT_PAUSE_MSEC);
+            continue;
+         case EPROTO:
+         case EPERM:
+            continue;
+         default:
+            LOG_WARNING ("Failed to accept connection on %s: %s",
+                         task->socket.name, strerror (errno));
+            goto fail;
+         }
+      }
+
+      NetAcceptWakeups_Increment ();
+      NetAccepted_Add (n);
+
+      for (i = 0; i < n; i++) {
+         if ((max > 0) &&
+             (AtomicInt_GetAcquire (&socket_manager->connections) >= max)) {
+            NetRejected_Increment ();
+            Socket_Close (&clients [i]);
+            continue;
+         }
 
-      recv_task = Memory_SafeMalloc0 (sizeof *recv_task);
-      recv_task->socket_manager = task->socket_manager;
-      memcpy (&recv_task->socket, &csd, sizeof csd);
+         LOG_DEBUG ("[%s]: Connection established.", clients [i].name);
 
-      Task_Create (&recv_task->task, SocketManager_RecvLoop, recv_task);
+         AtomicInt_Increment (&socket_manager->connections);
+         NetConnections_Increment ();
+
+         recv_task = RecvTaskPool_Alloc0 ();
+         recv_task->socket_manager = socket_manager;
+         memcpy (&recv_task->socket, &clients [i], sizeof clients [i]);
+
+         Task_Create (&recv_task->task, SocketManager_RecvLoop, recv_task);
+      }
    }
 
 fail:
+   Memory_Free (clients);
    Socket_Close (&task->socket);
    Memory_Free (task);
 }
@@ -261,96 +1368,84 @@ SocketManager_Destroy (SocketManager *socket_manager)
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * SocketManager_AddListener --
+ *
+ *       Listens on @bind_ip, which is an IPv4 address, an IPv6 address
+ *       such as "[::1]", or a UNIX socket path. Paths start with '/', or
+ *       with '@' for the Linux abstract namespace, and ignore @port.
+ *
+ *       A stale socket file at a UNIX socket path is replaced; anything
+ *       else there, including a socket still in use, fails the bind.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Logs a warning if the address cannot be bound.
+ *
+ *--------------------------------------------------------------------------
+ */
+
 void
 SocketManager_AddListener (SocketManager *socket_manager, /* IN */
                            const char *bind_ip,           /* IN */
                            uint16_t port)                 /* IN */
 {
-   struct sockaddr_in6 addr6;
-   struct sockaddr_in addr4;
-   struct in6_addr ip6addr;
-   struct in_addr ip4addr;
+   struct sockaddr_storage addr;
+   socklen_t addrlen;
    ListenTask *task;
-   int ret = false;
-   int family;
    int opt = 1;
 
    ASSERT (socket_manager);
-   ASSERT (!socket_manager->running);
    ASSERT (bind_ip);
-   ASSERT (port);
+
+   if (!Socket_ParseAddr (bind_ip, port, &addr, &addrlen)) {
+      LOG_WARNING ("Failed to parse address \"%s\": %s",
+                   bind_ip, strerror (errno));
+      return;
+   }
 
    task = Memory_SafeMalloc0 (sizeof *task);
    task->socket_manager = socket_manager;
 
-   if (*bind_ip == '[') {
-      family = AF_INET6;
-      if (1 != inet_pton (AF_INET6, bind_ip, &ip6addr)) {
-         LOG_WARNING ("Failed to parse IPv6 address \"%s\": %s",
-                      bind_ip, strerror (errno));
-         return;
-      }
-   } else if (strstr (bind_ip, "/")) {
-      family = AF_UNIX;
-   } else {
-      family = AF_INET;
-      if (1 != inet_pton (AF_INET, bind_ip, &ip4addr)) {
-         LOG_WARNING ("Failed to parse IPv4 address \"%s\": %s",
-                      bind_ip, strerror (errno));
-         return;
-      }
-   }
-
-   if (!Socket_Init (&task->socket, family, SOCK_STREAM, 0)) {
+   if (!Socket_Init (&task->socket, addr.ss_family, SOCK_STREAM, 0)) {
       LOG_WARNING ("Failed to initialize socket: %s",
                    strerror (errno));
       Memory_Free (task);
       return;
    }
 
-   switch (family) {
-   case AF_INET:
-      addr4.sin_family = AF_INET;
-      addr4.sin_port = htons (port);
-      addr4.sin_addr = ip4addr;
-      ret = Socket_Bind (&task->socket,
-                         (const struct sockaddr *)&addr4,
-                         sizeof addr4);
-      break;
-   case AF_INET6:
-      LOG_WARNING ("IPv6 not yet supported.");
-      addr6.sin6_family = AF_INET6;
-      addr6.sin6_port = htons (port);
-      addr6.sin6_addr = ip6addr;
-      ret = Socket_Bind (&task->socket,
-                         (const struct sockaddr *)&addr6,
-                         sizeof addr6);
-      break;
-   case AF_UNIX:
-      LOG_WARNING ("UNIX Sockets not yet supported.");
-      break;
-   default:
-      ASSERT (false);
-   }
-
-   if (ret != 0) {
-      LOG_WARNING ("Failed to bind() socket: %s", strerror (errno));
+   if (addr.ss_family == AF_UNIX) {
+      if (!Socket_UnlinkStale (bind_ip)) {
+         LOG_WARNING ("Not replacing \"%s\" with a listener: %s",
+                      bind_ip, strerror (errno));
+         Socket_Close (&task->socket);
+         Memory_Free (task);
+         return;
+      }
+   } else if (-1 == Socket_SetSockOpt (&task->socket, SOL_SOCKET,
+                                       SO_REUSEADDR, &opt, sizeof opt)) {
+      LOG_WARNING ("Failed to set SO_REUSEADDR.");
+   }
+
+   if (0 != Socket_Bind (&task->socket,
+                         (const struct sockaddr *)&addr,
+                         addrlen)) {
+      LOG_WARNING ("Failed to bind() socket to \"%s\": %s",
+                   bind_ip, strerror (errno));
       Socket_Close (&task->socket);
       Memory_Free (task);
       return;
    }
 
-   ret = Socket_SetSockOpt (&task->socket, SOL_SOCKET, SO_REUSEADDR, &opt,
-                            sizeof opt);
-   if (ret == -1) {
-      LOG_WARNING ("Failed to set SO_REUSEADDR.");
-   }
+   LOG_INFO ("Listening on %s.", task->socket.name);
 
    socket_manager->listeners = List_Append (socket_manager->listeners, task);
 
    if (socket_manager->running) {
       SocketManager_StartListenTask (socket_manager, task);
    }
-
-   return;
 }
@@ -35,39 +35,97 @@ typedef struct _SocketManager         SocketManager;
 typedef struct _SocketManagerHandlers SocketManagerHandlers;
 
 
+typedef bool (*SocketManagerDispatchFunc) (SocketManager *manager,
+                                           Connection *connection,
+                                           WireProtocolMessage *message,
+                                           void *handler_data);
+
+
+/*
+ * With the "net.pipeline.depth" tunable above 1, a connection keeps
+ * reading while up to that many of its requests are being handled, each
+ * in its own task. Handlers then get a per-request copy of the
+ * connection: replies sent on it are written in request order once
+ * earlier requests finish, and it must not be used to receive.
+ * Pipelining needs lthread tasks and is otherwise ignored.
+ */
 struct _SocketManagerHandlers
 {
-   bool (*Accept)        (SocketManager *manager,
-                          Connection *connection,
-                          void *handler_data);
+   bool (*Accept)            (SocketManager *manager,
+                              Connection *connection,
+                              void *handler_data);
 
-   void (*Closed)        (SocketManager *manager,
-                          Connection *connection,
-                          void *handler_data);
+   void (*Closed)            (SocketManager *manager,
+                              Connection *connection,
+                              void *handler_data);
 
-   bool (*HandleMessage) (SocketManager *manager,
-                          Connection *connection,
-                          WireProtocolMessage *message,
-                          void *handler_data);
+   bool (*HandleMessage)     (SocketManager *manager,
+                              Connection *connection,
+                              WireProtocolMessage *message,
+                              void *handler_data);
 
    /*
     * Default handler will dispatch to the following typed
-    * message handlers.
+    * message handlers. Messages with no handler close the
+    * connection.
     */
 
-   bool (*HandleQuery)   (SocketManager *manager,
-                          Connection *connection,
-                          WireProtocolQuery *query,
-                          void *handler_data);
+   bool (*HandleReply)       (SocketManager *manager,
+                              Connection *connection,
+                              WireProtocolReply *reply,
+                              void *handler_data);
+
+   bool (*HandleMsg)         (SocketManager *manager,
+                              Connection *connection,
+                              WireProtocolMsg *msg,
+                              void *handler_data);
+
+   bool (*HandleUpdate)      (SocketManager *manager,
+                              Connection *connection,
+                              WireProtocolUpdate *update,
+                              void *handler_data);
+
+   bool (*HandleInsert)      (SocketManager *manager,
+                              Connection *connection,
+                              WireProtocolInsert *insert,
+                              void *handler_data);
+
+   bool (*HandleQuery)       (SocketManager *manager,
+                              Connection *connection,
+                              WireProtocolQuery *query,
+                              void *handler_data);
+
+   bool (*HandleGetmore)     (SocketManager *manager,
+                              Connection *connection,
+                              WireProtocolGetmore *getmore,
+                              void *handler_data);
+
+   bool (*HandleDelete)      (SocketManager *manager,
+                              Connection *connection,
+                              WireProtocolDelete *delete,
+                              void *handler_data);
+
+   bool (*HandleKillCursors) (SocketManager *manager,
+                              Connection *connection,
+                              WireProtocolKillCursors *kill_cursors,
+                              void *handler_data);
+
+   bool (*HandleOpMsg)       (SocketManager *manager,
+                              Connection *connection,
+                              WireProtocolOpMsg *op_msg,
+                              void *handler_data);
 };
 
 
 struct _SocketManager
 {
-   SocketManagerHandlers  handlers;
-   void                  *handlers_data;
-   List                  *listeners;
-   bool                   running;
+   SocketManagerHandlers      handlers;
+   SocketManagerDispatchFunc  dispatch [WIRE_PROTOCOL_SLOT_LAST];
+   void                      *handlers_data;
+   List                      *listeners;
+   volatile int32_t           connections;
+   int                        park_fd;
+   bool                       running;
 };
 
 
@@ -27,6 +27,7 @@
 
 #include <Debug.h>
 #include <Endian.h>
+#include <Hash.h>
 #include <Log.h>
 #include <WireProtocol.h>
 
@@ -98,6 +99,18 @@
    ASSERT (iov.iov_len); \
    rpc->msg_len += (int32_t)iov.iov_len; \
    Array_Append (array, iov);
+#define SECTIONS_FIELD(_flags, _name, _checksum) \
+   iov.iov_base = (void *)rpc->_name; \
+   iov.iov_len = rpc->_name##_len; \
+   ASSERT (iov.iov_len); \
+   rpc->msg_len += (int32_t)iov.iov_len; \
+   Array_Append (array, iov); \
+   if (rpc->_flags & WIRE_PROTOCOL_OP_MSG_CHECKSUM_PRESENT) { \
+      iov.iov_base = (void *)&rpc->_checksum; \
+      iov.iov_len = 4; \
+      rpc->msg_len += (int32_t)iov.iov_len; \
+      Array_Append (array, iov); \
+   }
 #define INT64_ARRAY_FIELD(_len, _name) \
    iov.iov_base = (void *)&rpc->_len; \
    iov.iov_len = 4; \
@@ -116,6 +129,7 @@
 #include "WireProtocolInsert.def"
 #include "WireProtocolKillCursors.def"
 #include "WireProtocolMsg.def"
+#include "WireProtocolOpMsg.def"
 #include "WireProtocolQuery.def"
 #include "WireProtocolReply.def"
 #include "WireProtocolUpdate.def"
@@ -131,6 +145,7 @@
 #undef IOVEC_ARRAY_FIELD
 #undef RAW_BUFFER_FIELD
 #undef BSON_OPTIONAL
+#undef SECTIONS_FIELD
 
 
 #define RPC(_name, _code) \
@@ -151,6 +166,11 @@
 #define BSON_OPTIONAL(_check, _code) \
    if (rpc->_check) { _code }
 #define RAW_BUFFER_FIELD(_name)
+/*
+ * The checksum is computed over the converted message, see
+ * WireProtocolMessage_SetChecksum(), so it is already little endian.
+ */
+#define SECTIONS_FIELD(_flags, _name, _checksum)
 #define INT64_ARRAY_FIELD(_len, _name) \
    do { \
       size_t i; \
@@ -166,6 +186,7 @@
 #include "WireProtocolInsert.def"
 #include "WireProtocolKillCursors.def"
 #include "WireProtocolMsg.def"
+#include "WireProtocolOpMsg.def"
 #include "WireProtocolQuery.def"
 #include "WireProtocolReply.def"
 #include "WireProtocolUpdate.def"
@@ -173,6 +194,7 @@
 
 #undef RPC
 #undef INT64_ARRAY_FIELD
+#undef SECTIONS_FIELD
 
 #define RPC(_name, _code) \
    static __inline__ void \
@@ -189,6 +211,10 @@
          rpc->_name[i] = UINT64_FROM_LE(rpc->_name[i]); \
       } \
    } while (0);
+#define SECTIONS_FIELD(_flags, _name, _checksum) \
+   if (rpc->_flags & WIRE_PROTOCOL_OP_MSG_CHECKSUM_PRESENT) { \
+      rpc->_checksum = UINT32_FROM_LE(rpc->_checksum); \
+   }
 
 
 #include "WireProtocolDelete.def"
@@ -196,6 +222,7 @@
 #include "WireProtocolInsert.def"
 #include "WireProtocolKillCursors.def"
 #include "WireProtocolMsg.def"
+#include "WireProtocolOpMsg.def"
 #include "WireProtocolQuery.def"
 #include "WireProtocolReply.def"
 #include "WireProtocolUpdate.def"
@@ -211,6 +238,7 @@
 #undef IOVEC_ARRAY_FIELD
 #undef BSON_OPTIONAL
 #undef RAW_BUFFER_FIELD
+#undef SECTIONS_FIELD
 
 #define RPC(_name, _code) \
    static void \
@@ -278,6 +306,29 @@
       } \
       printf("\n"); \
    }
+#define SECTIONS_FIELD(_flags, _name, _checksum) \
+   do { \
+      WireProtocolSectionIter __iter; \
+      WireProtocolSection __s; \
+      bson_reader_t *__r; \
+      const bson_t *__b; \
+      bool __eof; \
+      WireProtocolSectionIter_Init (&__iter, rpc); \
+      while (WireProtocolSectionIter_Next (&__iter, &__s)) { \
+         __r = bson_reader_new_from_data(__s.documents, \
+                                         __s.documents_len); \
+         while ((__b = bson_reader_read(__r, &__eof))) { \
+            char *s = bson_as_json(__b, NULL); \
+            printf("  "#_name" [%s] : %s\n", \
+                   __s.identifier ? __s.identifier : "body", s); \
+            bson_free(s); \
+         } \
+         bson_reader_destroy(__r); \
+      } \
+      if (rpc->_flags & WIRE_PROTOCOL_OP_MSG_CHECKSUM_PRESENT) { \
+         printf("  "#_checksum" : 0x%08x\n", rpc->_checksum); \
+      } \
+   } while (0);
 #define INT64_ARRAY_FIELD(_len, _name) \
    do { \
       size_t i; \
@@ -293,6 +344,7 @@
 #include "WireProtocolInsert.def"
 #include "WireProtocolKillCursors.def"
 #include "WireProtocolMsg.def"
+#include "WireProtocolOpMsg.def"
 #include "WireProtocolQuery.def"
 #include "WireProtocolReply.def"
 #include "WireProtocolUpdate.def"
@@ -308,6 +360,7 @@
 #undef IOVEC_ARRAY_FIELD
 #undef BSON_OPTIONAL
 #undef RAW_BUFFER_FIELD
+#undef SECTIONS_FIELD
 
 
 #define RPC(_name, _code) \
@@ -406,6 +459,21 @@
    rpc->_name##_len = (int32_t)buflen; \
    buf = NULL; \
    buflen = 0;
+#define SECTIONS_FIELD(_flags, _name, _checksum) \
+   if (UINT32_FROM_LE(rpc->_flags) & WIRE_PROTOCOL_OP_MSG_CHECKSUM_PRESENT) { \
+      if (buflen < 4) { \
+         return false; \
+      } \
+      buflen -= 4; \
+      memcpy(&rpc->_checksum, buf + buflen, 4); \
+   } \
+   if (!buflen) { \
+      return false; \
+   } \
+   rpc->_name = (void *)buf; \
+   rpc->_name##_len = (int32_t)buflen; \
+   buf = NULL; \
+   buflen = 0;
 
 
 #include "WireProtocolDelete.def"
@@ -414,6 +482,7 @@
 #include "WireProtocolInsert.def"
 #include "WireProtocolKillCursors.def"
 #include "WireProtocolMsg.def"
+#include "WireProtocolOpMsg.def"
 #include "WireProtocolQuery.def"
 #include "WireProtocolReply.def"
 #include "WireProtocolUpdate.def"
@@ -429,6 +498,210 @@
 #undef IOVEC_ARRAY_FIELD
 #undef BSON_OPTIONAL
 #undef RAW_BUFFER_FIELD
+#undef SECTIONS_FIELD
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * WireProtocolSectionIter_Init --
+ *
+ *       Prepares to walk the sections of op_msg.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+WireProtocolSectionIter_Init (WireProtocolSectionIter *iter,   /* OUT */
+                              const WireProtocolOpMsg *op_msg) /* IN */
+{
+   ASSERT (iter);
+   ASSERT (op_msg);
+
+   iter->buf = op_msg->sections;
+   iter->buflen = op_msg->sections_len;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * WireProtocolSectionIter_DocumentsValid --
+ *
+ *       Checks that buf is made up of whole BSON documents.
+ *
+ * Returns:
+ *       true if the document lengths add up to buflen.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+WireProtocolSectionIter_DocumentsValid (const uint8_t *buf, /* IN */
+                                        size_t buflen)      /* IN */
+{
+   int32_t len;
+
+   while (buflen) {
+      if (buflen < 5) {
+         return false;
+      }
+      memcpy (&len, buf, 4);
+      len = (int32_t)UINT32_FROM_LE (len);
+      if ((len < 5) || (len > buflen)) {
+         return false;
+      }
+      buf += len;
+      buflen -= len;
+   }
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * WireProtocolSectionIter_Next --
+ *
+ *       Reads the next section, pointing section into the message
+ *       rather than copying it.
+ *
+ * Returns:
+ *       true if section was set. false at the end of the sections or
+ *       at a malformed section, in which case iter->buflen is not 0.
+ *
+ * Side effects:
+ *       Advances iter.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+WireProtocolSectionIter_Next (WireProtocolSectionIter *iter,  /* IN/OUT */
+                              WireProtocolSection *section)   /* OUT */
+{
+   const uint8_t *end;
+   const uint8_t *buf;
+   int32_t len;
+
+   ASSERT (iter);
+   ASSERT (section);
+
+   if (iter->buflen < 5) {
+      return false;
+   }
+
+   buf = iter->buf + 1;
+   memcpy (&len, buf, 4);
+   len = (int32_t)UINT32_FROM_LE (len);
+
+   if ((len < 5) || (len > (iter->buflen - 1))) {
+      return false;
+   }
+
+   switch (iter->buf [0]) {
+   case WIRE_PROTOCOL_SECTION_BODY:
+      section->kind = WIRE_PROTOCOL_SECTION_BODY;
+      section->identifier = NULL;
+      section->documents = buf;
+      section->documents_len = len;
+      break;
+   case WIRE_PROTOCOL_SECTION_SEQUENCE:
+      /*
+       * len covers itself, the identifier and the documents, but not
+       * the kind byte.
+       */
+      end = buf + len;
+      buf += 4;
+      section->kind = WIRE_PROTOCOL_SECTION_SEQUENCE;
+      section->identifier = (const char *)buf;
+      if (!(buf = memchr (buf, '\0', end - buf))) {
+         return false;
+      }
+      buf++;
+      if (!WireProtocolSectionIter_DocumentsValid (buf, end - buf)) {
+         return false;
+      }
+      section->documents = buf;
+      section->documents_len = (int32_t)(end - buf);
+      break;
+   default:
+      return false;
+   }
+
+   iter->buf += len + 1;
+   iter->buflen -= len + 1;
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * WireProtocolOpMsg_Check --
+ *
+ *       Validates a scattered OP_MSG: its flags, that its sections are
+ *       well formed with exactly one body, and its checksum if present.
+ *
+ * Returns:
+ *       true if op_msg is valid.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+WireProtocolOpMsg_Check (const WireProtocolOpMsg *op_msg, /* IN */
+                         const uint8_t *buf,              /* IN */
+                         size_t buflen)                   /* IN */
+{
+   WireProtocolSectionIter iter;
+   WireProtocolSection section;
+   uint32_t checksum;
+   uint32_t flags;
+   int bodies = 0;
+
+   flags = UINT32_FROM_LE (op_msg->flags);
+
+   if (flags & WIRE_PROTOCOL_OP_MSG_REQUIRED_MASK &
+       ~(WIRE_PROTOCOL_OP_MSG_CHECKSUM_PRESENT |
+         WIRE_PROTOCOL_OP_MSG_MORE_TO_COME)) {
+      LOG_WARNING ("Unknown required OP_MSG flags: 0x%08x", flags);
+      return false;
+   }
+
+   WireProtocolSectionIter_Init (&iter, op_msg);
+   while (WireProtocolSectionIter_Next (&iter, &section)) {
+      bodies += (section.kind == WIRE_PROTOCOL_SECTION_BODY);
+   }
+
+   if (iter.buflen || (bodies != 1)) {
+      return false;
+   }
+
+   if (flags & WIRE_PROTOCOL_OP_MSG_CHECKSUM_PRESENT) {
+      checksum = UINT32_FROM_LE (op_msg->checksum);
+      if (checksum != Hash_Crc32c (buf, buflen - 4, 0)) {
+         LOG_WARNING ("OP_MSG checksum mismatch.");
+         return false;
+      }
+   }
+
+   return true;
+}
 
 
 void
@@ -463,6 +736,9 @@ WireProtocolMessage_Gather (WireProtocolMessage *rpc, /* IN */
    case WIRE_PROTOCOL_KILL_CURSORS:
       WireProtocolKillCursors_Gather (&rpc->kill_cursors, array);
       return;
+   case WIRE_PROTOCOL_OP_MSG:
+      WireProtocolOpMsg_Gather (&rpc->op_msg, array);
+      return;
    default:
       LOG_WARNING ("Unknown rpc type: 0x%08x", rpc->header.opcode);
       break;
@@ -505,6 +781,9 @@ WireProtocolMessage_ToLe (WireProtocolMessage *rpc) /* IN */
    case WIRE_PROTOCOL_KILL_CURSORS:
       WireProtocolKillCursors_ToLe (&rpc->kill_cursors);
       break;
+   case WIRE_PROTOCOL_OP_MSG:
+      WireProtocolOpMsg_ToLe (&rpc->op_msg);
+      break;
    default:
       LOG_WARNING ("Unknown rpc type: 0x%08x", opcode);
       break;
@@ -548,6 +827,9 @@ WireProtocolMessage_FromLe (WireProtocolMessage *rpc) /* IN */
    case WIRE_PROTOCOL_KILL_CURSORS:
       WireProtocolKillCursors_FromLe (&rpc->kill_cursors);
       break;
+   case WIRE_PROTOCOL_OP_MSG:
+      WireProtocolOpMsg_FromLe (&rpc->op_msg);
+      break;
    default:
       LOG_WARNING ("Unknown rpc type: 0x%08x", rpc->header.opcode);
       break;
@@ -586,6 +868,9 @@ WireProtocolMessage_Printf (WireProtocolMessage *rpc) /* IN */
    case WIRE_PROTOCOL_KILL_CURSORS:
       WireProtocolKillCursors_Printf (&rpc->kill_cursors);
       break;
+   case WIRE_PROTOCOL_OP_MSG:
+      WireProtocolOpMsg_Printf (&rpc->op_msg);
+      break;
    default:
       LOG_WARNING ("Unknown rpc type: 0x%08x", rpc->header.opcode);
       break;
@@ -633,8 +918,101 @@ WireProtocolMessage_Scatter (WireProtocolMessage *rpc, /* IN */
       return WireProtocolDelete_Scatter (&rpc->delete, buf, buflen);
    case WIRE_PROTOCOL_KILL_CURSORS:
       return WireProtocolKillCursors_Scatter (&rpc->kill_cursors, buf, buflen);
+   case WIRE_PROTOCOL_OP_MSG:
+      return (WireProtocolOpMsg_Scatter (&rpc->op_msg, buf, buflen) &&
+              WireProtocolOpMsg_Check (&rpc->op_msg, buf, buflen));
    default:
       LOG_WARNING ("Unknown rpc type: 0x%08x", opcode);
       return false;
    }
 }
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * WireProtocolMessage_SetChecksum --
+ *
+ *       Fills in the checksum of an OP_MSG that asks for one, from the
+ *       iovecs gathered for it. Must be called after
+ *       WireProtocolMessage_ToLe() so the checksum covers the bytes
+ *       that are sent.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Sets message->op_msg.checksum.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+WireProtocolMessage_SetChecksum (WireProtocolMessage *rpc, /* IN */
+                                 const Array *iovecs)      /* IN */
+{
+   const struct iovec *iov;
+   uint32_t crc = 0;
+   int i;
+
+   ASSERT (rpc);
+   ASSERT (iovecs);
+
+   if ((UINT32_FROM_LE (rpc->header.opcode) != WIRE_PROTOCOL_OP_MSG) ||
+       !(UINT32_FROM_LE (rpc->op_msg.flags) &
+         WIRE_PROTOCOL_OP_MSG_CHECKSUM_PRESENT)) {
+      return;
+   }
+
+   /* The last iovec is the checksum itself. */
+   for (i = 0; i < iovecs->len - 1; i++) {
+      iov = &Array_Index (iovecs, struct iovec, i);
+      crc = Hash_Crc32c (iov->iov_base, iov->iov_len, crc);
+   }
+
+   rpc->op_msg.checksum = UINT32_TO_LE (crc);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * WireProtocol_SetChecksum --
+ *
+ *       Recomputes the checksum of an encoded OP_MSG after its bytes
+ *       were modified, such as by rewriting the request id.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Updates the last 4 bytes of buf if it is an OP_MSG with a
+ *       checksum.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+WireProtocol_SetChecksum (uint8_t *buf,  /* IN/OUT */
+                          size_t buflen) /* IN */
+{
+   WireProtocolHeader header;
+   uint32_t flags;
+   uint32_t crc;
+
+   ASSERT (buf);
+
+   /* The header, flags and checksum. */
+   if (buflen < sizeof header + 8) {
+      return;
+   }
+
+   memcpy (&header, buf, sizeof header);
+   memcpy (&flags, buf + sizeof header, 4);
+
+   if ((UINT32_FROM_LE (header.opcode) == WIRE_PROTOCOL_OP_MSG) &&
+       (UINT32_FROM_LE (flags) & WIRE_PROTOCOL_OP_MSG_CHECKSUM_PRESENT)) {
+      crc = UINT32_TO_LE (Hash_Crc32c (buf, buflen - 4, 0));
+      memcpy (buf + buflen - 4, &crc, 4);
+   }
+}
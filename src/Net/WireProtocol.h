@@ -77,6 +77,29 @@ typedef enum
 } WireProtocolDeleteFlags;
 
 
+typedef enum
+{
+   WIRE_PROTOCOL_OP_MSG_NONE             = 0,
+   WIRE_PROTOCOL_OP_MSG_CHECKSUM_PRESENT = 1 << 0,
+   WIRE_PROTOCOL_OP_MSG_MORE_TO_COME     = 1 << 1,
+   WIRE_PROTOCOL_OP_MSG_EXHAUST_ALLOWED  = 1 << 16,
+} WireProtocolOpMsgFlags;
+
+
+/*
+ * Flags in the low 16 bits must be understood by the receiver. The high
+ * 16 bits are optional.
+ */
+#define WIRE_PROTOCOL_OP_MSG_REQUIRED_MASK 0xFFFF
+
+
+typedef enum
+{
+   WIRE_PROTOCOL_SECTION_BODY     = 0,
+   WIRE_PROTOCOL_SECTION_SEQUENCE = 1,
+} WireProtocolSectionKind;
+
+
 typedef enum
 {
    WIRE_PROTOCOL_REPLY = 1,
@@ -87,9 +110,31 @@ typedef enum
    WIRE_PROTOCOL_GETMORE = 2005,
    WIRE_PROTOCOL_DELETE = 2006,
    WIRE_PROTOCOL_KILL_CURSORS = 2007,
+   WIRE_PROTOCOL_OP_MSG = 2013,
 } WireProtocolOpcode;
 
 
+/*
+ * Dense indexes for the opcodes above, for tables that would otherwise
+ * be keyed on the sparse opcode values. Anything else maps to
+ * WIRE_PROTOCOL_SLOT_UNKNOWN.
+ */
+typedef enum
+{
+   WIRE_PROTOCOL_SLOT_REPLY,
+   WIRE_PROTOCOL_SLOT_MSG,
+   WIRE_PROTOCOL_SLOT_UPDATE,
+   WIRE_PROTOCOL_SLOT_INSERT,
+   WIRE_PROTOCOL_SLOT_QUERY,
+   WIRE_PROTOCOL_SLOT_GETMORE,
+   WIRE_PROTOCOL_SLOT_DELETE,
+   WIRE_PROTOCOL_SLOT_KILL_CURSORS,
+   WIRE_PROTOCOL_SLOT_OP_MSG,
+   WIRE_PROTOCOL_SLOT_UNKNOWN,
+   WIRE_PROTOCOL_SLOT_LAST
+} WireProtocolSlot;
+
+
 #define RPC(_name, _code)                typedef struct { _code } WireProtocol##_name;
 #define INT32_FIELD(_name)               int32_t _name;
 #define INT64_FIELD(_name)               int64_t _name;
@@ -100,6 +145,8 @@ typedef enum
 #define IOVEC_ARRAY_FIELD(_name)         const struct iovec *_name; int32_t n_##_name; struct iovec _name##_recv;
 #define RAW_BUFFER_FIELD(_name)          const uint8_t *_name; int32_t _name##_len;
 #define BSON_OPTIONAL(_check, _code)     _code
+#define SECTIONS_FIELD(_flags, _name, _checksum) \
+   const uint8_t *_name; int32_t _name##_len; uint32_t _checksum;
 
 
 #include "WireProtocolDelete.def"
@@ -108,6 +155,7 @@ typedef enum
 #include "WireProtocolInsert.def"
 #include "WireProtocolKillCursors.def"
 #include "WireProtocolMsg.def"
+#include "WireProtocolOpMsg.def"
 #include "WireProtocolQuery.def"
 #include "WireProtocolReply.def"
 #include "WireProtocolUpdate.def"
@@ -122,6 +170,7 @@ typedef union
    WireProtocolInsert      insert;
    WireProtocolKillCursors kill_cursors;
    WireProtocolMsg         msg;
+   WireProtocolOpMsg       op_msg;
    WireProtocolQuery       query;
    WireProtocolReply       reply;
    WireProtocolUpdate      update;
@@ -144,16 +193,93 @@ STATIC_ASSERT (offsetof (WireProtocolHeader, opcode) ==
 #undef IOVEC_ARRAY_FIELD
 #undef BSON_OPTIONAL
 #undef RAW_BUFFER_FIELD
+#undef SECTIONS_FIELD
 
 
-void WireProtocolMessage_FromLe  (WireProtocolMessage *message);
-void WireProtocolMessage_Gather  (WireProtocolMessage *message,
-                                  Array *iovecs);
-void WireProtocolMessage_Printf  (WireProtocolMessage *message);
-bool WireProtocolMessage_Scatter (WireProtocolMessage *message,
-                                  const uint8_t *buf,
-                                  size_t buflen);
-void WireProtocolMessage_ToLe    (WireProtocolMessage *message);
+/*
+ * The sections of an OP_MSG are walked in place with
+ * WireProtocolSectionIter, so section pointers are only valid as long
+ * as the message buffer. A kind 0 section is the single body document.
+ * A kind 1 section is a run of documents concatenated as on the wire,
+ * which can be used as is as the documents iovec of an OP_INSERT.
+ */
+typedef struct
+{
+   WireProtocolSectionKind  kind;
+   const char              *identifier;
+   const uint8_t           *documents;
+   int32_t                  documents_len;
+} WireProtocolSection;
+
+
+typedef struct
+{
+   const uint8_t *buf;
+   size_t         buflen;
+} WireProtocolSectionIter;
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * WireProtocol_OpcodeSlot --
+ *
+ *       Maps a host order opcode to its dense index.
+ *
+ * Returns:
+ *       A WireProtocolSlot, WIRE_PROTOCOL_SLOT_UNKNOWN if opcode is not
+ *       a known opcode.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static __inline__ WireProtocolSlot
+WireProtocol_OpcodeSlot (int32_t opcode) /* IN */
+{
+   switch (opcode) {
+   case WIRE_PROTOCOL_REPLY:
+      return WIRE_PROTOCOL_SLOT_REPLY;
+   case WIRE_PROTOCOL_MSG:
+      return WIRE_PROTOCOL_SLOT_MSG;
+   case WIRE_PROTOCOL_UPDATE:
+      return WIRE_PROTOCOL_SLOT_UPDATE;
+   case WIRE_PROTOCOL_INSERT:
+      return WIRE_PROTOCOL_SLOT_INSERT;
+   case WIRE_PROTOCOL_QUERY:
+      return WIRE_PROTOCOL_SLOT_QUERY;
+   case WIRE_PROTOCOL_GETMORE:
+      return WIRE_PROTOCOL_SLOT_GETMORE;
+   case WIRE_PROTOCOL_DELETE:
+      return WIRE_PROTOCOL_SLOT_DELETE;
+   case WIRE_PROTOCOL_KILL_CURSORS:
+      return WIRE_PROTOCOL_SLOT_KILL_CURSORS;
+   case WIRE_PROTOCOL_OP_MSG:
+      return WIRE_PROTOCOL_SLOT_OP_MSG;
+   default:
+      return WIRE_PROTOCOL_SLOT_UNKNOWN;
+   }
+}
+
+
+void WireProtocolMessage_FromLe      (WireProtocolMessage *message);
+void WireProtocolMessage_Gather      (WireProtocolMessage *message,
+                                      Array *iovecs);
+void WireProtocolMessage_Printf      (WireProtocolMessage *message);
+bool WireProtocolMessage_Scatter     (WireProtocolMessage *message,
+                                      const uint8_t *buf,
+                                      size_t buflen);
+void WireProtocolMessage_SetChecksum (WireProtocolMessage *message,
+                                      const Array *iovecs);
+void WireProtocolMessage_ToLe        (WireProtocolMessage *message);
+void WireProtocol_SetChecksum        (uint8_t *buf,
+                                      size_t buflen);
+void WireProtocolSectionIter_Init    (WireProtocolSectionIter *iter,
+                                      const WireProtocolOpMsg *op_msg);
+bool WireProtocolSectionIter_Next    (WireProtocolSectionIter *iter,
+                                      WireProtocolSection *section);
 
 
 END_DECLS
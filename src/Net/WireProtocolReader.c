@@ -28,9 +28,15 @@
 #include <Endian.h>
 #include <Math.h>
 #include <Memory.h>
+#include <Task.h>
+#include <Trace.h>
+#include <Tunable.h>
 #include <WireProtocolReader.h>
 
 
+TUNABLE_INT (gReaderBufSize, "net.reader.bufsize", 512);
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -60,7 +66,7 @@ WireProtocolReader_Init (WireProtocolReader *reader, /* IN */
 
    reader->sock = sock;
    reader->buflen = 0;
-   reader->bufalloc = 512;
+   reader->bufalloc = MAX (64, TunableInt_Get (gReaderBufSize));
    reader->buf = Memory_Malloc (reader->bufalloc);
 }
 
@@ -81,12 +87,138 @@ WireProtocolReader_Init (WireProtocolReader *reader, /* IN */
  *--------------------------------------------------------------------------
  */
 
+static void
+WireProtocolReader_FreeBuffer (WireProtocolReader *reader) /* IN */
+{
+   if (reader->bufalloc >= MEMORY_HUGE_PAGE_SIZE) {
+      Memory_FreeLarge (reader->buf, reader->bufalloc);
+   } else {
+      Memory_Free (reader->buf);
+   }
+}
+
+
 void
 WireProtocolReader_Destroy (WireProtocolReader *reader) /* IN */
 {
    ASSERT (reader);
 
-   Memory_Free (reader->buf);
+   WireProtocolReader_FreeBuffer (reader);
+
+   reader->buf = NULL;
+   reader->bufalloc = 0;
+   reader->buflen = 0;
+   reader->msglen = 0;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * WireProtocolReader_Shrink --
+ *
+ *       Returns the buffer of an idle reader to the "net.reader.bufsize"
+ *       size, releasing the memory a large message grew it to.
+ *
+ *       Like WireProtocolReader_Read(), this invalidates the last
+ *       message read.
+ *
+ * Returns:
+ *       The number of bytes released, 0 if reader holds unread data.
+ *
+ * Side effects:
+ *       May replace the reader's buffer.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+size_t
+WireProtocolReader_Shrink (WireProtocolReader *reader) /* IN */
+{
+   size_t released;
+   size_t size;
+
+   ASSERT (reader);
+
+   if (WireProtocolReader_HasPending (reader)) {
+      return 0;
+   }
+
+   reader->buflen = 0;
+   reader->msglen = 0;
+
+   size = MAX (64, TunableInt_Get (gReaderBufSize));
+
+   if (reader->bufalloc <= size) {
+      return 0;
+   }
+
+   released = reader->bufalloc - size;
+
+   WireProtocolReader_FreeBuffer (reader);
+   reader->buf = Memory_SafeMalloc (size);
+   reader->bufalloc = size;
+
+   return released;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * WireProtocolReader_Poll --
+ *
+ *       Buffers whatever has already arrived on the socket, without
+ *       waiting for more.
+ *
+ *       Like WireProtocolReader_Read(), this invalidates the last
+ *       message read.
+ *
+ * Returns:
+ *       The number of bytes read, 0 if the peer closed the
+ *       connection, or -1 and errno is set. errno is EAGAIN if nothing
+ *       has arrived.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+ssize_t
+WireProtocolReader_Poll (WireProtocolReader *reader) /* IN */
+{
+   ssize_t ret;
+
+   ASSERT (reader);
+
+   if (reader->buflen > reader->msglen) {
+      memmove (reader->buf,
+               reader->buf + reader->msglen,
+               reader->buflen - reader->msglen);
+   }
+
+   reader->buflen -= reader->msglen;
+   reader->msglen = 0;
+
+   if (reader->buflen == reader->bufalloc) {
+      return reader->buflen;
+   }
+
+   /*
+    * Not Socket_Recv(), which would wait for the socket rather than
+    * fail with EAGAIN.
+    */
+   ret = recv (reader->sock->sd,
+               reader->buf + reader->buflen,
+               reader->bufalloc - reader->buflen,
+               MSG_DONTWAIT);
+
+   if (ret > 0) {
+      reader->buflen += ret;
+   }
+
+   return ret;
 }
 
 
@@ -94,6 +226,7 @@ static void
 WireProtocolReader_GrowBuffer (WireProtocolReader *reader, /* IN */
                                uint32_t minsize)           /* IN */
 {
+   uint8_t *buf;
    size_t size;
 
    ASSERT (reader);
@@ -101,7 +234,21 @@ WireProtocolReader_GrowBuffer (WireProtocolReader *reader, /* IN */
 
    if (minsize > reader->bufalloc) {
       size = UInt32_NextPowerOf2 (minsize);
-      reader->buf = Memory_SafeRealloc (reader->buf, size);
+
+      /*
+       * Buffers for multi-megabyte messages are mapped separately so they
+       * can be backed by huge pages on the reading thread's node.
+       */
+      if (size >= MEMORY_HUGE_PAGE_SIZE) {
+         buf = Memory_AllocLarge (size, (MEMORY_LARGE_HUGEPAGES |
+                                         MEMORY_LARGE_NUMA_LOCAL));
+         memcpy (buf, reader->buf, reader->buflen);
+         WireProtocolReader_FreeBuffer (reader);
+         reader->buf = buf;
+      } else {
+         reader->buf = Memory_SafeRealloc (reader->buf, size);
+      }
+
       reader->bufalloc = size;
    }
 }
@@ -170,6 +317,8 @@ bool
 WireProtocolReader_Read (WireProtocolReader *reader,   /* IN */
                          WireProtocolMessage *message) /* OUT */
 {
+   bool ret;
+
    ASSERT (reader);
    ASSERT (message);
 
@@ -181,18 +330,26 @@ WireProtocolReader_Read (WireProtocolReader *reader,   /* IN */
 
    reader->buflen -= reader->msglen;
 
+   TRACE_BEGIN (TRACE_RECV, 0);
+
    if (WireProtocolReader_TryFill (reader, sizeof reader->msglen)) {
       if (reader->buflen >= sizeof reader->msglen) {
          memcpy (&reader->msglen, reader->buf, sizeof reader->msglen);
          reader->msglen = UINT32_FROM_LE (reader->msglen);
          if (WireProtocolReader_TryFill (reader, reader->msglen)) {
+            TRACE_END (TRACE_RECV, reader->msglen);
+            TRACE_BEGIN (TRACE_PARSE, reader->msglen);
             WireProtocolMessage_FromLe (message);
-            return WireProtocolMessage_Scatter (message,
-                                                reader->buf,
-                                                reader->msglen);
+            ret = WireProtocolMessage_Scatter (message,
+                                               reader->buf,
+                                               reader->msglen);
+            TRACE_END (TRACE_PARSE, reader->msglen);
+            return ret;
          }
       }
    }
 
+   TRACE_END (TRACE_RECV, 0);
+
    return false;
 }
@@ -41,11 +41,37 @@ typedef struct
 } WireProtocolReader;
 
 
-void WireProtocolReader_Init    (WireProtocolReader *reader,
-                                 Socket *sock);
-void WireProtocolReader_Destroy (WireProtocolReader *reader);
-bool WireProtocolReader_Read    (WireProtocolReader *reader,
-                                 WireProtocolMessage *message);
+void    WireProtocolReader_Init    (WireProtocolReader *reader,
+                                    Socket *sock);
+void    WireProtocolReader_Destroy (WireProtocolReader *reader);
+bool    WireProtocolReader_Read    (WireProtocolReader *reader,
+                                    WireProtocolMessage *message);
+size_t  WireProtocolReader_Shrink  (WireProtocolReader *reader);
+ssize_t WireProtocolReader_Poll    (WireProtocolReader *reader);
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * WireProtocolReader_HasPending --
+ *
+ *       Checks for data buffered beyond the last message read, which the
+ *       next read will consume before touching the socket.
+ *
+ * Returns:
+ *       true if there is buffered data.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static __inline__ bool
+WireProtocolReader_HasPending (const WireProtocolReader *reader) /* IN */
+{
+   return (reader->buflen > reader->msglen);
+}
 
 
 END_DECLS
@@ -27,9 +27,18 @@
 
 #include <Debug.h>
 #include <Memory.h>
+#include <MemoryArena.h>
+#include <Task.h>
+#include <Trace.h>
 #include <WireProtocolWriter.h>
 
 
+/*
+ * Enough for the header, fixed fields and a few documents of any message.
+ */
+#define WRITER_IOVECS 16
+
+
 void
 WireProtocolWriter_Init (WireProtocolWriter *writer, /* OUT */
                          Socket *sock)               /* IN */
@@ -38,6 +47,9 @@ WireProtocolWriter_Init (WireProtocolWriter *writer, /* OUT */
    ASSERT (sock);
 
    writer->sock = sock;
+   writer->fuzzer = NULL;
+   writer->buffer = NULL;
+   writer->arena = NULL;
 }
 
 
@@ -46,6 +58,7 @@ WireProtocolWriter_Write (WireProtocolWriter *writer,   /* IN */
                           WireProtocolMessage *message) /* IN */
 {
    struct msghdr msg;
+   struct iovec *iov;
    Array iovecs;
    ssize_t ret;
    size_t expected = 0;
@@ -57,7 +70,15 @@ WireProtocolWriter_Write (WireProtocolWriter *writer,   /* IN */
    /*
     * Gather everything while we have non-mutated data.
     */
-   Array_Init (&iovecs, sizeof(struct iovec), false);
+   if (writer->arena) {
+      Array_InitBorrowed (&iovecs, sizeof (struct iovec), false,
+                          MemoryArena_Alloc (writer->arena,
+                                             (WRITER_IOVECS *
+                                              sizeof (struct iovec))),
+                          WRITER_IOVECS);
+   } else {
+      Array_Init (&iovecs, sizeof(struct iovec), false);
+   }
    WireProtocolMessage_Gather (message, &iovecs);
 
    /*
@@ -71,6 +92,16 @@ WireProtocolWriter_Write (WireProtocolWriter *writer,   /* IN */
     * Finally do endianness conversion.
     */
    WireProtocolMessage_ToLe (message);
+   WireProtocolMessage_SetChecksum (message, &iovecs);
+
+   if (writer->buffer) {
+      for (i = 0; i < iovecs.len; i++) {
+         iov = &Array_Index (&iovecs, struct iovec, i);
+         Array_AppendRange (writer->buffer, iov->iov_len, iov->iov_base);
+      }
+      Array_Destroy (&iovecs);
+      return true;
+   }
 
    Memory_Zero (&msg, sizeof msg);
    msg.msg_iov = (void *)iovecs.data;
@@ -80,7 +111,9 @@ WireProtocolWriter_Write (WireProtocolWriter *writer,   /* IN */
       expected += msg.msg_iov [i].iov_len;
    }
 
+   TRACE_BEGIN (TRACE_SEND, expected);
    ret = Socket_SendMsg (writer->sock, &msg, 0);
+   TRACE_END (TRACE_SEND, expected);
 
    Array_Destroy (&iovecs);
 
@@ -21,6 +21,7 @@
 #define WIRE_PROTOCOL_WRITER_H
 
 #include <Macros.h>
+#include <MemoryArena.h>
 #include <Socket.h>
 #include <Types.h>
 #include <WireProtocol.h>
@@ -32,11 +33,20 @@ BEGIN_DECLS
 typedef struct _WireProtocolWriter WireProtocolWriter;
 
 
+/*
+ * If buffer is set, messages are encoded and appended to it, an Array
+ * of uint8_t, instead of being sent on sock.
+ *
+ * If arena is set, each message is gathered into iovecs allocated from
+ * it, so the arena must be reset regularly, such as after each request.
+ */
 struct _WireProtocolWriter
 {
    Socket *sock;
    uint64_t timeout;
    void (*fuzzer) (WireProtocolMessage *message);
+   Array *buffer;
+   MemoryArena *arena;
 };
 
 
@@ -22,12 +22,15 @@
 
 
 #include <Macros.h>
+#include <Types.h>
 
 
 BEGIN_DECLS
 
 
 #ifndef TASK_USE_LTHREAD
+# include <errno.h>
+# include <poll.h>
 # include <pthread.h>
 # include <sys/types.h>
 # include <sys/socket.h>
@@ -48,6 +51,21 @@ typedef pthread_t Task;
 # define Task_Write               write
 # define Task_BeginBlockingCall()
 # define Task_EndBlockingCall()
+# define Task_ReleaseStack()
+
+static __inline__ int
+Task_WaitReadable (int fd,           /* IN */
+                   uint64_t timeout) /* IN */
+{
+   struct pollfd pfd = { fd, POLLIN, 0 };
+   int ret;
+
+   while ((-1 == (ret = poll (&pfd, 1, timeout ? (int)timeout : -1))) &&
+          (errno == EINTR)) {
+   }
+
+   return (ret > 0) ? 0 : (ret == 0) ? -2 : -1;
+}
 #else
 #include <lthread.h>
 typedef struct lthread * Task;
@@ -66,6 +84,8 @@ typedef struct lthread * Task;
 # define Task_Write              lthread_write
 # define Task_BeginBlockingCall  lthread_compute_begin
 # define Task_EndBlockingCall    lthread_compute_end
+# define Task_ReleaseStack       lthread_release_stack
+# define Task_WaitReadable       lthread_wait_read
 #endif
 
 
@@ -19,6 +19,7 @@
 
 #include <Debug.h>
 #include <CString.h>
+#include <Hash.h>
 
 
 /*
@@ -243,10 +244,14 @@ CString_HasSuffix (const char *src,    /* IN */
  *
  * CString_Hash --
  *
- *       A hash-function for a string. This is from Daniel J. Bernstein.
+ *       A hash-function for a string.
+ *
+ *       Strings are often client supplied (collection names, for one), so
+ *       this uses the per-process seed from Hash_GetSeed(). Hashes are
+ *       therefore not stable across runs.
  *
  * Returns:
- *       None.
+ *       The hash of the string.
  *
  * Side effects:
  *       None.
@@ -258,16 +263,10 @@ uint32_t
 CString_Hash (const void *data) /* IN */
 {
    const char *string = data;
-   uint32_t hash = 5381;
-   uint32_t i;
 
    ASSERT(string);
 
-   for (i = 0; string[i]; i++) {
-      hash = ((hash << 5) + hash) + string[i];
-   }
-
-   return hash;
+   return (uint32_t)Hash_Bytes (string, strlen (string), Hash_GetSeed ());
 }
 
 
@@ -111,7 +111,7 @@ TestSuite_AddFull (TestSuite  *suite,
    ASSERT (func);
 
    test = Memory_SafeMalloc0 (sizeof *test);
-   test->name = strdup (name);
+   test->name = CString_Dup (name);
    test->func = func;
    test->check = check;
    test->next = NULL;
@@ -134,6 +134,124 @@ BlockingQueue_Pop (BlockingQueue *queue) /* IN */
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * BlockingQueue_PushN --
+ *
+ *       Pushes @n_items items onto the queue, in order.
+ *
+ *       Items are added in as few lock acquisitions as the free space
+ *       allows, blocking while the queue is full, so pushing a batch
+ *       costs about as much as pushing one item.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Wakes readers.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+BlockingQueue_PushN (BlockingQueue *queue, /* IN */
+                     void **items,         /* IN */
+                     int n_items)          /* IN */
+{
+   int count;
+   int idx;
+   int i;
+
+   ASSERT (queue);
+   ASSERT (items || !n_items);
+
+   Mutex_Lock (&queue->mutex);
+
+   while (n_items > 0) {
+      while (BlockingQueue_IsFullLocked (queue)) {
+         Cond_Wait (&queue->wrcond, &queue->mutex);
+      }
+
+      count = MIN (n_items, queue->items.len - queue->count);
+
+      for (i = 0; i < count; i++) {
+         idx = (queue->head + queue->count + i) & queue->mask;
+         Array_Index (&queue->items, void*, idx) = items [i];
+      }
+
+      queue->count += count;
+      items += count;
+      n_items -= count;
+
+      if (count == 1) {
+         Cond_Signal (&queue->rdcond);
+      } else {
+         Cond_Broadcast (&queue->rdcond);
+      }
+   }
+
+   Mutex_Unlock (&queue->mutex);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * BlockingQueue_PopN --
+ *
+ *       Pops up to @max_items items from the queue into @items, blocking
+ *       until at least one is available.
+ *
+ * Returns:
+ *       The number of items popped, at least 1.
+ *
+ * Side effects:
+ *       Wakes writers.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+int
+BlockingQueue_PopN (BlockingQueue *queue, /* IN */
+                    void **items,         /* OUT */
+                    int max_items)        /* IN */
+{
+   int count;
+   int i;
+
+   ASSERT (queue);
+   ASSERT (items);
+   ASSERT (max_items > 0);
+
+   Mutex_Lock (&queue->mutex);
+
+   while (BlockingQueue_IsEmptyLocked (queue)) {
+      Cond_Wait (&queue->rdcond, &queue->mutex);
+   }
+
+   count = MIN (max_items, queue->count);
+
+   for (i = 0; i < count; i++) {
+      items [i] = Array_Index (&queue->items, void*,
+                               (queue->head + i) & queue->mask);
+   }
+
+   queue->head = (queue->head + count) & queue->mask;
+   queue->count -= count;
+
+   if (count == 1) {
+      Cond_Signal (&queue->wrcond);
+   } else {
+      Cond_Broadcast (&queue->wrcond);
+   }
+
+   Mutex_Unlock (&queue->mutex);
+
+   return count;
+}
+
+
 void
 BlockingQueue_Destroy (BlockingQueue *queue) /* IN */
 {
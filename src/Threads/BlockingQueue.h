@@ -51,6 +51,12 @@ void  BlockingQueue_Destroy (BlockingQueue *queue);
 void  BlockingQueue_Push    (BlockingQueue *queue,
                              void *data);
 void *BlockingQueue_Pop     (BlockingQueue *queue);
+void  BlockingQueue_PushN   (BlockingQueue *queue,
+                             void **items,
+                             int n_items);
+int   BlockingQueue_PopN    (BlockingQueue *queue,
+                             void **items,
+                             int max_items);
 
 
 END_DECLS
@@ -37,6 +37,7 @@ BEGIN_DECLS
 # define Cond_Broadcast pthread_cond_broadcast
 # define Cond_Destroy   pthread_cond_destroy
 # define Cond_Wait      pthread_cond_wait
+# define Cond_TimedWait pthread_cond_timedwait
 #elif defined(PLATFORM_WIN32)
 # define Cond              HANDLE
 # define Cond_Init(p,a)    (*(p) = CreateEvent(NULL, 0, 0, NULL))
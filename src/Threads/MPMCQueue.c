@@ -0,0 +1,447 @@
+/* MPMCQueue.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <Atomic.h>
+#include <Debug.h>
+#include <Memory.h>
+#include <MPMCQueue.h>
+#include <Thread.h>
+
+#if defined(PLATFORM_LINUX)
+# include <limits.h>
+# include <linux/futex.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif
+
+
+/*
+ * Number of times to retry an empty or full queue before parking. A
+ * short spin avoids the futex round trip when the other side is about
+ * to catch up.
+ */
+#define MPMC_QUEUE_SPIN 32
+
+
+static void
+MPMCQueueParking_Init (MPMCQueueParking *parking) /* OUT */
+{
+   parking->seq = 0;
+   parking->sleeping = 0;
+#if !defined(PLATFORM_LINUX)
+   Mutex_Init (&parking->mutex, NULL);
+   Cond_Init (&parking->cond, NULL);
+#endif
+}
+
+
+static void
+MPMCQueueParking_Destroy (MPMCQueueParking *parking) /* IN */
+{
+#if !defined(PLATFORM_LINUX)
+   Mutex_Destroy (&parking->mutex);
+   Cond_Destroy (&parking->cond);
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MPMCQueueParking_Prepare --
+ *
+ *       Announces that the caller is about to park on @parking. The
+ *       caller must then retry the queue once more before calling
+ *       MPMCQueueParking_Wait() with the returned sequence.
+ *
+ * Returns:
+ *       The sequence to wait on.
+ *
+ * Side effects:
+ *       The next signal will wake all parked threads.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static __inline__ int32_t
+MPMCQueueParking_Prepare (MPMCQueueParking *parking) /* IN */
+{
+   int32_t seq;
+
+   seq = AtomicInt_GetAcquire (&parking->seq);
+   AtomicInt_CompareAndSwap (&parking->sleeping, 0, 1);
+
+   return seq;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MPMCQueueParking_Wait --
+ *
+ *       Blocks until @parking has been signaled since @seq was read
+ *       from it.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       May return spuriously.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+MPMCQueueParking_Wait (MPMCQueueParking *parking, /* IN */
+                       int32_t seq)               /* IN */
+{
+#if defined(PLATFORM_LINUX)
+   (void)syscall (SYS_futex, &parking->seq, FUTEX_WAIT_PRIVATE, seq,
+                  NULL, NULL, 0);
+#else
+   Mutex_Lock (&parking->mutex);
+   while (parking->seq == seq) {
+      Cond_Wait (&parking->cond, &parking->mutex);
+   }
+   Mutex_Unlock (&parking->mutex);
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MPMCQueueParking_Signal --
+ *
+ *       Wakes the threads parked on @parking, if there are any.
+ *
+ *       The caller has just moved the head (or tail) with a
+ *       compare-and-swap. That and the load of sleeping pair with
+ *       MPMCQueueParking_Prepare() and the final look at head and tail
+ *       in MPMCQueue_Pop() (or MPMCQueue_Push()): either the sleeper
+ *       sees the queue has moved, or we see the sleeper. So the fast
+ *       path needs no extra barrier, and only the first push into an
+ *       empty queue (or pop from a full one) pays for a wakeup.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static __inline__ void
+MPMCQueueParking_Signal (MPMCQueueParking *parking) /* IN */
+{
+   if (LIKELY (!AtomicInt_GetSeqCst (&parking->sleeping)) ||
+       (AtomicInt_CompareAndSwap (&parking->sleeping, 1, 0) != 1)) {
+      return;
+   }
+
+#if defined(PLATFORM_LINUX)
+   AtomicInt_Increment (&parking->seq);
+   (void)syscall (SYS_futex, &parking->seq, FUTEX_WAKE_PRIVATE, INT_MAX,
+                  NULL, NULL, 0);
+#else
+   Mutex_Lock (&parking->mutex);
+   parking->seq++;
+   Cond_Broadcast (&parking->cond);
+   Mutex_Unlock (&parking->mutex);
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MPMCQueue_Init --
+ *
+ *       Initializes a queue holding up to @maxitems items.
+ *
+ *       @maxitems *MUST* be a power of two.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @queue is initialized.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+MPMCQueue_Init (MPMCQueue *queue, /* OUT */
+                int maxitems)     /* IN */
+{
+   int i;
+
+   ASSERT (queue);
+   ASSERT (maxitems > 1);
+   ASSERT ((maxitems & (maxitems - 1)) == 0);
+
+   Memory_Zero (queue, sizeof *queue);
+
+   queue->slots = Memory_Memalign (maxitems * sizeof *queue->slots, 64);
+   queue->mask = maxitems - 1;
+
+   for (i = 0; i < maxitems; i++) {
+      queue->slots [i].sequence = i;
+      queue->slots [i].data = NULL;
+   }
+
+   MPMCQueueParking_Init (&queue->not_empty);
+   MPMCQueueParking_Init (&queue->not_full);
+
+   Memory_Barrier ();
+}
+
+
+void
+MPMCQueue_Destroy (MPMCQueue *queue) /* IN */
+{
+   ASSERT (queue);
+
+   MPMCQueueParking_Destroy (&queue->not_empty);
+   MPMCQueueParking_Destroy (&queue->not_full);
+   Memory_Free (queue->slots);
+   queue->slots = NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MPMCQueue_TryPush --
+ *
+ *       Adds @data to the queue unless it is full.
+ *
+ *       A slot is free for the producer at position pos when its
+ *       sequence equals pos. Once written, the sequence becomes pos + 1,
+ *       which tells consumers it is ready.
+ *
+ * Returns:
+ *       true if @data was queued, false if the queue was full.
+ *
+ * Side effects:
+ *       May wake a consumer.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+MPMCQueue_TryPush (MPMCQueue *queue, /* IN */
+                   void *data)       /* IN */
+{
+   MPMCQueueSlot *slot;
+   uint32_t pos;
+   int32_t diff;
+
+   ASSERT (queue);
+
+   pos = AtomicInt_GetAcquire (&queue->head);
+
+   for (;;) {
+      slot = &queue->slots [pos & queue->mask];
+      diff = (int32_t)(AtomicInt_GetAcquire (&slot->sequence) - pos);
+
+      if (diff == 0) {
+         if (AtomicInt_CompareAndSwap (&queue->head, pos, pos + 1) == pos) {
+            break;
+         }
+         pos = AtomicInt_GetAcquire (&queue->head);
+      } else if (diff < 0) {
+         return false;
+      } else {
+         pos = AtomicInt_GetAcquire (&queue->head);
+      }
+   }
+
+   slot->data = data;
+   AtomicInt_SetRelease (&slot->sequence, pos + 1);
+
+   MPMCQueueParking_Signal (&queue->not_empty);
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MPMCQueue_TryPop --
+ *
+ *       Removes the oldest item from the queue unless it is empty.
+ *
+ *       A slot is ready for the consumer at position pos when its
+ *       sequence equals pos + 1. Once read, the sequence becomes
+ *       pos + maxitems, which frees it for the producer's next lap.
+ *
+ * Returns:
+ *       true and the item in @data, or false if the queue was empty.
+ *
+ * Side effects:
+ *       May wake a producer.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+MPMCQueue_TryPop (MPMCQueue *queue, /* IN */
+                  void **data)      /* OUT */
+{
+   MPMCQueueSlot *slot;
+   uint32_t pos;
+   int32_t diff;
+
+   ASSERT (queue);
+   ASSERT (data);
+
+   pos = AtomicInt_GetAcquire (&queue->tail);
+
+   for (;;) {
+      slot = &queue->slots [pos & queue->mask];
+      diff = (int32_t)(AtomicInt_GetAcquire (&slot->sequence) - (pos + 1));
+
+      if (diff == 0) {
+         if (AtomicInt_CompareAndSwap (&queue->tail, pos, pos + 1) == pos) {
+            break;
+         }
+         pos = AtomicInt_GetAcquire (&queue->tail);
+      } else if (diff < 0) {
+         return false;
+      } else {
+         pos = AtomicInt_GetAcquire (&queue->tail);
+      }
+   }
+
+   *data = slot->data;
+   AtomicInt_SetRelease (&slot->sequence, pos + queue->mask + 1);
+
+   MPMCQueueParking_Signal (&queue->not_full);
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MPMCQueue_Push --
+ *
+ *       Adds @data to the queue, blocking while the queue is full.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       May wake a consumer.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+MPMCQueue_Push (MPMCQueue *queue, /* IN */
+                void *data)       /* IN */
+{
+   int32_t seq;
+   int i;
+
+   ASSERT (queue);
+
+   for (;;) {
+      for (i = 0; i < MPMC_QUEUE_SPIN; i++) {
+         if (MPMCQueue_TryPush (queue, data)) {
+            return;
+         }
+      }
+
+      seq = MPMCQueueParking_Prepare (&queue->not_full);
+
+      if (MPMCQueue_TryPush (queue, data)) {
+         return;
+      }
+
+      /*
+       * A consumer has claimed a slot but not yet released it.
+       */
+      if ((AtomicInt_GetSeqCst (&queue->head) -
+           AtomicInt_GetSeqCst (&queue->tail)) <= queue->mask) {
+         Thread_Yield ();
+         continue;
+      }
+
+      MPMCQueueParking_Wait (&queue->not_full, seq);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * MPMCQueue_Pop --
+ *
+ *       Removes the oldest item from the queue, blocking while the queue
+ *       is empty.
+ *
+ * Returns:
+ *       The item.
+ *
+ * Side effects:
+ *       May wake a producer.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void *
+MPMCQueue_Pop (MPMCQueue *queue) /* IN */
+{
+   void *data;
+   int32_t seq;
+   int i;
+
+   ASSERT (queue);
+
+   for (;;) {
+      for (i = 0; i < MPMC_QUEUE_SPIN; i++) {
+         if (MPMCQueue_TryPop (queue, &data)) {
+            return data;
+         }
+      }
+
+      seq = MPMCQueueParking_Prepare (&queue->not_empty);
+
+      if (MPMCQueue_TryPop (queue, &data)) {
+         return data;
+      }
+
+      /*
+       * A producer has claimed a slot but not yet filled it.
+       */
+      if (AtomicInt_GetSeqCst (&queue->head) !=
+          AtomicInt_GetSeqCst (&queue->tail)) {
+         Thread_Yield ();
+         continue;
+      }
+
+      MPMCQueueParking_Wait (&queue->not_empty, seq);
+   }
+}
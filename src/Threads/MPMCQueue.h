@@ -0,0 +1,104 @@
+/* MPMCQueue.h
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+
+#include <Macros.h>
+#include <Platform.h>
+#include <Types.h>
+
+#if !defined(PLATFORM_LINUX)
+# include <Cond.h>
+# include <Mutex.h>
+#endif
+
+
+BEGIN_DECLS
+
+
+/*
+ * MPMCQueue is a bounded multi-producer, multi-consumer queue with the
+ * same interface as BlockingQueue, but no lock on the fast path.
+ *
+ * It is Dmitry Vyukov's ring: every slot carries a sequence number that
+ * tells producers and consumers whether the slot is theirs for the
+ * current lap, so each push or pop is one compare-and-swap on the head or
+ * tail followed by a release store to the slot. Head and tail live on
+ * separate cache lines so producers and consumers do not contend.
+ *
+ * Only when the queue is empty (or full) do MPMCQueue_Pop() (or
+ * MPMCQueue_Push()) park the thread, on a futex on Linux and on a
+ * condition variable elsewhere.
+ */
+
+
+typedef struct _MPMCQueue        MPMCQueue;
+typedef struct _MPMCQueueSlot    MPMCQueueSlot;
+typedef struct _MPMCQueueParking MPMCQueueParking;
+
+
+struct _MPMCQueueSlot
+{
+   volatile uint32_t  sequence;
+   void              *data;
+};
+
+
+struct _MPMCQueueParking
+{
+   volatile int32_t seq;
+   volatile int32_t sleeping;
+#if !defined(PLATFORM_LINUX)
+   Mutex            mutex;
+   Cond             cond;
+#endif
+};
+
+
+struct _MPMCQueue
+{
+   MPMCQueueSlot    *slots;
+   uint32_t          mask;
+
+   volatile uint32_t head GNUC_ALIGNED (64);
+   volatile uint32_t tail GNUC_ALIGNED (64);
+
+   MPMCQueueParking  not_empty GNUC_ALIGNED (64);
+   MPMCQueueParking  not_full GNUC_ALIGNED (64);
+} GNUC_ALIGNED (64);
+
+
+void  MPMCQueue_Init    (MPMCQueue *queue,
+                         int maxitems);
+void  MPMCQueue_Destroy (MPMCQueue *queue);
+bool  MPMCQueue_TryPush (MPMCQueue *queue,
+                         void *data);
+bool  MPMCQueue_TryPop  (MPMCQueue *queue,
+                         void **data);
+void  MPMCQueue_Push    (MPMCQueue *queue,
+                         void *data);
+void *MPMCQueue_Pop     (MPMCQueue *queue);
+
+
+END_DECLS
+
+
+#endif /* MPMC_QUEUE_H */
@@ -21,14 +21,14 @@
 #define RW_LOCK_H
 
 
-#if defined(PLATFORM_POSIX)
-# include <pthread.h>
-#endif
-
 #include <Macros.h>
 #include <Platform.h>
 #include <Types.h>
 
+#if defined(PLATFORM_POSIX)
+# include <pthread.h>
+#endif
+
 
 BEGIN_DECLS
 
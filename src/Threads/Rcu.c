@@ -0,0 +1,383 @@
+/* Rcu.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <pthread.h>
+
+#include <Array.h>
+#include <Atomic.h>
+#include <Debug.h>
+#include <Memory.h>
+#include <Mutex.h>
+#include <Platform.h>
+#include <Rcu.h>
+#include <Thread.h>
+#include <ThreadOnce.h>
+
+#if defined(PLATFORM_LINUX)
+# include <linux/membarrier.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif
+
+
+/*
+ * Callbacks queued with Rcu_Defer() run in batches, sharing one grace
+ * period.
+ */
+#define RCU_DEFER_BATCH 128
+
+
+typedef struct _RcuThread RcuThread;
+
+
+struct _RcuThread
+{
+   volatile uint32_t  epoch;
+   unsigned           nesting;
+   RcuThread         *next;
+};
+
+
+typedef struct
+{
+   RcuFunc  func;
+   void    *data;
+} RcuCallback;
+
+
+static struct
+{
+   volatile uint32_t  epoch;
+   bool               membarrier;
+   pthread_key_t      key;
+   Mutex              mutex;
+   RcuThread         *threads;
+   Mutex              defer_mutex;
+   Array              deferred;
+} gRcu;
+
+
+static ThreadOnce gRcuOnce = THREAD_ONCE_INIT;
+
+
+static void
+Rcu_ThreadRelease (void *data) /* IN */
+{
+   RcuThread *self = data;
+   RcuThread **iter;
+
+   Mutex_Lock (&gRcu.mutex);
+   for (iter = &gRcu.threads; *iter; iter = &(*iter)->next) {
+      if (*iter == self) {
+         *iter = self->next;
+         break;
+      }
+   }
+   Mutex_Unlock (&gRcu.mutex);
+
+   Memory_Free (self);
+}
+
+
+static void
+Rcu_Init (void)
+{
+   gRcu.epoch = 1;
+
+#if defined(PLATFORM_LINUX) && defined(SYS_membarrier)
+   {
+      long cmds = syscall (SYS_membarrier, MEMBARRIER_CMD_QUERY, 0);
+
+      gRcu.membarrier =
+         (cmds > 0) &&
+         (cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED) &&
+         (syscall (SYS_membarrier,
+                   MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0);
+   }
+#endif
+
+   pthread_key_create (&gRcu.key, Rcu_ThreadRelease);
+   Mutex_Init (&gRcu.mutex, NULL);
+   Mutex_Init (&gRcu.defer_mutex, NULL);
+   Array_Init (&gRcu.deferred, sizeof (RcuCallback), false);
+}
+
+
+static __inline__ RcuThread *
+Rcu_GetThread (void)
+{
+   RcuThread *self;
+
+   ThreadOnce_Once (&gRcuOnce, Rcu_Init);
+
+   if (UNLIKELY (!(self = pthread_getspecific (gRcu.key)))) {
+      self = Memory_SafeMalloc0 (sizeof *self);
+      pthread_setspecific (gRcu.key, self);
+
+      Mutex_Lock (&gRcu.mutex);
+      self->next = gRcu.threads;
+      gRcu.threads = self;
+      Mutex_Unlock (&gRcu.mutex);
+   }
+
+   return self;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Rcu_Fence --
+ *
+ *       Issues a full memory barrier on every thread of the process,
+ *       or just this one where readers fence for themselves.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+Rcu_Fence (void)
+{
+#if defined(PLATFORM_LINUX) && defined(SYS_membarrier)
+   if (gRcu.membarrier) {
+      if (syscall (SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0) != 0) {
+         (void)syscall (SYS_membarrier, MEMBARRIER_CMD_GLOBAL, 0);
+      }
+      return;
+   }
+#endif
+
+   Memory_Barrier ();
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Rcu_ReadLock --
+ *
+ *       Enters a read section. Pointers loaded with Rcu_Dereference()
+ *       stay valid until the matching Rcu_ReadUnlock().
+ *
+ *       The first call on a thread registers it with the grace period
+ *       machinery.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Holds back Rcu_Synchronize() in other threads.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+Rcu_ReadLock (void)
+{
+   RcuThread *self = Rcu_GetThread ();
+
+   if (self->nesting++) {
+      return;
+   }
+
+   /*
+    * Our epoch must be visible before we load any protected pointer.
+    * With membarrier that is the writer's job, and we only need to keep
+    * the compiler from hoisting loads above the store.
+    */
+   AtomicInt_SetRelease (&self->epoch, AtomicInt_GetAcquire (&gRcu.epoch));
+
+   if (gRcu.membarrier) {
+      Atomic_CompilerBarrier ();
+   } else {
+      Memory_Barrier ();
+   }
+}
+
+
+void
+Rcu_ReadUnlock (void)
+{
+   RcuThread *self = pthread_getspecific (gRcu.key);
+
+   ASSERT (self && self->nesting);
+
+   if (!--self->nesting) {
+      AtomicInt_SetRelease (&self->epoch, 0);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Rcu_Synchronize --
+ *
+ *       Waits for a grace period: every read section in progress when
+ *       this was called has ended once it returns. Must not be called
+ *       from inside a read section.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+Rcu_Synchronize (void)
+{
+   RcuThread *iter;
+   uint32_t target;
+   uint32_t epoch;
+
+   ASSERT (!Rcu_GetThread ()->nesting);
+
+   Mutex_Lock (&gRcu.mutex);
+
+   /*
+    * Order the caller's updates before the new epoch, and the new epoch
+    * before our look at the readers' slots.
+    */
+   Rcu_Fence ();
+   target = gRcu.epoch + 1;
+   if (!target) {
+      target = 1;
+   }
+   AtomicInt_SetSeqCst (&gRcu.epoch, target);
+   Rcu_Fence ();
+
+   for (iter = gRcu.threads; iter; iter = iter->next) {
+      while ((epoch = AtomicInt_GetAcquire (&iter->epoch)) &&
+             ((int32_t)(epoch - target) < 0)) {
+         Thread_Yield ();
+      }
+   }
+
+   Mutex_Unlock (&gRcu.mutex);
+}
+
+
+static void
+Rcu_RunCallbacks (Array *callbacks) /* IN */
+{
+   RcuCallback *cb;
+   int i;
+
+   if (callbacks->len) {
+      Rcu_Synchronize ();
+
+      for (i = 0; i < callbacks->len; i++) {
+         cb = &Array_Index (callbacks, RcuCallback, i);
+         cb->func (cb->data);
+      }
+   }
+
+   Array_Destroy (callbacks);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Rcu_Defer --
+ *
+ *       Calls @func with @data after a grace period, typically to free
+ *       an object that was just unpublished. Must not be called from
+ *       inside a read section.
+ *
+ *       Callbacks are batched; the call that fills a batch waits for
+ *       the grace period and runs it.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       May block for a grace period.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+Rcu_Defer (RcuFunc func, /* IN */
+           void *data)   /* IN */
+{
+   RcuCallback cb;
+   Array batch;
+
+   ASSERT (func);
+
+   ThreadOnce_Once (&gRcuOnce, Rcu_Init);
+
+   cb.func = func;
+   cb.data = data;
+
+   Mutex_Lock (&gRcu.defer_mutex);
+   Array_Append (&gRcu.deferred, cb);
+   if (gRcu.deferred.len < RCU_DEFER_BATCH) {
+      Mutex_Unlock (&gRcu.defer_mutex);
+      return;
+   }
+   batch = gRcu.deferred;
+   Array_Init (&gRcu.deferred, sizeof (RcuCallback), false);
+   Mutex_Unlock (&gRcu.defer_mutex);
+
+   Rcu_RunCallbacks (&batch);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Rcu_Barrier --
+ *
+ *       Waits for a grace period and runs every callback queued with
+ *       Rcu_Defer() so far.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+Rcu_Barrier (void)
+{
+   Array batch;
+
+   ThreadOnce_Once (&gRcuOnce, Rcu_Init);
+
+   Mutex_Lock (&gRcu.defer_mutex);
+   batch = gRcu.deferred;
+   Array_Init (&gRcu.deferred, sizeof (RcuCallback), false);
+   Mutex_Unlock (&gRcu.defer_mutex);
+
+   Rcu_RunCallbacks (&batch);
+}
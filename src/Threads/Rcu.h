@@ -0,0 +1,71 @@
+/* Rcu.h
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RCU_H
+#define RCU_H
+
+
+#include <Atomic.h>
+#include <Macros.h>
+#include <Types.h>
+
+
+BEGIN_DECLS
+
+
+/*
+ * Read-copy-update for read-mostly shared state.
+ *
+ * Readers bracket their accesses with Rcu_ReadLock() and
+ * Rcu_ReadUnlock() and load shared pointers with Rcu_Dereference().
+ * Writers build a new copy, publish it with Rcu_AssignPointer(), and
+ * hand the old copy to Rcu_Defer(), which frees it once every read
+ * section that might still see it has ended.
+ *
+ * Grace periods are tracked with a global epoch. A reader stores the
+ * epoch it entered at in a per-thread slot and clears the slot when it
+ * leaves; Rcu_Synchronize() bumps the epoch and waits for every slot
+ * holding an older one. On Linux the writer forces a memory barrier on
+ * all reader threads with membarrier(2), so the reader side is a couple
+ * of plain loads and stores: no locked instructions and no fences.
+ *
+ * Read sections nest, must not block, and must not span an lthread
+ * switch: a reader parked inside one holds back every writer.
+ */
+
+
+typedef void (*RcuFunc) (void *data);
+
+
+#define Rcu_Dereference(p)      (AtomicPtr_GetAcquire (&(p)))
+#define Rcu_AssignPointer(p, v) (AtomicPtr_SetRelease (&(p), (v)))
+
+
+void Rcu_ReadLock    (void);
+void Rcu_ReadUnlock  (void);
+void Rcu_Synchronize (void);
+void Rcu_Defer       (RcuFunc func,
+                      void *data);
+void Rcu_Barrier     (void);
+
+
+END_DECLS
+
+
+#endif /* RCU_H */
@@ -0,0 +1,116 @@
+/* SeqLock.h
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SEQ_LOCK_H
+#define SEQ_LOCK_H
+
+
+#include <Atomic.h>
+#include <Macros.h>
+#include <Types.h>
+
+
+BEGIN_DECLS
+
+
+/*
+ * A SeqLock protects a small piece of data that is read far more often
+ * than it is written, without readers writing to shared memory.
+ *
+ * Writers make the sequence odd while they update the data and even
+ * again afterwards. Readers copy the data out between
+ * SeqLock_ReadBegin() and SeqLock_ReadRetry() and start over if the
+ * sequence moved in between:
+ *
+ *   do {
+ *      seq = SeqLock_ReadBegin (&lock);
+ *      copy = shared;
+ *   } while (SeqLock_ReadRetry (&lock, seq));
+ *
+ * A reader may see a torn copy before it retries, so it must not follow
+ * pointers or otherwise act on what it read until SeqLock_ReadRetry()
+ * returns false. Writers exclude each other by spinning.
+ */
+
+
+typedef struct
+{
+   volatile uint32_t seq;
+} SeqLock;
+
+
+#define SEQ_LOCK_INIT { 0 }
+
+
+static __inline__ void
+SeqLock_Init (SeqLock *lock) /* OUT */
+{
+   lock->seq = 0;
+}
+
+
+static __inline__ uint32_t
+SeqLock_ReadBegin (const SeqLock *lock) /* IN */
+{
+   uint32_t seq;
+
+   while (UNLIKELY ((seq = AtomicInt_GetAcquire (&lock->seq)) & 1)) {
+      /* A writer is in the middle of an update. */
+   }
+
+   return seq;
+}
+
+
+static __inline__ bool
+SeqLock_ReadRetry (const SeqLock *lock, /* IN */
+                   uint32_t seq)        /* IN */
+{
+   Atomic_FenceAcquire ();
+
+   return UNLIKELY (AtomicInt_GetAcquire (&lock->seq) != seq);
+}
+
+
+static __inline__ void
+SeqLock_WriteLock (SeqLock *lock) /* IN */
+{
+   uint32_t seq;
+
+   for (;;) {
+      seq = AtomicInt_GetAcquire (&lock->seq);
+      if (!(seq & 1) &&
+          (AtomicInt_CompareAndSwap (&lock->seq, seq, seq + 1) == seq)) {
+         break;
+      }
+   }
+}
+
+
+static __inline__ void
+SeqLock_WriteUnlock (SeqLock *lock) /* IN */
+{
+   AtomicInt_SetRelease (&lock->seq, lock->seq + 1);
+}
+
+
+END_DECLS
+
+
+#endif /* SEQ_LOCK_H */
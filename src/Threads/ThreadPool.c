@@ -17,37 +17,529 @@
  */
 
 
+#include <pthread.h>
 #include <stdio.h>
 
 #include <Atomic.h>
 #include <Debug.h>
 #include <Macros.h>
+#include <Memory.h>
+#include <MemoryPool.h>
+#include <Task.h>
 #include <Thread.h>
+#include <ThreadOnce.h>
 #include <ThreadPool.h>
 
 
-static void *
-ThreadPool_Worker (void *poolptr) /* IN */
+#define THREAD_POOL_DEQUE_MASK (THREAD_POOL_DEQUE_SIZE - 1)
+
+
+/*
+ * Tasks submitted from outside the pool stay on the shared queue; more
+ * helpers than workers for one parallel-for would only queue up.
+ */
+#define THREAD_POOL_MAX_HELPERS 64
+
+
+typedef enum
+{
+   THREAD_POOL_TASK_PENDING,
+   THREAD_POOL_TASK_DONE,
+   THREAD_POOL_TASK_WAITING,
+} ThreadPoolTaskState;
+
+
+struct _ThreadPoolTask
+{
+   ThreadPoolClosure  func;
+   void              *data;
+   void              *result;
+   ThreadPool        *pool;
+   volatile int32_t   state;
+   bool               detached;
+};
+
+
+typedef struct
+{
+   ThreadPoolRangeFunc  func;
+   void                *data;
+   volatile int64_t     next;
+   int64_t              end;
+   int64_t              grain;
+} ThreadPoolRange;
+
+
+MEMORY_POOL (ThreadPoolTaskPool, ThreadPoolFuture, "ThreadPoolTask")
+
+
+static pthread_key_t gThreadPoolWorkerKey;
+static ThreadOnce    gThreadPoolWorkerKeyOnce = THREAD_ONCE_INIT;
+
+
+static void
+ThreadPool_InitWorkerKey (void)
+{
+   pthread_key_create (&gThreadPoolWorkerKey, NULL);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * ThreadPool_CurrentWorker --
+ *
+ *       Finds the calling thread's worker in @pool.
+ *
+ * Returns:
+ *       The worker, or NULL if the calling thread does not belong to
+ *       @pool.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static ThreadPoolWorker *
+ThreadPool_CurrentWorker (ThreadPool *pool) /* IN */
+{
+   ThreadPoolWorker *self;
+
+   self = pthread_getspecific (gThreadPoolWorkerKey);
+
+   return (self && self->pool == pool) ? self : NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * ThreadPoolWorker_Push --
+ *
+ *       Pushes @task on the bottom of @self's deque. Only the owning
+ *       worker may call this.
+ *
+ * Returns:
+ *       false if the deque is full.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+ThreadPoolWorker_Push (ThreadPoolWorker *self, /* IN */
+                       ThreadPoolFuture *task) /* IN */
+{
+   uint32_t bottom = self->bottom;
+   uint32_t top = AtomicInt_GetAcquire (&self->top);
+
+   if ((int32_t)(bottom - top) >= THREAD_POOL_DEQUE_SIZE) {
+      return false;
+   }
+
+   AtomicPtr_SetRelease (&self->tasks [bottom & THREAD_POOL_DEQUE_MASK],
+                         task);
+   AtomicInt_SetRelease (&self->bottom, bottom + 1);
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * ThreadPoolWorker_Take --
+ *
+ *       Pops the newest task off the bottom of @self's deque. Only the
+ *       owning worker may call this.
+ *
+ *       The bottom is published before top is read, so a thief racing
+ *       for the last task either sees it gone or has to win the same
+ *       compare-and-swap on top as we do.
+ *
+ * Returns:
+ *       A task, or NULL if the deque is empty.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static ThreadPoolFuture *
+ThreadPoolWorker_Take (ThreadPoolWorker *self) /* IN */
+{
+   ThreadPoolFuture *task;
+   uint32_t bottom = self->bottom - 1;
+   uint32_t top;
+   int32_t diff;
+
+   AtomicInt_SetSeqCst (&self->bottom, bottom);
+   top = AtomicInt_GetSeqCst (&self->top);
+   diff = (int32_t)(bottom - top);
+
+   if (diff < 0) {
+      AtomicInt_SetRelease (&self->bottom, bottom + 1);
+      return NULL;
+   }
+
+   task = self->tasks [bottom & THREAD_POOL_DEQUE_MASK];
+
+   if (diff == 0) {
+      if (AtomicInt_CompareAndSwap (&self->top, top, top + 1) != top) {
+         task = NULL;
+      }
+      AtomicInt_SetRelease (&self->bottom, bottom + 1);
+   }
+
+   return task;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * ThreadPoolWorker_Steal --
+ *
+ *       Takes the oldest task off the top of @victim's deque. Any thread
+ *       may call this.
+ *
+ * Returns:
+ *       A task, or NULL if the deque is empty or another thread got the
+ *       task first.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static ThreadPoolFuture *
+ThreadPoolWorker_Steal (ThreadPoolWorker *victim) /* IN */
+{
+   ThreadPoolFuture *task;
+   uint32_t top = AtomicInt_GetSeqCst (&victim->top);
+   uint32_t bottom = AtomicInt_GetSeqCst (&victim->bottom);
+
+   if ((int32_t)(bottom - top) <= 0) {
+      return NULL;
+   }
+
+   task = AtomicPtr_GetAcquire (&victim->tasks [top & THREAD_POOL_DEQUE_MASK]);
+
+   if (AtomicInt_CompareAndSwap (&victim->top, top, top + 1) != top) {
+      return NULL;
+   }
+
+   return task;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * ThreadPool_Wake --
+ *
+ *       Wakes idle workers after @n_tasks were queued.
+ *
+ *       Queuing increments pending before checking idle, and a worker
+ *       increments idle before checking pending, so at least one of them
+ *       sees the other. The mutex keeps the signal from landing between
+ *       a worker's check and its wait.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+ThreadPool_Wake (ThreadPool *pool, /* IN */
+                 int n_tasks)      /* IN */
+{
+   if (AtomicInt_GetSeqCst (&pool->idle) > 0) {
+      Mutex_Lock (&pool->mutex);
+      if (n_tasks > 1) {
+         Cond_Broadcast (&pool->cond);
+      } else {
+         Cond_Signal (&pool->cond);
+      }
+      Mutex_Unlock (&pool->mutex);
+   }
+}
+
+
+static ThreadPoolFuture *
+ThreadPool_NewTask (ThreadPool *pool,       /* IN */
+                    ThreadPoolClosure func, /* IN */
+                    void *data,             /* IN */
+                    bool detached)          /* IN */
+{
+   ThreadPoolFuture *task;
+
+   ASSERT (!pool->shutdown);
+
+   task = ThreadPoolTaskPool_Alloc ();
+   task->func = func;
+   task->data = data;
+   task->result = NULL;
+   task->pool = pool;
+   task->state = THREAD_POOL_TASK_PENDING;
+   task->detached = detached;
+
+   return task;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * ThreadPool_Complete --
+ *
+ *       Marks @task done, waking its waiter if one is blocked.
+ *
+ *       A waiter flips the state from PENDING to WAITING under the wait
+ *       mutex before sleeping, so without one this is a single
+ *       compare-and-swap. @task is not touched once DONE is stored: the
+ *       waiter may free it right away.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+ThreadPool_Complete (ThreadPoolFuture *task) /* IN */
+{
+   ThreadPool *pool = task->pool;
+   unsigned lock;
+
+   if (AtomicInt_CompareAndSwap (&task->state,
+                                 THREAD_POOL_TASK_PENDING,
+                                 THREAD_POOL_TASK_DONE) ==
+       THREAD_POOL_TASK_PENDING) {
+      return;
+   }
+
+   lock = ((size_t)task >> 6) % THREAD_POOL_WAIT_LOCKS;
+
+   Mutex_Lock (&pool->wait_mutex [lock]);
+   AtomicInt_SetRelease (&task->state, THREAD_POOL_TASK_DONE);
+   Cond_Broadcast (&pool->wait_cond [lock]);
+   Mutex_Unlock (&pool->wait_mutex [lock]);
+}
+
+
+static void
+ThreadPool_Run (ThreadPool *pool,       /* IN */
+                ThreadPoolFuture *task) /* IN */
+{
+   if (task->func) {
+      task->result = task->func (task->data);
+   } else {
+      pool->worker (task->data, pool->worker_data);
+   }
+
+   if (task->detached) {
+      ThreadPoolTaskPool_Free (task);
+   } else {
+      ThreadPool_Complete (task);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * ThreadPool_Queue --
+ *
+ *       Queues @task: on the calling worker's deque if it is one of
+ *       ours, on the shared queue otherwise.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Runs @task inline if the calling worker's deque is full, and
+ *       blocks while the shared queue is full.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+ThreadPool_Queue (ThreadPool *pool,       /* IN */
+                  ThreadPoolFuture *task) /* IN */
+{
+   ThreadPoolWorker *self = ThreadPool_CurrentWorker (pool);
+
+   if (self) {
+      if (!ThreadPoolWorker_Push (self, task)) {
+         ThreadPool_Run (pool, task);
+         return;
+      }
+   } else {
+      MPMCQueue_Push (&pool->queue, task);
+   }
+
+   AtomicInt_Increment (&pool->pending);
+   ThreadPool_Wake (pool, 1);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * ThreadPool_FindTask --
+ *
+ *       Looks for a task for @self: its own deque first, then up to the
+ *       batch size from the shared queue, then the other workers' deques
+ *       starting from a random one.
+ *
+ *       @self is NULL when a thread outside the pool helps out; it only
+ *       looks at the shared queue and steals.
+ *
+ * Returns:
+ *       A task, or NULL if none was found.
+ *
+ * Side effects:
+ *       Tasks beyond the first taken from the shared queue are moved to
+ *       @self's deque.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static ThreadPoolFuture *
+ThreadPool_FindTask (ThreadPool *pool,       /* IN */
+                     ThreadPoolWorker *self) /* IN */
 {
-   ThreadPool *pool = poolptr;
-   ThreadPoolFunc func;
-   void *func_data;
-   void *data;
+   ThreadPoolFuture *task = NULL;
+   void *item;
+   uint32_t start;
+   int batch;
+   int i;
+
+   if (self && (task = ThreadPoolWorker_Take (self))) {
+      goto found;
+   }
 
-   ASSERT (pool);
+   if (MPMCQueue_TryPop (&pool->queue, &item)) {
+      task = item;
+      if (self) {
+         /*
+          * Only thieves touch our deque meanwhile, and they only make
+          * room, so the room it has now is there for the whole batch.
+          */
+         batch = (int)MIN (pool->batch,
+                           THREAD_POOL_DEQUE_SIZE -
+                           (int32_t)(self->bottom -
+                                     AtomicInt_GetAcquire (&self->top)));
+         for (i = 1; i < batch; i++) {
+            if (!MPMCQueue_TryPop (&pool->queue, &item)) {
+               break;
+            }
+            ThreadPoolWorker_Push (self, item);
+         }
+      }
+      goto found;
+   }
+
+   if (self) {
+      self->seed ^= self->seed << 13;
+      self->seed ^= self->seed >> 17;
+      self->seed ^= self->seed << 5;
+      start = self->seed;
+   } else {
+      start = (uint32_t)((size_t)&task >> 4);
+   }
 
-   func = pool->worker;
-   func_data = pool->worker_data;
+   for (i = 0; i < pool->nworkers; i++) {
+      ThreadPoolWorker *victim;
+
+      victim = &pool->workers [(start + i) % pool->nworkers];
+      if (victim != self && (task = ThreadPoolWorker_Steal (victim))) {
+         goto found;
+      }
+   }
+
+   return NULL;
+
+found:
+   AtomicInt_Decrement (&pool->pending);
+
+   return task;
+}
+
+
+static void *
+ThreadPool_Worker (void *data) /* IN */
+{
+   ThreadPoolWorker *self = data;
+   ThreadPool *pool = self->pool;
+   ThreadPoolFuture *task;
+
+   pthread_setspecific (gThreadPoolWorkerKey, self);
 
    for (;;) {
-      data = BlockingQueue_Pop (&pool->queue);
-      func (data, func_data);
+      if ((task = ThreadPool_FindTask (pool, self))) {
+         ThreadPool_Run (pool, task);
+         continue;
+      }
+
+      if (AtomicInt_GetSeqCst (&pool->pending) > 0) {
+         Thread_Yield ();
+         continue;
+      }
+
+      if (AtomicInt_GetAcquire (&pool->shutdown)) {
+         break;
+      }
+
+      Mutex_Lock (&pool->mutex);
+      AtomicInt_Increment (&pool->idle);
+      while (AtomicInt_GetSeqCst (&pool->pending) <= 0 &&
+             !AtomicInt_GetAcquire (&pool->shutdown)) {
+         Cond_Wait (&pool->cond, &pool->mutex);
+      }
+      AtomicInt_Decrement (&pool->idle);
+      Mutex_Unlock (&pool->mutex);
    }
 
+   pthread_setspecific (gThreadPoolWorkerKey, NULL);
+
    return NULL;
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * ThreadPool_Init --
+ *
+ *       Starts @nthreads workers. @qdepth bounds the shared queue for
+ *       work queued from outside the pool.
+ *
+ *       @worker is called for each pointer passed to ThreadPool_Push()
+ *       and may be NULL if only closures are submitted.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
 void
 ThreadPool_Init (ThreadPool *threadpool, /* IN */
                  int nthreads,           /* IN */
@@ -55,36 +547,101 @@ ThreadPool_Init (ThreadPool *threadpool, /* IN */
                  ThreadPoolFunc worker,  /* IN */
                  void *user_data)        /* IN */
 {
-   Thread thread;
+   ThreadPoolWorker *self;
    char name [32];
    int i;
 
    ASSERT (threadpool);
+   ASSERT (nthreads > 0);
+
+   ThreadOnce_Once (&gThreadPoolWorkerKeyOnce, ThreadPool_InitWorkerKey);
 
-   BlockingQueue_Init (&threadpool->queue, qdepth);
+   MPMCQueue_Init (&threadpool->queue, qdepth);
+   Mutex_Init (&threadpool->mutex, NULL);
+   Cond_Init (&threadpool->cond, NULL);
+
+   for (i = 0; i < THREAD_POOL_WAIT_LOCKS; i++) {
+      Mutex_Init (&threadpool->wait_mutex [i], NULL);
+      Cond_Init (&threadpool->wait_cond [i], NULL);
+   }
 
    threadpool->worker = worker;
    threadpool->worker_data = user_data;
+   threadpool->batch = 1;
+   threadpool->pending = 0;
+   threadpool->idle = 0;
+   threadpool->shutdown = 0;
+   threadpool->nworkers = nthreads;
+   threadpool->workers = Memory_Memalign (sizeof *self * nthreads, 64);
 
-   Memory_Barrier ();
+   for (i = 0; i < nthreads; i++) {
+      self = &threadpool->workers [i];
+      self->top = 0;
+      self->bottom = 0;
+      self->pool = threadpool;
+      self->seed = 2654435761U * (i + 1);
+   }
 
-   Array_Init (&threadpool->threads, sizeof thread, false);
+   Memory_Barrier ();
 
    for (i = 0; i < nthreads; i++) {
+      self = &threadpool->workers [i];
       snprintf (name, sizeof name, "ThreadPool-%u", i);
       name [sizeof name - 1] = '\0';
-      Thread_Init (&thread, name, ThreadPool_Worker, threadpool);
-      Array_Append (&threadpool->threads, thread);
+      Thread_Init (&self->thread, name, ThreadPool_Worker, self);
    }
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * ThreadPool_Destroy --
+ *
+ *       Stops the pool once all queued work has run, and joins the
+ *       workers. Must not be called from a worker.
+ *
+ *       Futures of @threadpool are complete once this returns and may
+ *       still be waited on.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
 void
 ThreadPool_Destroy (ThreadPool *threadpool) /* IN */
 {
-   /*
-    * TODO:
-    */
+   int i;
+
+   ASSERT (threadpool);
+   ASSERT (!ThreadPool_CurrentWorker (threadpool));
+
+   Mutex_Lock (&threadpool->mutex);
+   AtomicInt_SetRelease (&threadpool->shutdown, 1);
+   Cond_Broadcast (&threadpool->cond);
+   Mutex_Unlock (&threadpool->mutex);
+
+   for (i = 0; i < threadpool->nworkers; i++) {
+      Thread_Join (threadpool->workers [i].thread);
+   }
+
+   ASSERT (threadpool->pending == 0);
+
+   for (i = 0; i < THREAD_POOL_WAIT_LOCKS; i++) {
+      Mutex_Destroy (&threadpool->wait_mutex [i]);
+      Cond_Destroy (&threadpool->wait_cond [i]);
+   }
+
+   Mutex_Destroy (&threadpool->mutex);
+   Cond_Destroy (&threadpool->cond);
+   MPMCQueue_Destroy (&threadpool->queue);
+   Memory_Free (threadpool->workers);
+   threadpool->workers = NULL;
 }
 
 
@@ -93,6 +650,316 @@ ThreadPool_Push (ThreadPool *threadpool, /* IN */
                  void *data)             /* IN */
 {
    ASSERT (threadpool);
+   ASSERT (threadpool->worker);
+
+   ThreadPool_Queue (threadpool,
+                     ThreadPool_NewTask (threadpool, NULL, data, true));
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * ThreadPool_PushBatch --
+ *
+ *       Queues @n_items items for the pool's ThreadPoolFunc, waking idle
+ *       workers once for the whole batch.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Blocks while the shared queue is full.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+ThreadPool_PushBatch (ThreadPool *threadpool, /* IN */
+                      void **items,           /* IN */
+                      int n_items)            /* IN */
+{
+   ThreadPoolWorker *self;
+   ThreadPoolFuture *task;
+   int queued = 0;
+   int i;
+
+   ASSERT (threadpool);
+   ASSERT (threadpool->worker);
+
+   self = ThreadPool_CurrentWorker (threadpool);
+
+   for (i = 0; i < n_items; i++) {
+      task = ThreadPool_NewTask (threadpool, NULL, items [i], true);
+      if (self) {
+         if (!ThreadPoolWorker_Push (self, task)) {
+            ThreadPool_Run (threadpool, task);
+            continue;
+         }
+      } else if (!MPMCQueue_TryPush (&threadpool->queue, task)) {
+         /*
+          * Let the workers at what is queued so far before blocking
+          * for room.
+          */
+         AtomicInt_Add (&threadpool->pending, queued);
+         ThreadPool_Wake (threadpool, queued);
+         queued = 0;
+         MPMCQueue_Push (&threadpool->queue, task);
+      }
+      queued++;
+   }
+
+   AtomicInt_Add (&threadpool->pending, queued);
+   ThreadPool_Wake (threadpool, queued);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * ThreadPool_SetBatchSize --
+ *
+ *       Sets how many items a worker takes off the shared queue per
+ *       visit, from 1 (the default) to THREAD_POOL_MAX_BATCH.
+ *
+ *       Larger batches cut traffic on the shared queue when many small
+ *       items are queued from outside the pool; the extra items sit in
+ *       the worker's deque, where idle workers may steal them.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
 
-   BlockingQueue_Push (&threadpool->queue, data);
+void
+ThreadPool_SetBatchSize (ThreadPool *threadpool, /* IN */
+                         int batch)              /* IN */
+{
+   ASSERT (threadpool);
+   ASSERT (batch > 0);
+   ASSERT (batch <= THREAD_POOL_MAX_BATCH);
+
+   threadpool->batch = batch;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * ThreadPool_Submit --
+ *
+ *       Queues a call to @func with @data.
+ *
+ * Returns:
+ *       A future for the return value of @func. It must be passed to
+ *       ThreadPoolFuture_Wait() exactly once, which frees it.
+ *
+ * Side effects:
+ *       Blocks while the shared queue is full.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+ThreadPoolFuture *
+ThreadPool_Submit (ThreadPool *threadpool,  /* IN */
+                   ThreadPoolClosure func, /* IN */
+                   void *data)             /* IN */
+{
+   ThreadPoolFuture *future;
+
+   ASSERT (threadpool);
+   ASSERT (func);
+
+   future = ThreadPool_NewTask (threadpool, func, data, false);
+   ThreadPool_Queue (threadpool, future);
+
+   return future;
+}
+
+
+bool
+ThreadPoolFuture_IsDone (ThreadPoolFuture *future) /* IN */
+{
+   ASSERT (future);
+
+   return AtomicInt_GetAcquire (&future->state) == THREAD_POOL_TASK_DONE;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * ThreadPoolFuture_Wait --
+ *
+ *       Waits for @future to complete and frees it.
+ *
+ *       A worker of the same pool runs other tasks meanwhile. Any other
+ *       caller blocks; an lthread does so inside Task_BeginBlockingCall()
+ *       so the scheduler keeps running other lthreads.
+ *
+ * Returns:
+ *       The value returned by the submitted closure.
+ *
+ * Side effects:
+ *       @future is freed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void *
+ThreadPoolFuture_Wait (ThreadPoolFuture *future) /* IN */
+{
+   ThreadPool *pool;
+   ThreadPoolWorker *self;
+   ThreadPoolFuture *task;
+   unsigned lock;
+   int32_t state;
+   bool in_task;
+   void *result;
+
+   ASSERT (future);
+   ASSERT (!future->detached);
+
+   pool = future->pool;
+
+   if (!ThreadPoolFuture_IsDone (future)) {
+      if ((self = ThreadPool_CurrentWorker (pool))) {
+         while (!ThreadPoolFuture_IsDone (future)) {
+            if ((task = ThreadPool_FindTask (pool, self))) {
+               ThreadPool_Run (pool, task);
+            } else {
+               Thread_Yield ();
+            }
+         }
+      } else {
+         lock = ((size_t)future >> 6) % THREAD_POOL_WAIT_LOCKS;
+#if defined(TASK_USE_LTHREAD)
+         in_task = (Task_Current () != NULL);
+#else
+         in_task = false;
+#endif
+
+         if (in_task) {
+            Task_BeginBlockingCall ();
+         }
+         Mutex_Lock (&pool->wait_mutex [lock]);
+         state = AtomicInt_CompareAndSwap (&future->state,
+                                           THREAD_POOL_TASK_PENDING,
+                                           THREAD_POOL_TASK_WAITING);
+         if (state != THREAD_POOL_TASK_DONE) {
+            while (AtomicInt_GetAcquire (&future->state) !=
+                   THREAD_POOL_TASK_DONE) {
+               Cond_Wait (&pool->wait_cond [lock], &pool->wait_mutex [lock]);
+            }
+         }
+         Mutex_Unlock (&pool->wait_mutex [lock]);
+         if (in_task) {
+            Task_EndBlockingCall ();
+         }
+      }
+   }
+
+   result = future->result;
+   ThreadPoolTaskPool_Free (future);
+
+   return result;
+}
+
+
+static void *
+ThreadPool_RunRange (void *data) /* IN */
+{
+   ThreadPoolRange *range = data;
+   int64_t begin;
+
+   for (;;) {
+      begin = AtomicInt64_Add (&range->next, range->grain) - range->grain;
+      if (begin >= range->end) {
+         break;
+      }
+      range->func (begin, MIN (begin + range->grain, range->end),
+                   range->data);
+   }
+
+   return NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * ThreadPool_ParallelFor --
+ *
+ *       Calls @func over [@begin, @end) in chunks of @grain indexes,
+ *       spread over the calling thread and the pool. A @grain of 0 picks
+ *       about eight chunks per thread.
+ *
+ *       Chunks are claimed from a shared counter by the caller and by up
+ *       to one helper task per worker, so uneven chunks balance out
+ *       without splitting the range up front.
+ *
+ * Returns:
+ *       None once every chunk has run.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+ThreadPool_ParallelFor (ThreadPool *threadpool,   /* IN */
+                        size_t begin,             /* IN */
+                        size_t end,               /* IN */
+                        size_t grain,             /* IN */
+                        ThreadPoolRangeFunc func, /* IN */
+                        void *data)               /* IN */
+{
+   ThreadPoolFuture *helpers [THREAD_POOL_MAX_HELPERS];
+   ThreadPoolRange range;
+   size_t n_chunks;
+   int max_helpers;
+   int n_helpers;
+   int i;
+
+   ASSERT (threadpool);
+   ASSERT (func);
+
+   if (end <= begin) {
+      return;
+   }
+
+   if (!grain) {
+      grain = MAX (1, (end - begin) / ((threadpool->nworkers + 1) * 8));
+   }
+
+   n_chunks = (end - begin + grain - 1) / grain;
+   max_helpers = MIN (threadpool->nworkers, THREAD_POOL_MAX_HELPERS);
+   n_helpers = (int)MIN (n_chunks - 1, (size_t)max_helpers);
+
+   if (!n_helpers) {
+      func (begin, end, data);
+      return;
+   }
+
+   range.func = func;
+   range.data = data;
+   range.next = begin;
+   range.end = end;
+   range.grain = grain;
+
+   for (i = 0; i < n_helpers; i++) {
+      helpers [i] = ThreadPool_Submit (threadpool, ThreadPool_RunRange,
+                                       &range);
+   }
+
+   ThreadPool_RunRange (&range);
+
+   for (i = 0; i < n_helpers; i++) {
+      ThreadPoolFuture_Wait (helpers [i]);
+   }
 }
@@ -21,38 +21,125 @@
 #define THREAD_POOL_H
 
 
-#include <Array.h>
-#include <BlockingQueue.h>
+#include <Cond.h>
 #include <Macros.h>
+#include <MPMCQueue.h>
+#include <Mutex.h>
+#include <Thread.h>
+#include <Types.h>
 
 
 BEGIN_DECLS
 
 
-typedef struct _ThreadPool ThreadPool;
+/*
+ * ThreadPool is a work-stealing pool of threads.
+ *
+ * Every worker owns a Chase-Lev deque. Work queued from a worker (a task
+ * submitting subtasks, a parallel-for inside a task) goes to the bottom
+ * of the worker's own deque, which it pops LIFO without locking. Idle
+ * workers steal from the top of a random victim's deque. Work queued
+ * from any other thread goes through a shared MPMCQueue.
+ *
+ * Work is either a closure passed to ThreadPool_Submit(), which returns
+ * a future, or, for pools created with a ThreadPoolFunc, a bare pointer
+ * passed to ThreadPool_Push() and handed to that function.
+ *
+ * ThreadPoolFuture_Wait() called from a worker runs other tasks until
+ * the future completes, so tasks may wait on their subtasks. Called from
+ * an lthread it is a blocking call (see Task.h), so the scheduler keeps
+ * running other lthreads.
+ */
+
+
+typedef struct _ThreadPool       ThreadPool;
+typedef struct _ThreadPoolTask   ThreadPoolFuture;
+typedef struct _ThreadPoolWorker ThreadPoolWorker;
+
+
+typedef void  (*ThreadPoolFunc)      (void *data,
+                                      void *user_data);
+typedef void *(*ThreadPoolClosure)   (void *data);
+typedef void  (*ThreadPoolRangeFunc) (size_t begin,
+                                      size_t end,
+                                      void *data);
+
+
+/*
+ * Upper bound for ThreadPool_SetBatchSize(). A worker takes up to that
+ * many items off the shared queue per visit, runs the first and keeps
+ * the rest in its deque, where idle workers may steal them.
+ */
+#define THREAD_POOL_MAX_BATCH 64
+
+
+/*
+ * Capacity of each worker's deque. Must be a power of two. A worker
+ * whose deque is full runs newly submitted tasks inline.
+ */
+#define THREAD_POOL_DEQUE_SIZE 1024
 
 
-typedef void (*ThreadPoolFunc) (void *data,
-                                void *user_data);
+/*
+ * Waiters block on one of a few condition variables picked by future
+ * address, so futures carry no lock of their own.
+ */
+#define THREAD_POOL_WAIT_LOCKS 16
+
+
+struct _ThreadPoolWorker
+{
+   volatile uint32_t  top GNUC_ALIGNED (64);
+   volatile uint32_t  bottom GNUC_ALIGNED (64);
+   ThreadPoolFuture  *tasks [THREAD_POOL_DEQUE_SIZE] GNUC_ALIGNED (64);
+   ThreadPool        *pool;
+   Thread             thread;
+   uint32_t           seed;
+} GNUC_ALIGNED (64);
 
 
 struct _ThreadPool
 {
-   ThreadPoolFunc  worker;
-   void           *worker_data;
-   Array           threads;
-   BlockingQueue   queue;
+   ThreadPoolFunc     worker;
+   void              *worker_data;
+   ThreadPoolWorker  *workers;
+   int                nworkers;
+   volatile int       batch;
+   volatile int32_t   pending;
+   volatile int32_t   idle;
+   volatile int32_t   shutdown;
+   Mutex              mutex;
+   Cond               cond;
+   Mutex              wait_mutex [THREAD_POOL_WAIT_LOCKS];
+   Cond               wait_cond [THREAD_POOL_WAIT_LOCKS];
+   MPMCQueue          queue;
 };
 
 
-void ThreadPool_Init    (ThreadPool *threadpool,
-                         int nthreads,
-                         int qdepth,
-                         ThreadPoolFunc worker,
-                         void *user_data);
-void ThreadPool_Push    (ThreadPool *threadpool,
-                         void *data);
-void ThreadPool_Destroy (ThreadPool *threadpool);
+void              ThreadPool_Init         (ThreadPool *threadpool,
+                                           int nthreads,
+                                           int qdepth,
+                                           ThreadPoolFunc worker,
+                                           void *user_data);
+void              ThreadPool_Push         (ThreadPool *threadpool,
+                                           void *data);
+void              ThreadPool_PushBatch    (ThreadPool *threadpool,
+                                           void **items,
+                                           int n_items);
+void              ThreadPool_SetBatchSize (ThreadPool *threadpool,
+                                           int batch);
+ThreadPoolFuture *ThreadPool_Submit       (ThreadPool *threadpool,
+                                           ThreadPoolClosure func,
+                                           void *data);
+void              ThreadPool_ParallelFor  (ThreadPool *threadpool,
+                                           size_t begin,
+                                           size_t end,
+                                           size_t grain,
+                                           ThreadPoolRangeFunc func,
+                                           void *data);
+void              ThreadPool_Destroy      (ThreadPool *threadpool);
+bool              ThreadPoolFuture_IsDone (ThreadPoolFuture *future);
+void             *ThreadPoolFuture_Wait   (ThreadPoolFuture *future);
 
 
 END_DECLS
@@ -86,8 +86,8 @@ Thread_Worker (void *data) /* IN */
 
    ret = info->func (info->data);
 
-   free (info->name);
-   free (info);
+   Memory_FreeUntracked (info->name);
+   Memory_Free (info);
 
    return ret;
 }
@@ -0,0 +1,694 @@
+/* Trace.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#if !defined(_WIN32)
+# include <sys/mman.h>
+#endif
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <Atomic.h>
+#include <Debug.h>
+#include <Memory.h>
+#include <Platform.h>
+#include <ThreadOnce.h>
+#include <TimeSpec.h>
+#include <Trace.h>
+
+
+#define TRACE_MAGIC          33665511
+#define TRACE_EVENTS_PER_CPU 4096
+#define TRACE_MAX_PAGES      (64 * 1024)
+
+
+#pragma pack(push, 1)
+typedef struct
+{
+   uint32_t magic;
+   uint32_t size;
+   uint32_t ncpu;
+   uint32_t nevents;
+   uint64_t ticks_per_sec;
+   char     padding [40];
+} TraceHeader;
+
+typedef struct
+{
+   volatile int64_t head;
+   int64_t          padding [7];
+} TraceRing;
+#pragma pack(pop)
+
+
+typedef struct
+{
+   uint8_t  *mem;
+   size_t    memsize;
+   unsigned  ncpu;
+   unsigned  nevents;
+   unsigned  did_malloc : 1;
+} Trace;
+
+
+STATIC_ASSERT (sizeof (TraceHeader) == 64);
+STATIC_ASSERT (sizeof (TraceRing) == 64);
+STATIC_ASSERT (sizeof (TraceEvent) == 32);
+
+
+int               gTraceEnabled;
+static Trace      gTrace;
+static pid_t      gTracePid;
+static ThreadOnce gTraceOnce = THREAD_ONCE_INIT;
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Trace_GetTimestamp --
+ *
+ *       Fetches the current timestamp and the CPU we are running on.
+ *
+ *       With rdtscp, both come from a single instruction. Otherwise we
+ *       fall back to the monotonic clock in nanoseconds.
+ *
+ * Returns:
+ *       A timestamp in ticks. See Trace_GetTicksPerSecond().
+ *
+ * Side effects:
+ *       @cpu is set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static __inline__ uint64_t
+Trace_GetTimestamp (unsigned *cpu) /* OUT */
+{
+#if defined(ENABLE_RDTSCP)
+   uint32_t rax, rdx, aux;
+   __asm__ volatile ("rdtscp\n" : "=a" (rax), "=d" (rdx), "=c" (aux) : : );
+   *cpu = aux & 0xFFF;
+   return ((uint64_t)rdx << 32) | rax;
+#else
+   struct timespec ts;
+
+# if defined(HAVE_PLATFORM_GETCURRENTCPU)
+   *cpu = Platform_GetCurrentCpu ();
+# else
+   *cpu = 0;
+# endif
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+   return ((uint64_t)ts.tv_sec * NANOSEC_PER_SEC) + ts.tv_nsec;
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Trace_Calibrate --
+ *
+ *       Determines how many timestamp ticks elapse per second. When using
+ *       rdtscp this spins for roughly 10 milliseconds comparing the TSC
+ *       against the monotonic clock.
+ *
+ * Returns:
+ *       The number of ticks per second.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static uint64_t
+Trace_Calibrate (void)
+{
+#if defined(ENABLE_RDTSCP)
+   unsigned cpu;
+   uint64_t tsc0;
+   uint64_t tsc1;
+   uint64_t usec0;
+   uint64_t usec1;
+
+   usec0 = TimeSpec_GetMonotonic ();
+   tsc0 = Trace_GetTimestamp (&cpu);
+
+   do {
+      usec1 = TimeSpec_GetMonotonic ();
+   } while ((usec1 - usec0) < 10000);
+
+   tsc1 = Trace_GetTimestamp (&cpu);
+
+   return ((tsc1 - tsc0) * USEC_PER_SEC) / (usec1 - usec0);
+#else
+   return NANOSEC_PER_SEC;
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Trace_GetRing --
+ *
+ *       Locates the ring buffer for @cpu within the trace segment.
+ *
+ * Returns:
+ *       A TraceRing which is followed by the ring's events.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static __inline__ TraceRing *
+Trace_GetRing (unsigned cpu) /* IN */
+{
+   size_t stride;
+
+   stride = sizeof (TraceRing) + (gTrace.nevents * sizeof (TraceEvent));
+
+   return (TraceRing *)(void *)(gTrace.mem +
+                                sizeof (TraceHeader) +
+                                (cpu * stride));
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Trace_Destroy --
+ *
+ *       Cleanup after the trace segment. This is registered with atexit()
+ *       and removes the shared memory segment if it was created.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+Trace_Destroy (void)
+{
+   gTraceEnabled = 0;
+
+   Memory_Barrier ();
+
+#if defined(PLATFORM_POSIX)
+   if (!gTracePid) {
+      char name [32];
+
+      snprintf (name, sizeof name, "/Trace-%u", (int)getpid ());
+      name [sizeof name - 1] = '\0';
+      shm_unlink (name);
+   }
+#endif
+
+   if (gTrace.did_malloc) {
+      Memory_Free (gTrace.mem);
+#if defined(PLATFORM_POSIX)
+   } else {
+      munmap (gTrace.mem, gTrace.memsize);
+#endif
+   }
+
+   gTrace.mem = NULL;
+   gTrace.memsize = 0;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Trace_AllocBuffer --
+ *
+ *       Allocates the shared memory segment for the trace rings. This
+ *       mirrors Counters_AllocBuffer() and falls back to malloc() if the
+ *       segment could not be created or TRACE_DISABLE_SHM is set.
+ *
+ * Returns:
+ *       A mmap() or malloc() based buffer.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void *
+Trace_AllocBuffer (size_t size) /* IN */
+{
+   void *mem;
+#if defined(PLATFORM_POSIX)
+   char name [32];
+   int fd;
+
+   if (getenv ("TRACE_DISABLE_SHM")) {
+      goto use_malloc;
+   }
+
+   snprintf (name, sizeof name, "/Trace-%u", (int)getpid ());
+   name [sizeof name - 1] = '\0';
+
+   if (-1 == (fd = shm_open (name, O_CREAT|O_RDWR, S_IRUSR|S_IWUSR|S_IRGRP))) {
+      goto use_malloc;
+   }
+
+   if (-1 == ftruncate (fd, size)) {
+      goto failure;
+   }
+
+   mem = mmap (NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+   if (mem == MAP_FAILED) {
+      goto failure;
+   }
+
+   close (fd);
+
+   return mem;
+
+failure:
+   shm_unlink (name);
+   close (fd);
+
+use_malloc:
+#endif
+   gTrace.did_malloc = 1;
+   mem = Memory_SafeMalloc0 (size);
+   return mem;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Trace_DoInit --
+ *
+ *       Creates the trace segment for the local process and enables
+ *       recording of trace events.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       gTraceEnabled is set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+Trace_DoInit (void)
+{
+   TraceHeader *hdr;
+   size_t pagesize;
+   size_t size;
+
+   ASSERT (!gTracePid);
+
+   gTrace.ncpu = Platform_GetCpuCount ();
+   gTrace.nevents = TRACE_EVENTS_PER_CPU;
+
+   pagesize = Platform_GetPageSize ();
+   size = sizeof (TraceHeader) +
+          (gTrace.ncpu * (sizeof (TraceRing) +
+                          (gTrace.nevents * sizeof (TraceEvent))));
+   size = ((size / pagesize) + 1) * pagesize;
+
+   gTrace.mem = Trace_AllocBuffer (size);
+   gTrace.memsize = size;
+
+   hdr = (TraceHeader *)(void *)gTrace.mem;
+   hdr->size = gTrace.memsize;
+   hdr->ncpu = gTrace.ncpu;
+   hdr->nevents = gTrace.nevents;
+   hdr->ticks_per_sec = Trace_Calibrate ();
+
+   Memory_Barrier ();
+
+   hdr->magic = TRACE_MAGIC;
+
+   atexit (Trace_Destroy);
+
+   Memory_Barrier ();
+
+   gTraceEnabled = 1;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Trace_DoInitRemote --
+ *
+ *       Maps the trace segment of a remote process for reading.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+Trace_DoInitRemote (void)
+{
+#if defined(PLATFORM_POSIX)
+   TraceHeader hdr;
+   void *mem;
+   char name [32];
+   int fd;
+
+   ASSERT (gTracePid);
+
+   snprintf (name, sizeof name, "/Trace-%u", (int)gTracePid);
+   name [sizeof name - 1] = '\0';
+
+   if (-1 == (fd = shm_open (name, O_RDONLY, 0))) {
+      perror ("Failed to load shared memory segment");
+      return;
+   }
+
+   if ((sizeof hdr != pread (fd, &hdr, sizeof hdr, 0)) ||
+       (hdr.magic != TRACE_MAGIC)) {
+      fprintf (stderr, "Shared memory segment contains invalid magic\n");
+      close (fd);
+      return;
+   }
+
+   if ((hdr.size < Platform_GetPageSize ()) ||
+       (hdr.size > (Platform_GetPageSize () * TRACE_MAX_PAGES)) ||
+       !hdr.nevents ||
+       (hdr.nevents & (hdr.nevents - 1)) ||
+       (hdr.size < (sizeof hdr +
+                    (hdr.ncpu * (sizeof (TraceRing) +
+                                 (hdr.nevents * sizeof (TraceEvent))))))) {
+      fprintf (stderr, "Shared memory segment has an invalid size!\n");
+      close (fd);
+      return;
+   }
+
+   if (MAP_FAILED == (mem = mmap (NULL, hdr.size, PROT_READ, MAP_SHARED, fd, 0))) {
+      perror ("Failed to mmap() shared memory segment.");
+      close (fd);
+      return;
+   }
+
+   gTrace.mem = mem;
+   gTrace.memsize = hdr.size;
+   gTrace.ncpu = hdr.ncpu;
+   gTrace.nevents = hdr.nevents;
+
+   atexit (Trace_Destroy);
+   close (fd);
+#else
+   fprintf (stderr, "Remote tracing is not supported on Windows.\n");
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Trace_Init --
+ *
+ *       Initializes the trace rings for the local process and enables
+ *       recording of trace events.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+Trace_Init (void)
+{
+   ThreadOnce_Once (&gTraceOnce, Trace_DoInit);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Trace_InitRemote --
+ *
+ *       Loads the trace segment of the process identified by @pid so
+ *       that it can be read with Trace_Foreach().
+ *
+ *       Like Counters_InitRemote(), this cannot be mixed with
+ *       Trace_Init() in the same process.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+Trace_InitRemote (pid_t pid) /* IN */
+{
+   gTracePid = pid;
+   ThreadOnce_Once (&gTraceOnce, Trace_DoInitRemote);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Trace_SetEnabled --
+ *
+ *       Pauses or resumes recording of trace events. Trace_Init() must
+ *       have been called before recording can be resumed.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+Trace_SetEnabled (bool enabled) /* IN */
+{
+   gTraceEnabled = (enabled && gTrace.mem && !gTracePid);
+   Memory_Barrier ();
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Trace_Record --
+ *
+ *       Records a trace event into the ring of the current CPU. This is
+ *       the slow path of TRACE_EVENT() and should not be called directly
+ *       unless gTraceEnabled has been checked.
+ *
+ *       The slot is claimed with an atomic increment of the ring head so
+ *       that a thread migrated between CPUs cannot clobber another
+ *       writer's slot. The timestamp is written last so that readers can
+ *       skip slots that are still being filled.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+Trace_Record (TraceType type,   /* IN */
+              TracePhase phase, /* IN */
+              uint64_t task,    /* IN */
+              uint64_t arg)     /* IN */
+{
+   TraceEvent *event;
+   TraceRing *ring;
+   unsigned cpu;
+   uint64_t timestamp;
+   int64_t idx;
+
+   timestamp = Trace_GetTimestamp (&cpu);
+
+   if (UNLIKELY (cpu >= gTrace.ncpu)) {
+      cpu %= gTrace.ncpu;
+   }
+
+   ring = Trace_GetRing (cpu);
+   idx = AtomicInt64_Add (&ring->head, 1) - 1;
+   event = ((TraceEvent *)(void *)(ring + 1)) + (idx & (gTrace.nevents - 1));
+
+   event->timestamp = 0;
+   Memory_Barrier ();
+
+   event->task = task;
+   event->arg = arg;
+   event->type = type;
+   event->phase = phase;
+   event->cpu = cpu;
+
+   Memory_Barrier ();
+   event->timestamp = timestamp;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Trace_Foreach --
+ *
+ *       Iterates the events currently stored in the trace rings, ring by
+ *       ring. Events within a ring are delivered oldest first.
+ *
+ *       Events are not copied out atomically, so an event that is being
+ *       overwritten while we read it may be skipped.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+Trace_Foreach (TraceForeachFunc func, /* IN */
+               void *user_data)       /* IN */
+{
+   const TraceEvent *events;
+   TraceEvent event;
+   TraceRing *ring;
+   unsigned cpu;
+   int64_t head;
+   int64_t i;
+
+   ASSERT (func);
+
+   if (!gTrace.mem) {
+      return;
+   }
+
+   for (cpu = 0; cpu < gTrace.ncpu; cpu++) {
+      ring = Trace_GetRing (cpu);
+      events = (const TraceEvent *)(const void *)(ring + 1);
+      head = AtomicInt64_Get (&ring->head);
+
+      for (i = MAX (0, head - (int64_t)gTrace.nevents); i < head; i++) {
+         memcpy (&event, &events [i & (gTrace.nevents - 1)], sizeof event);
+         if (event.timestamp &&
+             (event.type > TRACE_NONE) &&
+             (event.type < TRACE_LAST)) {
+            func (&event, user_data);
+         }
+      }
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Trace_GetTicksPerSecond --
+ *
+ *       Returns the number of timestamp ticks per second for the events
+ *       stored in the trace segment.
+ *
+ * Returns:
+ *       A non-zero number of ticks, or 0 if no segment is loaded.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+uint64_t
+Trace_GetTicksPerSecond (void)
+{
+   if (gTrace.mem) {
+      return ((const TraceHeader *)(const void *)gTrace.mem)->ticks_per_sec;
+   }
+
+   return 0;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * TraceType_ToString --
+ *
+ *       Returns the span name for a given trace type.
+ *
+ * Returns:
+ *       A const string that should not be modified or freed.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+const char *
+TraceType_ToString (TraceType type) /* IN */
+{
+   switch (type) {
+   case TRACE_RECV:
+      return "recv";
+   case TRACE_PARSE:
+      return "parse";
+   case TRACE_HANDLER:
+      return "handler";
+   case TRACE_SEND:
+      return "send";
+   case TRACE_RESUME:
+      return "resume";
+   case TRACE_NONE:
+   case TRACE_LAST:
+   default:
+      return "unknown";
+   }
+}
@@ -0,0 +1,123 @@
+/* Trace.h
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef TRACE_H
+#define TRACE_H
+
+
+#include <Macros.h>
+#include <Platform.h>
+#include <Types.h>
+
+
+/*
+ * Counters tell us how much work we did in aggregate, but not where a
+ * single slow request spent its time. The tracer records begin/end pairs
+ * for a few well known spans (recv wait, parse, handler, send, lthread
+ * resume) into a per-CPU ring buffer living in shared memory, much like
+ * the counters segment. congo-trace can then dump the rings of a running
+ * process as Chrome trace JSON (chrome://tracing).
+ *
+ * Recording is disabled until Trace_Init() is called. When disabled, each
+ * trace point costs a single load and a (predicted not-taken) branch; the
+ * timestamp and ring bookkeeping live out of line in Trace_Record().
+ *
+ * Timestamps come from rdtscp when configured with --enable-rdtscp (which
+ * also gives us the current CPU for free), otherwise the monotonic clock
+ * in nanoseconds. The ticks-per-second of the clock is stored in the
+ * segment header so readers can convert.
+ *
+ * TRACE_BEGIN() and TRACE_END() key the span on Task_Current(), so callers
+ * must include Task.h. Trace.h itself does not, so that it can be used from
+ * within lthread.
+ */
+
+
+BEGIN_DECLS
+
+
+#define TRACE_EVENT(type, phase, task, arg) \
+   do { \
+      if (UNLIKELY (gTraceEnabled)) { \
+         Trace_Record ((type), (phase), (uint64_t)(size_t)(task), (arg)); \
+      } \
+   } while (0)
+#define TRACE_BEGIN(type, arg) \
+   TRACE_EVENT (type, TRACE_PHASE_BEGIN, Task_Current (), arg)
+#define TRACE_END(type, arg) \
+   TRACE_EVENT (type, TRACE_PHASE_END, Task_Current (), arg)
+
+
+typedef enum
+{
+   TRACE_NONE    = 0,
+   TRACE_RECV    = 1,
+   TRACE_PARSE   = 2,
+   TRACE_HANDLER = 3,
+   TRACE_SEND    = 4,
+   TRACE_RESUME  = 5,
+   TRACE_LAST
+} TraceType;
+
+
+typedef enum
+{
+   TRACE_PHASE_BEGIN = 'B',
+   TRACE_PHASE_END   = 'E',
+} TracePhase;
+
+
+#pragma pack(push, 1)
+typedef struct
+{
+   uint64_t timestamp;
+   uint64_t task;
+   uint64_t arg;
+   uint16_t type;
+   uint8_t  phase;
+   uint8_t  padding;
+   uint32_t cpu;
+} TraceEvent;
+#pragma pack(pop)
+
+
+typedef void (*TraceForeachFunc) (const TraceEvent *event,
+                                  void *user_data);
+
+
+extern int gTraceEnabled;
+
+
+void        Trace_Init              (void);
+void        Trace_InitRemote        (pid_t pid);
+void        Trace_SetEnabled        (bool enabled);
+void        Trace_Record            (TraceType type,
+                                     TracePhase phase,
+                                     uint64_t task,
+                                     uint64_t arg);
+void        Trace_Foreach           (TraceForeachFunc func,
+                                     void *user_data);
+uint64_t    Trace_GetTicksPerSecond (void);
+const char *TraceType_ToString      (TraceType type);
+
+
+END_DECLS
+
+
+#endif /* TRACE_H */
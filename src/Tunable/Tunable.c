@@ -17,61 +17,515 @@
  */
 
 
-#include <Array.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#include <Atomic.h>
 #include <CString.h>
 #include <Debug.h>
+#include <Hash.h>
 #include <Log.h>
+#include <Memory.h>
 #include <Mutex.h>
+#include <Rcu.h>
 #include <ThreadOnce.h>
 #include <Tunable.h>
 
 
+/*
+ * Tunables are read on hot paths from any thread, so they live in an
+ * RCU protected table: readers take no lock.
+ *
+ * Registering appends to the table in place while there is room and
+ * publishes the new length, or publishes a larger copy. Setting swaps
+ * in a new Value. Either way the old copy is freed after a grace
+ * period. The mutex only serializes writers.
+ *
+ * Each table carries an open addressing index from lowercased name to
+ * tunable, twice the size of the table so probes stay short. Slots hold
+ * the tunable plus one, zero being empty, and are published after the
+ * info they point at. Tunables are never removed.
+ *
+ * Scalar tunables also keep their value in bits, an int64 that typed
+ * handles read directly.
+ */
+
+
 typedef struct
 {
-   char  *name;
-   Value  value;
+   char             *name;
+   Value            *value;
+   int               type;
+   volatile int64_t  bits;
 } TunableInfo;
 
 
-static Mutex gTunableMutex;
-static Array gTunableInfo;
+typedef struct
+{
+   volatile int32_t   len;
+   int32_t            allocated;
+   uint32_t           mask;
+   volatile int32_t  *index;
+   TunableInfo       *infos [1];
+} TunableTable;
+
+
+volatile int32_t gTunableSerial = 1;
+
+
+static Mutex         gTunableMutex;
+static TunableTable *gTunableTable;
+static ThreadOnce    gTunableOnce = THREAD_ONCE_INIT;
 
 
 static void
 Tunable_Init (void)
 {
    Mutex_Init (&gTunableMutex, NULL);
-   Array_Init (&gTunableInfo, sizeof (TunableInfo), false);
 }
 
 
-Tunable
-Tunable_Register (const char *key,            /* IN */
-                  const Value *current_value) /* IN */
+static void
+Tunable_FreeValue (void *data) /* IN */
+{
+   Value *value = data;
+
+   Value_Destroy (value);
+   Memory_Free (value);
+}
+
+
+static uint32_t
+Tunable_HashName (const char *name) /* IN */
+{
+   uint64_t hash = 0;
+   uint64_t word;
+   int i;
+
+   while (*name) {
+      for (i = 0, word = 0; (i < 8) && *name; i++, name++) {
+         word |= (uint64_t)tolower ((unsigned char)*name) << (i * 8);
+      }
+      hash = Hash_Mix64 (hash ^ word);
+   }
+
+   return (uint32_t)hash;
+}
+
+
+/*
+ * Must be called inside a read section or with the mutex held.
+ */
+static Tunable
+Tunable_Lookup (TunableTable *table, /* IN */
+                const char *key)     /* IN */
+{
+   uint32_t i;
+   int32_t slot;
+
+   if (!table) {
+      return TUNABLE_INVALID;
+   }
+
+   for (i = Tunable_HashName (key) & table->mask;
+        (slot = AtomicInt_GetAcquire (&table->index [i]));
+        i = (i + 1) & table->mask) {
+      if (0 == strcasecmp (key, table->infos [slot - 1]->name)) {
+         return (Tunable)(slot - 1);
+      }
+   }
+
+   return TUNABLE_INVALID;
+}
+
+
+static void
+Tunable_IndexInsert (TunableTable *table, /* IN */
+                     Tunable tunable)     /* IN */
+{
+   uint32_t i;
+
+   i = Tunable_HashName (table->infos [tunable]->name) & table->mask;
+
+   while (table->index [i]) {
+      if (0 == strcasecmp (table->infos [tunable]->name,
+                           table->infos [table->index [i] - 1]->name)) {
+         /* Keep the first registration, as a linear scan would. */
+         return;
+      }
+      i = (i + 1) & table->mask;
+   }
+
+   AtomicInt_SetRelease (&table->index [i], tunable + 1);
+}
+
+
+static TunableTable *
+Tunable_NewTable (int32_t allocated) /* IN */
+{
+   TunableTable *table;
+   size_t size;
+
+   size = sizeof *table + ((allocated - 1) * sizeof table->infos [0]);
+   table = Memory_SafeMalloc0 (size + (2 * allocated * sizeof (int32_t)));
+   table->allocated = allocated;
+   table->mask = (2 * allocated) - 1;
+   table->index = (volatile int32_t *)((uint8_t *)table + size);
+
+   return table;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Tunable_ToInt64 --
+ *
+ *       Converts @value to an integer. Strings are parsed, and must hold
+ *       nothing but the number.
+ *
+ * Returns:
+ *       true if @value could be converted.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+Tunable_ToInt64 (const Value *value, /* IN */
+                 int64_t *out)       /* OUT */
+{
+   char *end;
+
+   switch (value->type) {
+   case VALUE_TYPE_INT16:
+      *out = value->u.i16;
+      return true;
+   case VALUE_TYPE_UINT16:
+      *out = value->u.u16;
+      return true;
+   case VALUE_TYPE_INT32:
+      *out = value->u.i32;
+      return true;
+   case VALUE_TYPE_UINT32:
+      *out = value->u.u32;
+      return true;
+   case VALUE_TYPE_INT64:
+      *out = value->u.i64;
+      return true;
+   case VALUE_TYPE_UINT64:
+      *out = (int64_t)value->u.u64;
+      return true;
+   case VALUE_TYPE_SIZE:
+   case VALUE_TYPE_SSIZE:
+      *out = (int64_t)value->u.sz;
+      return true;
+   case VALUE_TYPE_BOOL:
+      *out = value->u.bl;
+      return true;
+   case VALUE_TYPE_FLOAT:
+      *out = (int64_t)value->u.flt4;
+      return true;
+   case VALUE_TYPE_DOUBLE:
+      *out = (int64_t)value->u.flt8;
+      return true;
+   case VALUE_TYPE_STRING:
+      if (value->u.str && *value->u.str) {
+         *out = strtoll (value->u.str, &end, 0);
+         return !*end;
+      }
+      return false;
+   default:
+      return false;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Tunable_Convert --
+ *
+ *       Converts @value to @type, one of VALUE_TYPE_INT64, _BOOL and
+ *       _DOUBLE, and packs it into the bits read by typed handles.
+ *
+ * Returns:
+ *       true and the converted value in @out and @bits, or false if
+ *       @value cannot be converted.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+Tunable_Convert (const Value *value, /* IN */
+                 int type,           /* IN */
+                 Value *out,         /* OUT */
+                 int64_t *bits)      /* OUT */
 {
-   static ThreadOnce once = THREAD_ONCE_INIT;
-   TunableInfo info = { 0 };
+   union {
+      int64_t i;
+      double  d;
+   } u;
+   const char *str;
+   char *end;
+
+   Memory_Zero (out, sizeof *out);
+
+   switch (type) {
+   case VALUE_TYPE_INT64:
+      if (!Tunable_ToInt64 (value, &u.i)) {
+         return false;
+      }
+      Value_InitInt64 (out, u.i);
+      break;
+   case VALUE_TYPE_BOOL:
+      if (value->type == VALUE_TYPE_STRING && (str = value->u.str)) {
+         if (!strcasecmp (str, "true") || !strcasecmp (str, "yes") ||
+             !strcasecmp (str, "on")) {
+            u.i = 1;
+         } else if (!strcasecmp (str, "false") || !strcasecmp (str, "no") ||
+                    !strcasecmp (str, "off")) {
+            u.i = 0;
+         } else if (!Tunable_ToInt64 (value, &u.i)) {
+            return false;
+         }
+      } else if (!Tunable_ToInt64 (value, &u.i)) {
+         return false;
+      }
+      u.i = !!u.i;
+      Value_InitBool (out, u.i);
+      break;
+   case VALUE_TYPE_DOUBLE:
+      if (value->type == VALUE_TYPE_DOUBLE) {
+         u.d = value->u.flt8;
+      } else if (value->type == VALUE_TYPE_FLOAT) {
+         u.d = value->u.flt4;
+      } else if (value->type == VALUE_TYPE_STRING) {
+         if (!(str = value->u.str) || !*str) {
+            return false;
+         }
+         u.d = strtod (str, &end);
+         if (*end) {
+            return false;
+         }
+      } else if (Tunable_ToInt64 (value, &u.i)) {
+         u.d = (double)u.i;
+      } else {
+         return false;
+      }
+      Value_InitDouble (out, u.d);
+      break;
+   default:
+      ASSERT (false);
+      return false;
+   }
+
+   *bits = u.i;
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Tunable_Add --
+ *
+ *       Registers @key with @value, or with @type, returns the existing
+ *       tunable of that name after giving it @type if it had none.
+ *
+ *       @type is 0 for tunables registered through Tunable_Register(),
+ *       which keep whatever Value they are set to.
+ *
+ * Returns:
+ *       The tunable, and its info in @infop.
+ *
+ * Side effects:
+ *       May grow the table.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static Tunable
+Tunable_Add (const char *key,      /* IN */
+             const Value *value,   /* IN */
+             int type,             /* IN */
+             TunableInfo **infop)  /* OUT */
+{
+   TunableTable *table;
+   TunableTable *old;
+   TunableInfo *info;
+   Value converted;
+   Value *current;
+   Value *copy;
    Tunable tunable;
+   int64_t bits = 0;
+   int32_t i;
+   bool valid;
 
    ASSERT (key);
 
-   ThreadOnce_Once (&once, Tunable_Init);
+   ThreadOnce_Once (&gTunableOnce, Tunable_Init);
+
+   Mutex_Lock (&gTunableMutex);
+
+   old = gTunableTable;
+
+   if (type && (TUNABLE_INVALID != (tunable = Tunable_Lookup (old, key)))) {
+      info = old->infos [tunable];
+      *infop = info;
+      if (info->type) {
+         ASSERT (info->type == type);
+         Mutex_Unlock (&gTunableMutex);
+         return tunable;
+      }
+      if (!(valid = Tunable_Convert (info->value, type, &converted, &bits))) {
+         Tunable_Convert (value, type, &converted, &bits);
+      }
+      current = info->value;
+      copy = Memory_SafeMalloc0 (sizeof *copy);
+      *copy = converted;
+      Rcu_AssignPointer (info->value, copy);
+      AtomicInt64_SetRelease (&info->bits, bits);
+      info->type = type;
+      Mutex_Unlock (&gTunableMutex);
+      /*
+       * Logging may register the log tunables, so never with the lock
+       * held.
+       */
+      if (!valid) {
+         LOG_WARNING ("Invalid value for tunable \"%s\", resetting.", key);
+      }
+      Rcu_Defer (Tunable_FreeValue, current);
+      AtomicInt_Increment (&gTunableSerial);
+      return tunable;
+   }
 
-   info.name = CString_Dup (key);
+   info = Memory_SafeMalloc0 (sizeof *info);
+   info->name = CString_Dup (key);
+   info->value = Memory_SafeMalloc0 (sizeof *info->value);
+   info->type = type;
+   *infop = info;
 
-   if (current_value) {
-      Value_Copy (current_value, &info.value);
+   if (type) {
+      Tunable_Convert (value, type, info->value, &bits);
+      info->bits = bits;
+   } else if (value) {
+      Value_Copy (value, info->value);
+   }
+
+   tunable = old ? old->len : 0;
+
+   if (old && (tunable < old->allocated)) {
+      old->infos [tunable] = info;
+      AtomicInt_SetRelease (&old->len, tunable + 1);
+      Tunable_IndexInsert (old, tunable);
+      old = NULL;
+   } else {
+      table = Tunable_NewTable (old ? old->allocated * 2 : 16);
+      if (old) {
+         memcpy (table->infos, old->infos, tunable * sizeof old->infos [0]);
+      }
+      table->infos [tunable] = info;
+      table->len = tunable + 1;
+      for (i = 0; i <= tunable; i++) {
+         Tunable_IndexInsert (table, i);
+      }
+      Rcu_AssignPointer (gTunableTable, table);
    }
 
-   Mutex_Lock (&gTunableMutex);
-   tunable = gTunableInfo.len;
-   Array_Append (&gTunableInfo, info);
    Mutex_Unlock (&gTunableMutex);
 
+   if (old) {
+      Rcu_Defer (Memory_Free, old);
+   }
+
+   AtomicInt_Increment (&gTunableSerial);
+
    return tunable;
 }
 
 
+Tunable
+Tunable_Register (const char *key,            /* IN */
+                  const Value *current_value) /* IN */
+{
+   TunableInfo *info;
+
+   return Tunable_Add (key, current_value, 0, &info);
+}
+
+
+void
+Tunable_RegisterInt (TunableInt *handle,    /* OUT */
+                     const char *key,       /* IN */
+                     int64_t default_value) /* IN */
+{
+   TunableInfo *info;
+   Value value;
+
+   ASSERT (handle);
+
+   Value_InitInt64 (&value, default_value);
+   handle->tunable = Tunable_Add (key, &value, VALUE_TYPE_INT64, &info);
+   handle->bits = &info->bits;
+}
+
+
+void
+Tunable_RegisterBool (TunableBool *handle, /* OUT */
+                      const char *key,     /* IN */
+                      bool default_value)  /* IN */
+{
+   TunableInfo *info;
+   Value value;
+
+   ASSERT (handle);
+
+   Value_InitBool (&value, default_value);
+   handle->tunable = Tunable_Add (key, &value, VALUE_TYPE_BOOL, &info);
+   handle->bits = &info->bits;
+}
+
+
+void
+Tunable_RegisterDouble (TunableDouble *handle, /* OUT */
+                        const char *key,       /* IN */
+                        double default_value)  /* IN */
+{
+   TunableInfo *info;
+   Value value;
+
+   ASSERT (handle);
+
+   Value_InitDouble (&value, default_value);
+   handle->tunable = Tunable_Add (key, &value, VALUE_TYPE_DOUBLE, &info);
+   handle->bits = &info->bits;
+}
+
+
+/*
+ * Must be called inside a read section.
+ */
+static TunableInfo *
+Tunable_GetInfo (Tunable tunable) /* IN */
+{
+   TunableTable *table = Rcu_Dereference (gTunableTable);
+
+   if (table && (tunable < AtomicInt_GetAcquire (&table->len))) {
+      return table->infos [tunable];
+   }
+
+   return NULL;
+}
+
+
 void
 Tunable_Get (Tunable tunable, /* IN */
              Value *value)    /* OUT */
@@ -81,50 +535,279 @@ Tunable_Get (Tunable tunable, /* IN */
    ASSERT (tunable != TUNABLE_INVALID);
    ASSERT (value);
 
-   if (tunable < gTunableInfo.len) {
-      info = &Array_Index (&gTunableInfo, TunableInfo, tunable);
-      Value_Copy (&info->value, value);
+   Rcu_ReadLock ();
+
+   if ((info = Tunable_GetInfo (tunable))) {
+      Value_Copy (Rcu_Dereference (info->value), value);
+      Rcu_ReadUnlock ();
       return;
    }
 
+   Rcu_ReadUnlock ();
+
    LOG_WARNING ("No such tunable %d", tunable);
    Memory_Zero (value, sizeof *value);
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Tunable_Parse --
+ *
+ *       Parses @str as a Value of @type, for untyped tunables set from a
+ *       string that already hold a scalar.
+ *
+ * Returns:
+ *       true if @str is a valid @type, otherwise false.
+ *
+ * Side effects:
+ *       @out is initialized if true is returned.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+Tunable_Parse (const char *str, /* IN */
+               int type,        /* IN */
+               Value *out)      /* OUT */
+{
+   Value value;
+   int64_t bits;
+   int64_t i;
+
+   value.type = VALUE_TYPE_STRING;
+   value.u.str = (char *)str;
+
+   switch (type) {
+   case VALUE_TYPE_BOOL:
+   case VALUE_TYPE_DOUBLE:
+      return Tunable_Convert (&value, type, out, &bits);
+   case VALUE_TYPE_FLOAT:
+      if (!Tunable_Convert (&value, VALUE_TYPE_DOUBLE, out, &bits)) {
+         return false;
+      }
+      Value_InitFloat (out, (float)out->u.flt8);
+      return true;
+   case VALUE_TYPE_STRING:
+      return false;
+   default:
+      break;
+   }
+
+   if (!Tunable_ToInt64 (&value, &i)) {
+      return false;
+   }
+
+   Memory_Zero (out, sizeof *out);
+   out->type = type;
+
+   switch (type) {
+   case VALUE_TYPE_INT16:
+      out->u.i16 = (int16_t)i;
+      return (i == out->u.i16);
+   case VALUE_TYPE_UINT16:
+      out->u.u16 = (uint16_t)i;
+      return (i == out->u.u16);
+   case VALUE_TYPE_INT32:
+      out->u.i32 = (int32_t)i;
+      return (i == out->u.i32);
+   case VALUE_TYPE_UINT32:
+      out->u.u32 = (uint32_t)i;
+      return (i == out->u.u32);
+   case VALUE_TYPE_INT64:
+      out->u.i64 = i;
+      return true;
+   case VALUE_TYPE_UINT64:
+      out->u.u64 = (uint64_t)i;
+      return true;
+   case VALUE_TYPE_SIZE:
+   case VALUE_TYPE_SSIZE:
+      out->u.sz = (size_t)i;
+      return true;
+   default:
+      return false;
+   }
+}
+
+
+static bool
+Tunable_Store (Tunable tunable,    /* IN */
+               const Value *value) /* IN */
+{
+   TunableInfo *info;
+   Value *copy;
+   Value *old;
+   int64_t bits = 0;
+
+   ASSERT (tunable != TUNABLE_INVALID);
+   ASSERT (value);
+
+   Rcu_ReadLock ();
+   info = Tunable_GetInfo (tunable);
+   Rcu_ReadUnlock ();
+
+   if (!info) {
+      LOG_WARNING ("No such tunable %d", tunable);
+      return false;
+   }
+
+   copy = Memory_SafeMalloc0 (sizeof *copy);
+
+   Mutex_Lock (&gTunableMutex);
+
+   if (!info->type) {
+      Value_Copy (value, copy);
+   } else if (!Tunable_Convert (value, info->type, copy, &bits)) {
+      Mutex_Unlock (&gTunableMutex);
+      LOG_WARNING ("Invalid value for tunable \"%s\"", info->name);
+      Memory_Free (copy);
+      return false;
+   }
+
+   old = info->value;
+   Rcu_AssignPointer (info->value, copy);
+   AtomicInt64_SetRelease (&info->bits, bits);
+
+   Mutex_Unlock (&gTunableMutex);
+
+   Rcu_Defer (Tunable_FreeValue, old);
+   AtomicInt_Increment (&gTunableSerial);
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Tunable_Set --
+ *
+ *       Sets @tunable to @value, converted to the tunable's type if it
+ *       was registered with one.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Logs and ignores values that cannot be converted.
+ *
+ *--------------------------------------------------------------------------
+ */
+
 void
 Tunable_Set (Tunable tunable,    /* IN */
              const Value *value) /* IN */
+{
+   Tunable_Store (tunable, value);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Tunable_SetString --
+ *
+ *       Sets @tunable from its textual form, such as a value typed by an
+ *       operator.
+ *
+ *       Typed tunables parse @str as their type. Untyped tunables holding
+ *       a scalar keep its type when @str parses as one, and otherwise
+ *       store @str itself, so "log.level" may be set to "warning".
+ *
+ * Returns:
+ *       false if @tunable does not exist or @str is not a valid value
+ *       for its type.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+Tunable_SetString (Tunable tunable, /* IN */
+                   const char *str) /* IN */
 {
    TunableInfo *info;
+   Value value;
+   int type = 0;
+   bool ret;
 
    ASSERT (tunable != TUNABLE_INVALID);
+   ASSERT (str);
 
-   if (tunable < gTunableInfo.len) {
-      info = &Array_Index (&gTunableInfo, TunableInfo, tunable);
-      Value_Destroy (&info->value);
-      Value_Copy (value, &info->value);
-      return;
+   Rcu_ReadLock ();
+   if ((info = Tunable_GetInfo (tunable)) && !info->type) {
+      type = Rcu_Dereference (info->value)->type;
    }
+   Rcu_ReadUnlock ();
 
-   LOG_WARNING ("No such tunable %d", tunable);
+   if (!type || !Tunable_Parse (str, type, &value)) {
+      Value_InitString (&value, str);
+   }
+
+   ret = Tunable_Store (tunable, &value);
+   Value_Destroy (&value);
+
+   return ret;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * Tunable_Foreach --
+ *
+ *       Calls @func for every registered tunable, in registration order.
+ *
+ *       @func runs inside an RCU read section, so it must not block or
+ *       change tunables. @name and @value are only valid during the call.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+Tunable_Foreach (TunableForeachFunc func, /* IN */
+                 void *user_data)         /* IN */
+{
+   TunableTable *table;
+   TunableInfo *info;
+   int32_t len;
+   int32_t i;
+
+   ASSERT (func);
+
+   Rcu_ReadLock ();
+
+   if ((table = Rcu_Dereference (gTunableTable))) {
+      len = AtomicInt_GetAcquire (&table->len);
+      for (i = 0; i < len; i++) {
+         info = table->infos [i];
+         func (i, info->name, Rcu_Dereference (info->value), user_data);
+      }
+   }
+
+   Rcu_ReadUnlock ();
 }
 
 
 Tunable
 Tunable_Find (const char *key) /* IN */
 {
-   const TunableInfo *info;
-   int i;
+   Tunable tunable;
 
    ASSERT (key);
 
-   for (i = 0; i < gTunableInfo.len; i++) {
-      info = &Array_Index (&gTunableInfo, TunableInfo, i);
-      if (0 == strcasecmp (key, info->name)) {
-         return (Tunable)i;
-      }
-   }
+   Rcu_ReadLock ();
+   tunable = Tunable_Lookup (Rcu_Dereference (gTunableTable), key);
+   Rcu_ReadUnlock ();
 
-   return TUNABLE_INVALID;
+   return tunable;
 }
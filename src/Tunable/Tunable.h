@@ -21,7 +21,9 @@
 #define TUNABLE_H
 
 
+#include <Atomic.h>
 #include <Macros.h>
+#include <Types.h>
 #include <Value.h>
 
 
@@ -34,13 +36,128 @@ typedef int Tunable;
 #define TUNABLE_INVALID (-1)
 
 
-Tunable Tunable_Register (const char *key,
-                          const Value *curval);
-Tunable Tunable_Find     (const char *key);
-void    Tunable_Set      (Tunable tunable,
-                          const Value *value);
-void    Tunable_Get      (Tunable tunable,
-                          Value *value);
+typedef void (*TunableForeachFunc) (Tunable tunable,
+                                    const char *name,
+                                    const Value *value,
+                                    void *user_data);
+
+
+/*
+ * gTunableSerial is incremented every time a tunable is registered or
+ * changed. Hot paths can cache values derived from tunables and only
+ * recompute them when the serial changes.
+ */
+extern volatile int32_t gTunableSerial;
+
+
+/*
+ * Typed handles for scalar tunables. Reading one is a single load of the
+ * current value, so hot paths can consult tunables on every request
+ * instead of caching them.
+ *
+ * Values set through Tunable_Set() are converted to the handle's type
+ * (strings are parsed), so a tunable set by name from an admin command
+ * reads back correctly through its handle.
+ *
+ * Tunables are usually declared at file scope, which registers them
+ * before main():
+ *
+ *   TUNABLE_INT (gReadSize, "net.reader.bufsize", 512)
+ *
+ *   size = TunableInt_Get (gReadSize);
+ */
+
+
+typedef struct
+{
+   Tunable                 tunable;
+   const volatile int64_t *bits;
+} TunableInt;
+
+
+typedef struct
+{
+   Tunable                 tunable;
+   const volatile int64_t *bits;
+} TunableBool;
+
+
+typedef struct
+{
+   Tunable                 tunable;
+   const volatile int64_t *bits;
+} TunableDouble;
+
+
+#define TUNABLE_DEFINE(Kind, Type, Identifier, Name, Default) \
+   static Kind Identifier; \
+   \
+   static void \
+   Identifier##_Register (void) __attribute__((constructor)); \
+   \
+   static void \
+   Identifier##_Register (void) \
+   { \
+      Tunable_Register##Type (&Identifier, Name, Default); \
+   }
+
+
+#define TUNABLE_INT(Identifier, Name, Default) \
+   TUNABLE_DEFINE (TunableInt, Int, Identifier, Name, Default)
+#define TUNABLE_BOOL(Identifier, Name, Default) \
+   TUNABLE_DEFINE (TunableBool, Bool, Identifier, Name, Default)
+#define TUNABLE_DOUBLE(Identifier, Name, Default) \
+   TUNABLE_DEFINE (TunableDouble, Double, Identifier, Name, Default)
+
+
+Tunable       Tunable_Register       (const char *key,
+                                      const Value *curval);
+void          Tunable_RegisterInt    (TunableInt *handle,
+                                      const char *key,
+                                      int64_t default_value);
+void          Tunable_RegisterBool   (TunableBool *handle,
+                                      const char *key,
+                                      bool default_value);
+void          Tunable_RegisterDouble (TunableDouble *handle,
+                                      const char *key,
+                                      double default_value);
+Tunable       Tunable_Find           (const char *key);
+void          Tunable_Set            (Tunable tunable,
+                                      const Value *value);
+bool          Tunable_SetString      (Tunable tunable,
+                                      const char *str);
+void          Tunable_Get            (Tunable tunable,
+                                      Value *value);
+void          Tunable_Foreach        (TunableForeachFunc func,
+                                      void *user_data);
+
+
+static __inline__ int64_t
+TunableInt_Get (TunableInt handle) /* IN */
+{
+   return AtomicInt64_GetAcquire (handle.bits);
+}
+
+
+static __inline__ bool
+TunableBool_Get (TunableBool handle) /* IN */
+{
+   return !!AtomicInt64_GetAcquire (handle.bits);
+}
+
+
+static __inline__ double
+TunableDouble_Get (TunableDouble handle) /* IN */
+{
+   union {
+      int64_t i;
+      double  d;
+   } u;
+
+   u.i = AtomicInt64_GetAcquire (handle.bits);
+
+   return u.d;
+}
 
 
 END_DECLS
@@ -44,6 +44,8 @@
 #include "lthread_int.h"
 #include "lthread_poller.h"
 
+#include <Trace.h>
+
 static void _exec(void *lt);
 static void _lthread_init(struct lthread *lt);
 static void _lthread_key_create(void);
@@ -132,6 +134,7 @@ _lthread_yield(struct lthread *lt)
 void
 _lthread_free(struct lthread *lt)
 {
+    lt->sched->live_lthreads--;
     free(lt->stack);
     free(lt);
 }
@@ -161,7 +164,9 @@ _lthread_resume(struct lthread *lt)
         _lthread_init(lt);
 
     sched->current_lthread = lt;
+    TRACE_EVENT(TRACE_RESUME, TRACE_PHASE_BEGIN, sched, (uint64_t)(size_t)lt);
     _switch(&lt->ctx, &lt->sched->ctx);
+    TRACE_EVENT(TRACE_RESUME, TRACE_PHASE_END, sched, (uint64_t)(size_t)lt);
     sched->current_lthread = NULL;
     _lthread_madvise(lt);
 
@@ -207,6 +212,8 @@ _lthread_madvise(struct lthread *lt)
     }
 
     lt->last_stack_size = current_stack;
+    if (current_stack > lt->sched->stack_highwater)
+        lt->sched->stack_highwater = current_stack;
 }
 
 static void
@@ -309,6 +316,7 @@ int
 lthread_create(struct lthread **new_lt, void *fun, void *arg)
 {
     struct lthread *lt = NULL;
+    int err;
     assert(pthread_once(&key_once, _lthread_key_create) == 0);
     struct lthread_sched *sched = lthread_get_sched();
 
@@ -326,16 +334,25 @@ lthread_create(struct lthread **new_lt, void *fun, void *arg)
         return (errno);
     }
 
-    if (posix_memalign(&lt->stack, getpagesize(), sched->stack_size)) {
+    /*
+     * Not Memory_AllocLarge(): stacks are too small to gain from huge
+     * pages, and a mapping per lthread costs an mmap()/munmap() pair on
+     * every create and exit. posix_memalign() returns its error rather
+     * than setting errno.
+     */
+    if ((err = posix_memalign(&lt->stack, getpagesize(),
+        sched->stack_size)) != 0) {
         free(lt);
+        errno = err;
         perror("Failed to allocate stack for new lthread");
-        return (errno);
+        return (err);
     }
 
     lt->sched = sched;
     lt->stack_size = sched->stack_size;
     lt->state = BIT(LT_ST_NEW);
     lt->id = sched->spawned_lthreads++;
+    sched->live_lthreads++;
     lt->fun = fun;
     lt->fd_wait = -1;
     lt->arg = arg;
@@ -361,7 +378,42 @@ lthread_get_data(void)
 struct lthread*
 lthread_current(void)
 {
-    return (lthread_get_sched()->current_lthread);
+    struct lthread_sched *sched = NULL;
+
+    /* callable from any thread; NULL outside of a scheduler */
+    assert(pthread_once(&key_once, _lthread_key_create) == 0);
+    sched = lthread_get_sched();
+
+    return (sched ? sched->current_lthread : NULL);
+}
+
+int
+lthread_stack_stats(int *live, size_t *highwater, size_t *stack_size)
+{
+    struct lthread_sched *sched = NULL;
+
+    assert(pthread_once(&key_once, _lthread_key_create) == 0);
+    if ((sched = lthread_get_sched()) == NULL)
+        return (-1);
+
+    *live = sched->live_lthreads;
+    *highwater = sched->stack_highwater;
+    *stack_size = sched->stack_size;
+
+    return (0);
+}
+
+/*
+ * Releases the current lthread's stack pages below the point where it next
+ * yields, even if it yields no shallower than last time. Pages touched by
+ * calls made between yields are otherwise kept until a shallower yield.
+ */
+void
+lthread_release_stack(void)
+{
+    struct lthread *lt = lthread_get_sched()->current_lthread;
+
+    lt->last_stack_size = lt->stack_size;
 }
 
 void
@@ -66,11 +66,14 @@ int     lthread_init(size_t size);
 void    *lthread_get_data(void);
 void    lthread_set_data(void *data);
 lthread_t *lthread_current();
+int     lthread_stack_stats(int *live, size_t *highwater, size_t *stack_size);
+void    lthread_release_stack(void);
 
 /* socket related functions */
 int     lthread_socket(int, int, int);
 int     lthread_pipe(int fildes[2]);
 int     lthread_accept(int fd, struct sockaddr *, socklen_t *);
+int     lthread_wait_read(int fd, uint64_t timeout);
 int     lthread_close(int fd);
 void    lthread_set_funcname(const char *f);
 uint64_t lthread_id();
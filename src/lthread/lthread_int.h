@@ -151,6 +151,8 @@ struct lthread_sched {
     void                *stack;
     size_t              stack_size;
     int                 spawned_lthreads;
+    int                 live_lthreads;
+    size_t              stack_highwater; /* largest stack seen at a yield */
     uint64_t            default_timeout;
     struct lthread      *current_lthread;
     int                 page_size;
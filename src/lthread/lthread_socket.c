@@ -180,6 +180,29 @@ lthread_accept(int fd, struct sockaddr *addr, socklen_t *len)
     return (ret);
 }
 
+/*
+ * Waits until fd is readable, such as a listening socket with connections
+ * queued, so callers can drain it with their own non-blocking calls.
+ * Returns 0 when readable, -2 on timeout and -1 if fd was closed.
+ */
+int
+lthread_wait_read(int fd, uint64_t timeout)
+{
+    struct lthread *lt = lthread_get_sched()->current_lthread;
+
+    if (lt->state & BIT(LT_ST_FDEOF))
+        return (-1);
+
+    _lthread_sched_event(lt, fd, LT_EV_READ, timeout);
+
+    if (lt->state & BIT(LT_ST_FDEOF))
+        return (-1);
+    if (lt->state & BIT(LT_ST_EXPIRED))
+        return (-2);
+
+    return (0);
+}
+
 int
 lthread_close(int fd)
 {
@@ -0,0 +1,222 @@
+/* ContainerBenchmarks.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <Containers/Array.h>
+#include <Containers/HashMap.h>
+#include <Containers/HashTable.h>
+#include <Containers/Sort.h>
+#include <Core/Debug.h>
+#include <Core/Hash.h>
+#include <Memory/Memory.h>
+
+#include "ContainerBenchmarks.h"
+
+
+/*
+ * Each pair of benchmarks does the same work with the generic container,
+ * which goes through function pointers and a runtime element size, and
+ * with its *_DEFINE counterpart specialized for the element type.
+ */
+#define N_ELEMS       (1 << 20)
+#define APPEND_ROUNDS 16
+#define LOOKUP_ROUNDS 8
+
+
+#define UInt64_Compare(a,b) ((*(a) > *(b)) - (*(a) < *(b)))
+#define Pointer_HashKey(k)  ((uint32_t)Hash_Mix64 ((uintptr_t)(k)))
+#define Pointer_EqualKey(a,b) ((a) == (b))
+
+
+ARRAY_DEFINE (UInt64Array, uint64_t)
+SORT_DEFINE (UInt64, uint64_t, UInt64_Compare)
+HASHMAP_DEFINE (PointerMap, void *, void *, Pointer_HashKey, Pointer_EqualKey)
+
+
+static uint64_t *gValues;
+
+
+static void
+ContainerBenchmarks_InitValues (void)
+{
+   uint64_t seed = 0x9E3779B97F4A7C15ULL;
+   uint32_t i;
+
+   if (gValues) {
+      return;
+   }
+
+   gValues = Memory_SafeMallocN (sizeof *gValues, N_ELEMS);
+
+   for (i = 0; i < N_ELEMS; i++) {
+      seed ^= seed << 13;
+      seed ^= seed >> 7;
+      seed ^= seed << 17;
+      gValues [i] = seed;
+   }
+}
+
+
+static int
+UInt64_CompareFunc (const void *a, /* IN */
+                    const void *b) /* IN */
+{
+   return UInt64_Compare ((const uint64_t *)a, (const uint64_t *)b);
+}
+
+
+static void
+Bench_Containers_Array_Append_Generic (void)
+{
+   uint32_t i;
+   uint32_t j;
+   Array ar;
+
+   for (i = 0; i < APPEND_ROUNDS; i++) {
+      Array_Init (&ar, sizeof (uint64_t), false);
+      for (j = 0; j < N_ELEMS; j++) {
+         Array_Append (&ar, j);
+      }
+      ASSERT (ar.len == N_ELEMS);
+      Array_Destroy (&ar);
+   }
+}
+
+
+static void
+Bench_Containers_Array_Append_Typed (void)
+{
+   UInt64Array ar;
+   uint32_t i;
+   uint32_t j;
+
+   for (i = 0; i < APPEND_ROUNDS; i++) {
+      UInt64Array_Init (&ar);
+      for (j = 0; j < N_ELEMS; j++) {
+         UInt64Array_Append (&ar, j);
+      }
+      ASSERT (UInt64Array_Size (&ar) == N_ELEMS);
+      UInt64Array_Destroy (&ar);
+   }
+}
+
+
+static void
+Bench_Containers_Sort_Generic (void)
+{
+   uint64_t *values;
+
+   ContainerBenchmarks_InitValues ();
+
+   values = Memory_SafeMallocN (sizeof *values, N_ELEMS);
+   memcpy (values, gValues, N_ELEMS * sizeof *values);
+
+   qsort (values, N_ELEMS, sizeof *values, UInt64_CompareFunc);
+   ASSERT (values [0] <= values [N_ELEMS - 1]);
+
+   Memory_Free (values);
+}
+
+
+static void
+Bench_Containers_Sort_Typed (void)
+{
+   uint64_t *values;
+
+   ContainerBenchmarks_InitValues ();
+
+   values = Memory_SafeMallocN (sizeof *values, N_ELEMS);
+   memcpy (values, gValues, N_ELEMS * sizeof *values);
+
+   UInt64_Sort (values, N_ELEMS);
+   ASSERT (values [0] <= values [N_ELEMS - 1]);
+
+   Memory_Free (values);
+}
+
+
+static void
+Bench_Containers_HashMap_Generic (void)
+{
+   HashTable *hash_table;
+   uint32_t i;
+   uint32_t j;
+
+   ContainerBenchmarks_InitValues ();
+
+   hash_table = HashTable_Create (1024, Pointer_Hash, Pointer_Equal,
+                                  NULL, NULL);
+
+   for (i = 0; i < N_ELEMS; i++) {
+      HashTable_Insert (hash_table, &gValues [i], &gValues [i]);
+   }
+
+   for (i = 0; i < LOOKUP_ROUNDS; i++) {
+      for (j = 0; j < N_ELEMS; j++) {
+         ASSERT (HashTable_Lookup (hash_table, &gValues [j]));
+      }
+   }
+
+   HashTable_Free (hash_table);
+}
+
+
+static void
+Bench_Containers_HashMap_Typed (void)
+{
+   PointerMap map;
+   uint32_t i;
+   uint32_t j;
+
+   ContainerBenchmarks_InitValues ();
+
+   PointerMap_Init (&map, 1024);
+
+   for (i = 0; i < N_ELEMS; i++) {
+      PointerMap_Insert (&map, &gValues [i], &gValues [i]);
+   }
+
+   for (i = 0; i < LOOKUP_ROUNDS; i++) {
+      for (j = 0; j < N_ELEMS; j++) {
+         ASSERT (PointerMap_Lookup (&map, &gValues [j]));
+      }
+   }
+
+   PointerMap_Destroy (&map);
+}
+
+
+void
+ContainerBenchmarks_Install (TestSuite *suite) /* IN */
+{
+   TestSuite_Add (suite, "Containers/Array/Append/Generic",
+                  Bench_Containers_Array_Append_Generic);
+   TestSuite_Add (suite, "Containers/Array/Append/Typed",
+                  Bench_Containers_Array_Append_Typed);
+   TestSuite_Add (suite, "Containers/Sort/Generic",
+                  Bench_Containers_Sort_Generic);
+   TestSuite_Add (suite, "Containers/Sort/Typed",
+                  Bench_Containers_Sort_Typed);
+   TestSuite_Add (suite, "Containers/HashMap/Generic",
+                  Bench_Containers_HashMap_Generic);
+   TestSuite_Add (suite, "Containers/HashMap/Typed",
+                  Bench_Containers_HashMap_Typed);
+}
@@ -0,0 +1,267 @@
+/* HashBenchmarks.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <Containers/HashTable.h>
+#include <Core/Debug.h>
+#include <Core/Hash.h>
+#include <Memory/Memory.h>
+#include <String/CString.h>
+
+#include "HashBenchmarks.h"
+
+
+#define N_NAMES       4096
+#define NAME_ROUNDS   2000
+#define LONG_SIZE     4096
+#define LONG_ROUNDS   100000
+#define MIX_ROUNDS    (1 << 26)
+#define N_BUCKETS     4096
+
+
+static char *gNames [N_NAMES];
+static size_t gNameLengths [N_NAMES];
+static volatile uint64_t gSink;
+
+
+/*
+ * Collection names as they appear in queries: a handful of databases with
+ * many similar collections.
+ */
+static void
+HashBenchmarks_InitNames (void)
+{
+   char name [64];
+   int i;
+
+   if (gNames [0]) {
+      return;
+   }
+
+   for (i = 0; i < N_NAMES; i++) {
+      snprintf (name, sizeof name, "db%d.events_%05d", i % 8, i);
+      gNames [i] = CString_Dup (name);
+      gNameLengths [i] = strlen (name);
+   }
+}
+
+
+/*
+ * The string hash CString_Hash() used before Hash_Bytes(), kept for
+ * comparison.
+ */
+static uint32_t
+HashBenchmarks_DJB (const char *str, /* IN */
+                    size_t len)      /* IN */
+{
+   uint32_t hash = 5381;
+   size_t i;
+
+   for (i = 0; i < len; i++) {
+      hash = ((hash << 5) + hash) + str [i];
+   }
+
+   return hash;
+}
+
+
+static void
+Bench_Hash_Short_Bytes (void)
+{
+   uint64_t sum = 0;
+   int i;
+   int j;
+
+   HashBenchmarks_InitNames ();
+
+   for (i = 0; i < NAME_ROUNDS; i++) {
+      for (j = 0; j < N_NAMES; j++) {
+         sum += Hash_Bytes (gNames [j], gNameLengths [j], i);
+      }
+   }
+
+   gSink = sum;
+}
+
+
+static void
+Bench_Hash_Short_DJB (void)
+{
+   uint64_t sum = 0;
+   int i;
+   int j;
+
+   HashBenchmarks_InitNames ();
+
+   for (i = 0; i < NAME_ROUNDS; i++) {
+      for (j = 0; j < N_NAMES; j++) {
+         sum += HashBenchmarks_DJB (gNames [j], gNameLengths [j]) + i;
+      }
+   }
+
+   gSink = sum;
+}
+
+
+static void
+Bench_Hash_Long_Bytes (void)
+{
+   uint8_t *buf;
+   uint64_t sum = 0;
+   int i;
+
+   buf = Memory_SafeMalloc0 (LONG_SIZE);
+
+   for (i = 0; i < LONG_ROUNDS; i++) {
+      sum += Hash_Bytes (buf, LONG_SIZE, i);
+   }
+
+   gSink = sum;
+   Memory_Free (buf);
+}
+
+
+static void
+Bench_Hash_Long_Crc32c (void)
+{
+   uint8_t *buf;
+   uint64_t sum = 0;
+   int i;
+
+   buf = Memory_SafeMalloc0 (LONG_SIZE);
+
+   for (i = 0; i < LONG_ROUNDS; i++) {
+      sum += Hash_Crc32c (buf, LONG_SIZE, i);
+   }
+
+   gSink = sum;
+   Memory_Free (buf);
+}
+
+
+static void
+Bench_Hash_Long_DJB (void)
+{
+   uint8_t *buf;
+   uint64_t sum = 0;
+   int i;
+
+   buf = Memory_SafeMalloc0 (LONG_SIZE);
+
+   for (i = 0; i < LONG_ROUNDS; i++) {
+      buf [0] = i;
+      sum += HashBenchmarks_DJB ((const char *)buf, LONG_SIZE);
+   }
+
+   gSink = sum;
+   Memory_Free (buf);
+}
+
+
+static void
+Bench_Hash_Mix64 (void)
+{
+   uint64_t sum = 0;
+   uint64_t i;
+
+   for (i = 0; i < MIX_ROUNDS; i++) {
+      sum += Hash_Mix64 (i);
+   }
+
+   gSink = sum;
+}
+
+
+/*
+ * Quality: hash keys into N_BUCKETS buckets using the low bits, as
+ * HashTable does, and return the chi-squared statistic against a uniform
+ * distribution. For a good hash this is close to N_BUCKETS - 1; values
+ * several times larger mean clustering.
+ */
+static double
+HashBenchmarks_ChiSquared (const uint32_t *counts, /* IN */
+                           uint32_t n_keys)        /* IN */
+{
+   double expected = (double)n_keys / N_BUCKETS;
+   double chi = 0.0;
+   double d;
+   int i;
+
+   for (i = 0; i < N_BUCKETS; i++) {
+      d = counts [i] - expected;
+      chi += (d * d) / expected;
+   }
+
+   return chi;
+}
+
+
+static void
+Bench_Hash_Quality_Names (void)
+{
+   uint32_t bytes [N_BUCKETS] = { 0 };
+   uint32_t djb [N_BUCKETS] = { 0 };
+   uint32_t n = N_BUCKETS * 16;
+   char name [64];
+   size_t len;
+   uint32_t i;
+
+   for (i = 0; i < n; i++) {
+      len = snprintf (name, sizeof name, "db%u.events_%05u", i % 8, i);
+      bytes [Hash_Bytes (name, len, Hash_GetSeed ()) % N_BUCKETS]++;
+      djb [HashBenchmarks_DJB (name, len) % N_BUCKETS]++;
+   }
+
+   ASSERT (HashBenchmarks_ChiSquared (bytes, n) < (2 * N_BUCKETS));
+   gSink = HashBenchmarks_ChiSquared (djb, n);
+}
+
+
+static void
+Bench_Hash_Quality_Pointers (void)
+{
+   uint32_t mixed [N_BUCKETS] = { 0 };
+   uint32_t n = N_BUCKETS * 16;
+   uintptr_t addr;
+   uint32_t i;
+
+   for (i = 0; i < n; i++) {
+      addr = 0x7F0000000000ULL + ((uintptr_t)i * 48);
+      mixed [Pointer_Hash ((void *)addr) % N_BUCKETS]++;
+   }
+
+   ASSERT (HashBenchmarks_ChiSquared (mixed, n) < (2 * N_BUCKETS));
+}
+
+
+void
+HashBenchmarks_Install (TestSuite *suite) /* IN */
+{
+   TestSuite_Add (suite, "Hash/Short/Bytes", Bench_Hash_Short_Bytes);
+   TestSuite_Add (suite, "Hash/Short/DJB", Bench_Hash_Short_DJB);
+   TestSuite_Add (suite, "Hash/Long/Bytes", Bench_Hash_Long_Bytes);
+   TestSuite_Add (suite, "Hash/Long/Crc32c", Bench_Hash_Long_Crc32c);
+   TestSuite_Add (suite, "Hash/Long/DJB", Bench_Hash_Long_DJB);
+   TestSuite_Add (suite, "Hash/Mix64", Bench_Hash_Mix64);
+   TestSuite_Add (suite, "Hash/Quality/Names", Bench_Hash_Quality_Names);
+   TestSuite_Add (suite, "Hash/Quality/Pointers", Bench_Hash_Quality_Pointers);
+}
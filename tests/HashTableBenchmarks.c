@@ -0,0 +1,166 @@
+/* HashTableBenchmarks.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <Containers/HashTable.h>
+#include <Core/Debug.h>
+#include <Memory/Memory.h>
+
+#include "HashTableBenchmarks.h"
+
+
+/*
+ * Keys look like the Connection pointers congo-proxy stores in gProxies:
+ * distinct, aligned heap addresses.
+ */
+#define N_KEYS        (1 << 20)
+#define LOOKUP_ROUNDS 8
+#define CHURN_LIVE    4096
+#define CHURN_OPS     (1 << 22)
+
+
+static void **gKeys;
+
+
+static void
+HashTableBenchmarks_InitKeys (void)
+{
+   uint32_t seed = 0x2545F491;
+   uintptr_t base = 0x7F0000000000ULL;
+   uint32_t i;
+
+   if (gKeys) {
+      return;
+   }
+
+   gKeys = Memory_SafeMallocN (sizeof *gKeys, N_KEYS);
+
+   for (i = 0; i < N_KEYS; i++) {
+      seed = (seed * 1103515245) + 12345;
+      gKeys [i] = (void *)(base + ((uintptr_t)i * 256) + ((seed >> 16) & 0xC0));
+   }
+}
+
+
+static HashTable *
+HashTableBenchmarks_Fill (uint32_t size) /* IN */
+{
+   HashTable *hash_table;
+   uint32_t i;
+
+   HashTableBenchmarks_InitKeys ();
+
+   hash_table = HashTable_Create (size, Pointer_Hash, Pointer_Equal,
+                                  NULL, NULL);
+
+   for (i = 0; i < N_KEYS; i++) {
+      HashTable_Insert (hash_table, gKeys [i], gKeys [i]);
+   }
+
+   return hash_table;
+}
+
+
+static void
+Bench_HashTable_Insert_Grow (void)
+{
+   HashTable_Free (HashTableBenchmarks_Fill (1));
+}
+
+
+static void
+Bench_HashTable_Insert_Sized (void)
+{
+   HashTable_Free (HashTableBenchmarks_Fill (N_KEYS));
+}
+
+
+static void
+Bench_HashTable_Lookup_Hit (void)
+{
+   HashTable *hash_table;
+   uint32_t i;
+   uint32_t j;
+
+   hash_table = HashTableBenchmarks_Fill (1024);
+
+   for (i = 0; i < LOOKUP_ROUNDS; i++) {
+      for (j = 0; j < N_KEYS; j++) {
+         ASSERT (HashTable_Lookup (hash_table, gKeys [j]));
+      }
+   }
+
+   HashTable_Free (hash_table);
+}
+
+
+static void
+Bench_HashTable_Lookup_Miss (void)
+{
+   HashTable *hash_table;
+   uint32_t i;
+   uint32_t j;
+
+   hash_table = HashTableBenchmarks_Fill (1024);
+
+   for (i = 0; i < LOOKUP_ROUNDS; i++) {
+      for (j = 0; j < N_KEYS; j++) {
+         ASSERT (!HashTable_Lookup (hash_table, (uint8_t *)gKeys [j] + 8));
+      }
+   }
+
+   HashTable_Free (hash_table);
+}
+
+
+/*
+ * A fixed number of live keys with constant turnover, as connections come
+ * and go. Exercises tombstone reuse.
+ */
+static void
+Bench_HashTable_Churn (void)
+{
+   HashTable *hash_table;
+   uint32_t i;
+
+   HashTableBenchmarks_InitKeys ();
+
+   hash_table = HashTable_Create (CHURN_LIVE, Pointer_Hash, Pointer_Equal,
+                                  NULL, NULL);
+
+   for (i = 0; i < CHURN_OPS; i++) {
+      HashTable_Insert (hash_table, gKeys [i % N_KEYS], gKeys [i % N_KEYS]);
+      if (i >= CHURN_LIVE) {
+         HashTable_Remove (hash_table, gKeys [(i - CHURN_LIVE) % N_KEYS]);
+      }
+      ASSERT (HashTable_Lookup (hash_table, gKeys [i % N_KEYS]));
+   }
+
+   HashTable_Free (hash_table);
+}
+
+
+void
+HashTableBenchmarks_Install (TestSuite *suite) /* IN */
+{
+   TestSuite_Add (suite, "HashTable/Insert/Grow", Bench_HashTable_Insert_Grow);
+   TestSuite_Add (suite, "HashTable/Insert/Sized", Bench_HashTable_Insert_Sized);
+   TestSuite_Add (suite, "HashTable/Lookup/Hit", Bench_HashTable_Lookup_Hit);
+   TestSuite_Add (suite, "HashTable/Lookup/Miss", Bench_HashTable_Lookup_Miss);
+   TestSuite_Add (suite, "HashTable/Churn", Bench_HashTable_Churn);
+}
@@ -0,0 +1,192 @@
+/* HeapBenchmarks.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <Containers/Heap.h>
+#include <Core/Debug.h>
+#include <Memory/Memory.h>
+
+#include "HeapBenchmarks.h"
+
+
+/*
+ * Timers as the scheduler would keep them: a 64-bit deadline and the
+ * task to wake, 16 bytes, so four siblings of the 4-ary heap share a
+ * cache line.
+ */
+#define N_TIMERS   (1 << 20)
+#define CHURN_OPS  (1 << 22)
+
+
+typedef struct
+{
+   uint64_t  deadline;
+   void     *task;
+} Timer;
+
+
+static __inline__ int
+Timer_Compare (const Timer *a, /* IN */
+               const Timer *b) /* IN */
+{
+   return (a->deadline < b->deadline) - (a->deadline > b->deadline);
+}
+
+
+DARY_HEAP_DEFINE (BinaryTimerHeap, Timer, Timer_Compare, 2)
+DARY_HEAP_DEFINE (QuaternaryTimerHeap, Timer, Timer_Compare, 4)
+PAIRING_HEAP_DEFINE (PairingTimerHeap, Timer, Timer_Compare)
+
+
+static __inline__ uint64_t
+HeapBenchmarks_Next (uint64_t *seed) /* IN/OUT */
+{
+   *seed ^= *seed << 13;
+   *seed ^= *seed >> 7;
+   *seed ^= *seed << 17;
+
+   return *seed;
+}
+
+
+/*
+ * Fill the heap with random deadlines and expire them all.
+ */
+#define HEAP_BENCH_SORT(Name) \
+   do { \
+      uint64_t seed = 0x9E3779B97F4A7C15ULL; \
+      uint64_t last = 0; \
+      Name heap; \
+      Timer t; \
+      uint32_t i; \
+\
+      Name##_Init (&heap); \
+      t.task = NULL; \
+      for (i = 0; i < N_TIMERS; i++) { \
+         t.deadline = HeapBenchmarks_Next (&seed); \
+         Name##_Insert (&heap, &t); \
+      } \
+      while (Name##_Extract (&heap, &t)) { \
+         ASSERT (t.deadline >= last); \
+         last = t.deadline; \
+      } \
+      Name##_Destroy (&heap); \
+   } while (0)
+
+
+/*
+ * A steady population of timers where most are rescheduled to an earlier
+ * deadline or cancelled before they fire.
+ */
+#define HEAP_BENCH_CHURN(Name) \
+   do { \
+      uint64_t seed = 0x9E3779B97F4A7C15ULL; \
+      Name##Handle *handles; \
+      Name heap; \
+      Timer t; \
+      uint32_t slot; \
+      uint32_t i; \
+\
+      handles = Memory_SafeMallocN (sizeof *handles, N_TIMERS); \
+      Name##_Init (&heap); \
+      t.task = NULL; \
+      for (i = 0; i < N_TIMERS; i++) { \
+         t.deadline = HeapBenchmarks_Next (&seed); \
+         t.task = (void *)(uintptr_t)i; \
+         handles [i] = Name##_Insert (&heap, &t); \
+      } \
+      for (i = 0; i < CHURN_OPS; i++) { \
+         slot = HeapBenchmarks_Next (&seed) % N_TIMERS; \
+         switch (i & 3) { \
+         case 0: \
+         case 1: \
+            t = *Name##_Get (&heap, handles [slot]); \
+            t.deadline -= t.deadline / 8; \
+            Name##_DecreaseKey (&heap, handles [slot], &t); \
+            break; \
+         case 2: \
+            Name##_Remove (&heap, handles [slot], &t); \
+            t.deadline = HeapBenchmarks_Next (&seed); \
+            handles [slot] = Name##_Insert (&heap, &t); \
+            break; \
+         default: \
+            Name##_Extract (&heap, &t); \
+            slot = (uintptr_t)t.task; \
+            t.deadline = HeapBenchmarks_Next (&seed); \
+            handles [slot] = Name##_Insert (&heap, &t); \
+            break; \
+         } \
+      } \
+      ASSERT (Name##_Size (&heap) == N_TIMERS); \
+      Name##_Destroy (&heap); \
+      Memory_Free (handles); \
+   } while (0)
+
+
+static void
+Bench_Heap_Sort_Binary (void)
+{
+   HEAP_BENCH_SORT (BinaryTimerHeap);
+}
+
+
+static void
+Bench_Heap_Sort_Quaternary (void)
+{
+   HEAP_BENCH_SORT (QuaternaryTimerHeap);
+}
+
+
+static void
+Bench_Heap_Sort_Pairing (void)
+{
+   HEAP_BENCH_SORT (PairingTimerHeap);
+}
+
+
+static void
+Bench_Heap_Churn_Binary (void)
+{
+   HEAP_BENCH_CHURN (BinaryTimerHeap);
+}
+
+
+static void
+Bench_Heap_Churn_Quaternary (void)
+{
+   HEAP_BENCH_CHURN (QuaternaryTimerHeap);
+}
+
+
+static void
+Bench_Heap_Churn_Pairing (void)
+{
+   HEAP_BENCH_CHURN (PairingTimerHeap);
+}
+
+
+void
+HeapBenchmarks_Install (TestSuite *suite) /* IN */
+{
+   TestSuite_Add (suite, "Heap/Sort/Binary", Bench_Heap_Sort_Binary);
+   TestSuite_Add (suite, "Heap/Sort/Quaternary", Bench_Heap_Sort_Quaternary);
+   TestSuite_Add (suite, "Heap/Sort/Pairing", Bench_Heap_Sort_Pairing);
+   TestSuite_Add (suite, "Heap/Churn/Binary", Bench_Heap_Churn_Binary);
+   TestSuite_Add (suite, "Heap/Churn/Quaternary", Bench_Heap_Churn_Quaternary);
+   TestSuite_Add (suite, "Heap/Churn/Pairing", Bench_Heap_Churn_Pairing);
+}
@@ -0,0 +1,180 @@
+/* MemoryBenchmarks.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <Core/Debug.h>
+#include <Memory/Memory.h>
+#include <Memory/MemoryArena.h>
+#include <Memory/MemoryPool.h>
+
+#include "MemoryBenchmarks.h"
+
+
+/*
+ * Each iteration simulates handling one request: a burst of small,
+ * short-lived allocations that all die together when the reply is sent.
+ */
+#define REQUESTS             200000
+#define ALLOCS_PER_REQUEST   64
+
+
+static size_t gSizes [ALLOCS_PER_REQUEST];
+
+
+static void
+MemoryBenchmarks_InitSizes (void)
+{
+   uint32_t seed = 0x2545F491;
+   int i;
+
+   for (i = 0; i < ALLOCS_PER_REQUEST; i++) {
+      seed = (seed * 1103515245) + 12345;
+      gSizes [i] = 16 + ((seed >> 16) % 496);
+   }
+}
+
+
+static void
+Bench_Memory_Malloc_Request (void)
+{
+   void *ptrs [ALLOCS_PER_REQUEST];
+   int i;
+   int j;
+
+   MemoryBenchmarks_InitSizes ();
+
+   for (i = 0; i < REQUESTS; i++) {
+      for (j = 0; j < ALLOCS_PER_REQUEST; j++) {
+         ptrs [j] = Memory_SafeMalloc (gSizes [j]);
+         *(volatile uint8_t *)ptrs [j] = j;
+      }
+      for (j = 0; j < ALLOCS_PER_REQUEST; j++) {
+         Memory_Free (ptrs [j]);
+      }
+   }
+}
+
+
+static void
+Bench_Memory_Arena_Request (void)
+{
+   MemoryArena arena;
+   void *ptr;
+   int i;
+   int j;
+
+   MemoryBenchmarks_InitSizes ();
+   MemoryArena_Init (&arena, 0, MEMORY_ARENA_RECYCLE);
+
+   for (i = 0; i < REQUESTS; i++) {
+      for (j = 0; j < ALLOCS_PER_REQUEST; j++) {
+         ptr = MemoryArena_Alloc (&arena, gSizes [j]);
+         *(volatile uint8_t *)ptr = j;
+      }
+      MemoryArena_Reset (&arena);
+   }
+
+   MemoryArena_Destroy (&arena);
+}
+
+
+static void
+Bench_Memory_Arena_NoRecycle (void)
+{
+   MemoryArena arena;
+   void *ptr;
+   int i;
+   int j;
+
+   MemoryBenchmarks_InitSizes ();
+   MemoryArena_Init (&arena, 4096, MEMORY_ARENA_NONE);
+
+   for (i = 0; i < REQUESTS; i++) {
+      for (j = 0; j < ALLOCS_PER_REQUEST; j++) {
+         ptr = MemoryArena_Alloc (&arena, gSizes [j]);
+         *(volatile uint8_t *)ptr = j;
+      }
+      MemoryArena_Reset (&arena);
+   }
+
+   MemoryArena_Destroy (&arena);
+}
+
+
+/*
+ * Fixed-size objects with a working set larger than a magazine, such as
+ * connection state being created and torn down.
+ */
+#define POOL_OBJECTS 256
+#define POOL_ROUNDS  20000
+#define POOL_SIZE    48
+
+
+static void
+Bench_Memory_Malloc_Fixed (void)
+{
+   void *ptrs [POOL_OBJECTS];
+   int i;
+   int j;
+
+   for (i = 0; i < POOL_ROUNDS; i++) {
+      for (j = 0; j < POOL_OBJECTS; j++) {
+         ptrs [j] = Memory_SafeMalloc (POOL_SIZE);
+      }
+      for (j = 0; j < POOL_OBJECTS; j++) {
+         Memory_Free (ptrs [j]);
+      }
+   }
+}
+
+
+static void
+Bench_Memory_Pool_Fixed (void)
+{
+   void *ptrs [POOL_OBJECTS];
+   MemoryPool pool;
+   int i;
+   int j;
+
+   MemoryPool_Init (&pool, "Bench", POOL_SIZE);
+
+   for (i = 0; i < POOL_ROUNDS; i++) {
+      for (j = 0; j < POOL_OBJECTS; j++) {
+         ptrs [j] = MemoryPool_Alloc (&pool);
+      }
+      for (j = 0; j < POOL_OBJECTS; j++) {
+         MemoryPool_Free (&pool, ptrs [j]);
+      }
+   }
+
+   MemoryPool_Destroy (&pool);
+}
+
+
+void
+MemoryBenchmarks_Install (TestSuite *suite) /* IN */
+{
+   TestSuite_Add (suite, "Memory/Malloc/Request", Bench_Memory_Malloc_Request);
+   TestSuite_Add (suite, "Memory/Arena/Request", Bench_Memory_Arena_Request);
+   TestSuite_Add (suite, "Memory/Arena/NoRecycle", Bench_Memory_Arena_NoRecycle);
+   TestSuite_Add (suite, "Memory/Malloc/Fixed", Bench_Memory_Malloc_Fixed);
+   TestSuite_Add (suite, "Memory/Pool/Fixed", Bench_Memory_Pool_Fixed);
+}
@@ -0,0 +1,174 @@
+/* NetBenchmarks.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <errno.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <Core/Debug.h>
+#include <Net/Socket.h>
+#include <Threads/Thread.h>
+
+#include "NetBenchmarks.h"
+
+
+/*
+ * Round trip latency of a small request over each transport a client may
+ * use to reach a local congo-proxy. Each benchmark sends ROUND_TRIPS
+ * messages of MESSAGE_SIZE bytes, about the size of a small OP_QUERY,
+ * and waits for each echo before sending the next.
+ */
+#define ROUND_TRIPS  20000
+#define MESSAGE_SIZE 64
+
+
+static bool
+NetBench_ReadExact (int fd,     /* IN */
+                    char *buf,  /* OUT */
+                    size_t len) /* IN */
+{
+   ssize_t ret;
+
+   while (len) {
+      if ((ret = read (fd, buf, len)) <= 0) {
+         if ((ret < 0) && (errno == EINTR)) {
+            continue;
+         }
+         return false;
+      }
+      buf += ret;
+      len -= ret;
+   }
+
+   return true;
+}
+
+
+static void *
+NetBench_Echo (void *data) /* IN */
+{
+   char buf [MESSAGE_SIZE];
+   int listener = (int)(size_t)data;
+   int fd;
+
+   if (-1 == (fd = accept (listener, NULL, NULL))) {
+      return NULL;
+   }
+
+   while (NetBench_ReadExact (fd, buf, sizeof buf)) {
+      if (sizeof buf != write (fd, buf, sizeof buf)) {
+         break;
+      }
+   }
+
+   close (fd);
+
+   return NULL;
+}
+
+
+static void
+NetBench_RoundTrips (const char *host) /* IN */
+{
+   struct sockaddr_storage addr;
+   socklen_t addrlen;
+   char buf [MESSAGE_SIZE] = { 0 };
+   Thread thread;
+   int listener;
+   int client;
+   int opt = 1;
+   int i;
+
+   if (!Socket_ParseAddr (host, 0, &addr, &addrlen)) {
+      ASSERT (false);
+   }
+
+   listener = socket (addr.ss_family, SOCK_STREAM, 0);
+
+   if ((-1 == listener) ||
+       (0 != bind (listener, (struct sockaddr *)&addr, addrlen)) ||
+       (0 != listen (listener, 1)) ||
+       (0 != getsockname (listener, (struct sockaddr *)&addr, &addrlen))) {
+      /* No IPv6 here, for example. */
+      fprintf (stderr, "Skipping %s: %s\n", host, strerror (errno));
+      if (listener != -1) {
+         close (listener);
+      }
+      return;
+   }
+
+   Thread_Init (&thread, "NetEcho", NetBench_Echo,
+                (void *)(size_t)listener);
+
+   client = socket (addr.ss_family, SOCK_STREAM, 0);
+   if (0 != connect (client, (struct sockaddr *)&addr, addrlen)) {
+      ASSERT (false);
+   }
+
+   if (addr.ss_family != AF_UNIX) {
+      setsockopt (client, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof opt);
+   }
+
+   for (i = 0; i < ROUND_TRIPS; i++) {
+      buf [0] = (char)i;
+      if ((sizeof buf != write (client, buf, sizeof buf)) ||
+          !NetBench_ReadExact (client, buf, sizeof buf)) {
+         ASSERT (false);
+      }
+      ASSERT (buf [0] == (char)i);
+   }
+
+   close (client);
+   Thread_Join (thread);
+   close (listener);
+}
+
+
+static void
+Bench_Net_Latency_Tcp (void)
+{
+   NetBench_RoundTrips ("127.0.0.1");
+}
+
+
+static void
+Bench_Net_Latency_Tcp6 (void)
+{
+   NetBench_RoundTrips ("[::1]");
+}
+
+
+static void
+Bench_Net_Latency_Unix (void)
+{
+   char path [64];
+
+   snprintf (path, sizeof path, "@congo-bench-%d", (int)getpid ());
+   NetBench_RoundTrips (path);
+}
+
+
+void
+NetBenchmarks_Install (TestSuite *suite) /* IN */
+{
+   TestSuite_Add (suite, "Net/Latency/Tcp", Bench_Net_Latency_Tcp);
+   TestSuite_Add (suite, "Net/Latency/Tcp6", Bench_Net_Latency_Tcp6);
+   TestSuite_Add (suite, "Net/Latency/Unix", Bench_Net_Latency_Unix);
+}
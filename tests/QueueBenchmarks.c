@@ -0,0 +1,187 @@
+/* QueueBenchmarks.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <Core/Debug.h>
+#include <Threads/BlockingQueue.h>
+#include <Threads/MPMCQueue.h>
+#include <Threads/Thread.h>
+
+#include "QueueBenchmarks.h"
+
+
+/*
+ * N producers each push ITEMS / N items through a shared queue to N
+ * consumers, for 2 to 64 threads in all, with BlockingQueue and with
+ * MPMCQueue. The BlockingBatch variants move BATCH items per lock hold
+ * with BlockingQueue_PushN() and BlockingQueue_PopN().
+ */
+#define ITEMS       (1 << 20)
+#define QUEUE_DEPTH 1024
+#define MAX_THREADS 32
+#define BATCH       32
+
+
+typedef struct
+{
+   bool           mpmc;
+   int            batch;
+   BlockingQueue  blocking;
+   MPMCQueue      lockfree;
+   size_t         per_thread;
+} QueueBench;
+
+
+static void *
+QueueBench_Producer (void *data) /* IN */
+{
+   QueueBench *bench = data;
+   void *items [BATCH];
+   size_t i;
+   int j;
+
+   for (i = 1; i <= bench->per_thread; i += bench->batch) {
+      if (bench->batch > 1) {
+         for (j = 0; j < bench->batch; j++) {
+            items [j] = (void *)(i + j);
+         }
+         BlockingQueue_PushN (&bench->blocking, items, bench->batch);
+      } else if (bench->mpmc) {
+         MPMCQueue_Push (&bench->lockfree, (void *)i);
+      } else {
+         BlockingQueue_Push (&bench->blocking, (void *)i);
+      }
+   }
+
+   return NULL;
+}
+
+
+static void *
+QueueBench_Consumer (void *data) /* IN */
+{
+   QueueBench *bench = data;
+   void *items [BATCH];
+   size_t sum = 0;
+   size_t i;
+   int n;
+   int j;
+
+   for (i = 0; i < bench->per_thread; i += n) {
+      n = 1;
+      if (bench->batch > 1) {
+         n = BlockingQueue_PopN (&bench->blocking, items,
+                                 (int)MIN (BATCH, bench->per_thread - i));
+         for (j = 0; j < n; j++) {
+            sum += (size_t)items [j];
+         }
+      } else if (bench->mpmc) {
+         sum += (size_t)MPMCQueue_Pop (&bench->lockfree);
+      } else {
+         sum += (size_t)BlockingQueue_Pop (&bench->blocking);
+      }
+   }
+
+   return (void *)sum;
+}
+
+
+static void
+QueueBenchmarks_Run (bool mpmc,         /* IN */
+                     int batch,         /* IN */
+                     unsigned nthreads) /* IN */
+{
+   Thread producers [MAX_THREADS];
+   Thread consumers [MAX_THREADS];
+   QueueBench bench;
+   size_t sum = 0;
+   unsigned i;
+
+   ASSERT (nthreads <= MAX_THREADS);
+
+   bench.mpmc = mpmc;
+   bench.batch = batch;
+   bench.per_thread = ITEMS / nthreads;
+
+   if (mpmc) {
+      MPMCQueue_Init (&bench.lockfree, QUEUE_DEPTH);
+   } else {
+      BlockingQueue_Init (&bench.blocking, QUEUE_DEPTH);
+   }
+
+   for (i = 0; i < nthreads; i++) {
+      Thread_Init (&consumers [i], "QueueConsumer", QueueBench_Consumer,
+                   &bench);
+      Thread_Init (&producers [i], "QueueProducer", QueueBench_Producer,
+                   &bench);
+   }
+
+   for (i = 0; i < nthreads; i++) {
+      Thread_Join (producers [i]);
+      sum += (size_t)Thread_Join (consumers [i]);
+   }
+
+   ASSERT (sum == (nthreads *
+                   (bench.per_thread * (bench.per_thread + 1) / 2)));
+
+   if (mpmc) {
+      MPMCQueue_Destroy (&bench.lockfree);
+   } else {
+      BlockingQueue_Destroy (&bench.blocking);
+   }
+}
+
+
+#define QUEUE_BENCHMARK(Name, Mpmc, Batch, Threads) \
+   static void \
+   Bench_Queue_##Name##_##Threads (void) \
+   { \
+      QueueBenchmarks_Run (Mpmc, Batch, Threads); \
+   }
+
+
+QUEUE_BENCHMARK (Blocking, false, 1, 1)
+QUEUE_BENCHMARK (BlockingBatch, false, BATCH, 1)
+QUEUE_BENCHMARK (MPMC, true, 1, 1)
+QUEUE_BENCHMARK (Blocking, false, 1, 4)
+QUEUE_BENCHMARK (BlockingBatch, false, BATCH, 4)
+QUEUE_BENCHMARK (MPMC, true, 1, 4)
+QUEUE_BENCHMARK (Blocking, false, 1, 16)
+QUEUE_BENCHMARK (BlockingBatch, false, BATCH, 16)
+QUEUE_BENCHMARK (MPMC, true, 1, 16)
+QUEUE_BENCHMARK (Blocking, false, 1, 32)
+QUEUE_BENCHMARK (BlockingBatch, false, BATCH, 32)
+QUEUE_BENCHMARK (MPMC, true, 1, 32)
+
+
+void
+QueueBenchmarks_Install (TestSuite *suite) /* IN */
+{
+   TestSuite_Add (suite, "Queue/Blocking/1", Bench_Queue_Blocking_1);
+   TestSuite_Add (suite, "Queue/BlockingBatch/1", Bench_Queue_BlockingBatch_1);
+   TestSuite_Add (suite, "Queue/MPMC/1", Bench_Queue_MPMC_1);
+   TestSuite_Add (suite, "Queue/Blocking/4", Bench_Queue_Blocking_4);
+   TestSuite_Add (suite, "Queue/BlockingBatch/4", Bench_Queue_BlockingBatch_4);
+   TestSuite_Add (suite, "Queue/MPMC/4", Bench_Queue_MPMC_4);
+   TestSuite_Add (suite, "Queue/Blocking/16", Bench_Queue_Blocking_16);
+   TestSuite_Add (suite, "Queue/BlockingBatch/16", Bench_Queue_BlockingBatch_16);
+   TestSuite_Add (suite, "Queue/MPMC/16", Bench_Queue_MPMC_16);
+   TestSuite_Add (suite, "Queue/Blocking/32", Bench_Queue_Blocking_32);
+   TestSuite_Add (suite, "Queue/BlockingBatch/32", Bench_Queue_BlockingBatch_32);
+   TestSuite_Add (suite, "Queue/MPMC/32", Bench_Queue_MPMC_32);
+}
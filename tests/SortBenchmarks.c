@@ -0,0 +1,150 @@
+/* SortBenchmarks.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stddef.h>
+#include <string.h>
+
+#include <Containers/Array.h>
+#include <Core/Debug.h>
+#include <Memory/Memory.h>
+
+#include "SortBenchmarks.h"
+
+
+/*
+ * Each benchmark sorts TOTAL_ELEMS elements in arrays of a given size, so
+ * that times are comparable across sizes and show where radix and
+ * parallel sorting start to pay off. Elements are a 64-bit key with a
+ * payload, like a disk location with its record.
+ */
+#define TOTAL_ELEMS (1 << 22)
+
+
+typedef struct
+{
+   uint64_t  key;
+   void     *payload;
+} SortRecord;
+
+
+typedef enum
+{
+   SORT_QSORT,
+   SORT_RADIX,
+   SORT_PARALLEL,
+} SortKind;
+
+
+static SortRecord *gRecords;
+
+
+static int
+SortRecord_Compare (const void *a, /* IN */
+                    const void *b) /* IN */
+{
+   const SortRecord *ra = a;
+   const SortRecord *rb = b;
+
+   return (ra->key > rb->key) - (ra->key < rb->key);
+}
+
+
+static void
+SortBenchmarks_Run (SortKind kind, /* IN */
+                    uint32_t size) /* IN */
+{
+   uint64_t seed = 0x9E3779B97F4A7C15ULL;
+   uint32_t round;
+   uint32_t i;
+   Array ar;
+
+   if (!gRecords) {
+      gRecords = Memory_SafeMallocN (sizeof *gRecords, TOTAL_ELEMS);
+      for (i = 0; i < TOTAL_ELEMS; i++) {
+         seed ^= seed << 13;
+         seed ^= seed >> 7;
+         seed ^= seed << 17;
+         gRecords [i].key = seed;
+         gRecords [i].payload = &gRecords [i];
+      }
+   }
+
+   Array_InitSized (&ar, sizeof (SortRecord), false, size);
+
+   for (round = 0; round < (TOTAL_ELEMS / size); round++) {
+      Array_Clear (&ar);
+      Array_AppendRange (&ar, size, &gRecords [round * size]);
+
+      switch (kind) {
+      case SORT_QSORT:
+         Array_Sort (&ar, SortRecord_Compare);
+         break;
+      case SORT_RADIX:
+         Array_SortByUInt64 (&ar, offsetof (SortRecord, key));
+         break;
+      case SORT_PARALLEL:
+         Array_SortParallel (&ar, SortRecord_Compare);
+         break;
+      default:
+         ASSERT (false);
+         break;
+      }
+
+      ASSERT (Array_Index (&ar, SortRecord, 0).key <=
+              Array_Index (&ar, SortRecord, size - 1).key);
+   }
+
+   Array_Destroy (&ar);
+}
+
+
+#define SORT_BENCHMARK(Kind, Name, Size) \
+   static void \
+   Bench_Sort_##Name##_##Size (void) \
+   { \
+      SortBenchmarks_Run (Kind, Size); \
+   }
+
+
+SORT_BENCHMARK (SORT_QSORT, Qsort, 16)
+SORT_BENCHMARK (SORT_RADIX, Radix, 16)
+SORT_BENCHMARK (SORT_QSORT, Qsort, 256)
+SORT_BENCHMARK (SORT_RADIX, Radix, 256)
+SORT_BENCHMARK (SORT_QSORT, Qsort, 4096)
+SORT_BENCHMARK (SORT_RADIX, Radix, 4096)
+SORT_BENCHMARK (SORT_QSORT, Qsort, 1048576)
+SORT_BENCHMARK (SORT_RADIX, Radix, 1048576)
+SORT_BENCHMARK (SORT_PARALLEL, Parallel, 65536)
+SORT_BENCHMARK (SORT_PARALLEL, Parallel, 1048576)
+
+
+void
+SortBenchmarks_Install (TestSuite *suite) /* IN */
+{
+   TestSuite_Add (suite, "Sort/Qsort/16", Bench_Sort_Qsort_16);
+   TestSuite_Add (suite, "Sort/Radix/16", Bench_Sort_Radix_16);
+   TestSuite_Add (suite, "Sort/Qsort/256", Bench_Sort_Qsort_256);
+   TestSuite_Add (suite, "Sort/Radix/256", Bench_Sort_Radix_256);
+   TestSuite_Add (suite, "Sort/Qsort/4096", Bench_Sort_Qsort_4096);
+   TestSuite_Add (suite, "Sort/Radix/4096", Bench_Sort_Radix_4096);
+   TestSuite_Add (suite, "Sort/Qsort/1048576", Bench_Sort_Qsort_1048576);
+   TestSuite_Add (suite, "Sort/Radix/1048576", Bench_Sort_Radix_1048576);
+   TestSuite_Add (suite, "Sort/Parallel/65536", Bench_Sort_Parallel_65536);
+   TestSuite_Add (suite, "Sort/Parallel/1048576", Bench_Sort_Parallel_1048576);
+}
@@ -0,0 +1,173 @@
+/* SyncBenchmarks.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+
+#include <Core/Debug.h>
+#include <Threads/Rcu.h>
+#include <Threads/RWLock.h>
+#include <Threads/SeqLock.h>
+#include <Tunable/Tunable.h>
+
+#include "SyncBenchmarks.h"
+
+
+/*
+ * Read side cost of each way to share a small read-mostly structure,
+ * READS uncontended reads each.
+ */
+#define READS (1 << 24)
+
+
+typedef struct
+{
+   uint64_t a;
+   uint64_t b;
+} SyncData;
+
+
+static SyncData  gData = { 1, 2 };
+static SyncData *gDataPtr = &gData;
+
+
+static void
+Bench_Sync_RWLock (void)
+{
+   RWLock lock;
+   uint64_t sum = 0;
+   int i;
+
+   RWLock_Init (&lock, NULL);
+
+   for (i = 0; i < READS; i++) {
+      RWLock_ReadLock (&lock);
+      sum += gData.a + gData.b;
+      RWLock_Unlock (&lock);
+   }
+
+   ASSERT (sum == 3ULL * READS);
+}
+
+
+static void
+Bench_Sync_SeqLock (void)
+{
+   SeqLock lock = SEQ_LOCK_INIT;
+   uint64_t sum = 0;
+   uint64_t val;
+   uint32_t seq;
+   int i;
+
+   for (i = 0; i < READS; i++) {
+      do {
+         seq = SeqLock_ReadBegin (&lock);
+         val = gData.a + gData.b;
+      } while (SeqLock_ReadRetry (&lock, seq));
+      sum += val;
+   }
+
+   ASSERT (sum == 3ULL * READS);
+}
+
+
+static void
+Bench_Sync_Rcu (void)
+{
+   SyncData *data;
+   uint64_t sum = 0;
+   int i;
+
+   for (i = 0; i < READS; i++) {
+      Rcu_ReadLock ();
+      data = Rcu_Dereference (gDataPtr);
+      sum += data->a + data->b;
+      Rcu_ReadUnlock ();
+   }
+
+   ASSERT (sum == 3ULL * READS);
+}
+
+
+static void
+Bench_Sync_Tunable (void)
+{
+   Tunable tunable;
+   Value value;
+   uint64_t sum = 0;
+   int i;
+
+   Value_InitSize (&value, 3);
+   tunable = Tunable_Register ("bench.sync.tunable", &value);
+
+   for (i = 0; i < READS; i++) {
+      Tunable_Get (tunable, &value);
+      sum += Value_GetSize (&value);
+   }
+
+   ASSERT (sum == 3ULL * READS);
+}
+
+
+static void
+Bench_Sync_TunableInt (void)
+{
+   TunableInt tunable;
+   uint64_t sum = 0;
+   int i;
+
+   Tunable_RegisterInt (&tunable, "bench.sync.tunable.int", 3);
+
+   for (i = 0; i < READS; i++) {
+      sum += TunableInt_Get (tunable);
+   }
+
+   ASSERT (sum == 3ULL * READS);
+}
+
+
+static void
+Bench_Sync_TunableFind (void)
+{
+   char name [32];
+   int i;
+
+   for (i = 0; i < 256; i++) {
+      snprintf (name, sizeof name, "bench.sync.find.%d", i);
+      Tunable_Register (name, NULL);
+   }
+
+   for (i = 0; i < (READS >> 4); i++) {
+      snprintf (name, sizeof name, "bench.sync.find.%d", i & 255);
+      if (TUNABLE_INVALID == Tunable_Find (name)) {
+         ASSERT (false);
+      }
+   }
+}
+
+
+void
+SyncBenchmarks_Install (TestSuite *suite) /* IN */
+{
+   TestSuite_Add (suite, "Sync/RWLock", Bench_Sync_RWLock);
+   TestSuite_Add (suite, "Sync/SeqLock", Bench_Sync_SeqLock);
+   TestSuite_Add (suite, "Sync/Rcu", Bench_Sync_Rcu);
+   TestSuite_Add (suite, "Sync/Tunable", Bench_Sync_Tunable);
+   TestSuite_Add (suite, "Sync/TunableInt", Bench_Sync_TunableInt);
+   TestSuite_Add (suite, "Sync/TunableFind", Bench_Sync_TunableFind);
+}
@@ -0,0 +1,168 @@
+/* ThreadPoolBenchmarks.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <Core/Atomic.h>
+#include <Core/Debug.h>
+#include <Memory/Memory.h>
+#include <Core/Platform.h>
+#include <Threads/ThreadPool.h>
+
+#include "ThreadPoolBenchmarks.h"
+
+
+/*
+ * Push/N queues ITEMS empty work items from outside the pool, with
+ * workers taking N at a time off the shared queue. Fib/N runs the
+ * naive recursive Fibonacci with one task per call, which is all
+ * deque pushes, pops and steals. ParallelFor sums ELEMENTS integers.
+ */
+#define ITEMS    (1 << 18)
+#define ELEMENTS (1 << 24)
+
+
+static ThreadPool gPool;
+static volatile int32_t gCount;
+
+
+static void
+ThreadPoolBench_Worker (void *data,      /* IN */
+                        void *user_data) /* IN */
+{
+   AtomicInt_Increment (&gCount);
+}
+
+
+static void
+ThreadPoolBenchmarks_Init (void)
+{
+   ThreadPool_Init (&gPool, MAX (2, Platform_GetCpuCount ()), 1024,
+                    ThreadPoolBench_Worker, NULL);
+   gCount = 0;
+}
+
+
+static void
+ThreadPoolBenchmarks_Push (int batch) /* IN */
+{
+   int i;
+
+   ThreadPoolBenchmarks_Init ();
+   ThreadPool_SetBatchSize (&gPool, batch);
+
+   for (i = 0; i < ITEMS; i++) {
+      ThreadPool_Push (&gPool, NULL);
+   }
+
+   ThreadPool_Destroy (&gPool);
+   ASSERT (gCount == ITEMS);
+}
+
+
+static void
+Bench_ThreadPool_Push_1 (void)
+{
+   ThreadPoolBenchmarks_Push (1);
+}
+
+
+static void
+Bench_ThreadPool_Push_32 (void)
+{
+   ThreadPoolBenchmarks_Push (32);
+}
+
+
+static void *
+ThreadPoolBench_Fib (void *data) /* IN */
+{
+   ThreadPoolFuture *future;
+   size_t n = (size_t)data;
+   size_t a;
+   size_t b;
+
+   if (n < 2) {
+      return data;
+   }
+
+   future = ThreadPool_Submit (&gPool, ThreadPoolBench_Fib, (void *)(n - 1));
+   b = (size_t)ThreadPoolBench_Fib ((void *)(n - 2));
+   a = (size_t)ThreadPoolFuture_Wait (future);
+
+   return (void *)(a + b);
+}
+
+
+static void
+Bench_ThreadPool_Fib_25 (void)
+{
+   ThreadPoolFuture *future;
+
+   ThreadPoolBenchmarks_Init ();
+   future = ThreadPool_Submit (&gPool, ThreadPoolBench_Fib, (void *)25);
+   ASSERT ((size_t)ThreadPoolFuture_Wait (future) == 75025);
+   ThreadPool_Destroy (&gPool);
+}
+
+
+static void
+ThreadPoolBench_Sum (size_t begin, /* IN */
+                     size_t end,   /* IN */
+                     void *data)   /* IN */
+{
+   const uint32_t *values = data;
+   int64_t sum = 0;
+   size_t i;
+
+   for (i = begin; i < end; i++) {
+      sum += values [i];
+   }
+
+   AtomicInt_Add (&gCount, (int32_t)sum);
+}
+
+
+static void
+Bench_ThreadPool_ParallelFor (void)
+{
+   uint32_t *values;
+   size_t i;
+
+   values = Memory_SafeMallocN (sizeof *values, ELEMENTS);
+   for (i = 0; i < ELEMENTS; i++) {
+      values [i] = i & 1;
+   }
+
+   ThreadPoolBenchmarks_Init ();
+   ThreadPool_ParallelFor (&gPool, 0, ELEMENTS, 0, ThreadPoolBench_Sum,
+                           values);
+   ThreadPool_Destroy (&gPool);
+
+   ASSERT (gCount == ELEMENTS / 2);
+   Memory_Free (values);
+}
+
+
+void
+ThreadPoolBenchmarks_Install (TestSuite *suite) /* IN */
+{
+   TestSuite_Add (suite, "ThreadPool/Push/1", Bench_ThreadPool_Push_1);
+   TestSuite_Add (suite, "ThreadPool/Push/32", Bench_ThreadPool_Push_32);
+   TestSuite_Add (suite, "ThreadPool/Fib/25", Bench_ThreadPool_Fib_25);
+   TestSuite_Add (suite, "ThreadPool/ParallelFor", Bench_ThreadPool_ParallelFor);
+}
@@ -0,0 +1,48 @@
+#include <Counters/Counter.h>
+
+#include "ContainerBenchmarks.h"
+#include "HashBenchmarks.h"
+#include "HashTableBenchmarks.h"
+#include "HeapBenchmarks.h"
+#include "MemoryBenchmarks.h"
+#include "NetBenchmarks.h"
+#include "QueueBenchmarks.h"
+#include "SortBenchmarks.h"
+#include "SyncBenchmarks.h"
+#include "ThreadPoolBenchmarks.h"
+
+
+/*
+ * bench-congo uses the test harness to time each benchmark; compare the
+ * "elapsed" field of related entries. Run with -p so that benchmarks do
+ * not compete with each other for CPUs.
+ */
+
+
+int
+main (int argc,      /* IN */
+      char *argv[])  /* IN */
+{
+   TestSuite suite;
+   int ret;
+
+   Counters_Init ();
+
+   TestSuite_Init (&suite, "/Bench/", argc, argv);
+
+   ContainerBenchmarks_Install (&suite);
+   HashBenchmarks_Install (&suite);
+   HashTableBenchmarks_Install (&suite);
+   HeapBenchmarks_Install (&suite);
+   MemoryBenchmarks_Install (&suite);
+   NetBenchmarks_Install (&suite);
+   QueueBenchmarks_Install (&suite);
+   SortBenchmarks_Install (&suite);
+   SyncBenchmarks_Install (&suite);
+   ThreadPoolBenchmarks_Install (&suite);
+
+   ret = TestSuite_Run (&suite);
+   TestSuite_Destroy (&suite);
+
+   return ret;
+}
@@ -1,4 +1,5 @@
 #include <Counters/Counter.h>
+#include <Random/Random.h>
 
 #include "CoreTests.h"
 #include "MutatorTests.h"
@@ -12,6 +13,7 @@ main (int argc,      /* IN */
    int ret;
 
    Counters_Init ();
+   Random_Init ();
 
    TestSuite_Init (&suite, "/", argc, argv);
 
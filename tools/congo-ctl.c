@@ -0,0 +1,158 @@
+/* congo-ctl.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <Admin/Admin.h>
+#include <Net/Socket.h>
+
+
+static void
+usage (const char *prgname)
+{
+   fprintf (stderr, "usage: %s SOCKET COMMAND [ARGS...]\n", prgname);
+   fprintf (stderr, "\n"
+                    "Runs COMMAND on the admin socket of a congo process,\n"
+                    "see --admin_socket. Run \"help\" for a list of commands.\n"
+                    "\n"
+                    "  %s /tmp/congo.sock list net.\n"
+                    "  %s /tmp/congo.sock set log.level warning\n",
+            prgname, prgname);
+}
+
+
+static bool
+WriteAll (int fd,          /* IN */
+          const char *buf, /* IN */
+          size_t len)      /* IN */
+{
+   ssize_t ret;
+
+   while (len) {
+      if ((ret = write (fd, buf, len)) < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         return false;
+      }
+      buf += ret;
+      len -= ret;
+   }
+
+   return true;
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   struct sockaddr_un addr;
+   socklen_t addrlen;
+   char line [ADMIN_MAX_LINE];
+   char header [32];
+   char buf [4096];
+   size_t hlen = 0;
+   size_t len = 0;
+   size_t body;
+   ssize_t ret;
+   char *eol;
+   bool ok;
+   int fd;
+   int i;
+
+   if ((argc == 2) && (0 == strcmp ("-h", argv [1]))) {
+      usage (argv [0]);
+      return EXIT_SUCCESS;
+   } else if (argc < 3) {
+      usage (argv [0]);
+      return EXIT_FAILURE;
+   }
+
+   for (i = 2; i < argc; i++) {
+      if ((len + strlen (argv [i]) + 2) > sizeof line) {
+         fprintf (stderr, "Command too long.\n");
+         return EXIT_FAILURE;
+      }
+      len += snprintf (line + len, sizeof line - len, "%s%s",
+                       argv [i], (i + 1 < argc) ? " " : "\n");
+   }
+
+   if (!Socket_UnixAddr (argv [1], &addr, &addrlen)) {
+      fprintf (stderr, "Invalid socket path \"%s\".\n", argv [1]);
+      return EXIT_FAILURE;
+   }
+
+   if ((-1 == (fd = socket (AF_UNIX, SOCK_STREAM, 0))) ||
+       (0 != connect (fd, (struct sockaddr *)&addr, addrlen))) {
+      fprintf (stderr, "Failed to connect to \"%s\": %s\n",
+               argv [1], strerror (errno));
+      return EXIT_FAILURE;
+   }
+
+   if (!WriteAll (fd, line, len)) {
+      fprintf (stderr, "Failed to send command: %s\n", strerror (errno));
+      return EXIT_FAILURE;
+   }
+
+   /*
+    * The reply starts with "OK <length>\n" or "ERROR <length>\n".
+    */
+   for (;;) {
+      if ((hlen == sizeof header) ||
+          (0 >= (ret = read (fd, header + hlen, 1)))) {
+         fprintf (stderr, "Invalid reply from \"%s\".\n", argv [1]);
+         return EXIT_FAILURE;
+      }
+      if (header [hlen++] == '\n') {
+         break;
+      }
+   }
+
+   header [hlen - 1] = '\0';
+
+   if (0 == strncmp (header, "OK ", 3)) {
+      ok = true;
+      body = strtoul (header + 3, &eol, 10);
+   } else if (0 == strncmp (header, "ERROR ", 6)) {
+      ok = false;
+      body = strtoul (header + 6, &eol, 10);
+   } else {
+      fprintf (stderr, "Invalid reply from \"%s\".\n", argv [1]);
+      return EXIT_FAILURE;
+   }
+
+   while (body) {
+      if (0 >= (ret = read (fd, buf, MIN (body, sizeof buf)))) {
+         fprintf (stderr, "Truncated reply from \"%s\".\n", argv [1]);
+         return EXIT_FAILURE;
+      }
+      WriteAll (ok ? STDOUT_FILENO : STDERR_FILENO, buf, ret);
+      body -= ret;
+   }
+
+   close (fd);
+
+   return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -27,6 +27,7 @@
 #include <Endian.h>
 #include <HashTable.h>
 #include <Log.h>
+#include <MemoryPool.h>
 #include <OptionContext.h>
 #include <OptionEntry.h>
 #include <Random.h>
@@ -51,6 +52,9 @@ static int        gNextFuzzer;
 static HashTable *gProxies;
 
 
+MEMORY_POOL (ConnectionPool, Connection, "Connection")
+
+
 static OptionEntry entries[] = {
    { "bind_ip", 0, 0, OPTION_ARG_STRING, &gBindIp,
      "The ip address to bind to [0.0.0.0]" },
@@ -69,9 +73,9 @@ Fuzzer_GetServerConnection (Connection *client) /* IN */
    Connection *server;
 
    if (!(server = HashTable_Lookup (gProxies, client))) {
-      server = Memory_SafeMalloc0 (sizeof *server);
+      server = ConnectionPool_Alloc0 ();
       if (!Connection_InitFromHost (server, gHost, gPort)) {
-         Memory_Free (server);
+         ConnectionPool_Free (server);
          return NULL;
       }
       server->no_header_mutate = true;
@@ -280,6 +284,7 @@ Fuzzer_ConnectionClosed (SocketManager *socket_manager,
    if ((server = HashTable_Lookup (gProxies, connection))) {
       Connection_Destroy (server);
       HashTable_Remove (gProxies, connection);
+      ConnectionPool_Free (server);
    }
 }
 
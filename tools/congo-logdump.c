@@ -0,0 +1,317 @@
+/* congo-logdump.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <Containers/Array.h>
+#include <Log/LogBinary.h>
+
+
+typedef struct
+{
+   uint32_t id;
+   const LogBinaryRecord *record;
+   const char *domain;
+   const char *format;
+} LogSiteInfo;
+
+
+static void
+usage (const char *prgname)
+{
+   fprintf (stderr, "usage: %s FILE\n", prgname);
+}
+
+
+static uint8_t *
+ReadFile (FILE *file,
+          size_t *len)
+{
+   uint8_t *buf = NULL;
+   size_t allocated = 0;
+   size_t n;
+
+   *len = 0;
+
+   for (;;) {
+      if (*len == allocated) {
+         allocated = allocated ? allocated * 2 : 65536;
+         buf = realloc (buf, allocated);
+         if (!buf) {
+            return NULL;
+         }
+      }
+
+      if (!(n = fread (buf + *len, 1, allocated - *len, file))) {
+         break;
+      }
+
+      *len += n;
+   }
+
+   return buf;
+}
+
+
+static int
+CompareRecords (const void *a,
+                const void *b)
+{
+   const LogBinaryRecord *ra = *(const LogBinaryRecord **)a;
+   const LogBinaryRecord *rb = *(const LogBinaryRecord **)b;
+
+   if (ra->timestamp != rb->timestamp) {
+      return (ra->timestamp < rb->timestamp) ? -1 : 1;
+   }
+
+   /*
+    * Keep records with the same timestamp in file order.
+    */
+   return (ra < rb) ? -1 : (ra > rb);
+}
+
+
+/*
+ * Orders sites by id, and sites with the same id in file order.
+ */
+static int
+CompareSites (const void *a,
+              const void *b)
+{
+   const LogSiteInfo *sa = a;
+   const LogSiteInfo *sb = b;
+
+   if (sa->id != sb->id) {
+      return (sa->id < sb->id) ? -1 : 1;
+   }
+
+   return (sa->record < sb->record) ? -1 : (sa->record > sb->record);
+}
+
+
+static int
+CompareSiteId (const void *key,
+               const void *element)
+{
+   const LogSiteInfo *site = element;
+   uint32_t id = *(const uint32_t *)key;
+
+   return (id < site->id) ? -1 : (id > site->id);
+}
+
+
+/*
+ * Site and text records carry two NUL terminated strings after the
+ * record header. Returns false if either runs past the end of the record.
+ */
+static bool
+GetStrings (const LogBinaryRecord *record,
+            const char **first,
+            const char **second)
+{
+   const char *begin = (const char *)(record + 1);
+   const char *end = (const char *)record + record->len;
+   const char *nul;
+
+   if (!(nul = memchr (begin, '\0', end - begin))) {
+      return false;
+   }
+
+   *first = begin;
+   begin = nul + 1;
+
+   if (!memchr (begin, '\0', end - begin)) {
+      return false;
+   }
+
+   *second = begin;
+
+   return true;
+}
+
+
+static void
+PrintRecord (const LogBinaryRecord *record,
+             const char *domain,
+             const char *message)
+{
+   struct tm tt;
+   time_t t;
+   char nowstr [32];
+
+   t = record->timestamp / 1000000000ULL;
+   localtime_r (&t, &tt);
+   strftime (nowstr, sizeof nowstr, "%Y/%m/%d %H:%M:%S", &tt);
+
+   fprintf (stdout, "%s.%04ld: %8s: %12s: %s\n",
+            nowstr,
+            (long)((record->timestamp % 1000000000ULL) / 1000000ULL),
+            LogLevel_ToString (record->level),
+            domain,
+            message);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   const LogBinaryHeader *header;
+   const LogBinaryRecord *record;
+   const LogSiteInfo *site;
+   LogSiteInfo info;
+   Array records;
+   Array sites;
+   uint8_t *buf;
+   FILE *file;
+   size_t len;
+   size_t offset;
+   uint32_t site_id;
+   uint32_t i;
+   uint32_t j;
+   char message [4096];
+   const char *domain;
+   const char *str;
+
+   if (argc != 2) {
+      usage (argv [0]);
+      return EXIT_FAILURE;
+   } else if (0 == strcmp ("-h", argv [1])) {
+      usage (argv [0]);
+      return EXIT_SUCCESS;
+   }
+
+   if (0 == strcmp ("-", argv [1])) {
+      file = stdin;
+   } else if (!(file = fopen (argv [1], "rb"))) {
+      perror ("Failed to open log");
+      return EXIT_FAILURE;
+   }
+
+   buf = ReadFile (file, &len);
+
+   if (file != stdin) {
+      fclose (file);
+   }
+
+   header = (const LogBinaryHeader *)buf;
+
+   if (!buf ||
+       (len < sizeof *header) ||
+       (0 != memcmp (header->magic, LOG_BINARY_MAGIC, sizeof header->magic)) ||
+       (header->version != LOG_BINARY_VERSION)) {
+      fprintf (stderr, "%s is not a binary congo log.\n", argv [1]);
+      return EXIT_FAILURE;
+   }
+
+   Array_Init (&records, sizeof record, false);
+   Array_Init (&sites, sizeof info, false);
+
+   /*
+    * Records from different threads are written as each thread's ring is
+    * drained, so a message can appear before the record for its call
+    * site. Collect all of the sites first, then render in time order.
+    */
+   for (offset = sizeof *header; (len - offset) >= sizeof *record;) {
+      record = (const LogBinaryRecord *)(buf + offset);
+
+      if ((record->len < sizeof *record) || (record->len > (len - offset))) {
+         fprintf (stderr, "Truncated record at offset %zu.\n", offset);
+         break;
+      }
+
+      offset += record->len;
+
+      if (record->type == LOG_BINARY_SITE) {
+         if (!GetStrings (record, &info.domain, &info.format)) {
+            fprintf (stderr, "Malformed call site at offset %zu.\n",
+                     offset - record->len);
+            continue;
+         }
+         info.id = record->site;
+         info.record = record;
+         Array_Append (&sites, info);
+      } else {
+         Array_Append (&records, record);
+      }
+   }
+
+   /*
+    * Site ids are allocated per process, so a log that was restarted can
+    * hold a few sites with large ids. Look them up by id rather than
+    * index. Should an id repeat, the last definition in the file wins.
+    */
+   Array_Sort (&sites, CompareSites);
+   for (i = 0, j = 0; i < sites.len; i++) {
+      if ((i + 1 < sites.len) &&
+          (Array_Index (&sites, LogSiteInfo, i + 1).id ==
+           Array_Index (&sites, LogSiteInfo, i).id)) {
+         continue;
+      }
+      Array_Index (&sites, LogSiteInfo, j++) =
+         Array_Index (&sites, LogSiteInfo, i);
+   }
+   sites.len = j;
+
+   qsort (records.data, records.len, sizeof record, CompareRecords);
+
+   for (i = 0; i < records.len; i++) {
+      record = Array_Index (&records, const LogBinaryRecord *, i);
+
+      switch (record->type) {
+      case LOG_BINARY_TEXT:
+         if (GetStrings (record, &domain, &str)) {
+            PrintRecord (record, domain, str);
+         }
+         break;
+      case LOG_BINARY_EVENT:
+         site_id = record->site;
+         site = Array_Search (&sites, &site_id, CompareSiteId);
+         if (!site) {
+            snprintf (message, sizeof message,
+                      "<missing call site %u>", record->site);
+            PrintRecord (record, "", message);
+         } else if (!LogBinary_Format (site->format,
+                                       (const uint8_t *)(record + 1),
+                                       record->len - sizeof *record,
+                                       message,
+                                       sizeof message)) {
+            snprintf (message, sizeof message,
+                      "<invalid arguments for \"%s\">", site->format);
+            PrintRecord (record, site->domain, message);
+         } else {
+            PrintRecord (record, site->domain, message);
+         }
+         break;
+      default:
+         break;
+      }
+   }
+
+   Array_Destroy (&records);
+   Array_Destroy (&sites);
+   free (buf);
+
+   return EXIT_SUCCESS;
+}
@@ -22,11 +22,16 @@
 #endif
 
 #include <bson.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <unistd.h>
 
+#include <Admin.h>
+#include <Counter.h>
 #include <Endian.h>
 #include <HashTable.h>
 #include <Log.h>
+#include <MemoryPool.h>
 #include <OptionContext.h>
 #include <OptionEntry.h>
 #include <Random.h>
@@ -35,6 +40,8 @@
 #include <Socket.h>
 #include <SocketManager.h>
 #include <Task.h>
+#include <Trace.h>
+#include <Tunable.h>
 #include <WireProtocol.h>
 #include <WireProtocolReader.h>
 #include <WireProtocolWriter.h>
@@ -44,18 +51,42 @@ static char      *gBindIp = "0.0.0.0";
 static int        gBindPort = 27000;
 static char      *gHost = "localhost";
 static int        gPort = 27017;
+static bool       gTrace;
+static char      *gBinaryLog;
+static char      *gAdminSocket;
+static int        gBacklog = 1024;
+static int        gMaxConnections;
+static int        gIdleTimeout = 5000;
+static bool       gIdlePark;
 static HashTable *gProxies;
 
 
+MEMORY_POOL (ConnectionPool, Connection, "Connection")
+
+
 static OptionEntry entries[] = {
    { "bind_ip", 0, 0, OPTION_ARG_STRING, &gBindIp,
-     "The ip address to bind to [0.0.0.0]" },
+     "The ip address or UNIX socket path to bind to [0.0.0.0]" },
    { "bind_port", 0, 0, OPTION_ARG_INT, &gBindPort,
      "The port to bind to [27000]" },
    { "host", 0, 0, OPTION_ARG_STRING, &gHost,
-     "The hostname to forward traffic to in client mode [localhost]" },
+     "The hostname or UNIX socket path to forward traffic to [localhost]" },
    { "port", 0, 0, OPTION_ARG_INT, &gPort,
      "The port to connect in client mode [27017]" },
+   { "trace", 0, 0, OPTION_ARG_NONE, &gTrace,
+     "Record trace events for congo-trace" },
+   { "binary_log", 0, 0, OPTION_ARG_STRING, &gBinaryLog,
+     "Write a binary log to the given file, see congo-logdump" },
+   { "admin_socket", 0, 0, OPTION_ARG_STRING, &gAdminSocket,
+     "Accept congo-ctl commands on the given UNIX socket" },
+   { "backlog", 0, 0, OPTION_ARG_INT, &gBacklog,
+     "The length of the listen queue [1024]" },
+   { "max_connections", 0, 0, OPTION_ARG_INT, &gMaxConnections,
+     "Close new connections beyond this many, 0 for no limit [0]" },
+   { "idle_timeout", 0, 0, OPTION_ARG_INT, &gIdleTimeout,
+     "Release buffers of connections idle this many msec, 0 never [5000]" },
+   { "idle_park", 0, 0, OPTION_ARG_NONE, &gIdlePark,
+     "Also release the task of idle connections until data arrives" },
 };
 
 
@@ -65,9 +96,9 @@ Proxy_GetServerConnection (Connection *client) /* IN */
    Connection *server;
 
    if (!(server = HashTable_Lookup (gProxies, client))) {
-      server = Memory_SafeMalloc0 (sizeof *server);
+      server = ConnectionPool_Alloc0 ();
       if (!Connection_InitFromHost (server, gHost, gPort)) {
-         Memory_Free (server);
+         ConnectionPool_Free (server);
          return NULL;
       }
       server->no_header_mutate = true;
@@ -173,6 +204,7 @@ Proxy_ConnectionClosed (SocketManager *socket_manager,
    if ((server = HashTable_Lookup (gProxies, connection))) {
       Connection_Destroy (server);
       HashTable_Remove (gProxies, connection);
+      ConnectionPool_Free (server);
    }
 }
 
@@ -188,6 +220,8 @@ main (int argc,     /* IN */
    SocketManager socket_manager;
    OptionContext context;
    Error error;
+   Value value;
+   int fd;
 
    OptionContext_Init (&context, "congo-proxy", "A logging mongod proxy.");
    OptionContext_AddEntries (&context, entries, N_ELEMENTS (entries));
@@ -199,6 +233,34 @@ main (int argc,     /* IN */
    Signals_Init ();
 #endif
    Random_Init ();
+   Counters_Init ();
+
+   if (gBinaryLog) {
+      fd = open (gBinaryLog, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+      if ((fd == -1) || !Log_StartBinary (fd, LOG_OVERFLOW_DROP)) {
+         fprintf (stderr, "Failed to open binary log \"%s\".\n", gBinaryLog);
+         return EXIT_FAILURE;
+      }
+   } else {
+      Log_StartAsync (STDERR_FILENO, LOG_OVERFLOW_DROP);
+   }
+
+   if (gTrace) {
+      Trace_Init ();
+   }
+
+   if (gAdminSocket && !Admin_Start (gAdminSocket)) {
+      return EXIT_FAILURE;
+   }
+
+   Value_InitInt32 (&value, gBacklog);
+   Tunable_Set (Tunable_Find ("net.listen.backlog"), &value);
+   Value_InitInt32 (&value, gMaxConnections);
+   Tunable_Set (Tunable_Find ("net.max_connections"), &value);
+   Value_InitInt32 (&value, gIdleTimeout);
+   Tunable_Set (Tunable_Find ("net.idle.timeout"), &value);
+   Value_InitBool (&value, gIdlePark);
+   Tunable_Set (Tunable_Find ("net.idle.park"), &value);
 
    gProxies = HashTable_Create (1024, Pointer_Hash, Pointer_Equal, NULL, NULL);
 
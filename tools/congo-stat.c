@@ -28,10 +28,49 @@
 #include <Counters/Counter.h>
 
 
+/*
+ * Counters registered by builds with --enable-memory-stats. Each call site
+ * to the allocator gets one counter in each of these categories, named
+ * after its file and line.
+ */
+static const char *gMemoryCategories [] = {
+   "Memory/LiveBytes",
+   "Memory/Allocs",
+   "Memory/Frees",
+   "Memory/Size64",
+   "Memory/Size256",
+   "Memory/Size1K",
+   "Memory/Size4K",
+   "Memory/SizeLarge",
+};
+
+
+#define N_MEMORY_CATEGORIES \
+   (sizeof gMemoryCategories / sizeof gMemoryCategories [0])
+
+
+typedef struct
+{
+   const char *name;
+   int64_t     values [N_MEMORY_CATEGORIES];
+} MemorySiteRow;
+
+
+typedef struct
+{
+   MemorySiteRow *rows;
+   size_t         len;
+   size_t         allocated;
+} MemorySiteTable;
+
+
 static void
 usage (const char *prgname)
 {
-   fprintf (stderr, "usage: %s PID\n", prgname);
+   fprintf (stderr, "usage: %s [-m] PID\n", prgname);
+   fprintf (stderr, "\n"
+                    "  -m   Show allocations by call site, sorted by live\n"
+                    "       bytes. Requires --enable-memory-stats.\n");
 }
 
 
@@ -47,24 +86,141 @@ Counters_ForeachCb (Counter *counter,
 }
 
 
+static MemorySiteRow *
+MemorySiteTable_Get (MemorySiteTable *table,
+                     const char      *name)
+{
+   MemorySiteRow *row;
+   size_t i;
+
+   for (i = 0; i < table->len; i++) {
+      if (0 == strcmp (table->rows [i].name, name)) {
+         return &table->rows [i];
+      }
+   }
+
+   if (table->len == table->allocated) {
+      table->allocated = table->allocated ? table->allocated * 2 : 64;
+      table->rows = realloc (table->rows,
+                             table->allocated * sizeof *table->rows);
+      if (!table->rows) {
+         fprintf (stderr, "Failed to allocate memory.\n");
+         exit (EXIT_FAILURE);
+      }
+   }
+
+   row = &table->rows [table->len++];
+   memset (row, 0, sizeof *row);
+   row->name = name;
+
+   return row;
+}
+
+
+static void
+MemorySites_ForeachCb (Counter *counter,
+                       void    *user_data)
+{
+   MemorySiteTable *table = user_data;
+   MemorySiteRow *row;
+   size_t i;
+
+   if (0 != strncmp (counter->category, "Memory/", 7)) {
+      return;
+   }
+
+   for (i = 0; i < N_MEMORY_CATEGORIES; i++) {
+      if (0 == strcmp (counter->category, gMemoryCategories [i])) {
+         row = MemorySiteTable_Get (table, counter->name);
+         row->values [i] += Counter_Get (counter);
+         break;
+      }
+   }
+}
+
+
+static int
+MemorySiteRow_Compare (const void *a,
+                       const void *b)
+{
+   const MemorySiteRow *ra = a;
+   const MemorySiteRow *rb = b;
+
+   if (ra->values [0] != rb->values [0]) {
+      return (ra->values [0] < rb->values [0]) ? 1 : -1;
+   }
+
+   return strcmp (ra->name, rb->name);
+}
+
+
+static int
+MemorySites_Print (void)
+{
+   MemorySiteTable table = { 0 };
+   size_t i;
+   size_t j;
+
+   Counters_Foreach (MemorySites_ForeachCb, &table);
+
+   if (!table.len) {
+      fprintf (stderr, "No memory statistics found. "
+                       "Was the process built with --enable-memory-stats?\n");
+      return EXIT_FAILURE;
+   }
+
+   qsort (table.rows, table.len, sizeof *table.rows, MemorySiteRow_Compare);
+
+   fprintf (stdout, "%-32s %14s %12s %12s %10s %10s %10s %10s %10s\n",
+            "Site", "LiveBytes", "Allocs", "Frees",
+            "<=64", "<=256", "<=1K", "<=4K", ">4K");
+
+   for (i = 0; i < table.len; i++) {
+      if (!table.rows [i].values [1]) {
+         continue;
+      }
+      fprintf (stdout, "%-32s %14"PRId64" %12"PRId64" %12"PRId64,
+               table.rows [i].name,
+               table.rows [i].values [0],
+               table.rows [i].values [1],
+               table.rows [i].values [2]);
+      for (j = 3; j < N_MEMORY_CATEGORIES; j++) {
+         fprintf (stdout, " %10"PRId64, table.rows [i].values [j]);
+      }
+      fprintf (stdout, "\n");
+   }
+
+   free (table.rows);
+
+   return EXIT_SUCCESS;
+}
+
+
 int
 main (int   argc,
       char *argv[])
 {
    char *endptr = NULL;
+   const char *pidstr;
+   bool memory = false;
    long lpid;
 
-   if (argc != 2) {
-      usage (argv [0]);
-      return EXIT_FAILURE;
-   } else if (0 == strcmp ("-h", argv [1])) {
+   if ((argc == 2) && (0 == strcmp ("-h", argv [1]))) {
       usage (argv [0]);
       return EXIT_SUCCESS;
+   } else if ((argc == 3) && (0 == strcmp ("-m", argv [1]))) {
+      memory = true;
+      pidstr = argv [2];
+   } else if (argc == 2) {
+      pidstr = argv [1];
+   } else {
+      usage (argv [0]);
+      return EXIT_FAILURE;
    }
 
-   lpid = strtol (argv [1], &endptr, 10);
+   lpid = strtol (pidstr, &endptr, 10);
 
-   if (((lpid == 0) && (endptr == argv [1])) ||
+   if (((lpid == 0) && (endptr == pidstr)) ||
        (((lpid == LONG_MIN) || (lpid == LONG_MAX)) && (errno == ERANGE))) {
       usage (argv [0]);
       return EXIT_FAILURE;
@@ -72,6 +228,10 @@ main (int   argc,
 
    Counters_InitRemote ((pid_t)(int)lpid);
 
+   if (memory) {
+      return MemorySites_Print ();
+   }
+
    Counters_Foreach (Counters_ForeachCb, NULL);
 
    return EXIT_SUCCESS;
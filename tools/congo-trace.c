@@ -0,0 +1,107 @@
+/* congo-trace.c
+ *
+ * Copyright (C) 2014 MongoDB, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <errno.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <Trace/Trace.h>
+
+
+typedef struct
+{
+   long     pid;
+   uint64_t ticks_per_sec;
+   unsigned count;
+} TraceDump;
+
+
+static void
+usage (const char *prgname)
+{
+   fprintf (stderr, "usage: %s PID > trace.json\n", prgname);
+}
+
+
+static void
+Trace_ForeachCb (const TraceEvent *event,
+                 void             *user_data)
+{
+   TraceDump *dump = user_data;
+   double usec;
+
+   usec = ((double)event->timestamp * 1000000.0) / dump->ticks_per_sec;
+
+   fprintf (stdout,
+            "%s    { \"name\": \"%s\", \"cat\": \"congo\", \"ph\": \"%c\", "
+            "\"ts\": %.3f, \"pid\": %ld, \"tid\": %"PRIu64", "
+            "\"args\": { \"arg\": %"PRIu64", \"cpu\": %u } }",
+            dump->count++ ? ",\n" : "",
+            TraceType_ToString (event->type),
+            event->phase,
+            usec,
+            dump->pid,
+            event->task,
+            event->arg,
+            event->cpu);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   TraceDump dump = { 0 };
+   char *endptr = NULL;
+   long lpid;
+
+   if (argc != 2) {
+      usage (argv [0]);
+      return EXIT_FAILURE;
+   } else if (0 == strcmp ("-h", argv [1])) {
+      usage (argv [0]);
+      return EXIT_SUCCESS;
+   }
+
+   lpid = strtol (argv [1], &endptr, 10);
+
+   if (((lpid == 0) && (endptr == argv [1])) ||
+       (((lpid == LONG_MIN) || (lpid == LONG_MAX)) && (errno == ERANGE))) {
+      usage (argv [0]);
+      return EXIT_FAILURE;
+   }
+
+   Trace_InitRemote ((pid_t)(int)lpid);
+
+   if (!(dump.ticks_per_sec = Trace_GetTicksPerSecond ())) {
+      return EXIT_FAILURE;
+   }
+
+   dump.pid = lpid;
+
+   fprintf (stdout, "{\n  \"traceEvents\": [\n");
+   Trace_Foreach (Trace_ForeachCb, &dump);
+   fprintf (stdout, "\n  ],\n  \"displayTimeUnit\": \"ns\"\n}\n");
+
+   return EXIT_SUCCESS;
+}